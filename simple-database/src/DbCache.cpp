@@ -1,97 +1,458 @@
 #include "DbCache.hpp"
 #include <algorithm>
-#define MAX(a,b) (((a)>(b))?(a):(b))
 
-DbCache::CacheItem::CacheItem(const uint8_t* data, size_t len) {
-    mDataLen = MAX(len, MinDataLen);
-    mData = new uint8_t[mDataLen];
-    memcpy(mData, data, len);
-    mLen = len;
+// the frequency sketch gets a counter for every this many bytes of budget
+static const size_t SketchBytesPerItem = 256;
+
+DbCache::DbCache(size_t maxSize, CachePolicy policy) :
+    mMaxSize{maxSize},
+    mPolicy{policy},
+    mSketch{0}
+{
+    SizeSegments();
 }
 
-DbCache::CacheItem::~CacheItem() {
-    delete[] mData;
+DbCache::~DbCache()
+{
+    Clear();
 }
 
-DbCache::CacheItem::CacheItem(DbCache::CacheItem&& c) {
-    mData = c.mData;
-    mLen = c.mLen;
-    mDataLen = c.mDataLen;
-    c.mData = nullptr;
-    c.mLen = 0;
-    c.mDataLen = 0;
+void DbCache::SizeSegments()
+{
+    mWindowMax = mPolicy == CachePolicy::TinyLfu ? mMaxSize / 100 : mMaxSize;
+    mProtectedMax = (mMaxSize - mWindowMax) / 5 * 4;
+    mSketch = FrequencySketch{mPolicy == CachePolicy::TinyLfu ? mMaxSize / SketchBytesPerItem : 0};
 }
 
-void DbCache::AddItem(const char* key, const uint8_t* data, size_t len)
+void DbCache::Unlink(List& list, CacheItem& item, ListKind kind)
 {
-    if (len > MaxSize) {
-        return;
+    CacheItem* newer = item.mNewer[kind];
+    CacheItem* older = item.mOlder[kind];
+    if (newer != nullptr) {
+        newer->mOlder[kind] = older;
+    } else {
+        list.newest = older;
+    }
+
+    if (older != nullptr) {
+        older->mNewer[kind] = newer;
+    } else {
+        list.oldest = newer;
+    }
+
+    item.mNewer[kind] = nullptr;
+    item.mOlder[kind] = nullptr;
+    list.size -= item.mDataLen;
+    list.count--;
+}
+
+void DbCache::PushNewest(List& list, CacheItem& item, ListKind kind)
+{
+    item.mNewer[kind] = nullptr;
+    item.mOlder[kind] = list.newest;
+    if (list.newest != nullptr) {
+        list.newest->mNewer[kind] = &item;
+    }
+    list.newest = &item;
+    if (list.oldest == nullptr) {
+        list.oldest = &item;
     }
+    list.size += item.mDataLen;
+    list.count++;
+}
+
+void DbCache::MoveTo(CacheItem& item, Segment segment)
+{
+    Unlink(mQueues[item.mSegment], item, InSegment);
+    item.mSegment = segment;
+    PushNewest(mQueues[segment], item, InSegment);
+}
 
-    // if we don't have enough space left for the new item
-    if (mTotalSize + MAX(len, CacheItem::MinDataLen) > MaxSize) {
-        auto oldestKey = mOrder.begin();
+void DbCache::Erase(CacheItem& item, bool evicted)
+{
+    Unlink(mQueues[item.mSegment], item, InSegment);
+    Unlink(item.mTable->items, item, InTable);
+    Unlink(item.mScope->items, item, InScope);
+    if (item.mScope->items.count == 0 && item.mScope->budget == 0) {
+        mScopes.erase(item.mKey->scope);
+    }
 
-        // attempt to reclaim data from the oldest item if it is big enough
-        // avoids allocating again
-        auto& oldestCacheItem = mItems[*oldestKey];
-        if (oldestCacheItem.mDataLen >= MAX(len, CacheItem::MinDataLen)) {
-            CacheItem newCacheItem = std::move(oldestCacheItem);
-            mItems.erase(*oldestKey);
-            mOrder.erase(oldestKey);
+    if (evicted) {
+        mStats.evictions++;
+        item.mTable->stats.evictions++;
+    }
+
+    mTotalSize -= item.mDataLen;
+    mSlabs.Free(item.mData, item.mLen);
+    // the key lives in the node being erased, so go through an iterator
+    mItems.erase(mItems.find(*item.mKey));
+}
+
+void DbCache::Evict()
+{
+    CacheItem* victim = mQueues[Probation].oldest;
+    if (victim == nullptr) {
+        victim = mQueues[Protected].oldest;
+    }
+    if (victim == nullptr) {
+        victim = mQueues[Window].oldest;
+    }
+    Erase(*victim, true);
+}
+
+void DbCache::Touch(CacheItem& item)
+{
+    Unlink(item.mTable->items, item, InTable);
+    PushNewest(item.mTable->items, item, InTable);
+    Unlink(item.mScope->items, item, InScope);
+    PushNewest(item.mScope->items, item, InScope);
+
+    if (item.mSegment == Probation) {
+        MoveTo(item, Protected);
+    } else if (mQueues[item.mSegment].newest != &item) {
+        MoveTo(item, item.mSegment);
+    }
+
+    // a full protected part pushes its oldest back down to probation
+    List& protectedQueue = mQueues[Protected];
+    while (protectedQueue.size > mProtectedMax && protectedQueue.oldest != &item) {
+        MoveTo(*protectedQueue.oldest, Probation);
+    }
+}
+
+uint8_t DbCache::Frequency(const CacheItem& item) const
+{
+    return mSketch.Estimate(RecordKeyHash()(*item.mKey));
+}
+
+void DbCache::Admit()
+{
+    List& window = mQueues[Window];
+    List& probation = mQueues[Probation];
+    List& protectedQueue = mQueues[Protected];
 
-            memcpy(newCacheItem.mData, data, len);
-            newCacheItem.mLen = len;
+    while (window.size > mWindowMax && window.oldest != nullptr) {
+        CacheItem& candidate = *window.oldest;
+        MoveTo(candidate, Probation);
 
-            mItems.emplace(key, std::move(newCacheItem));
-            mOrder.push_back(key);
-            return;
+        // the candidate has to have been read more often than everything it pushes out
+        bool admitted = true;
+        while (mTotalSize > mMaxSize) {
+            CacheItem* victim = probation.oldest != &candidate ? probation.oldest : protectedQueue.oldest;
+            if (victim == nullptr) {
+                break;
+            }
+
+            if (Frequency(candidate) <= Frequency(*victim)) {
+                admitted = false;
+                break;
+            }
+            Erase(*victim, true);
         }
 
-        // if we don't have enough space erase old cache items until we do
-        while (mTotalSize + MAX(len, CacheItem::MinDataLen) > MaxSize) {
-            oldestKey = mOrder.begin();
-            mTotalSize -= mItems[*oldestKey].mDataLen;
-            mItems.erase(*oldestKey);
-            mOrder.erase(oldestKey);
+        if (!admitted) {
+            Erase(candidate, true);
         }
     }
 
+    // the window can be under its part and the whole still over, if the main part grew into it
+    while (mTotalSize > mMaxSize) {
+        Evict();
+    }
+}
+
+void DbCache::FitBudget(Group* group, size_t cost)
+{
+    if (group == nullptr || group->budget == 0) {
+        return;
+    }
+
+    // a record bigger than a shard's part of the budget pushes out everything else of the group
+    size_t budget = std::max(group->budget, cost);
+    while (group->items.oldest != nullptr && group->items.size + cost > budget) {
+        Erase(*group->items.oldest, true);
+    }
+}
+
+void DbCache::AddItem(const RecordKey& key, const uint8_t* data, size_t len)
+{
+    // the record exists now, whether or not there is room for it
+    AbsentSlot* absent = AbsentSlotFor(key);
+    if (absent != nullptr && absent->used && absent->key == key) {
+        absent->used = false;
+    }
+
     RemoveItem(key);
 
-    CacheItem newCacheItem = CacheItem(data, len);
-    mTotalSize += newCacheItem.mDataLen;
-    mItems.emplace(key, std::move(newCacheItem));
-    mOrder.push_back(key);
+    size_t cost = SlabAllocator::SlotSize(len);
+    Group& table = mTables[key.table];
+    // only a scope with a budget is sure to keep its group while room is made
+    auto scopeIt = mScopes.find(key.scope);
+    Group* budgeted = scopeIt != mScopes.end() && scopeIt->second.budget > 0 ? &scopeIt->second : nullptr;
+    if (cost > mMaxSize || (table.budget > 0 && cost > table.whole) || (budgeted != nullptr && cost > budgeted->whole)) {
+        return;
+    }
+
+    FitBudget(&table, cost);
+    FitBudget(budgeted, cost);
+
+    // erase old cache items until the new one fits, their slots are then free for it
+    // with TinyLfu what goes is only decided once the new item is in the window
+    while (mPolicy == CachePolicy::Lru && mQueues[Window].oldest != nullptr && mTotalSize + cost > mMaxSize) {
+        Evict();
+    }
+
+    CacheItem item;
+    item.mData = mSlabs.Allocate(len);
+    if (item.mData == nullptr) {
+        return;
+    }
+    memcpy(item.mData, data, len);
+    item.mLen = len;
+    item.mDataLen = cost;
+    item.mTable = &table;
+    item.mScope = &mScopes[key.scope];
+    mTotalSize += cost;
+    mStats.insertedBytes += len;
+    table.stats.insertedBytes += len;
+
+    auto it = mItems.emplace(key, item).first;
+    CacheItem& added = it->second;
+    added.mKey = &it->first;
+    PushNewest(mQueues[Window], added, InSegment);
+    PushNewest(table.items, added, InTable);
+    PushNewest(added.mScope->items, added, InScope);
+
+    if (mPolicy == CachePolicy::TinyLfu) {
+        Admit();
+    }
 }
 
-void DbCache::RemoveItem(const char* key)
+void DbCache::RemoveItem(const RecordKey& key)
 {
-    if (!mItems.count(key)) {
+    auto it = mItems.find(key);
+    if (it == mItems.end()) {
         return;
     }
 
-    mTotalSize -= mItems[key].mDataLen;
-    mItems.erase(key);
-    mOrder.erase(std::find(mOrder.begin(), mOrder.end(), key));
+    Erase(it->second, false);
 }
 
-bool DbCache::GetItem(const char* key, uint8_t* data, size_t& len)
+bool DbCache::GetItem(const RecordKey& key, uint8_t* data, size_t& len)
 {
-    if (!mItems.count(key)) {
+    // misses count too, a record asked for often enough earns its place when it's next added
+    if (mPolicy == CachePolicy::TinyLfu) {
+        mSketch.Increment(RecordKeyHash()(key));
+    }
+
+    auto it = mItems.find(key);
+    if (it == mItems.end()) {
+        mStats.misses++;
+        mTables[key.table].stats.misses++;
         return false;
     }
 
-    const auto& item = mItems[key];
+    CacheItem& item = it->second;
     memcpy(data, item.mData, item.mLen);
     len = item.mLen;
+    mStats.hits++;
+    item.mTable->stats.hits++;
 
+    // a hit makes it the last to be evicted
+    Touch(item);
     return true;
 }
 
 void DbCache::Clear()
 {
+    // only the items too big for a slab own their memory, the arenas go all at once
+    for (auto& entry : mItems) {
+        if (entry.second.mLen > SlabAllocator::MaxSlot) {
+            mSlabs.Free(entry.second.mData, entry.second.mLen);
+        }
+    }
     mItems.clear();
-    mOrder.clear();
+    mSlabs.Reset();
+    mSketch.Clear();
+    ClearAbsent();
+
+    for (List& queue : mQueues) {
+        queue = List{};
+    }
+    // budgets and counters stay
+    for (auto& table : mTables) {
+        table.second.items = List{};
+    }
+    for (auto it = mScopes.begin(); it != mScopes.end(); ) {
+        if (it->second.budget == 0) {
+            it = mScopes.erase(it);
+        } else {
+            it->second.items = List{};
+            ++it;
+        }
+    }
     mTotalSize = 0;
 }
+
+void DbCache::EraseScope(uint64_t scope, bool allTables, uint32_t table)
+{
+    auto it = mScopes.find(scope);
+    if (it == mScopes.end()) {
+        return;
+    }
+
+    // erasing the last of them can take the scope's group along, so gather them first
+    std::vector<CacheItem*> items;
+    for (CacheItem* item = it->second.items.oldest; item != nullptr; item = item->mNewer[InScope]) {
+        if (allTables || item->mKey->table == table) {
+            items.push_back(item);
+        }
+    }
+
+    for (CacheItem* item : items) {
+        Erase(*item, false);
+    }
+}
+
+void DbCache::RemoveScope(uint64_t scope)
+{
+    EraseScope(scope, true, 0);
+}
+
+void DbCache::RemoveTable(uint64_t scope, uint32_t table)
+{
+    EraseScope(scope, false, table);
+}
+
+void DbCache::Resize(size_t maxSize)
+{
+    mMaxSize = maxSize;
+    SizeSegments();
+
+    while (mTotalSize > mMaxSize) {
+        Evict();
+    }
+
+    List& protectedQueue = mQueues[Protected];
+    while (protectedQueue.size > mProtectedMax) {
+        MoveTo(*protectedQueue.oldest, Probation);
+    }
+}
+
+void DbCache::SetTableBudget(uint32_t table, size_t bytes, size_t whole)
+{
+    Group& group = mTables[table];
+    group.budget = bytes;
+    group.whole = std::max(bytes, whole);
+    FitBudget(&group, 0);
+}
+
+void DbCache::SetScopeBudget(uint64_t scope, size_t bytes, size_t whole)
+{
+    Group& group = mScopes[scope];
+    group.budget = bytes;
+    group.whole = std::max(bytes, whole);
+    if (bytes == 0 && group.items.count == 0) {
+        mScopes.erase(scope);
+        return;
+    }
+
+    FitBudget(&group, 0);
+}
+
+void DbCache::Hottest(size_t count, const Visitor& visit) const
+{
+    for (Segment segment : {Protected, Probation, Window}) {
+        for (CacheItem* item = mQueues[segment].newest; item != nullptr && count > 0; item = item->mOlder[InSegment]) {
+            visit(*item->mKey, item->mData, item->mLen);
+            count--;
+        }
+    }
+}
+
+void DbCache::Hottest(size_t count, std::vector<HotItem>& items) const
+{
+    size_t place = 0;
+    for (Segment segment : {Protected, Probation, Window}) {
+        for (CacheItem* item = mQueues[segment].newest; item != nullptr && place < count; item = item->mOlder[InSegment]) {
+            items.push_back({*item->mKey, segment, Frequency(*item), place++});
+        }
+    }
+}
+
+bool DbCache::Visit(const RecordKey& key, const Visitor& visit) const
+{
+    auto it = mItems.find(key);
+    if (it == mItems.end()) {
+        return false;
+    }
+
+    visit(*it->second.mKey, it->second.mData, it->second.mLen);
+    return true;
+}
+
+DbCache::AbsentSlot* DbCache::AbsentSlotFor(const RecordKey& key)
+{
+    if (mAbsent.empty()) {
+        return nullptr;
+    }
+
+    return &mAbsent[RecordKeyHash()(key) & (AbsentSlots - 1)];
+}
+
+void DbCache::MarkAbsent(const RecordKey& key)
+{
+    if (mAbsent.empty()) {
+        mAbsent.resize(AbsentSlots, AbsentSlot{{}, false});
+    }
+
+    AbsentSlot* slot = AbsentSlotFor(key);
+    slot->key = key;
+    slot->used = true;
+}
+
+bool DbCache::IsAbsent(const RecordKey& key)
+{
+    AbsentSlot* slot = AbsentSlotFor(key);
+    if (slot == nullptr || !slot->used || !(slot->key == key)) {
+        return false;
+    }
+
+    mStats.absentHits++;
+    mTables[key.table].stats.absentHits++;
+    return true;
+}
+
+void DbCache::ClearAbsent()
+{
+    mAbsent.clear();
+}
+
+CacheStats DbCache::Stats() const
+{
+    CacheStats stats = mStats;
+    stats.residentBytes = mTotalSize;
+    stats.residentItems = mItems.size();
+    return stats;
+}
+
+CacheStats DbCache::TableStats(uint32_t table) const
+{
+    auto it = mTables.find(table);
+    if (it == mTables.end()) {
+        return CacheStats{};
+    }
+
+    CacheStats stats = it->second.stats;
+    stats.residentBytes = it->second.items.size;
+    stats.residentItems = it->second.items.count;
+    return stats;
+}
+
+void DbCache::ResetStats()
+{
+    mStats = CacheStats{};
+    for (auto& table : mTables) {
+        table.second.stats = CacheStats{};
+    }
+}
@@ -4,40 +4,266 @@
 #include <cstring>
 #include <stddef.h>
 #include <stdint.h>
+#include <functional>
 #include <unordered_map>
-#include <string>
 #include <vector>
+#include "FrequencySketch.hpp"
+#include "SlabAllocator.hpp"
 
+/**
+ * RecordKey
+ * Which record a cache item holds, packed into integers so a lookup never touches a string
+ * `table` is the id the driver hands out to each table name
+ */
+struct RecordKey {
+    uint64_t scope;
+    uint64_t id;
+    uint32_t table;
+    bool pending;
+
+    bool operator==(const RecordKey& other) const
+    {
+        return id == other.id && scope == other.scope && table == other.table && pending == other.pending;
+    }
+};
+
+struct RecordKeyHash {
+    size_t operator()(const RecordKey& key) const
+    {
+        // splitmix64 finaliser over the fields folded together
+        uint64_t h = key.id ^ (key.scope * 0x9e3779b97f4a7c15ULL) ^ ((uint64_t)key.table << 33) ^ (uint64_t)key.pending;
+        h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+        return (size_t)(h ^ (h >> 31));
+    }
+};
+
+/**
+ * CachePolicy - Which records a full DbCache keeps
+ * Lru keeps the most recently used ones. TinyLfu (W-TinyLFU) lets new records into a small
+ * window, and one leaving the window only takes the place of a record in the main part if it
+ * was asked for more often lately, so a scan reading every record once can't flush the ones
+ * read all the time. The main part is split into probation and protected, a hit on probation
+ * moves the record up.
+ */
+enum class CachePolicy {
+    Lru,
+    TinyLfu,
+};
+
+/**
+ * CacheStats - What a cache, or one table's part of it, has been doing
+ * Counters run from the last ResetStats, residency is what is cached right now
+ */
+struct CacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    // pushed out to make room, records removed or cleared don't count
+    uint64_t evictions = 0;
+    // record bytes added
+    uint64_t insertedBytes = 0;
+    // lookups answered by a mark that the record doesn't exist
+    uint64_t absentHits = 0;
+    // slot bytes
+    size_t residentBytes = 0;
+    size_t residentItems = 0;
+
+    CacheStats& operator+=(const CacheStats& other)
+    {
+        hits += other.hits;
+        misses += other.misses;
+        evictions += other.evictions;
+        insertedBytes += other.insertedBytes;
+        absentHits += other.absentHits;
+        residentBytes += other.residentBytes;
+        residentItems += other.residentItems;
+        return *this;
+    }
+};
+
+/**
+ * DbCache
+ * Cache of record bytes, capped at MaxSize bytes of record buffers
+ * Items sit in a hash map and are threaded onto lists in order of use, so finding,
+ * touching and evicting an item are all constant time
+ * Record bytes live in slots of a SlabAllocator, the budget counts the slot sizes
+ *
+ * A table or a scope can be given a budget of its own, a record that would take it over
+ * pushes out the least recently used records of that table or scope. Items are also listed by
+ * scope, so a scope or a table in it can be dropped without going through the whole cache
+ *
+ * Records found not to exist can be marked absent, so the next lookup doesn't go to storage.
+ * Marks are kept apart from the records in a fixed number of slots picked by the key's hash,
+ * a new mark simply takes the slot of an old one. Adding the record takes its mark away
+ */
 class DbCache {
     public:
-        DbCache(size_t maxSize) : MaxSize{maxSize} {}
-        void AddItem(const char* key, const uint8_t* data, size_t len);
-        void RemoveItem(const char* key);
-        bool GetItem(const char* key, uint8_t* data, size_t& len);
+        DbCache(size_t maxSize, CachePolicy policy = CachePolicy::Lru);
+        ~DbCache();
+        void AddItem(const RecordKey& key, const uint8_t* data, size_t len);
+        void RemoveItem(const RecordKey& key);
+        bool GetItem(const RecordKey& key, uint8_t* data, size_t& len);
         void Clear();
 
+        /**
+         * RemoveScope / RemoveTable - Drop every record of a scope, or of one table in it,
+         * pending ones included. Absent marks stay, the records are gone after all
+         */
+        void RemoveScope(uint64_t scope);
+        void RemoveTable(uint64_t scope, uint32_t table);
+
+        /**
+         * Hottest - Visit up to `count` cached records, the ones most worth keeping first:
+         * protected, probation, then the window, each from the most recently used
+         */
+        using Visitor = std::function<void(const RecordKey& key, const uint8_t* data, size_t len)>;
+        void Hottest(size_t count, const Visitor& visit) const;
+
+        /**
+         * HotItem - Where Hottest puts a record, for ranking it against those of other caches
+         * Hotter is a higher segment, then a higher frequency, then a lower place in its own cache
+         */
+        struct HotItem {
+            RecordKey key;
+            uint8_t segment;
+            uint8_t frequency;
+            size_t place;
+
+            bool operator<(const HotItem& other) const
+            {
+                if (segment != other.segment) {
+                    return segment > other.segment;
+                }
+                if (frequency != other.frequency) {
+                    return frequency > other.frequency;
+                }
+                return place < other.place;
+            }
+        };
+
+        // the same records Hottest visits, in the same order, only ranked
+        void Hottest(size_t count, std::vector<HotItem>& items) const;
+
+        /**
+         * Visit - Visit the key's record as Hottest would, without counting it as a use
+         * @return false if it isn't cached
+         */
+        bool Visit(const RecordKey& key, const Visitor& visit) const;
+
+        /**
+         * Resize - Change the cap, evicting what no longer fits
+         * TinyLfu starts counting reads afresh
+         */
+        void Resize(size_t maxSize);
+        size_t MaxSize() const { return mMaxSize; }
+
+        /**
+         * SetTableBudget / SetScopeBudget - Cap the slot bytes one table or scope may hold
+         * 0 takes the cap away, lowering it evicts straight away. When `bytes` is only this
+         * cache's part of a `whole` budget, a record up to `whole` still gets in, on its own
+         */
+        void SetTableBudget(uint32_t table, size_t bytes, size_t whole = 0);
+        void SetScopeBudget(uint64_t scope, size_t bytes, size_t whole = 0);
+
+        void MarkAbsent(const RecordKey& key);
+        bool IsAbsent(const RecordKey& key);
+        void ClearAbsent();
+
+        CacheStats Stats() const;
+        CacheStats TableStats(uint32_t table) const;
+        void ResetStats();
+
     private:
-        class CacheItem  {
-            public:
-                static const size_t MinDataLen = 1024;
-                CacheItem() = default;
-                CacheItem(const uint8_t* data, size_t len);
-                ~CacheItem();
-                CacheItem(CacheItem&& c);
-
-                uint8_t* mData = nullptr;
-                size_t mLen = 0;
-                size_t mDataLen = 0;
-
-            private:
-                CacheItem(const CacheItem& c);
-                CacheItem& operator=(const CacheItem& c);
+        // an Lru cache keeps everything in the window
+        enum Segment : uint8_t {
+            Window,
+            Probation,
+            Protected,
+            SegmentCount,
+        };
+
+        // every item is on the list of its segment, of its table and of its scope
+        enum ListKind : uint8_t {
+            InSegment,
+            InTable,
+            InScope,
+            ListKinds,
+        };
+
+        struct CacheItem;
+
+        struct List {
+            CacheItem* newest = nullptr;
+            CacheItem* oldest = nullptr;
+            // slot bytes of the items on the list
+            size_t size = 0;
+            size_t count = 0;
+        };
+
+        struct Group {
+            List items;
+            size_t budget = 0;
+            // the budget this one is a part of, no record bigger than it is kept
+            size_t whole = 0;
+            CacheStats stats;
         };
 
-        const size_t MaxSize;
+        // the slot belongs to the cache's allocator, the item only points at it
+        struct CacheItem  {
+            uint8_t* mData = nullptr;
+            size_t mLen = 0;
+            size_t mDataLen = 0;
+
+            const RecordKey* mKey = nullptr;
+            CacheItem* mNewer[ListKinds] = {};
+            CacheItem* mOlder[ListKinds] = {};
+            Segment mSegment = Window;
+            Group* mTable = nullptr;
+            Group* mScope = nullptr;
+        };
+
+        using Items = std::unordered_map<RecordKey, CacheItem, RecordKeyHash>;
+
+        struct AbsentSlot {
+            RecordKey key;
+            bool used;
+        };
+
+        static constexpr size_t AbsentSlots = 4096;
+
+        static void Unlink(List& list, CacheItem& item, ListKind kind);
+        static void PushNewest(List& list, CacheItem& item, ListKind kind);
+        void MoveTo(CacheItem& item, Segment segment);
+        void Erase(CacheItem& item, bool evicted);
+        // the scope's items, or only the ones of `table`
+        void EraseScope(uint64_t scope, bool allTables, uint32_t table);
+        void Evict();
+        void Touch(CacheItem& item);
+        // move what no longer fits in the window to the main part, or drop it
+        void Admit();
+        // evict from the group until `cost` more bytes fit in its budget
+        void FitBudget(Group* group, size_t cost);
+        uint8_t Frequency(const CacheItem& item) const;
+        // where the key's mark goes, nullptr before anything was marked
+        AbsentSlot* AbsentSlotFor(const RecordKey& key);
+        void SizeSegments();
+
+        size_t mMaxSize;
+        const CachePolicy mPolicy;
+        size_t mWindowMax = 0;
+        size_t mProtectedMax = 0;
         size_t mTotalSize = 0;
-        std::unordered_map<std::string, CacheItem> mItems;
-        std::vector<std::string> mOrder;
+        SlabAllocator mSlabs;
+        // map nodes never move, so the lists can point straight at them
+        Items mItems;
+        List mQueues[SegmentCount];
+        FrequencySketch mSketch;
+        CacheStats mStats;
+        // a scope's group goes with its last item, unless it has a budget
+        std::unordered_map<uint32_t, Group> mTables;
+        std::unordered_map<uint64_t, Group> mScopes;
+        // only allocated once something is marked
+        std::vector<AbsentSlot> mAbsent;
 };
 
 #endif //_DBCACHE_HPP_
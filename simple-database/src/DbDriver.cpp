@@ -1,7 +1,30 @@
 #include "DbDriver.hpp"
+#include "FileStorage.hpp"
+#include "LogStorage.hpp"
+#include "BTreeStorage.hpp"
+#include "LsmStorage.hpp"
+#include "WalStorage.hpp"
+#include <algorithm>
+#include <atomic>
+#include <vector>
 
 #if DB_RECORD_CACHE
-#include "DbCache.hpp"
+#include "ShardedCache.hpp"
+#endif
+
+#ifndef DARUMA_DB_RO
+#include "IdAllocator.hpp"
+#include <unordered_set>
+#endif
+#include <unordered_map>
+
+#if DB_DRIVER_LOCKING
+#include <shared_mutex>
+#define READ_TABLES() std::shared_lock<std::shared_mutex> tablesGuard(tablesLock)
+#define WRITE_TABLES() std::unique_lock<std::shared_mutex> tablesGuard(tablesLock)
+#else
+#define READ_TABLES() ((void) 0)
+#define WRITE_TABLES() ((void) 0)
 #endif
 
 #define MIN(a,b) (((a)<(b))?(a):(b))
@@ -24,9 +47,62 @@ DbEventPublisher sDeleteCallback = nullptr;
 // enough space for a max size serializeable + an appended commit id
 thread_local uint8_t workBuffer[base_message::BodyMaxLength + sizeof(ObjId)] = {0};
 
+// Tables that have been resolved, and had their directories created, this run
+struct TableKey {
+    ObjId scope;
+    std::string name;
+
+    bool operator==(const TableKey& other) const {
+        return scope == other.scope && name == other.name;
+    }
+};
+
+struct TableKeyHash {
+    size_t operator()(const TableKey& key) const {
+        return std::hash<std::string>()(key.name) ^ (std::hash<ObjId>()(key.scope) * 31);
+    }
+};
+
+std::unordered_map<TableKey, DbDriver::TableHandle, TableKeyHash> openTables;
+
+// table names are lower cased on disk, so every spelling of one has to land on the same table
+static std::string TableName(const char* tableName)
+{
+    std::string name{tableName};
+    for (char& c : name) c = tolower(c); // NOLINT
+    return name;
+}
+
+// handed out the first time a table name is seen and kept for the whole run,
+// the record cache is keyed on these instead of paths
+std::unordered_map<std::string, uint32_t> tableIds;
+// by table name, every scope's table gets its own of each
+std::unordered_map<std::string, std::vector<DbDriver::DeclaredIndex>> declaredIndexes;
+// the last table generation handed out, never reused so a table resolved again can't match an old one
+std::atomic<uint64_t> lastGeneration{0};
+#ifndef DARUMA_DB_RO
+std::unordered_set<ObjId> openScopes;
+#endif
+
+#if DB_DRIVER_LOCKING
+// over the tables, table ids, declared indexes and scopes above. Lookups that find what they
+// are after share it, only the first use of a table or scope takes it for itself
+std::shared_mutex tablesLock;
+#endif
+
+void DbDriver::CloseTables()
+{
+    WRITE_TABLES();
+    openTables.clear();
+#ifndef DARUMA_DB_RO
+    openScopes.clear();
+#endif
+}
+
 void DbDriver::SetDirectory(const FilePath& path)
 {
     tableDirPath = path;
+    CloseTables();
 }
 
 uint8_t* DbDriver::WorkBuffer()
@@ -34,8 +110,22 @@ uint8_t* DbDriver::WorkBuffer()
     return workBuffer;
 }
 
+// every open table moves on and its indexes are built again, for when records may have
+// changed without going through a driver
+static void TablesChanged()
+{
+    WRITE_TABLES();
+    for (auto& table : openTables) {
+        // later than every slot, so every record moves on
+        table.second.generation[0] = ++lastGeneration;
+        table.second.generation[1] = ++lastGeneration;
+        table.second.indexes[0].Clear();
+        table.second.indexes[1].Clear();
+    }
+}
+
 #if DB_RECORD_CACHE
-DbCache cache = {1024L * 1024L * 1L * 1024L}; // 1 Gb
+ShardedCache cache{1024L * 1024L * 1L * 1024L, DB_CACHE_SHARDS, CachePolicy::TinyLfu}; // 1 Gb
 #endif
 
 void DbDriver::ClearCache()
@@ -43,8 +133,243 @@ void DbDriver::ClearCache()
 #if DB_RECORD_CACHE
     cache.Clear();
 #endif
+    TablesChanged();
+}
+
+// the id a table's records are cached under, handed out the first time the name is seen
+static uint32_t TableId(const char* tableName)
+{
+    std::string name = TableName(tableName);
+    {
+        READ_TABLES();
+        auto it = tableIds.find(name);
+        if (it != tableIds.end()) {
+            return it->second;
+        }
+    }
+
+    WRITE_TABLES();
+    return tableIds.emplace(std::move(name), tableIds.size() + 1).first->second;
+}
+
+void DbDriver::SetCacheSize(size_t bytes)
+{
+#if DB_RECORD_CACHE
+    cache.Resize(bytes);
+#else
+    (void)bytes;
+#endif
+}
+
+size_t DbDriver::CacheSize()
+{
+#if DB_RECORD_CACHE
+    return cache.MaxSize();
+#else
+    return 0;
+#endif
+}
+
+void DbDriver::SetTableCacheBudget(const char* tableName, size_t bytes)
+{
+#if DB_RECORD_CACHE
+    cache.SetTableBudget(TableId(tableName), bytes);
+#else
+    (void)tableName;
+    (void)bytes;
+#endif
+}
+
+void DbDriver::SetScopeCacheBudget(ObjId scope, size_t bytes)
+{
+#if DB_RECORD_CACHE
+    cache.SetScopeBudget(scope, bytes);
+#else
+    (void)scope;
+    (void)bytes;
+#endif
+}
+
+CacheStats DbDriver::GetCacheStats()
+{
+#if DB_RECORD_CACHE
+    return cache.Stats();
+#else
+    return CacheStats{};
+#endif
+}
+
+CacheStats DbDriver::GetTableCacheStats(const char* tableName)
+{
+#if DB_RECORD_CACHE
+    return cache.TableStats(TableId(tableName));
+#else
+    (void)tableName;
+    return CacheStats{};
+#endif
+}
+
+void DbDriver::ResetCacheStats()
+{
+#if DB_RECORD_CACHE
+    cache.ResetStats();
+#endif
+}
+
+#if DB_RECORD_CACHE
+static RecordKey CacheKey(ObjId scope, bool pending, uint32_t tableId, ObjId id)
+{
+    return {scope, id, tableId, pending};
+}
+#endif
+
+FileStorage fileStorage;
+FileStorage fanOutStorage{true};
+LogStorage logStorage;
+BTreeStorage btreeStorage;
+LsmStorage lsmStorage;
+StorageType storageType = StorageType::File;
+StorageEngine* engine = &fileStorage;
+
+// declared after the engines so it is torn down, and commits whatever it holds, first
+WalStorage walStorage;
+WalOptions walOptions;
+
+// what the driver talks to, the wal when there is one, otherwise the engine itself
+StorageEngine* storage = &fileStorage;
+
+#ifndef DARUMA_DB_RO
+IdAllocator idAllocator;
+#endif
+
+// the wal only goes in front of the engine once it is attached, until then saves skip it
+static bool AttachWal()
+{
+    storage = engine;
+    if (!walOptions.enabled) {
+        return true;
+    }
+
+    if (!walStorage.Attach(engine, tableDirPath, walOptions)) {
+        LOG("Error replaying the wal, saving straight to the engine");
+        return false;
+    }
+    storage = &walStorage;
+    return true;
+}
+
+bool DbDriver::SetStorageType(StorageType type)
+{
+    if (type == storageType) {
+        return true;
+    }
+
+    CloseStorage();
+    ClearCache();
+
+    storageType = type;
+    switch (type) {
+        case StorageType::File:
+            engine = &fileStorage;
+            break;
+        case StorageType::FileFanOut:
+            engine = &fanOutStorage;
+            break;
+        case StorageType::Log:
+            engine = &logStorage;
+            break;
+        case StorageType::BTree:
+            engine = &btreeStorage;
+            break;
+        case StorageType::Lsm:
+            engine = &lsmStorage;
+            break;
+    }
+
+    return AttachWal();
 }
 
+StorageType DbDriver::GetStorageType()
+{
+    return storageType;
+}
+
+void DbDriver::CloseStorage()
+{
+    storage->Close(tableDirPath);
+}
+
+#ifndef DARUMA_DB_RO
+bool DbDriver::SetWalOptions(const WalOptions& options)
+{
+    walOptions = options;
+    walStorage.Detach();
+    storage = engine;
+#if DB_RECORD_CACHE
+    // records replayed from the wal may have been marked absent
+    cache.ClearAbsent();
+#endif
+    TablesChanged();
+
+    return AttachWal();
+}
+
+bool DbDriver::CommitWal()
+{
+    return !walOptions.enabled || walStorage.Commit();
+}
+
+bool DbDriver::MigrateFileLayout()
+{
+    FileStorage* files = nullptr;
+    if (storageType == StorageType::File) {
+        files = &fileStorage;
+    } else if (storageType == StorageType::FileFanOut) {
+        files = &fanOutStorage;
+    } else {
+        return false;
+    }
+
+    CloseStorage();
+    ClearCache();
+
+    // tables sit in the root of the db or in a scope directory, each with a pending table inside
+    std::vector<std::string> tables;
+    std::vector<std::string> scopes = {(const char*)tableDirPath};
+    for (size_t i = 0; i < scopes.size(); i++) {
+        DirectoryWrapper dir{scopes[i].c_str()};
+        FilePath fp;
+        bool isDir;
+        while (dir.NextPath(fp, isDir)) {
+            if (!isDir) continue;
+
+            const char* name = strrchr((const char*)fp, '/');
+            name = name ? name + 1 : (const char*)fp;
+            // a table can have an id for a name too, but every table has its counter directory
+            std::string counter = std::string{(const char*)fp} + "/counter";
+            ObjId scope;
+            if (i == 0 && FileNameToId(name, scope) && !DirectoryWrapper::Exists(counter.c_str())) {
+                scopes.push_back((const char*)fp);
+            } else {
+                tables.push_back((const char*)fp);
+            }
+        }
+    }
+
+    bool somethingFailed = false;
+    for (const std::string& table : tables) {
+        somethingFailed = !files->Migrate(table.c_str()) || somethingFailed;
+
+        std::string pending = table + "/pending";
+        if (DirectoryWrapper::Exists(pending.c_str())) {
+            somethingFailed = !files->Migrate(pending.c_str()) || somethingFailed;
+        }
+    }
+
+    return !somethingFailed;
+}
+#endif
+
 FilePath DbDriver::IdToFileName(ObjId id)
 {
     auto hex = binToHex<sizeof(id)>(&id);
@@ -53,6 +378,34 @@ FilePath DbDriver::IdToFileName(ObjId id)
     return fp;
 }
 
+bool DbDriver::FileNameToId(const char* name, ObjId& id)
+{
+    if (strlen(name) != sizeof(ObjId) * 2) {
+        return false;
+    }
+
+    uint8_t* bin = (uint8_t*)&id;
+    for (size_t i = 0; i < sizeof(ObjId) * 2; i++) {
+        char c = tolower(name[i]); // NOLINT
+        uint8_t nibble;
+        if (c >= '0' && c <= '9') {
+            nibble = c - '0';
+        } else if (c >= 'a' && c <= 'f') {
+            nibble = c - 'a' + 10;
+        } else {
+            return false;
+        }
+
+        if (i % 2 == 0) {
+            bin[i / 2] = nibble << 4;
+        } else {
+            bin[i / 2] |= nibble;
+        }
+    }
+
+    return true;
+}
+
 #ifndef DARUMA_DB_RO
 bool DbDriver::InitTable(const char* fullPath) const
 {
@@ -90,18 +443,35 @@ bool DbDriver::InitDb()
 {
     bool somethingFailed = false;
 
+    // tables and counters are read from disk again, the db may have changed underneath us
+    idAllocator.Clear();
+    CloseTables();
+#if DB_RECORD_CACHE
+    cache.ClearAbsent();
+#endif
+
     if (!DirectoryWrapper::Exists(tableDirPath) && !DirectoryWrapper::New(tableDirPath))
     {
         LOG("Error creating db directory");
         somethingFailed = true;
     }
 
+    // finish off any saves that were cut short by a crash
+    if (!AttachWal())
+    {
+        somethingFailed = true;
+    }
+
     return !somethingFailed;
 }
 
 bool DbDriver::InitScope(ObjId scope)
 {
     if (scope == RootScope) return false;
+    {
+        READ_TABLES();
+        if (openScopes.count(scope) > 0) return true;
+    }
 
     FilePath fp = ScopePath(scope);
 
@@ -114,39 +484,14 @@ bool DbDriver::InitScope(ObjId scope)
         somethingFailed = true;
     }
 
-    return !somethingFailed;
-}
-
-bool DbDriver::SaveObjCt(const char * tableName, ObjId id)
-{
-    FilePath fp = TableNameToCounterPath(tableName);
-
-    FileWrapper f{fp, "w"};
-    if (!f.DidOpen()) {
-        return false;
-    }
-    if (!f.Write(&id, sizeof(id))) {
-        LOG("Error writing obj count file, bytes written not equal to bytes to write");
-        return false;
-    }
+    WRITE_TABLES();
+    openScopes.insert(scope);
 
-    return true;
+    return !somethingFailed;
 }
 
 #endif
 
-ObjId DbDriver::GetObjCt(const char * tableName)
-{
-    FilePath fp = TableNameToCounterPath(tableName);
-    FileWrapper file{fp, "r"};
-    if (!file.DidOpen()) {
-        return 1;
-    }
-    ObjId id;
-    file.Read(&id, sizeof(ObjId));
-    return id;
-}
-
 FilePath DbDriver::ScopePath(ObjId scope)
 {
     FilePath fp = tableDirPath;
@@ -159,156 +504,600 @@ FilePath DbDriver::ScopePath(ObjId scope)
     return fp;
 }
 
-FilePath DbDriver::TableNameToCounterPath(const char* tableName)
+FilePath DbDriver::TablePath(ObjId scope, const char* tableName)
 {
-    FilePath fp = ScopePath(mScope);
+    FilePath fp = ScopePath(scope);
     strlcat(fp, tableName);
 
     char* p = ((char*)fp) + strlen(fp) - MIN(strlen(fp) - 1, strlen(tableName));
     for ( ; *p; ++p) *p = tolower(*p); // NOLINT
+    return fp;
+}
+
+DbDriver::TableHandle& DbDriver::ResolveTable(const char* tableName, bool create)
+{
+    TableKey key{mScope, TableName(tableName)};
+    {
+        READ_TABLES();
+        auto it = openTables.find(key);
+        if (it != openTables.end() && (it->second.created || !create)) {
+            return it->second;
+        }
+    }
 
+    FilePath fp = TablePath(mScope, tableName);
+    uint32_t tableId = TableId(tableName);
+
+    // another thread may have resolved it in the meantime
+    WRITE_TABLES();
+    auto it = openTables.find(key);
+    if (it == openTables.end()) {
+        TableHandle table;
+        table.tableId = tableId;
+        table.generation[0] = ++lastGeneration;
+        table.generation[1] = ++lastGeneration;
+        table.path = (const char*)fp;
+        table.pendingPath = table.path + "/pending";
+        table.counterPath = table.path + "/counter/objct";
+        it = openTables.emplace(std::move(key), std::move(table)).first;
+    }
+
+    if (create && !it->second.created) {
 #ifndef DARUMA_DB_RO
-    InitTable(fp);
+        InitTable(fp);
 #endif
+        it->second.created = true;
+    }
+    return it->second;
+}
 
-    strlcat(fp, "/counter/objct");
-    return fp;
+const char* DbDriver::TableNameToCounterPath(const char* tableName)
+{
+    return ResolveTable(tableName, true).counterPath.c_str();
 }
 
-FilePath DbDriver::TableNameToPath(const char* tableName)
+const char* DbDriver::TableNameToPath(const char* tableName, bool create)
 {
-    FilePath fp = ScopePath(mScope);
+    return PathOf(ResolveTable(tableName, create));
+}
 
-    strlcat(fp, tableName);
+const char* DbDriver::PathOf(const TableHandle& table) const
+{
+    return mPending ? table.pendingPath.c_str() : table.path.c_str();
+}
 
-    char* p = ((char*)fp) + strlen(fp) - MIN(strlen(fp) - 1, strlen(tableName));
-    for ( ; *p; ++p) *p = tolower(*p); // NOLINT
+uint32_t DbDriver::ReadRecord(const char * const tablePath, uint32_t tableId, ObjId id, void * data)
+{
+    size_t len = 0;
+#if DB_RECORD_CACHE
+    RecordKey key = CacheKey(mScope, mPending, tableId, id);
+    if (cache.GetItem(key, (uint8_t*)data, len)) {
+        return len;
+    }
+    if (cache.IsAbsent(key)) {
+        return 0;
+    }
+#else
+    (void)tableId;
+#endif
 
-#ifndef DARUMA_DB_RO
-    InitTable(fp);
+    len = storage->Read(tablePath, id, data);
+
+#if DB_RECORD_CACHE
+    if (len > 0 && mCacheReads) {
+        cache.AddItem(key, (uint8_t*)data, len);
+    } else if (len == 0 && mCacheReads) {
+        cache.MarkAbsent(key);
+    }
+#endif
+
+    return len;
+}
+
+size_t DbDriver::ReadRecords(const char * const tablePath, uint32_t tableId, const ObjId* ids, size_t count, uint8_t* data, uint32_t stride, uint32_t* lens)
+{
+    size_t found = 0;
+#if DB_RECORD_CACHE
+    std::vector<ObjId> missIds;
+    std::vector<size_t> misses;
+    for (size_t i = 0; i < count; i++) {
+        size_t len = 0;
+        RecordKey key = CacheKey(mScope, mPending, tableId, ids[i]);
+        if (cache.GetItem(key, data + i * stride, len)) {
+            lens[i] = len;
+            found++;
+        } else if (cache.IsAbsent(key)) {
+            lens[i] = 0;
+        } else {
+            lens[i] = 0;
+            missIds.push_back(ids[i]);
+            misses.push_back(i);
+        }
+    }
+
+    if (misses.empty()) {
+        return found;
+    }
+
+    // the misses are read into a group of their own and copied into place after
+    std::vector<uint8_t> missData(misses.size() * stride);
+    std::vector<uint32_t> missLens(misses.size());
+    storage->ReadMany(tablePath, missIds.data(), missIds.size(), missData.data(), stride, missLens.data());
+
+    for (size_t i = 0; i < misses.size(); i++) {
+        if (missLens[i] == 0) {
+            if (mCacheReads) {
+                cache.MarkAbsent(CacheKey(mScope, mPending, tableId, missIds[i]));
+            }
+            continue;
+        }
+
+        uint8_t* record = data + misses[i] * stride;
+        memcpy(record, missData.data() + i * stride, missLens[i]);
+        lens[misses[i]] = missLens[i];
+        if (mCacheReads) {
+            cache.AddItem(CacheKey(mScope, mPending, tableId, missIds[i]), record, missLens[i]);
+        }
+        found++;
+    }
+#else
+    (void)tableId;
+    storage->ReadMany(tablePath, ids, count, data, stride, lens);
+    for (size_t i = 0; i < count; i++) {
+        found += lens[i] > 0;
+    }
 #endif
-    if (mPending) {
-        strlcat(fp, "/pending");
+
+    return found;
+}
+
+size_t DbDriver::GetRecords(const ObjId* ids, size_t count, uint8_t* data, uint32_t stride, uint32_t* lens, const char* tableName)
+{
+    const TableHandle& table = ResolveTable(tableName, false);
+    return ReadRecords(PathOf(table), table.tableId, ids, count, data, stride, lens);
+}
+
+bool DbDriver::ReadsConcurrently()
+{
+    return ReadQueue::Concurrent() && (storageType == StorageType::File || storageType == StorageType::FileFanOut);
+}
+
+const uint8_t* DbDriver::ViewRecord(const char * const tablePath, uint32_t tableId, ObjId id, uint32_t& len)
+{
+    // a mapped record is already in memory, caching it would only copy it again
+    const uint8_t* record = storage->View(tablePath, id, len);
+    if (record != nullptr) {
+        return record;
     }
 
-    return fp;
+    len = ReadRecord(tablePath, tableId, id, workBuffer);
+    return len > 0 ? workBuffer : nullptr;
 }
 
-FilePath DbDriver::GetRecordPath(ObjId id, const char* tableName)
+const uint8_t* DbDriver::GetRecordView(ObjId id, const char* tableName, uint32_t& len)
 {
-    FilePath fp = TableNameToPath(tableName);
-    strlcat(fp, "/");
-    FilePath idPath = IdToFileName(id);
-    strlcat(fp, idPath);
-    return fp;
+    const TableHandle& table = ResolveTable(tableName, false);
+    return ViewRecord(PathOf(table), table.tableId, id, len);
 }
 
-uint32_t DbDriver::ReadRecord(const char * const fullPath, void * data)
+const uint8_t* DbDriver::GetNextRecordView(TableCursor& cursor, uint32_t& len)
 {
-    size_t len = 0;
+    ObjId id;
+    if (!storage->Next(cursor, id)) {
+        return nullptr;
+    }
+
+    return ViewRecord(cursor.TablePath(), cursor.TableId(), id, len);
+}
+
+size_t DbDriver::GetRecord(void * data, const ObjId id, const char* tableName)
+{
+    const TableHandle& table = ResolveTable(tableName, false);
+    return ReadRecord(PathOf(table), table.tableId, id, data);
+}
+
+bool DbDriver::OpenTable(const char* tableName, DirectoryWrapper& dir)
+{
+    return dir.Open(TableNameToPath(tableName, true));
+}
+
+bool DbDriver::OpenTable(const char* tableName, TableCursor& cursor)
+{
+    const TableHandle& table = ResolveTable(tableName, true);
+    bool didOpen = storage->Open(PathOf(table), cursor);
+    cursor.TableId(table.tableId);
+    return didOpen;
+}
+
+bool DbDriver::RecordExists(ObjId id, const char * tableName)
+{
+    const TableHandle& table = ResolveTable(tableName, false);
 #if DB_RECORD_CACHE
-    if (cache.GetItem(fullPath, (uint8_t*)data, len)) {
-        return len;
+    RecordKey key = CacheKey(mScope, mPending, table.tableId, id);
+    if (cache.IsAbsent(key)) {
+        return false;
+    }
+
+    bool exists = storage->Exists(PathOf(table), id);
+    if (!exists && mCacheReads) {
+        cache.MarkAbsent(key);
     }
+    return exists;
+#else
+    return storage->Exists(PathOf(table), id);
 #endif
-    FileWrapper f(fullPath);
+}
 
-    if (!f.DidOpen()) {
-        return 0;
+// what the cache held at the last SaveCacheSnapshot, read back in by WarmCache
+struct SnapshotEntry {
+    ObjId scope;
+    ObjId id;
+    uint32_t crc;
+    bool pending;
+    std::string table;
+};
+
+struct SnapshotHeader {
+    uint32_t magic;
+    uint32_t count;
+    // over the entries that follow
+    uint32_t crc;
+};
+
+static const uint32_t SnapshotMagic = 0x50534344; // "DCSP"
+std::vector<SnapshotEntry> warmUp;
+size_t warmUpNext = 0;
+
+static std::string SnapshotPath()
+{
+    return std::string((const char*)tableDirPath) + "/cache.snapshot";
+}
+
+static void Append(std::vector<uint8_t>& out, const void* data, size_t len)
+{
+    out.insert(out.end(), (const uint8_t*)data, (const uint8_t*)data + len);
+}
+
+static bool Take(const std::vector<uint8_t>& in, size_t& pos, void* data, size_t len)
+{
+    if (in.size() - pos < len) {
+        return false;
     }
 
-    // Read entire file
-    uint32_t crc = 0;
+    memcpy(data, in.data() + pos, len);
+    pos += len;
+    return true;
+}
 
-    if (f.Size() < sizeof(crc) + sizeof(ObjId)) {
-        LOG("ERROR: File at path");
-        LOG(fullPath);
-        LOG("has no CRC");
-        LOG("File length:");
-        logging::Print(f.Size());
-        return 0;
+bool DbDriver::SaveCacheSnapshot(size_t count)
+{
+#if DB_RECORD_CACHE
+    // table ids are only good for this run, the snapshot keeps the names
+    std::unordered_map<uint32_t, std::string> names;
+    {
+        READ_TABLES();
+        for (const auto& table : tableIds) {
+            names[table.second] = table.first;
+        }
     }
 
-    len = f.Size() - sizeof(crc);
+    std::vector<uint8_t> entries;
+    SnapshotHeader header{SnapshotMagic, 0, 0};
+    cache.Hottest(count, [&](const RecordKey& key, const uint8_t* data, size_t len) {
+        auto name = names.find(key.table);
+        if (name == names.end() || name->second.size() > UINT8_MAX || len < sizeof(ObjId)) {
+            return;
+        }
 
-    if (!f.Read(data, len)) {
-        return 0;
+        // the crc the engine keeps, over the body without the commit id
+        uint32_t crc = crc32(data, len - sizeof(ObjId));
+        uint8_t pending = key.pending;
+        uint8_t nameLen = name->second.size();
+        Append(entries, &key.scope, sizeof(key.scope));
+        Append(entries, &key.id, sizeof(key.id));
+        Append(entries, &crc, sizeof(crc));
+        Append(entries, &pending, sizeof(pending));
+        Append(entries, &nameLen, sizeof(nameLen));
+        Append(entries, name->second.data(), nameLen);
+        header.count++;
+    });
+    header.crc = crc32(entries.data(), entries.size());
+
+    // written aside and renamed over the old one, so a crash leaves one or the other
+    std::string path = SnapshotPath();
+    std::string tmpPath = path + ".tmp";
+    {
+        FileWrapper file{tmpPath.c_str(), "w"};
+        if (!file.DidOpen() || !file.Write(&header, sizeof(header)) ||
+            (!entries.empty() && !file.Write(entries.data(), entries.size())) || !file.Sync()) {
+            LOG("Error writing cache snapshot");
+            return false;
+        }
     }
 
-    if (!f.Read(&crc, sizeof(crc))) {
-        return 0;
+    if (DirectoryWrapper::Exists(path.c_str()) && !DirectoryWrapper::Delete(path.c_str())) {
+        return false;
     }
+    return DirectoryWrapper::Rename(tmpPath.c_str(), path.c_str());
+#else
+    (void)count;
+    return false;
+#endif
+}
 
-    bool crcMatches = crc == crc32(data, f.Size() - sizeof(crc) - sizeof(ObjId));
+bool DbDriver::LoadCacheSnapshot()
+{
+    warmUp.clear();
+    warmUpNext = 0;
 
-    if (!crcMatches) {
-        LOG("CRC MISMATCH!");
-        LOG(fullPath);
-        return 0;
+    FileWrapper file{SnapshotPath().c_str(), "r"};
+    SnapshotHeader header;
+    if (!file.DidOpen() || file.Size() < sizeof(header) || !file.Read(&header, sizeof(header)) || header.magic != SnapshotMagic) {
+        return false;
+    }
+
+    std::vector<uint8_t> entries(file.Size() - sizeof(header));
+    if ((!entries.empty() && !file.Read(entries.data(), entries.size())) || crc32(entries.data(), entries.size()) != header.crc) {
+        LOG("Discarding a corrupt cache snapshot");
+        return false;
     }
 
+    size_t pos = 0;
+    for (uint32_t i = 0; i < header.count; i++) {
+        SnapshotEntry entry;
+        uint8_t pending;
+        uint8_t nameLen;
+        char name[UINT8_MAX + 1];
+        if (!Take(entries, pos, &entry.scope, sizeof(entry.scope)) || !Take(entries, pos, &entry.id, sizeof(entry.id)) ||
+            !Take(entries, pos, &entry.crc, sizeof(entry.crc)) || !Take(entries, pos, &pending, sizeof(pending)) ||
+            !Take(entries, pos, &nameLen, sizeof(nameLen)) || !Take(entries, pos, name, nameLen)) {
+            warmUp.clear();
+            return false;
+        }
+
+        entry.pending = pending;
+        entry.table.assign(name, nameLen);
+        warmUp.push_back(std::move(entry));
+    }
+
+    return true;
+}
 
+size_t DbDriver::WarmCache(size_t count)
+{
 #if DB_RECORD_CACHE
-    cache.AddItem(fullPath, (uint8_t*)data, len);
+    size_t end = MIN(warmUp.size(), warmUpNext + count);
+
+    // the records of one table are read as a group
+    std::vector<std::vector<const SnapshotEntry*>> groups;
+    for (size_t i = warmUpNext; i < end; i++) {
+        const SnapshotEntry& entry = warmUp[i];
+        auto group = std::find_if(groups.begin(), groups.end(), [&entry](const std::vector<const SnapshotEntry*>& g) {
+            return g[0]->scope == entry.scope && g[0]->pending == entry.pending && g[0]->table == entry.table;
+        });
+        if (group == groups.end()) {
+            groups.push_back({&entry});
+        } else {
+            group->push_back(&entry);
+        }
+    }
+
+    uint32_t stride = base_message::BodyMaxLength + sizeof(ObjId) + sizeof(uint32_t);
+    for (const auto& group : groups) {
+        const SnapshotEntry& first = *group[0];
+
+        // a table dropped since the snapshot mustn't be brought back by resolving it
+        if (!DirectoryWrapper::Exists(TablePath(first.scope, first.table.c_str()))) {
+            continue;
+        }
+
+        DbDriver driver{first.scope, first.pending};
+        const TableHandle& table = driver.ResolveTable(first.table.c_str(), false);
+        std::vector<ObjId> ids(group.size());
+        for (size_t i = 0; i < group.size(); i++) {
+            ids[i] = group[i]->id;
+        }
+
+        std::vector<uint8_t> data(group.size() * stride);
+        std::vector<uint32_t> lens(group.size());
+        storage->ReadMany(driver.PathOf(table), ids.data(), ids.size(), data.data(), stride, lens.data());
+
+        for (size_t i = 0; i < group.size(); i++) {
+            const uint8_t* record = data.data() + i * stride;
+            if (lens[i] < sizeof(ObjId) || crc32(record, lens[i] - sizeof(ObjId)) != group[i]->crc) {
+                continue;
+            }
+            cache.AddItem(CacheKey(first.scope, first.pending, table.tableId, ids[i]), record, lens[i]);
+        }
+    }
+
+    warmUpNext = end;
+    if (warmUpNext == warmUp.size()) {
+        warmUp.clear();
+        warmUpNext = 0;
+    }
+    return warmUp.size() - warmUpNext;
+#else
+    (void)count;
+    warmUp.clear();
+    return 0;
 #endif
+}
 
-    return len;
+uint64_t DbDriver::RecordVersion(const char* tableName, ObjId id)
+{
+    TableHandle& table = ResolveTable(tableName, false);
+    const std::vector<uint64_t>& versions = table.versions[mPending];
+    uint64_t generation = table.generation[mPending];
+    if (versions.empty()) {
+        return generation;
+    }
+
+    uint64_t slot = versions[id % RecordVersionSlots];
+    return slot > generation ? slot : generation;
 }
 
-size_t DbDriver::GetRecord(void * data, const ObjId id, const char* tableName)
+void DbDriver::RecordChanged(TableHandle& table, ObjId id)
 {
-    FilePath recordPath = GetRecordPath(id, tableName);
+    std::vector<uint64_t>& versions = table.versions[mPending];
+    if (versions.empty()) {
+        versions.resize(RecordVersionSlots, 0);
+    }
+    versions[id % RecordVersionSlots] = ++lastGeneration;
+}
 
-    size_t recordLen;
+void DbDriver::RecordsRemoved(const char* tableName, const ObjId* ids, size_t count)
+{
+    READ_TABLES();
+    auto it = openTables.find({mScope, TableName(tableName)});
+    if (it == openTables.end()) {
+        return;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        RecordChanged(it->second, ids[i]);
+        it->second.indexes[mPending].Remove(ids[i]);
+    }
+}
 
+void DbDriver::TableIndexes::Insert(ObjId id, const uint8_t* record)
+{
+    for (auto& index : hashed) {
+        index.second.Insert(id, record);
+    }
+    for (auto& index : ordered) {
+        index.second.Insert(id, record);
+    }
+}
 
-    recordLen = ReadRecord(recordPath, data);
+void DbDriver::TableIndexes::Remove(ObjId id)
+{
+    for (auto& index : hashed) {
+        index.second.Remove(id);
+    }
+    for (auto& index : ordered) {
+        index.second.Remove(id);
+    }
+}
 
-    return recordLen;
+void DbDriver::TableIndexes::Clear()
+{
+    hashed.clear();
+    ordered.clear();
 }
 
-bool DbDriver::OpenTable(const char* tableName, DirectoryWrapper& dir)
+void DbDriver::Declare(const char* tableName, const char* name, IndexKey key, OrderKey orderKey)
 {
-    FilePath fp = TableNameToPath(tableName);
-    return dir.Open(fp);
+    WRITE_TABLES();
+    auto& declared = declaredIndexes[TableName(tableName)];
+    auto it = std::find_if(declared.begin(), declared.end(), [name](const DeclaredIndex& index) {
+        return index.name == name;
+    });
+    if (it != declared.end()) {
+        declared.erase(it);
+    }
+    if (key || orderKey) {
+        declared.push_back({name, std::move(key), std::move(orderKey)});
+    }
+
+    // built with the old key, if there was one
+    for (auto& table : openTables) {
+        if (table.first.name == TableName(tableName)) {
+            for (TableIndexes& indexes : table.second.indexes) {
+                indexes.hashed.erase(name);
+                indexes.ordered.erase(name);
+            }
+        }
+    }
 }
 
-bool DbDriver::RecordExists(ObjId id, const char * tableName)
+void DbDriver::DeclareIndex(const char* tableName, const char* name, IndexKey key)
 {
-    FilePath recordPath = GetRecordPath(id, tableName);
-    return DirectoryWrapper::Exists(recordPath);
+    Declare(tableName, name, std::move(key), nullptr);
 }
 
-bool DbDriver::NextRecordPath(FilePath& p, DirectoryWrapper& dir)
+void DbDriver::DeclareOrderedIndex(const char* tableName, const char* name, OrderKey key)
 {
-    while(true) {
-        bool isDir;
-        if (!dir.NextPath(p, isDir)) {
-            return false;
+    Declare(tableName, name, nullptr, std::move(key));
+}
+
+const DbDriver::DeclaredIndex* DbDriver::Declared(const char* tableName, const char* name)
+{
+    READ_TABLES();
+    auto declared = declaredIndexes.find(TableName(tableName));
+    if (declared == declaredIndexes.end()) {
+        return nullptr;
+    }
+
+    for (const DeclaredIndex& index : declared->second) {
+        if (index.name == name) {
+            return &index;
+        }
+    }
+    return nullptr;
+}
+
+HashIndex* DbDriver::Index(const char* tableName, const char* name)
+{
+    const DeclaredIndex* declared = Declared(tableName, name);
+    if (declared == nullptr || !declared->key) {
+        return nullptr;
+    }
+
+    auto& indexes = ResolveTable(tableName, false).indexes[mPending].hashed;
+    {
+        READ_TABLES();
+        auto it = indexes.find(name);
+        if (it != indexes.end()) {
+            return &it->second;
         }
+    }
 
-        if (isDir) continue;
+    WRITE_TABLES();
+    return &indexes.emplace(name, HashIndex{declared->key}).first->second;
+}
 
-        return true;
+OrderedIndex* DbDriver::Ordered(const char* tableName, const char* name)
+{
+    const DeclaredIndex* declared = Declared(tableName, name);
+    if (declared == nullptr || !declared->orderKey) {
+        return nullptr;
     }
+
+    auto& indexes = ResolveTable(tableName, false).indexes[mPending].ordered;
+    {
+        READ_TABLES();
+        auto it = indexes.find(name);
+        if (it != indexes.end()) {
+            return &it->second;
+        }
+    }
+
+    WRITE_TABLES();
+    return &indexes.emplace(name, OrderedIndex{declared->orderKey}).first->second;
 }
 
-bool DbDriver::GetNextRecord(void * data, DirectoryWrapper& dir)
+bool DbDriver::GetNextRecord(void * data, TableCursor& cursor)
 {
-    FilePath recordPath;
-    if (!NextRecordPath(recordPath, dir)) {
+    ObjId id;
+    if (!storage->Next(cursor, id)) {
         return false;
     }
 
-    return ReadRecord(recordPath, data) > 0;
+    return ReadRecord(cursor.TablePath(), cursor.TableId(), id, data) > 0;
 }
 
 #ifndef DARUMA_DB_RO
 
 bool DbDriver::NextId(const char * tableName, ObjId& id, bool increment)
 {
-    id = GetObjCt(tableName);
-    if (increment && !SaveObjCt(tableName, id + 1)) {
+    const char* counterPath = TableNameToCounterPath(tableName);
+    if (!increment) {
+        id = idAllocator.Peek(counterPath);
+        return true;
+    }
+
+    if (!idAllocator.Next(counterPath, 1, id)) {
         LOG("Failed to increment obj counter");
         return false;
     }
@@ -316,21 +1105,61 @@ bool DbDriver::NextId(const char * tableName, ObjId& id, bool increment)
     return true;
 }
 
-bool DbDriver::SaveRecord(ObjId id, ObjId commitId, const void * data, uint32_t len, const char* tableName)
+bool DbDriver::NextIds(const char * tableName, size_t count, ObjId& first)
+{
+    if (!idAllocator.Next(TableNameToCounterPath(tableName), count, first)) {
+        LOG("Failed to increment obj counter");
+        return false;
+    }
+
+    return true;
+}
+
+bool DbDriver::SaveRecords(const ObjId* ids, ObjId commitId, uint8_t* data, uint32_t len, size_t count, const char* tableName)
 {
-    // All pending records should have a non-zero commit id
     assert(!mPending || commitId);
-    FilePath recordPath = DbDriver::GetRecordPath(id, tableName);
-    FileWrapper f(recordPath, "w");
+    TableHandle& table = ResolveTable(tableName, true);
+    const char* tablePath = PathOf(table);
+
+    uint32_t stride = len + sizeof(ObjId);
+    std::vector<BatchRecord> batch(count);
+    ObjId maxId = 0;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t* record = data + i * stride;
+        uint32_t crc = crc32(record, len);
+        memcpy(record + len, &commitId, sizeof(commitId));
+        batch[i] = {ids[i], record, stride, crc};
+        maxId = MAX(maxId, ids[i]);
+    }
 
-    if (!f.DidOpen()) {
-        LOG("Error creating db object file at path:");
-        LOG(recordPath);
+    // reserved before the write so a crash can't leave a record behind its counter
+    if (count > 0 && !idAllocator.Bump(table.counterPath.c_str(), maxId)) {
+        LOG("Failed to increment obj counter");
+        return false;
+    }
+
+    if (!storage->WriteBatch(tablePath, batch.data(), count)) {
         return false;
     }
+    for (const BatchRecord& record : batch) {
+        RecordChanged(table, record.id);
+        table.indexes[mPending].Insert(record.id, (const uint8_t*)record.data);
+    }
+
+#if DB_RECORD_CACHE
+    for (const BatchRecord& record : batch) {
+        cache.AddItem(CacheKey(mScope, mPending, table.tableId, record.id), (const uint8_t*)record.data, record.len);
+    }
+#endif
+    return true;
+}
 
-    LOG("Opened file at path:");
-    LOG(recordPath);
+bool DbDriver::SaveRecord(ObjId id, ObjId commitId, const void * data, uint32_t len, const char* tableName)
+{
+    // All pending records should have a non-zero commit id
+    assert(!mPending || commitId);
+    TableHandle& table = ResolveTable(tableName, true);
+    const char* tablePath = PathOf(table);
 
     // use the workbuffer so we deinitely have room for the commit id
     if (data != workBuffer) {
@@ -342,28 +1171,22 @@ bool DbDriver::SaveRecord(ObjId id, ObjId commitId, const void * data, uint32_t
     memcpy(workBuffer + len, &commitId, sizeof(commitId));
     len += sizeof(ObjId);
 
-    if (!f.Write(workBuffer, len)) {
-        LOG("Error writing new db object at path:");
-        LOG(recordPath);
+    // Ensure the id is less than the current counter, otherwise our counter
+    // needs to be updated. Done before the write so a crash can't leave a
+    // record behind that the counter would hand out again
+    if (!idAllocator.Bump(table.counterPath.c_str(), id)) {
+        LOG("Failed to increment obj counter");
         return false;
     }
 
-    if (!f.Write(&crc, sizeof(crc))) {
+    if (!storage->Write(tablePath, id, workBuffer, len, crc)) {
         return false;
     }
-
-    // Ensure the id is less than the current counter,
-    // otherwise our counter needs to be updated
-    if (id >= GetObjCt(tableName)) {
-        if (!SaveObjCt(tableName, id + 1)) {
-            LOG("Failed to increment obj counter");
-            return false;
-        }
-    }
-
+    RecordChanged(table, id);
+    table.indexes[mPending].Insert(id, workBuffer);
 
 #if DB_RECORD_CACHE
-    cache.AddItem(recordPath, (uint8_t*)data, len);
+    cache.AddItem(CacheKey(mScope, mPending, table.tableId, id), workBuffer, len);
 #endif
     return true;
 }
@@ -379,24 +1202,72 @@ void DbDriver::SendOnCreateCallbackEvent(const char *tableName, ObjId id)
 
 bool DbDriver::DeleteRecord(const ObjId id, const char * tableName)
 {
-    FilePath record = GetRecordPath(id, tableName);
+    // copies, the delete callback is free to drop tables
+    const TableHandle& table = ResolveTable(tableName, false);
+    FilePath tablePath = PathOf(table);
+    uint32_t tableId = table.tableId;
     if(sDeleteCallback && !mPending)
     {
-        size_t len = GetRecord(WorkBuffer(), id, tableName);
+        size_t len = ReadRecord(tablePath, tableId, id, WorkBuffer());
         sDeleteCallback(WorkBuffer(), len, mScope, tableName);
     }
 #if DB_RECORD_CACHE
-    cache.RemoveItem(record);
+    RecordKey key = CacheKey(mScope, mPending, tableId, id);
+    cache.RemoveItem(key);
 #endif
-    return DirectoryWrapper::Delete(record);
+    if (!storage->Remove(tablePath, id)) {
+        return false;
+    }
+    RecordsRemoved(tableName, &id, 1);
+#if DB_RECORD_CACHE
+    cache.MarkAbsent(key);
+#endif
+    return true;
+}
+
+bool DbDriver::DeleteRecords(const ObjId* ids, size_t count, const char * tableName)
+{
+    // copies, the delete callback is free to drop tables
+    const TableHandle& table = ResolveTable(tableName, false);
+    FilePath tablePath = PathOf(table);
+    uint32_t tableId = table.tableId;
+    for (size_t i = 0; i < count; i++) {
+        if(sDeleteCallback && !mPending)
+        {
+            size_t len = ReadRecord(tablePath, tableId, ids[i], WorkBuffer());
+            sDeleteCallback(WorkBuffer(), len, mScope, tableName);
+        }
+#if DB_RECORD_CACHE
+        cache.RemoveItem(CacheKey(mScope, mPending, tableId, ids[i]));
+#endif
+    }
+
+    if (!storage->RemoveBatch(tablePath, ids, count)) {
+        return false;
+    }
+    RecordsRemoved(tableName, ids, count);
+
+#if DB_RECORD_CACHE
+    for (size_t i = 0; i < count; i++) {
+        cache.MarkAbsent(CacheKey(mScope, mPending, tableId, ids[i]));
+    }
+#endif
+    return true;
 }
 
 bool DbDriver::DeleteTable(const char * tableName)
 {
-    FilePath fp = TableNameToPath(tableName);
+    FilePath fp = TableNameToPath(tableName, false);
 #if DB_RECORD_CACHE
-    cache.Clear();
+    // pending records live inside the table, they go too
+    cache.RemoveTable(mScope, TableId(tableName));
 #endif
+    storage->Close(fp);
+    idAllocator.Forget(fp);
+    {
+        WRITE_TABLES();
+        openTables.erase({mScope, TableName(tableName)});
+    }
     return DirectoryWrapper::Delete(fp);
 }
 
@@ -415,6 +1286,17 @@ bool DbDriver::DeleteAll()
 bool DbDriver::DeleteScope()
 {
     FilePath fp = ScopePath(mScope);
+    storage->Close(fp);
+    idAllocator.Forget(fp);
+    if (mScope == RootScope) {
+        // every other scope lives inside the root one
+        CloseTables();
+    } else {
+        WRITE_TABLES();
+        for (auto it = openTables.begin(); it != openTables.end(); ) {
+            it = it->first.scope == mScope ? openTables.erase(it) : std::next(it);
+        }
+    }
     DirectoryWrapper dbDir{fp};
 
     if (!dbDir.DidOpen()) {
@@ -439,7 +1321,11 @@ bool DbDriver::DeleteScope()
     }
 
 #if DB_RECORD_CACHE
-    cache.Clear();
+    if (mScope == RootScope) {
+        cache.Clear();
+    } else {
+        cache.RemoveScope(mScope);
+    }
 #endif
 
     return !somethingFailed;
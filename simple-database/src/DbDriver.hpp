@@ -12,9 +12,25 @@
 #include "logging.hpp"
 #include "BaseMessageDefinitions.hpp"
 #include "FixedLengthString.hpp"
+#include "StorageEngine.hpp"
+#include "DbCache.hpp"
+#include "HashIndex.hpp"
+#include "OrderedIndex.hpp"
+#include "WalStorage.hpp"
 #include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// FatFS builds are single threaded, native ones may find records through drivers on several threads
+#ifndef DB_DRIVER_LOCKING
+#if USE_FF
+#define DB_DRIVER_LOCKING 0
+#else
+#define DB_DRIVER_LOCKING 1
+#endif
+#endif
 
-typedef uint64_t ObjId;
 using DbEventPublisher = std::function<void(const void *recordData, uint32_t dataLength, ObjId scope, const char *tableName)>;
 
 class DbDriver {
@@ -25,6 +41,13 @@ class DbDriver {
 
         static uint8_t* WorkBuffer();
         static void SetDirectory(const FilePath& path);
+        // false if the wal couldn't be attached in front of the new engine, see SetWalOptions
+        static bool SetStorageType(StorageType type);
+        static StorageType GetStorageType();
+        static void CloseStorage();
+
+        static FilePath IdToFileName(ObjId id);
+        static bool FileNameToId(const char* name, ObjId& id);
 
         template<size_t inputLength>
         static FixedLengthString<inputLength * 2> binToHex(const void *bin) {
@@ -49,16 +72,104 @@ class DbDriver {
 
         size_t GetRecord(void * data, ObjId id, const char* tableName);
         bool OpenTable(const char* tableName, DirectoryWrapper& dir);
-        bool GetNextRecord(void * data, DirectoryWrapper& dir);
+        bool OpenTable(const char* tableName, TableCursor& cursor);
+        bool GetNextRecord(void * data, TableCursor& cursor);
+
+        /**
+         * GetRecordView / GetNextRecordView - Like GetRecord / GetNextRecord without the copy
+         * Engines that can map their tables hand back a pointer into the mapping,
+         * everything else is read into the work buffer and that is returned instead
+         * @return the record or nullptr, only valid until the next call into the db
+         */
+        const uint8_t* GetRecordView(ObjId id, const char* tableName, uint32_t& len);
+        const uint8_t* GetNextRecordView(TableCursor& cursor, uint32_t& len);
         bool RecordExists(ObjId id, const char * tableName);
 
+        /**
+         * RecordVersion - Moves on whenever the record is saved or deleted in this scope, on
+         * whichever side of pending the driver is, and for every record of the table when the
+         * cache is cleared. A dropped table starts on one never handed out before, so something
+         * made from a record at one version is still good as long as the version is.
+         * Records share RecordVersionSlots versions per table, so a save can also move on those
+         * of a few records that didn't change
+         */
+        uint64_t RecordVersion(const char* tableName, ObjId id);
+        static const size_t RecordVersionSlots = 256;
+
+        /**
+         * DeclareIndex - Index the table, in every scope, by the value `key` picks out of its records
+         * Index - This driver's side of the table's index called `name`, nullptr if there is none.
+         * It is unbuilt until someone fills it, saves & deletes through any driver keep it up to date
+         * after that. Indexes go with their table, and are dropped with the cache. An empty key
+         * undeclares it
+         */
+        static void DeclareIndex(const char* tableName, const char* name, IndexKey key);
+        HashIndex* Index(const char* tableName, const char* name);
+
+        /**
+         * DeclareOrderedIndex / Ordered - The same for an index that keeps the records in order of a
+         * number, for ranges. A name is either kind of index, declaring it again replaces it
+         */
+        static void DeclareOrderedIndex(const char* tableName, const char* name, OrderKey key);
+        OrderedIndex* Ordered(const char* tableName, const char* name);
+
+        /**
+         * GetRecords - Read a group of records at once
+         * Record i goes to `data + i * stride`, which needs 4 bytes of room past the record
+         * @return number of records found, `lens[i]` is 0 for the ones that weren't
+         */
+        size_t GetRecords(const ObjId* ids, size_t count, uint8_t* data, uint32_t stride, uint32_t* lens, const char* tableName);
+
+        /**
+         * ReadsConcurrently - Whether GetRecords has the reads in flight at once with the current engine
+         * Engines that keep their tables in memory or mapped are quicker to read one at a time
+         */
+        static bool ReadsConcurrently();
+
+        /**
+         * CacheReads - Whether records this driver reads from storage are added to the cache
+         * Turn it off for scans, so reading through a table doesn't push out the records that
+         * are read all the time. Records already cached are still served from the cache
+         */
+        void CacheReads(bool cacheReads) { mCacheReads = cacheReads; }
+        bool CachesReads() const { return mCacheReads; }
+
 #ifndef DARUMA_DB_RO
         static bool InitDb();
         static bool DeleteAll();
 
+        /**
+         * SetWalOptions - Put a write-ahead log in front of the storage engine, or take it away
+         * Anything left in the wal from a crash is replayed here and on every InitDb. If it can't
+         * be, saves go straight to the engine until an attach succeeds and this returns false
+         */
+        static bool SetWalOptions(const WalOptions& options);
+
+        /**
+         * CommitWal - Make every save & delete so far durable, without waiting for the group to fill
+         */
+        static bool CommitWal();
+
+        /**
+         * MigrateFileLayout - Move every record on disk into the layout of the current file engine
+         * Run once after switching between StorageType::File and StorageType::FileFanOut
+         * @return false if the current engine isn't one of those, or a record couldn't be moved
+         */
+        static bool MigrateFileLayout();
+
         bool SaveRecord(ObjId id, ObjId commitId, const void * data, uint32_t len, const char* tableName);
         bool DeleteRecord(ObjId id, const char * tableName);
         bool NextId(const char * tableName, ObjId& id, bool increment = true);
+
+        /**
+         * SaveRecords - Save `count` records of `len` bytes as a single batch
+         * `data` holds the records back to back, each followed by room for the commit id
+         * Ids are bumped once and the engine syncs once for the whole batch
+         */
+        bool SaveRecords(const ObjId* ids, ObjId commitId, uint8_t* data, uint32_t len, size_t count, const char* tableName);
+        bool DeleteRecords(const ObjId* ids, size_t count, const char * tableName);
+        // Reserve `count` consecutive ids starting at `first`
+        bool NextIds(const char * tableName, size_t count, ObjId& first);
         bool DeleteTable(const char * tableName);
         bool DeleteScope();
         static void SetOnCreateCallback(DbEventPublisher createCallback);
@@ -67,25 +178,120 @@ class DbDriver {
 
         static void ClearCache();
 
+        /**
+         * SetCacheSize - Cap the record cache at `bytes` of records, 1GB unless set
+         * Whatever no longer fits is evicted straight away
+         */
+        static void SetCacheSize(size_t bytes);
+        static size_t CacheSize();
+
+        /**
+         * SetTableCacheBudget / SetScopeCacheBudget - Cap how much of the cache one table, counted
+         * over every scope, or one scope may take. 0 takes the cap away
+         */
+        static void SetTableCacheBudget(const char* tableName, size_t bytes);
+        static void SetScopeCacheBudget(ObjId scope, size_t bytes);
+
+        /**
+         * GetCacheStats / GetTableCacheStats - Hits, misses, evictions & bytes added since the last
+         * ResetCacheStats, and what is cached right now. All zero with the cache compiled out
+         */
+        static CacheStats GetCacheStats();
+        static CacheStats GetTableCacheStats(const char* tableName);
+        static void ResetCacheStats();
+
+        /**
+         * SaveCacheSnapshot - Note which records are cached, up to `count` of the ones used most,
+         * in the db directory, so the next run can start with them. Call it on shutdown
+         * LoadCacheSnapshot - Read the snapshot back in, without reading any record yet
+         * WarmCache - Read the next `count` records of the snapshot into the cache, hottest first.
+         * Spread it over idle moments after start up. Records that changed or went away since the
+         * snapshot was taken are skipped, their CRC no longer matches
+         * @return the number of records still waiting
+         */
+        static bool SaveCacheSnapshot(size_t count);
+        static bool LoadCacheSnapshot();
+        static size_t WarmCache(size_t count);
+
+        /**
+         * TableIndexes - The indexes of one side of a table, by name
+         */
+        struct TableIndexes {
+            std::unordered_map<std::string, HashIndex> hashed;
+            std::unordered_map<std::string, OrderedIndex> ordered;
+
+            void Insert(ObjId id, const uint8_t* record);
+            void Remove(ObjId id);
+            void Clear();
+        };
+
+        /**
+         * DeclaredIndex - What DeclareIndex or DeclareOrderedIndex were told, one of the keys is set
+         */
+        struct DeclaredIndex {
+            std::string name;
+            IndexKey key;
+            OrderKey orderKey;
+        };
+
+        /**
+         * TableHandle - Where a table lives on disk
+         * Resolved the first time a driver touches the table, its directories are only created
+         * once something saves to or opens it. Kept until the table or its scope is deleted, or
+         * the db is initialised again
+         */
+        struct TableHandle {
+            // keys the table's records in the cache, the same in every scope
+            uint32_t tableId;
+            // see RecordVersion, one for the table and one for its pending table. A record's
+            // version is the later of the generation and its slot, slots come with the first change
+            uint64_t generation[2];
+            std::vector<uint64_t> versions[2];
+            // as many of the declared ones as have been asked for, for each side too
+            TableIndexes indexes[2];
+            std::string path;
+            std::string pendingPath;
+            std::string counterPath;
+            // whether its directories have been made this run
+            bool created = false;
+        };
+
+        /**
+         * CloseTables - Forget every resolved table, they are resolved again on next use
+         */
+        static void CloseTables();
+
     private:
-        static FilePath IdToFileName(ObjId id);
         static FilePath ScopePath(ObjId scope);
+        static FilePath TablePath(ObjId scope, const char* tableName);
 
-        FilePath GetRecordPath(ObjId id, const char* tableName);
-
-        FilePath TableNameToPath(const char* tableName);
-        FilePath TableNameToCounterPath(const char* tableName);
+        /**
+         * ResolveTable - The table's handle, registered on first use. Only with `create` are its
+         * directories made, reads of a table that was never saved to leave the disk alone.
+         * Drivers on any number of threads may resolve and read at once, saves and deletes
+         * still come one at a time
+         */
+        TableHandle& ResolveTable(const char* tableName, bool create);
+        static void Declare(const char* tableName, const char* name, IndexKey key, OrderKey orderKey);
+        static const DeclaredIndex* Declared(const char* tableName, const char* name);
+        // after a delete, through the name as the delete callback may have dropped the table
+        void RecordsRemoved(const char* tableName, const ObjId* ids, size_t count);
+        // moves the record's version on, see RecordVersion
+        void RecordChanged(TableHandle& table, ObjId id);
+        const char* TableNameToPath(const char* tableName, bool create);
+        const char* PathOf(const TableHandle& table) const;
+        const char* TableNameToCounterPath(const char* tableName);
 
 #ifndef DARUMA_DB_RO
         bool InitScope(ObjId scope);
         bool InitTable(const char* fullPath) const;
-        bool SaveObjCt(const char * tableName, ObjId id);
 #endif
-        ObjId GetObjCt(const char * tableName);
-        uint32_t ReadRecord(const char * fullPath, void * data);
-        bool NextRecordPath(FilePath& p, DirectoryWrapper& dir);
+        uint32_t ReadRecord(const char * tablePath, uint32_t tableId, ObjId id, void * data);
+        const uint8_t* ViewRecord(const char * tablePath, uint32_t tableId, ObjId id, uint32_t& len);
+        size_t ReadRecords(const char * tablePath, uint32_t tableId, const ObjId* ids, size_t count, uint8_t* data, uint32_t stride, uint32_t* lens);
         ObjId mScope;
         bool mPending;
+        bool mCacheReads = true;
 };
 
 #endif //_DBDRIVER_HPP_
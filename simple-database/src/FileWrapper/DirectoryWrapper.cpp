@@ -1,6 +1,11 @@
 #include "DirectoryWrapper.hpp"
 #include <string.h>
 
+#if !USE_FF && !defined(_WIN32)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
 DirectoryWrapper::DirectoryWrapper(const char* path) {
     Open(path);
 }
@@ -14,6 +19,7 @@ bool DirectoryWrapper::DidOpen() {
 }
 
 bool DirectoryWrapper::Open(const char* path) {
+    Close();
     strncpy(mPath, path, sizeof(mPath) - 1);
 #if USE_FF
     // FF doesn't like trailing slashes
@@ -33,9 +39,11 @@ bool DirectoryWrapper::Open(const char* path) {
 bool DirectoryWrapper::Close() {
 #if USE_FF
     if (mDidOpen) {
+        mDidOpen = false;
         return FR_OK == f_closedir(&mDir);
     }
 #endif
+    mDidOpen = false;
     return true;
 }
 
@@ -90,6 +98,32 @@ bool DirectoryWrapper::Delete(const char* path) {
 #endif
 }
 
+bool DirectoryWrapper::Rename(const char* from, const char* to) {
+#if USE_FF
+    // FF refuses to rename over an existing object
+    if (Exists(to) && !Delete(to)) return false;
+    return FR_OK == f_rename(from, to);
+#else
+    std::error_code ec;
+    fs::rename(from, to, ec);
+    return !ec;
+#endif
+}
+
+bool DirectoryWrapper::Sync(const char* path) {
+#if USE_FF || defined(_WIN32)
+    // FF writes directory entries as they change, Windows can't open a directory to sync it
+    (void)path;
+    return true;
+#else
+    int fd = open(path, O_RDONLY | O_DIRECTORY);
+    if (fd < 0) return false;
+    bool synced = 0 == fsync(fd);
+    close(fd);
+    return synced;
+#endif
+}
+
 bool DirectoryWrapper::New(const char* path) {
 #if USE_FF
     FRESULT res = f_mkdir(path);
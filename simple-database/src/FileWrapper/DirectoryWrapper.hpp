@@ -37,6 +37,9 @@ class DirectoryWrapper
         bool NextPath(char* path, bool& isDir);
         static bool New(const char* path);
         static bool Delete(const char* path);
+        static bool Rename(const char* from, const char* to);
+        // wait for renames, creates and deletes in the directory to reach the disk
+        static bool Sync(const char* path);
         static bool Exists(const char* path);
         static bool BaseName(const char* path, char* name);
 
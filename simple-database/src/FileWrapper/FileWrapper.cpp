@@ -4,6 +4,14 @@
 #include <cassert>
 #include "logging.hpp"
 
+#if !USE_FF && !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+#if DB_MMAP_READS && !USE_FF && !defined(_WIN32)
+#include <sys/mman.h>
+#endif
+
 FileWrapper::FileWrapper(const char* fpath, const char* mode)
 {
 #if USE_FF
@@ -98,12 +106,14 @@ FileWrapper::~FileWrapper()
 
 void FileWrapper::Close()
 {
+    Unmap();
     if (mFile != nullptr) {
 #if USE_FF
         f_close(mFile);
 #else
         fclose(mFile);
 #endif
+        mFile = nullptr;
     }
 }
 
@@ -164,8 +174,13 @@ bool FileWrapper::Write(const void* buf, uint32_t len)
     }
 #else
     x = fwrite(buf, sizeof(uint8_t), len, mFile);
+    mDirty = true;
 #endif
 
+    if (Pos() > mFileLength) {
+        mFileLength = Pos();
+    }
+
     if (len != x) {
         LOG("Unable to write full file contents!");
         LOG("Flash is full?");
@@ -197,3 +212,113 @@ bool FileWrapper::Seek(uint32_t pos)
 #endif
     return true;
 }
+
+bool FileWrapper::ReadAt(uint32_t pos, void* buf, uint32_t len)
+{
+    if (mFile == nullptr) return false;
+#if USE_FF || defined(_WIN32)
+    return Seek(pos) && Read(buf, len);
+#else
+    // pread goes straight to the descriptor, so anything still sitting in the
+    // stdio buffer has to be pushed out first
+    if (mDirty && !Flush()) {
+        return false;
+    }
+
+    ssize_t lenRead = pread(fileno(mFile), buf, len, pos);
+    if (lenRead < 0 || (uint32_t)lenRead < len) {
+        LOG("Error reading file");
+        return false;
+    }
+    return true;
+#endif
+}
+
+bool FileWrapper::Flush()
+{
+    if (mFile == nullptr) return false;
+#if USE_FF
+    // FF writes are synced as they are made
+    return true;
+#else
+    mDirty = false;
+    return 0 == fflush(mFile);
+#endif
+}
+
+bool FileWrapper::Sync()
+{
+    if (mFile == nullptr) return false;
+#if USE_FF
+    return FR_OK == f_sync(mFile);
+#elif defined(_WIN32)
+    return Flush();
+#else
+    return Flush() && 0 == fsync(fileno(mFile));
+#endif
+}
+
+bool FileWrapper::Truncate(uint32_t len)
+{
+    if (mFile == nullptr) return false;
+    Unmap();
+#if USE_FF
+    FRESULT fRes = f_lseek(mFile, len);
+    if (fRes == FR_OK) fRes = f_truncate(mFile);
+    if (fRes == FR_OK) fRes = f_sync(mFile);
+    if (fRes != FR_OK) {
+        LOG("File Truncate Error:");
+        logging::Print(fRes);
+        return false;
+    }
+#elif defined(_WIN32)
+    (void)len;
+    return false;
+#else
+    if (!Flush() || 0 != ftruncate(fileno(mFile), len)) {
+        LOG("File Truncate Error");
+        return false;
+    }
+#endif
+    mFileLength = len;
+    return true;
+}
+
+const uint8_t* FileWrapper::Map()
+{
+#if DB_MMAP_READS && !USE_FF && !defined(_WIN32)
+    if (mFile == nullptr || mFileLength == 0) return nullptr;
+    if (mMap != nullptr && mMapLength == mFileLength) {
+        return mMap;
+    }
+
+    // the mapping sees what the descriptor sees, not what stdio is still holding on to
+    if (mDirty && !Flush()) {
+        return nullptr;
+    }
+
+    Unmap();
+    void* map = mmap(nullptr, mFileLength, PROT_READ, MAP_SHARED, fileno(mFile), 0);
+    if (map == MAP_FAILED) {
+        LOG("Error mapping file");
+        return nullptr;
+    }
+
+    mMap = (const uint8_t*)map;
+    mMapLength = mFileLength;
+    return mMap;
+#else
+    return nullptr;
+#endif
+}
+
+void FileWrapper::Unmap()
+{
+#if DB_MMAP_READS && !USE_FF && !defined(_WIN32)
+    if (mMap != nullptr) {
+        munmap((void*)mMap, mMapLength);
+    }
+#endif
+    mMap = nullptr;
+    mMapLength = 0;
+}
@@ -24,9 +24,23 @@ public:
     bool Read(void* buf, uint32_t len);
     bool Write(const void* buf, uint32_t len);
     bool Seek(uint32_t pos);
+    bool ReadAt(uint32_t pos, void* buf, uint32_t len);
+    bool Flush();
+    // Flush and wait for the data to reach the disk
+    bool Sync();
+    bool Truncate(uint32_t len);
     uint32_t Pos();
     uint32_t Size();
 
+    /**
+     * Map - Map the whole file read only, remapping if it has grown since the last call
+     * Only native builds with DB_MMAP_READS map anything, elsewhere this is always nullptr
+     * @return the mapping, valid until the next Map, Truncate or Close
+     */
+    const uint8_t* Map();
+    uint32_t MappedLength() const { return mMapLength; }
+    void Unmap();
+
 private:
 #if USE_FF
     FIL* mFile;
@@ -36,6 +50,9 @@ private:
 #endif
 
     uint32_t mFileLength = 0;
+    bool mDirty = false;
+    const uint8_t* mMap = nullptr;
+    uint32_t mMapLength = 0;
 };
 
 #endif //_FILEWRAPPER_HPP_
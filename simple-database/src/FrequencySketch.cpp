@@ -0,0 +1,69 @@
+#include "FrequencySketch.hpp"
+
+FrequencySketch::FrequencySketch(size_t width)
+{
+    mWidth = CountersPerWord;
+    while (mWidth < width) {
+        mWidth <<= 1;
+    }
+
+    mWords.resize(Depth * mWidth / CountersPerWord);
+    mSampleSize = 10 * mWidth;
+}
+
+size_t FrequencySketch::Index(uint64_t hash, size_t row) const
+{
+    // a differently seeded mix of the hash per row, rows go one after the other
+    static const uint64_t Seeds[Depth] = {0xc3a5c85c97cb3127ULL, 0xb492b66fbe98f273ULL, 0x9ae16a3b2f90404fULL, 0xcbf29ce484222325ULL};
+    uint64_t h = (hash + Seeds[row]) * Seeds[(row + 1) % Depth];
+    h ^= h >> 32;
+    return row * mWidth + (size_t)(h & (mWidth - 1));
+}
+
+uint8_t FrequencySketch::Counter(size_t index) const
+{
+    return (mWords[index / CountersPerWord] >> ((index % CountersPerWord) * 4)) & 0xF;
+}
+
+void FrequencySketch::Increment(uint64_t hash)
+{
+    bool added = false;
+    for (size_t row = 0; row < Depth; row++) {
+        size_t index = Index(hash, row);
+        if (Counter(index) < MaxCount) {
+            mWords[index / CountersPerWord] += (uint64_t)1 << ((index % CountersPerWord) * 4);
+            added = true;
+        }
+    }
+
+    if (added && ++mAdditions >= mSampleSize) {
+        Halve();
+    }
+}
+
+uint8_t FrequencySketch::Estimate(uint64_t hash) const
+{
+    uint8_t estimate = MaxCount;
+    for (size_t row = 0; row < Depth; row++) {
+        uint8_t count = Counter(Index(hash, row));
+        estimate = count < estimate ? count : estimate;
+    }
+    return estimate;
+}
+
+void FrequencySketch::Halve()
+{
+    // shift every counter down a bit, the mask drops what slid in from the counter above
+    for (uint64_t& word : mWords) {
+        word = (word >> 1) & 0x7777777777777777ULL;
+    }
+    mAdditions /= 2;
+}
+
+void FrequencySketch::Clear()
+{
+    for (uint64_t& word : mWords) {
+        word = 0;
+    }
+    mAdditions = 0;
+}
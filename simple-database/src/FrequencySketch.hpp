@@ -0,0 +1,39 @@
+#ifndef _FREQUENCYSKETCH_HPP_
+#define _FREQUENCYSKETCH_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+/**
+ * FrequencySketch
+ * Count-min sketch of how often keys were seen lately, four rows of 4 bit counters
+ * Once the number of increments reaches ten times the width every counter is halved,
+ * so old popularity fades and a key that stopped being read loses its place
+ */
+class FrequencySketch {
+    public:
+        static constexpr uint8_t MaxCount = 15;
+
+        // width is rounded up to a power of two, every row has that many counters
+        explicit FrequencySketch(size_t width);
+
+        void Increment(uint64_t hash);
+        uint8_t Estimate(uint64_t hash) const;
+        void Clear();
+
+    private:
+        static constexpr size_t Depth = 4;
+        static constexpr size_t CountersPerWord = 16;
+
+        size_t Index(uint64_t hash, size_t row) const;
+        uint8_t Counter(size_t index) const;
+        void Halve();
+
+        std::vector<uint64_t> mWords;
+        size_t mWidth = 0;
+        size_t mAdditions = 0;
+        size_t mSampleSize = 0;
+};
+
+#endif //_FREQUENCYSKETCH_HPP_
@@ -0,0 +1,44 @@
+#include "HashIndex.hpp"
+#include <algorithm>
+
+void HashIndex::Insert(ObjId id, const uint8_t* record)
+{
+    Remove(id);
+
+    const uint8_t* value;
+    uint32_t len;
+    if (!mKey(record, value, len)) {
+        return;
+    }
+
+    std::string key{(const char*)value, len};
+    mIds[key].insert(id);
+    mValues.emplace(id, std::move(key));
+}
+
+void HashIndex::Remove(ObjId id)
+{
+    auto value = mValues.find(id);
+    if (value == mValues.end()) {
+        return;
+    }
+
+    auto ids = mIds.find(value->second);
+    ids->second.erase(id);
+    if (ids->second.empty()) {
+        mIds.erase(ids);
+    }
+    mValues.erase(value);
+}
+
+void HashIndex::Find(const void* value, uint32_t len, std::vector<ObjId>& ids) const
+{
+    ids.clear();
+    auto it = mIds.find(std::string{(const char*)value, len});
+    if (it == mIds.end()) {
+        return;
+    }
+
+    ids.assign(it->second.begin(), it->second.end());
+    std::sort(ids.begin(), ids.end());
+}
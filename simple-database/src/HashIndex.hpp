@@ -0,0 +1,51 @@
+#ifndef _HASHINDEX_HPP_
+#define _HASHINDEX_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+#include "StorageEngine.hpp"
+
+/**
+ * IndexKey - Pick the indexed value out of a record as it is laid out on disk
+ * @return false if the record has nothing to index
+ */
+using IndexKey = std::function<bool(const uint8_t* record, const uint8_t*& value, uint32_t& len)>;
+
+/**
+ * HashIndex
+ * Ids of one side (main or pending) of a table in one scope, by the exact value their key
+ * picks out. Starts out empty and unbuilt, whoever first needs it fills it with every record
+ * of the table and marks it built. From then on the driver keeps it up to date on every save
+ * and delete
+ */
+class HashIndex {
+    public:
+        explicit HashIndex(IndexKey key) : mKey(std::move(key)) {}
+
+        // replaces whatever the id was indexed under before
+        void Insert(ObjId id, const uint8_t* record);
+        void Remove(ObjId id);
+
+        /**
+         * Find - The ids indexed under exactly `value`, lowest first
+         */
+        void Find(const void* value, uint32_t len, std::vector<ObjId>& ids) const;
+
+        bool IsBuilt() const { return mBuilt; }
+        void MarkBuilt() { mBuilt = true; }
+        size_t Size() const { return mValues.size(); }
+
+    private:
+        IndexKey mKey;
+        bool mBuilt = false;
+        std::unordered_map<std::string, std::unordered_set<ObjId>> mIds;
+        // what each id is indexed under, to take it out again
+        std::unordered_map<ObjId, std::string> mValues;
+};
+
+#endif //_HASHINDEX_HPP_
@@ -0,0 +1,96 @@
+#include "IdAllocator.hpp"
+#include "FileWrapper.hpp"
+#include "DirectoryWrapper.hpp"
+#include "logging.hpp"
+
+IdAllocator::Counter& IdAllocator::Load(const char* counterPath)
+{
+    auto it = mCounters.find(counterPath);
+    if (it != mCounters.end()) {
+        return it->second;
+    }
+
+    Counter counter;
+    FileWrapper file{counterPath, "r"};
+    ObjId stored;
+    if (file.DidOpen() && file.Read(&stored, sizeof(stored)) && stored > 0) {
+        counter.next = stored;
+        counter.reserved = stored;
+    }
+
+    return mCounters[counterPath] = counter;
+}
+
+bool IdAllocator::Reserve(const char* counterPath, Counter& counter, ObjId upTo)
+{
+    if (upTo <= counter.reserved) {
+        return true;
+    }
+
+    ObjId reserved = upTo + BlockSize;
+
+    // overwrite in place, truncating first would leave an empty counter behind on a crash
+    FileWrapper f{counterPath, DirectoryWrapper::Exists(counterPath) ? "r+" : "w"};
+    if (!f.DidOpen()) {
+        return false;
+    }
+    if (!f.Write(&reserved, sizeof(reserved)) || !f.Sync()) {
+        LOG("Error writing obj count file");
+        return false;
+    }
+
+    counter.reserved = reserved;
+    return true;
+}
+
+ObjId IdAllocator::Peek(const char* counterPath)
+{
+    return Load(counterPath).next;
+}
+
+bool IdAllocator::Next(const char* counterPath, size_t count, ObjId& first)
+{
+    Counter& counter = Load(counterPath);
+    if (!Reserve(counterPath, counter, counter.next + count)) {
+        return false;
+    }
+
+    first = counter.next;
+    counter.next += count;
+    return true;
+}
+
+bool IdAllocator::Bump(const char* counterPath, ObjId id)
+{
+    Counter& counter = Load(counterPath);
+    if (id < counter.next) {
+        return true;
+    }
+
+    if (!Reserve(counterPath, counter, id + 1)) {
+        return false;
+    }
+
+    counter.next = id + 1;
+    return true;
+}
+
+void IdAllocator::Forget(const char* pathPrefix)
+{
+    size_t len = strlen(pathPrefix);
+    for (auto it = mCounters.begin(); it != mCounters.end(); ) {
+        const std::string& path = it->first;
+        bool under = len > 0 && path.compare(0, len, pathPrefix) == 0 &&
+            (path.size() == len || path[len] == '/' || pathPrefix[len - 1] == '/');
+        if (under) {
+            it = mCounters.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void IdAllocator::Clear()
+{
+    mCounters.clear();
+}
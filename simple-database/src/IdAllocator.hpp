@@ -0,0 +1,59 @@
+#ifndef _IDALLOCATOR_HPP_
+#define _IDALLOCATOR_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include "StorageEngine.hpp"
+
+/**
+ * IdAllocator
+ * Hands out ids from memory, one counter per table
+ *
+ * The counter file only holds the top of the block of ids reserved so far. It is
+ * rewritten once a block runs out, and always before any id from the new block is
+ * handed out, so every id below it may already be in use. After a restart the table
+ * carries on from the top of the block, the unused rest of it is skipped.
+ */
+class IdAllocator {
+    public:
+        // ids reserved each time the counter file is written
+        static const ObjId BlockSize = 64;
+
+        /**
+         * Peek - The next id that will be handed out, without reserving it
+         */
+        ObjId Peek(const char* counterPath);
+
+        /**
+         * Next - Reserve `count` consecutive ids starting at `first`
+         */
+        bool Next(const char* counterPath, size_t count, ObjId& first);
+
+        /**
+         * Bump - Make sure `id` will never be handed out
+         * For records saved with an id the table didn't provision
+         */
+        bool Bump(const char* counterPath, ObjId id);
+
+        /**
+         * Forget - Drop the counters of every table under `pathPrefix`
+         * They are read from disk again on next use
+         */
+        void Forget(const char* pathPrefix);
+        void Clear();
+
+    private:
+        struct Counter {
+            ObjId next = 1;
+            ObjId reserved = 1;  // what the counter file holds
+        };
+
+        Counter& Load(const char* counterPath);
+        bool Reserve(const char* counterPath, Counter& counter, ObjId upTo);
+
+        std::unordered_map<std::string, Counter> mCounters;
+};
+
+#endif //_IDALLOCATOR_HPP_
@@ -0,0 +1,46 @@
+#include "OrderedIndex.hpp"
+
+void OrderedIndex::Insert(ObjId id, const uint8_t* record)
+{
+    Remove(id);
+
+    uint64_t value;
+    if (!mKey(record, value)) {
+        return;
+    }
+
+    mEntries.emplace(value, id);
+    mValues.emplace(id, value);
+}
+
+void OrderedIndex::Remove(ObjId id)
+{
+    auto value = mValues.find(id);
+    if (value == mValues.end()) {
+        return;
+    }
+
+    mEntries.erase({value->second, id});
+    mValues.erase(value);
+}
+
+void OrderedIndex::Range(uint64_t min, uint64_t max, bool descending, size_t limit, std::vector<ObjId>& ids) const
+{
+    ids.clear();
+    if (min > max) {
+        return;
+    }
+
+    auto first = mEntries.lower_bound({min, 0});
+    auto last = max == UINT64_MAX ? mEntries.end() : mEntries.lower_bound({max + 1, 0});
+    if (descending) {
+        for (auto it = last; it != first && ids.size() < limit; ) {
+            ids.push_back((--it)->second);
+        }
+        return;
+    }
+
+    for (auto it = first; it != last && ids.size() < limit; ++it) {
+        ids.push_back(it->second);
+    }
+}
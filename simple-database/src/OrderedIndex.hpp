@@ -0,0 +1,53 @@
+#ifndef _ORDEREDINDEX_HPP_
+#define _ORDEREDINDEX_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "StorageEngine.hpp"
+
+/**
+ * OrderKey - Read the value a record is ordered by out of it as it is laid out on disk
+ * @return false if the record has nothing to index
+ */
+using OrderKey = std::function<bool(const uint8_t* record, uint64_t& value)>;
+
+/**
+ * OrderedIndex
+ * Ids of one side (main or pending) of a table in one scope, sorted by the value their key reads,
+ * ties by id. Built and kept up to date the same way as a HashIndex, but it can also answer
+ * everything between two values
+ */
+class OrderedIndex {
+    public:
+        explicit OrderedIndex(OrderKey key) : mKey(std::move(key)) {}
+
+        // replaces whatever the id was indexed under before
+        void Insert(ObjId id, const uint8_t* record);
+        void Remove(ObjId id);
+
+        /**
+         * Range - The first `limit` ids with `min <= value <= max`, in order of value, highest
+         * first if `descending`
+         */
+        void Range(uint64_t min, uint64_t max, bool descending, size_t limit, std::vector<ObjId>& ids) const;
+
+        bool IsBuilt() const { return mBuilt; }
+        void MarkBuilt() { mBuilt = true; }
+        size_t Size() const { return mValues.size(); }
+
+    private:
+        using Entry = std::pair<uint64_t, ObjId>;
+
+        OrderKey mKey;
+        bool mBuilt = false;
+        std::set<Entry> mEntries;
+        // what each id is indexed under, to take it out again
+        std::unordered_map<ObjId, uint64_t> mValues;
+};
+
+#endif //_ORDEREDINDEX_HPP_
@@ -0,0 +1,187 @@
+#include "ShardedCache.hpp"
+#include <algorithm>
+
+#if DB_CACHE_LOCKING
+#define LOCK_SHARD(shard) std::lock_guard<std::mutex> guard((shard).lock)
+#else
+#define LOCK_SHARD(shard) ((void) 0)
+#endif
+
+ShardedCache::ShardedCache(size_t maxSize, size_t shards, CachePolicy policy)
+{
+    shards = shards > 0 ? shards : 1;
+    for (size_t i = 0; i < shards; i++) {
+        mShards.emplace_back(new Shard(maxSize / shards, policy));
+    }
+}
+
+ShardedCache::Shard& ShardedCache::ShardFor(const RecordKey& key)
+{
+    if (mShards.size() == 1) {
+        return *mShards[0];
+    }
+
+    // the shard's own map buckets on the low bits, so pick the shard with the high ones
+    uint64_t hash = RecordKeyHash()(key);
+    return *mShards[(hash >> 32) % mShards.size()];
+}
+
+void ShardedCache::AddItem(const RecordKey& key, const uint8_t* data, size_t len)
+{
+    Shard& shard = ShardFor(key);
+    LOCK_SHARD(shard);
+    shard.cache.AddItem(key, data, len);
+}
+
+void ShardedCache::RemoveItem(const RecordKey& key)
+{
+    Shard& shard = ShardFor(key);
+    LOCK_SHARD(shard);
+    shard.cache.RemoveItem(key);
+}
+
+bool ShardedCache::GetItem(const RecordKey& key, uint8_t* data, size_t& len)
+{
+    Shard& shard = ShardFor(key);
+    LOCK_SHARD(shard);
+    return shard.cache.GetItem(key, data, len);
+}
+
+void ShardedCache::Clear()
+{
+    for (auto& shard : mShards) {
+        LOCK_SHARD(*shard);
+        shard->cache.Clear();
+    }
+}
+
+void ShardedCache::RemoveScope(uint64_t scope)
+{
+    for (auto& shard : mShards) {
+        LOCK_SHARD(*shard);
+        shard->cache.RemoveScope(scope);
+    }
+}
+
+void ShardedCache::RemoveTable(uint64_t scope, uint32_t table)
+{
+    for (auto& shard : mShards) {
+        LOCK_SHARD(*shard);
+        shard->cache.RemoveTable(scope, table);
+    }
+}
+
+void ShardedCache::Hottest(size_t count, const DbCache::Visitor& visit)
+{
+    if (mShards.size() == 1) {
+        LOCK_SHARD(*mShards[0]);
+        mShards[0]->cache.Hottest(count, visit);
+        return;
+    }
+
+    // the hottest of the whole cache can all sit in one shard, so every shard offers `count`
+    std::vector<DbCache::HotItem> items;
+    for (auto& shard : mShards) {
+        LOCK_SHARD(*shard);
+        shard->cache.Hottest(count, items);
+    }
+
+    size_t hottest = std::min(count, items.size());
+    std::partial_sort(items.begin(), items.begin() + hottest, items.end());
+
+    // whatever was dropped in the meantime is skipped
+    for (size_t i = 0; i < hottest; i++) {
+        Shard& shard = ShardFor(items[i].key);
+        LOCK_SHARD(shard);
+        shard.cache.Visit(items[i].key, visit);
+    }
+}
+
+void ShardedCache::MarkAbsent(const RecordKey& key)
+{
+    Shard& shard = ShardFor(key);
+    LOCK_SHARD(shard);
+    shard.cache.MarkAbsent(key);
+}
+
+bool ShardedCache::IsAbsent(const RecordKey& key)
+{
+    Shard& shard = ShardFor(key);
+    LOCK_SHARD(shard);
+    return shard.cache.IsAbsent(key);
+}
+
+void ShardedCache::ClearAbsent()
+{
+    for (auto& shard : mShards) {
+        LOCK_SHARD(*shard);
+        shard->cache.ClearAbsent();
+    }
+}
+
+size_t ShardedCache::ShardPart(size_t bytes) const
+{
+    return (bytes + mShards.size() - 1) / mShards.size();
+}
+
+void ShardedCache::Resize(size_t maxSize)
+{
+    for (auto& shard : mShards) {
+        LOCK_SHARD(*shard);
+        shard->cache.Resize(maxSize / mShards.size());
+    }
+}
+
+size_t ShardedCache::MaxSize()
+{
+    size_t maxSize = 0;
+    for (auto& shard : mShards) {
+        LOCK_SHARD(*shard);
+        maxSize += shard->cache.MaxSize();
+    }
+    return maxSize;
+}
+
+void ShardedCache::SetTableBudget(uint32_t table, size_t bytes)
+{
+    for (auto& shard : mShards) {
+        LOCK_SHARD(*shard);
+        shard->cache.SetTableBudget(table, ShardPart(bytes), bytes);
+    }
+}
+
+void ShardedCache::SetScopeBudget(uint64_t scope, size_t bytes)
+{
+    for (auto& shard : mShards) {
+        LOCK_SHARD(*shard);
+        shard->cache.SetScopeBudget(scope, ShardPart(bytes), bytes);
+    }
+}
+
+CacheStats ShardedCache::Stats()
+{
+    CacheStats stats;
+    for (auto& shard : mShards) {
+        LOCK_SHARD(*shard);
+        stats += shard->cache.Stats();
+    }
+    return stats;
+}
+
+CacheStats ShardedCache::TableStats(uint32_t table)
+{
+    CacheStats stats;
+    for (auto& shard : mShards) {
+        LOCK_SHARD(*shard);
+        stats += shard->cache.TableStats(table);
+    }
+    return stats;
+}
+
+void ShardedCache::ResetStats()
+{
+    for (auto& shard : mShards) {
+        LOCK_SHARD(*shard);
+        shard->cache.ResetStats();
+    }
+}
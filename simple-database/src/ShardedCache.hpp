@@ -0,0 +1,85 @@
+#ifndef _SHARDEDCACHE_HPP_
+#define _SHARDEDCACHE_HPP_
+
+#include <memory>
+#include <vector>
+#include "DbCache.hpp"
+
+// FatFS builds are single threaded, native ones may read through the driver from several threads
+#ifndef DB_CACHE_SHARDS
+#if USE_FF
+#define DB_CACHE_SHARDS 1
+#else
+#define DB_CACHE_SHARDS 16
+#endif
+#endif
+
+#ifndef DB_CACHE_LOCKING
+#if USE_FF
+#define DB_CACHE_LOCKING 0
+#else
+#define DB_CACHE_LOCKING 1
+#endif
+#endif
+
+#if DB_CACHE_LOCKING
+#include <mutex>
+#endif
+
+/**
+ * ShardedCache
+ * The record cache split into shards picked by the hash of the key, each its own DbCache
+ * with its own lock, so threads reading different records rarely wait on each other.
+ * Every shard gets an equal part of MaxSize and evicts on its own.
+ */
+class ShardedCache {
+    public:
+        explicit ShardedCache(size_t maxSize, size_t shards = DB_CACHE_SHARDS, CachePolicy policy = CachePolicy::Lru);
+
+        void AddItem(const RecordKey& key, const uint8_t* data, size_t len);
+        void RemoveItem(const RecordKey& key);
+        bool GetItem(const RecordKey& key, uint8_t* data, size_t& len);
+        void Clear();
+        void RemoveScope(uint64_t scope);
+        void RemoveTable(uint64_t scope, uint32_t table);
+        // the hottest of all shards ranked together, `visit` is called with the record's shard locked
+        void Hottest(size_t count, const DbCache::Visitor& visit);
+
+        void MarkAbsent(const RecordKey& key);
+        bool IsAbsent(const RecordKey& key);
+        void ClearAbsent();
+
+        /**
+         * Resize / SetTableBudget / SetScopeBudget - As on DbCache, split evenly between the shards
+         * A record that fits the whole budget but not a shard's part still gets cached, that shard
+         * then holds it alone, so the table or scope can go over by up to a record per shard
+         */
+        void Resize(size_t maxSize);
+        size_t MaxSize();
+        void SetTableBudget(uint32_t table, size_t bytes);
+        void SetScopeBudget(uint64_t scope, size_t bytes);
+
+        // summed over the shards
+        CacheStats Stats();
+        CacheStats TableStats(uint32_t table);
+        void ResetStats();
+
+        size_t ShardCount() const { return mShards.size(); }
+
+    private:
+        struct Shard {
+            Shard(size_t maxSize, CachePolicy policy) : cache{maxSize, policy} {}
+#if DB_CACHE_LOCKING
+            std::mutex lock;
+#endif
+            DbCache cache;
+        };
+
+        Shard& ShardFor(const RecordKey& key);
+        // a shard's part of `bytes`, never rounded down to no cap at all
+        size_t ShardPart(size_t bytes) const;
+
+        std::vector<std::unique_ptr<Shard>> mShards;
+};
+
+#endif //_SHARDEDCACHE_HPP_
@@ -0,0 +1,221 @@
+#include "SlabAllocator.hpp"
+#include <new>
+
+#if DB_CACHE_HUGE_PAGES
+#include <sys/mman.h>
+#endif
+
+SlabAllocator::~SlabAllocator()
+{
+    Reset();
+}
+
+size_t SlabAllocator::ClassOf(size_t len)
+{
+    if (len <= MinSlot) {
+        return 0;
+    }
+
+    // 2^k < len <= 2^(k+1), split into four steps of 2^(k-2)
+    size_t k = 0;
+    while (((size_t)2 << k) < len) {
+        k++;
+    }
+    size_t base = (size_t)1 << k;
+    size_t step = base >> 2;
+    size_t sub = (len - base + step - 1) / step;
+    return (k - 6) * 4 + sub;
+}
+
+size_t SlabAllocator::ClassSize(size_t sizeClass)
+{
+    if (sizeClass == 0) {
+        return MinSlot;
+    }
+
+    size_t k = 6 + (sizeClass - 1) / 4;
+    size_t sub = (sizeClass - 1) % 4 + 1;
+    return ((size_t)1 << k) + sub * ((size_t)1 << (k - 2));
+}
+
+size_t SlabAllocator::SlotSize(size_t len)
+{
+    return len > MaxSlot ? len : ClassSize(ClassOf(len));
+}
+
+uint8_t* SlabAllocator::NewArena()
+{
+#if DB_CACHE_HUGE_PAGES
+    // twice the size, then trimmed down to an aligned arena
+    size_t span = 2 * ArenaSize;
+    void* mapped = mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (mapped == MAP_FAILED) {
+        return nullptr;
+    }
+    uint8_t* start = (uint8_t*)mapped;
+    uint8_t* memory = (uint8_t*)(((uintptr_t)start + ArenaSize - 1) & ~(uintptr_t)(ArenaSize - 1));
+    if (memory > start) {
+        munmap(start, memory - start);
+    }
+    if (start + span > memory + ArenaSize) {
+        munmap(memory + ArenaSize, start + span - (memory + ArenaSize));
+    }
+    madvise(memory, ArenaSize, MADV_HUGEPAGE);
+    return memory;
+#else
+    return (uint8_t*)::operator new[](ArenaSize, std::align_val_t{ArenaSize});
+#endif
+}
+
+void SlabAllocator::DeleteArena(uint8_t* memory)
+{
+#if DB_CACHE_HUGE_PAGES
+    munmap(memory, ArenaSize);
+#else
+    ::operator delete[](memory, std::align_val_t{ArenaSize});
+#endif
+}
+
+bool SlabAllocator::IsFull(const Arena& arena)
+{
+    return arena.free == nullptr && arena.next + arena.slotSize > arena.memory + ArenaSize;
+}
+
+void SlabAllocator::AddRoom(SizeClass& sizeClass, Arena& arena)
+{
+    arena.hasRoom = true;
+    arena.newer = nullptr;
+    arena.older = sizeClass.newest;
+    if (sizeClass.newest != nullptr) {
+        sizeClass.newest->newer = &arena;
+    }
+    sizeClass.newest = &arena;
+}
+
+void SlabAllocator::RemoveRoom(SizeClass& sizeClass, Arena& arena)
+{
+    if (arena.newer != nullptr) {
+        arena.newer->older = arena.older;
+    } else {
+        sizeClass.newest = arena.older;
+    }
+    if (arena.older != nullptr) {
+        arena.older->newer = arena.newer;
+    }
+    arena.hasRoom = false;
+    arena.newer = nullptr;
+    arena.older = nullptr;
+}
+
+SlabAllocator::Arena* SlabAllocator::TakeArena(size_t slotSize)
+{
+    Arena* arena;
+    if (!mEmpty.empty()) {
+        arena = mEmpty.back();
+        mEmpty.pop_back();
+    } else {
+        uint8_t* memory = NewArena();
+        if (memory == nullptr) {
+            return nullptr;
+        }
+        arena = &mArenas[(uintptr_t)memory];
+        arena->memory = memory;
+    }
+
+    arena->slotSize = slotSize;
+    arena->used = 0;
+    arena->free = nullptr;
+    arena->next = arena->memory;
+    return arena;
+}
+
+void SlabAllocator::GiveBack(Arena& arena)
+{
+    if (mEmpty.size() < EmptyArenas) {
+        mEmpty.push_back(&arena);
+        return;
+    }
+
+    uint8_t* memory = arena.memory;
+    mArenas.erase((uintptr_t)memory);
+    DeleteArena(memory);
+}
+
+uint8_t* SlabAllocator::Allocate(size_t len)
+{
+    if (len > MaxSlot) {
+        return new uint8_t[len];
+    }
+
+    SizeClass& sizeClass = mClasses[ClassOf(len)];
+    Arena* arena = sizeClass.newest;
+    if (arena == nullptr) {
+        arena = TakeArena(SlotSize(len));
+        if (arena == nullptr) {
+            return nullptr;
+        }
+        AddRoom(sizeClass, *arena);
+    }
+
+    uint8_t* slot;
+    if (arena->free != nullptr) {
+        slot = (uint8_t*)arena->free;
+        arena->free = arena->free->next;
+    } else {
+        slot = arena->next;
+        arena->next += arena->slotSize;
+    }
+    arena->used++;
+
+    // whatever is left of a full arena is too small for a slot, it's simply left behind
+    if (IsFull(*arena)) {
+        RemoveRoom(sizeClass, *arena);
+    }
+    return slot;
+}
+
+void SlabAllocator::Free(uint8_t* slot, size_t len)
+{
+    if (slot == nullptr) {
+        return;
+    }
+
+    if (len > MaxSlot) {
+        delete[] slot;
+        return;
+    }
+
+    auto it = mArenas.find((uintptr_t)slot & ~(uintptr_t)(ArenaSize - 1));
+    if (it == mArenas.end()) {
+        return;
+    }
+
+    Arena& arena = it->second;
+    SizeClass& sizeClass = mClasses[ClassOf(arena.slotSize)];
+    FreeSlot* freeSlot = (FreeSlot*)slot;
+    freeSlot->next = arena.free;
+    arena.free = freeSlot;
+    arena.used--;
+
+    if (arena.used == 0) {
+        if (arena.hasRoom) {
+            RemoveRoom(sizeClass, arena);
+        }
+        GiveBack(arena);
+    } else if (!arena.hasRoom) {
+        AddRoom(sizeClass, arena);
+    }
+}
+
+void SlabAllocator::Reset()
+{
+    for (const auto& arena : mArenas) {
+        DeleteArena(arena.second.memory);
+    }
+    mArenas.clear();
+    mEmpty.clear();
+
+    for (SizeClass& sizeClass : mClasses) {
+        sizeClass = SizeClass{};
+    }
+}
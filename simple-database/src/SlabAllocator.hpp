@@ -0,0 +1,114 @@
+#ifndef _SLABALLOCATOR_HPP_
+#define _SLABALLOCATOR_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <unordered_map>
+#include <vector>
+
+// back the arenas with transparent huge pages, native linux builds only
+#ifndef DB_CACHE_HUGE_PAGES
+#define DB_CACHE_HUGE_PAGES 0
+#endif
+#if DB_CACHE_HUGE_PAGES && (USE_FF || !defined(__linux__))
+#undef DB_CACHE_HUGE_PAGES
+#define DB_CACHE_HUGE_PAGES 0
+#endif
+
+/**
+ * SlabAllocator
+ * Hands out slots for cached records from a set of size classes, four per doubling from
+ * MinSlot up to MaxSlot so a slot is never more than a quarter bigger than asked for.
+ * Slots are carved from large arenas, each arena serving one class, and a freed slot goes back
+ * on its arena's free list, so churn never reaches the heap. Anything bigger than MaxSlot is
+ * allocated on its own.
+ *
+ * An arena whose slots have all been freed goes back to a pool shared by every class, so when
+ * the sizes of the records change the memory follows them. Beyond EmptyArenas the pool gives
+ * arenas back to the heap. Reset drops every arena at once.
+ * Not thread safe, every cache shard has its own.
+ */
+class SlabAllocator {
+    public:
+        static constexpr size_t MinSlot = 64;
+        static constexpr size_t MaxSlot = 64 * 1024;
+#if DB_CACHE_HUGE_PAGES
+        static constexpr size_t ArenaSize = 2 * 1024 * 1024;
+#else
+        static constexpr size_t ArenaSize = 64 * 1024;
+#endif
+        // empty arenas kept for whichever class needs one next
+        static constexpr size_t EmptyArenas = 4;
+
+        SlabAllocator() = default;
+        ~SlabAllocator();
+
+        /**
+         * SlotSize - Bytes an allocation of `len` really takes
+         */
+        static size_t SlotSize(size_t len);
+
+        uint8_t* Allocate(size_t len);
+
+        /**
+         * Free - Give back a slot, `len` is what it was allocated with
+         */
+        void Free(uint8_t* slot, size_t len);
+
+        /**
+         * Reset - Drop every arena, every slot handed out so far is gone with them
+         * Allocations bigger than MaxSlot must be freed first
+         */
+        void Reset();
+
+        // every arena held, the empty ones in the pool included
+        size_t ArenaBytes() const { return mArenas.size() * ArenaSize; }
+
+    private:
+        SlabAllocator(const SlabAllocator&) = delete;
+        SlabAllocator& operator=(const SlabAllocator&) = delete;
+
+        static constexpr size_t ClassCount = 41;
+
+        struct FreeSlot {
+            FreeSlot* next;
+        };
+
+        // arenas are aligned to their size, so a slot's arena is found from its address
+        struct Arena {
+            uint8_t* memory;
+            size_t slotSize = 0;
+            // slots handed out and not freed yet
+            size_t used = 0;
+            FreeSlot* free = nullptr;
+            // the part not carved up yet
+            uint8_t* next = nullptr;
+            // on its class's list while it has room for a slot
+            Arena* newer = nullptr;
+            Arena* older = nullptr;
+            bool hasRoom = false;
+        };
+
+        struct SizeClass {
+            // arenas of the class with room for a slot, allocations come from the newest
+            Arena* newest = nullptr;
+        };
+
+        static size_t ClassOf(size_t len);
+        static size_t ClassSize(size_t sizeClass);
+        static uint8_t* NewArena();
+        static void DeleteArena(uint8_t* memory);
+        static bool IsFull(const Arena& arena);
+        // an empty one from the pool, or a new one
+        Arena* TakeArena(size_t slotSize);
+        void GiveBack(Arena& arena);
+        void AddRoom(SizeClass& sizeClass, Arena& arena);
+        void RemoveRoom(SizeClass& sizeClass, Arena& arena);
+
+        SizeClass mClasses[ClassCount];
+        // keyed by where each arena starts, nodes never move
+        std::unordered_map<uintptr_t, Arena> mArenas;
+        std::vector<Arena*> mEmpty;
+};
+
+#endif //_SLABALLOCATOR_HPP_
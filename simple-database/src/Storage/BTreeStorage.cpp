@@ -0,0 +1,558 @@
+#include "BTreeStorage.hpp"
+#include "crc.h"
+#include "logging.hpp"
+
+// deeper than this and the tree has a cycle in it
+static const int MaxTreeDepth = 32;
+
+BTreeStorage::BTreeTable* BTreeStorage::OpenTree(const char* tablePath, bool create)
+{
+    auto it = mTables.find(tablePath);
+    if (it != mTables.end()) {
+        return &it->second;
+    }
+
+    StoragePath treePath = JoinPath(tablePath, TreeFileName);
+    bool exists = DirectoryWrapper::Exists(treePath);
+    if (!exists && (!create || !DirectoryWrapper::Exists(tablePath))) {
+        return nullptr;
+    }
+
+    BTreeTable table;
+    table.file = std::make_unique<FileWrapper>(treePath, exists ? "r+b" : "w+b");
+    if (!table.file->DidOpen()) {
+        LOG("Error opening table tree at path:");
+        LOG(treePath);
+        return nullptr;
+    }
+
+    if (exists) {
+        if (!table.file->ReadAt(0, &table.header, sizeof(table.header)) ||
+            table.header.magic != Magic ||
+            table.header.pageSize != PageSize) {
+            LOG("Table tree has a bad header:");
+            LOG(treePath);
+            return nullptr;
+        }
+    } else {
+        table.header = {Magic, PageSize, 1, 2, 0, 0};
+
+        Page root(PageSize, 0);
+        Header(root)->leaf = 1;
+
+        if (!WriteHeader(table) || !WritePage(table, table.header.root, root) || !table.file->Flush()) {
+            return nullptr;
+        }
+    }
+
+    return &(mTables[tablePath] = std::move(table));
+}
+
+bool BTreeStorage::ReadPage(BTreeTable& table, uint32_t pageNo, Page& page)
+{
+    page.resize(PageSize);
+    if (pageNo == 0 || pageNo >= table.header.pageCount) {
+        LOG("Table tree page out of range");
+        return false;
+    }
+    return table.file->ReadAt(pageNo * PageSize, page.data(), PageSize);
+}
+
+bool BTreeStorage::WritePage(BTreeTable& table, uint32_t pageNo, const Page& page)
+{
+    return table.file->Seek(pageNo * PageSize) && table.file->Write(page.data(), PageSize);
+}
+
+bool BTreeStorage::WriteHeader(BTreeTable& table)
+{
+    if (!table.file->Seek(0) || !table.file->Write(&table.header, sizeof(table.header))) {
+        return false;
+    }
+
+    // keep the first page full size so the next page lands on its boundary
+    if (table.file->Size() < PageSize) {
+        uint8_t zero[PageSize - sizeof(FileHeader)] = {0};
+        return table.file->Write(zero, sizeof(zero));
+    }
+
+    return true;
+}
+
+uint32_t BTreeStorage::AllocatePage(BTreeTable& table)
+{
+    uint32_t pageNo;
+    if (table.header.freeList != 0) {
+        pageNo = table.header.freeList;
+        Page page;
+        if (!ReadPage(table, pageNo, page)) {
+            return 0;
+        }
+        memcpy(&table.header.freeList, page.data(), sizeof(uint32_t));
+    } else {
+        pageNo = table.header.pageCount++;
+    }
+
+    return WriteHeader(table) ? pageNo : 0;
+}
+
+void BTreeStorage::FreePage(BTreeTable& table, uint32_t pageNo)
+{
+    Page page(PageSize, 0);
+    memcpy(page.data(), &table.header.freeList, sizeof(uint32_t));
+    if (!WritePage(table, pageNo, page)) {
+        // leaking the page is better than corrupting the free list
+        return;
+    }
+    table.header.freeList = pageNo;
+    WriteHeader(table);
+}
+
+uint32_t BTreeStorage::WriteOverflow(BTreeTable& table, const uint8_t* data, uint32_t len)
+{
+    uint32_t first = AllocatePage(table);
+    uint32_t pageNo = first;
+    Page page(PageSize, 0);
+
+    while (pageNo != 0) {
+        uint32_t chunk = MIN(len, OverflowCapacity);
+        uint32_t next = len > chunk ? AllocatePage(table) : 0;
+        if (len > chunk && next == 0) {
+            return 0;
+        }
+
+        memcpy(page.data(), &next, sizeof(next));
+        memcpy(page.data() + sizeof(next), data, chunk);
+        if (!WritePage(table, pageNo, page)) {
+            return 0;
+        }
+
+        data += chunk;
+        len -= chunk;
+        pageNo = next;
+    }
+
+    return first;
+}
+
+bool BTreeStorage::ReadOverflow(BTreeTable& table, uint32_t pageNo, uint8_t* data, uint32_t len)
+{
+    Page page;
+    while (len > 0) {
+        if (!ReadPage(table, pageNo, page)) {
+            return false;
+        }
+
+        uint32_t chunk = MIN(len, OverflowCapacity);
+        memcpy(data, page.data() + sizeof(uint32_t), chunk);
+        memcpy(&pageNo, page.data(), sizeof(pageNo));
+
+        data += chunk;
+        len -= chunk;
+    }
+
+    return true;
+}
+
+void BTreeStorage::FreeOverflow(BTreeTable& table, uint32_t pageNo)
+{
+    Page page;
+    while (pageNo != 0 && ReadPage(table, pageNo, page)) {
+        uint32_t next;
+        memcpy(&next, page.data(), sizeof(next));
+        FreePage(table, pageNo);
+        pageNo = next;
+    }
+}
+
+uint32_t BTreeStorage::ChildFor(Page& page, ObjId id, uint32_t& idx)
+{
+    // number of separators <= id, child idx holds everything from separator idx - 1 up
+    Branch* branches = Branches(page);
+    uint32_t lo = 0;
+    uint32_t hi = Header(page)->count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (branches[mid].key <= id) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+
+    idx = lo;
+    return idx == 0 ? FirstChild(page) : branches[idx - 1].child;
+}
+
+bool BTreeStorage::FindLeaf(BTreeTable& table, ObjId id, Page& leaf, uint32_t& pageNo)
+{
+    pageNo = table.header.root;
+    for (int depth = 0; depth < MaxTreeDepth; depth++) {
+        if (!ReadPage(table, pageNo, leaf)) {
+            return false;
+        }
+
+        if (Header(leaf)->leaf) {
+            return true;
+        }
+
+        uint32_t idx;
+        pageNo = ChildFor(leaf, id, idx);
+    }
+
+    LOG("Table tree is too deep");
+    return false;
+}
+
+bool BTreeStorage::FindCell(const Page& leaf, ObjId id, uint32_t& offset)
+{
+    const NodeHeader* header = Header(leaf);
+    offset = sizeof(NodeHeader);
+    for (uint16_t i = 0; i < header->count; i++) {
+        LeafCell cell;
+        memcpy(&cell, leaf.data() + offset, sizeof(cell));
+        if (cell.id == id) {
+            return true;
+        }
+        if (cell.id > id) {
+            return false;
+        }
+        offset += CellSize(cell);
+    }
+
+    return false;
+}
+
+bool BTreeStorage::Insert(BTreeTable& table, uint32_t pageNo, const LeafCell& cell, const uint8_t* inlineData, Split& split)
+{
+    Page page;
+    for (int depth = 0; depth < MaxTreeDepth; depth++) {
+        if (!ReadPage(table, pageNo, page)) {
+            return false;
+        }
+
+        if (Header(page)->leaf) {
+            return InsertIntoLeaf(table, pageNo, page, cell, inlineData, split);
+        }
+
+        uint32_t idx;
+        Split childSplit;
+        if (!Insert(table, ChildFor(page, cell.id, idx), cell, inlineData, childSplit)) {
+            return false;
+        }
+
+        if (!childSplit.happened) {
+            return true;
+        }
+
+        return InsertIntoBranch(table, pageNo, page, idx, childSplit, split);
+    }
+
+    return false;
+}
+
+bool BTreeStorage::InsertIntoLeaf(BTreeTable& table, uint32_t pageNo, Page& leaf, const LeafCell& cell, const uint8_t* inlineData, Split& split)
+{
+    NodeHeader* header = Header(leaf);
+    uint8_t* cells = leaf.data() + sizeof(NodeHeader);
+
+    uint32_t pos;
+    if (FindCell(leaf, cell.id, pos)) {
+        // replacing a record, drop the old version first
+        LeafCell existing;
+        memcpy(&existing, leaf.data() + pos, sizeof(existing));
+        if (existing.overflow) {
+            FreeOverflow(table, existing.overflow);
+        }
+
+        uint32_t existingSize = CellSize(existing);
+        uint8_t* at = leaf.data() + pos;
+        memmove(at, at + existingSize, header->used - (pos - sizeof(NodeHeader)) - existingSize);
+        header->used -= existingSize;
+        header->count--;
+    }
+    pos -= sizeof(NodeHeader);
+
+    uint32_t cellSize = CellSize(cell);
+    if (header->used + cellSize <= LeafCapacity) {
+        memmove(cells + pos + cellSize, cells + pos, header->used - pos);
+        memcpy(cells + pos, &cell, sizeof(cell));
+        if (!cell.overflow) {
+            memcpy(cells + pos + sizeof(cell), inlineData, cell.length);
+        }
+        header->used += cellSize;
+        header->count++;
+        return WritePage(table, pageNo, leaf);
+    }
+
+    // Not enough room, lay every cell out in order then split them roughly in half by size
+    std::vector<uint8_t> all(header->used + cellSize);
+    memcpy(all.data(), cells, pos);
+    memcpy(all.data() + pos, &cell, sizeof(cell));
+    if (!cell.overflow) {
+        memcpy(all.data() + pos + sizeof(cell), inlineData, cell.length);
+    }
+    memcpy(all.data() + pos + cellSize, cells + pos, header->used - pos);
+
+    uint32_t total = all.size();
+    uint16_t totalCount = header->count + 1;
+    uint32_t leftBytes = 0;
+    uint16_t leftCount = 0;
+    while (leftBytes < total / 2 && leftCount < totalCount - 1) {
+        LeafCell c;
+        memcpy(&c, all.data() + leftBytes, sizeof(c));
+        leftBytes += CellSize(c);
+        leftCount++;
+    }
+
+    uint32_t rightPageNo = AllocatePage(table);
+    if (rightPageNo == 0) {
+        return false;
+    }
+
+    Page right(PageSize, 0);
+    NodeHeader* rightHeader = Header(right);
+    rightHeader->leaf = 1;
+    rightHeader->count = totalCount - leftCount;
+    rightHeader->used = total - leftBytes;
+    rightHeader->next = header->next;
+    memcpy(right.data() + sizeof(NodeHeader), all.data() + leftBytes, total - leftBytes);
+
+    header->count = leftCount;
+    header->used = leftBytes;
+    header->next = rightPageNo;
+    memset(cells, 0, LeafCapacity);
+    memcpy(cells, all.data(), leftBytes);
+
+    LeafCell firstRight;
+    memcpy(&firstRight, all.data() + leftBytes, sizeof(firstRight));
+    split = {true, firstRight.id, rightPageNo};
+
+    return WritePage(table, rightPageNo, right) && WritePage(table, pageNo, leaf);
+}
+
+bool BTreeStorage::InsertIntoBranch(BTreeTable& table, uint32_t pageNo, Page& node, uint32_t idx, const Split& childSplit, Split& split)
+{
+    NodeHeader* header = Header(node);
+    Branch* branches = Branches(node);
+    Branch added = {childSplit.key, childSplit.page, 0};
+
+    if (header->count < BranchCapacity) {
+        memmove(branches + idx + 1, branches + idx, (header->count - idx) * sizeof(Branch));
+        branches[idx] = added;
+        header->count++;
+        return WritePage(table, pageNo, node);
+    }
+
+    std::vector<Branch> all(branches, branches + header->count);
+    all.insert(all.begin() + idx, added);
+
+    // the middle separator moves up, its child becomes the first child on the right
+    uint32_t mid = all.size() / 2;
+
+    uint32_t rightPageNo = AllocatePage(table);
+    if (rightPageNo == 0) {
+        return false;
+    }
+
+    Page right(PageSize, 0);
+    Header(right)->count = all.size() - mid - 1;
+    FirstChild(right) = all[mid].child;
+    memcpy(Branches(right), all.data() + mid + 1, Header(right)->count * sizeof(Branch));
+
+    header->count = mid;
+    memset(branches, 0, BranchCapacity * sizeof(Branch));
+    memcpy(branches, all.data(), mid * sizeof(Branch));
+
+    split = {true, all[mid].key, rightPageNo};
+
+    return WritePage(table, rightPageNo, right) && WritePage(table, pageNo, node);
+}
+
+bool BTreeStorage::SeekFrom(BTreeTable& table, ObjId from, ObjId& id)
+{
+    Page leaf;
+    uint32_t pageNo;
+    if (!FindLeaf(table, from, leaf, pageNo)) {
+        return false;
+    }
+
+    // empty leaves are never merged away, so keep walking right until something turns up
+    while (true) {
+        const NodeHeader* header = Header(leaf);
+        uint32_t offset = sizeof(NodeHeader);
+        for (uint16_t i = 0; i < header->count; i++) {
+            LeafCell cell;
+            memcpy(&cell, leaf.data() + offset, sizeof(cell));
+            if (cell.id >= from) {
+                id = cell.id;
+                return true;
+            }
+            offset += CellSize(cell);
+        }
+
+        if (header->next == 0 || !ReadPage(table, header->next, leaf)) {
+            return false;
+        }
+    }
+}
+
+uint32_t BTreeStorage::Read(const char* tablePath, ObjId id, void* data)
+{
+    BTreeTable* table = OpenTree(tablePath, false);
+    if (table == nullptr) {
+        return 0;
+    }
+
+    Page leaf;
+    uint32_t pageNo;
+    uint32_t offset;
+    if (!FindLeaf(*table, id, leaf, pageNo) || !FindCell(leaf, id, offset)) {
+        return 0;
+    }
+
+    LeafCell cell;
+    memcpy(&cell, leaf.data() + offset, sizeof(cell));
+    if (cell.overflow) {
+        if (!ReadOverflow(*table, cell.overflow, (uint8_t*)data, cell.length)) {
+            return 0;
+        }
+    } else {
+        memcpy(data, leaf.data() + offset + sizeof(cell), cell.length);
+    }
+
+    if (cell.crc != crc32(data, cell.length - sizeof(ObjId))) {
+        LOG("CRC MISMATCH!");
+        LOG(tablePath);
+        return 0;
+    }
+
+    return cell.length;
+}
+
+bool BTreeStorage::Exists(const char* tablePath, ObjId id)
+{
+    BTreeTable* table = OpenTree(tablePath, false);
+    if (table == nullptr) {
+        return false;
+    }
+
+    Page leaf;
+    uint32_t pageNo;
+    uint32_t offset;
+    return FindLeaf(*table, id, leaf, pageNo) && FindCell(leaf, id, offset);
+}
+
+bool BTreeStorage::Write(const char* tablePath, ObjId id, const void* data, uint32_t len, uint32_t crc)
+{
+    BTreeTable* table = OpenTree(tablePath, true);
+    if (table == nullptr) {
+        return false;
+    }
+
+    LeafCell cell = {id, len, crc, 0, 0};
+    if (len > MaxInlineLength) {
+        cell.overflow = WriteOverflow(*table, (const uint8_t*)data, len);
+        if (cell.overflow == 0) {
+            return false;
+        }
+    }
+
+    Split split;
+    if (!Insert(*table, table->header.root, cell, (const uint8_t*)data, split)) {
+        return false;
+    }
+
+    if (split.happened) {
+        uint32_t rootPageNo = AllocatePage(*table);
+        if (rootPageNo == 0) {
+            return false;
+        }
+
+        Page root(PageSize, 0);
+        Header(root)->count = 1;
+        FirstChild(root) = table->header.root;
+        Branches(root)[0] = {split.key, split.page, 0};
+
+        if (!WritePage(*table, rootPageNo, root)) {
+            return false;
+        }
+
+        table->header.root = rootPageNo;
+        if (!WriteHeader(*table)) {
+            return false;
+        }
+    }
+
+    return table->file->Flush();
+}
+
+bool BTreeStorage::Remove(const char* tablePath, ObjId id)
+{
+    BTreeTable* table = OpenTree(tablePath, false);
+    if (table == nullptr) {
+        return false;
+    }
+
+    Page leaf;
+    uint32_t pageNo;
+    uint32_t offset;
+    if (!FindLeaf(*table, id, leaf, pageNo) || !FindCell(leaf, id, offset)) {
+        return false;
+    }
+
+    LeafCell cell;
+    memcpy(&cell, leaf.data() + offset, sizeof(cell));
+    if (cell.overflow) {
+        FreeOverflow(*table, cell.overflow);
+    }
+
+    NodeHeader* header = Header(leaf);
+    uint32_t cellSize = CellSize(cell);
+    uint32_t tail = sizeof(NodeHeader) + header->used - offset - cellSize;
+    memmove(leaf.data() + offset, leaf.data() + offset + cellSize, tail);
+    memset(leaf.data() + offset + tail, 0, cellSize);
+    header->used -= cellSize;
+    header->count--;
+
+    return WritePage(*table, pageNo, leaf) && table->file->Flush();
+}
+
+bool BTreeStorage::Open(const char* tablePath, TableCursor& cursor)
+{
+    cursor.Reset(tablePath, DirectoryWrapper::Exists(tablePath));
+    return cursor.DidOpen();
+}
+
+bool BTreeStorage::Next(TableCursor& cursor, ObjId& id)
+{
+    BTreeTable* table = OpenTree(cursor.TablePath(), false);
+    if (table == nullptr) {
+        return false;
+    }
+
+    ObjId from = cursor.First();
+    if (cursor.Started()) {
+        if (cursor.Position() == UINT64_MAX) {
+            return false;
+        }
+        from = cursor.Position() + 1;
+    }
+
+    if (!SeekFrom(*table, from, id) || id > cursor.Last()) {
+        return false;
+    }
+
+    cursor.Advance(id);
+    return true;
+}
+
+void BTreeStorage::Close(const char* pathPrefix)
+{
+    for (auto it = mTables.begin(); it != mTables.end();) {
+        if (PathHasPrefix(it->first.c_str(), pathPrefix)) {
+            it = mTables.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,119 @@
+#ifndef _BTREESTORAGE_HPP_
+#define _BTREESTORAGE_HPP_
+
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "StorageEngine.hpp"
+#include "FileWrapper.hpp"
+
+/**
+ * BTreeStorage
+ * Every table is a single B+tree file of fixed size pages, <table>/records.btree, keyed on id
+ *
+ * Page 0 holds the file header, every other page is a node, an overflow page or free.
+ * Leaves hold the records themselves, small records inline and larger ones in a chain of
+ * overflow pages hanging off the leaf cell. Leaves are linked left to right so scans walk
+ * the leaf level in id order, and a scan can be resumed from any id with a single descent.
+ *
+ * Pages are not merged when records are deleted, freed overflow pages are reused.
+ */
+class BTreeStorage : public StorageEngine {
+    public:
+        static constexpr const char* TreeFileName = "records.btree";
+        static const uint32_t PageSize = 4096;
+
+        uint32_t Read(const char* tablePath, ObjId id, void* data) override;
+        bool Exists(const char* tablePath, ObjId id) override;
+        bool Write(const char* tablePath, ObjId id, const void* data, uint32_t len, uint32_t crc) override;
+        bool Remove(const char* tablePath, ObjId id) override;
+
+        bool Open(const char* tablePath, TableCursor& cursor) override;
+        bool Next(TableCursor& cursor, ObjId& id) override;
+
+        void Close(const char* pathPrefix) override;
+
+    private:
+        using Page = std::vector<uint8_t>;
+
+        struct FileHeader {
+            uint32_t magic;
+            uint32_t pageSize;
+            uint32_t root;
+            uint32_t pageCount;
+            uint32_t freeList;
+            uint32_t reserved;
+        };
+
+        struct NodeHeader {
+            uint8_t leaf;
+            uint8_t reserved;
+            uint16_t count;
+            uint32_t next;  // right sibling for leaves
+            uint32_t used;  // bytes of cells in a leaf
+        };
+
+        // leaf cell, followed by `length` bytes unless the record lives in overflow pages
+        struct LeafCell {
+            ObjId id;
+            uint32_t length;
+            uint32_t crc;
+            uint32_t overflow;
+            uint32_t reserved;
+        };
+
+        // internal nodes are child0 followed by `count` of these
+        struct Branch {
+            ObjId key;
+            uint32_t child;
+            uint32_t reserved;
+        };
+
+        struct Split {
+            bool happened = false;
+            ObjId key = 0;
+            uint32_t page = 0;
+        };
+
+        struct BTreeTable {
+            std::unique_ptr<FileWrapper> file;
+            FileHeader header;
+        };
+
+        static const uint32_t Magic = 0x45525442; // "BTRE"
+        static const uint32_t LeafCapacity = PageSize - sizeof(NodeHeader);
+        static const uint32_t BranchCapacity = (PageSize - sizeof(NodeHeader) - sizeof(uint32_t)) / sizeof(Branch);
+        static const uint32_t MaxInlineLength = LeafCapacity / 4 - sizeof(LeafCell);
+        static const uint32_t OverflowCapacity = PageSize - sizeof(uint32_t);
+
+        BTreeTable* OpenTree(const char* tablePath, bool create);
+
+        bool ReadPage(BTreeTable& table, uint32_t pageNo, Page& page);
+        bool WritePage(BTreeTable& table, uint32_t pageNo, const Page& page);
+        bool WriteHeader(BTreeTable& table);
+        uint32_t AllocatePage(BTreeTable& table);
+        void FreePage(BTreeTable& table, uint32_t pageNo);
+
+        uint32_t WriteOverflow(BTreeTable& table, const uint8_t* data, uint32_t len);
+        bool ReadOverflow(BTreeTable& table, uint32_t pageNo, uint8_t* data, uint32_t len);
+        void FreeOverflow(BTreeTable& table, uint32_t pageNo);
+
+        bool FindLeaf(BTreeTable& table, ObjId id, Page& leaf, uint32_t& pageNo);
+        bool FindCell(const Page& leaf, ObjId id, uint32_t& offset);
+        bool Insert(BTreeTable& table, uint32_t pageNo, const LeafCell& cell, const uint8_t* inlineData, Split& split);
+        bool InsertIntoLeaf(BTreeTable& table, uint32_t pageNo, Page& leaf, const LeafCell& cell, const uint8_t* inlineData, Split& split);
+        bool InsertIntoBranch(BTreeTable& table, uint32_t pageNo, Page& node, uint32_t idx, const Split& childSplit, Split& split);
+        bool SeekFrom(BTreeTable& table, ObjId from, ObjId& id);
+
+        static NodeHeader* Header(Page& page) { return (NodeHeader*)page.data(); }
+        static const NodeHeader* Header(const Page& page) { return (const NodeHeader*)page.data(); }
+        static uint32_t CellSize(const LeafCell& cell) { return sizeof(LeafCell) + (cell.overflow ? 0 : cell.length); }
+        static uint32_t& FirstChild(Page& page) { return *(uint32_t*)(page.data() + sizeof(NodeHeader)); }
+        static Branch* Branches(Page& page) { return (Branch*)(page.data() + sizeof(NodeHeader) + sizeof(uint32_t)); }
+        static uint32_t ChildFor(Page& page, ObjId id, uint32_t& idx);
+
+        std::unordered_map<std::string, BTreeTable> mTables;
+};
+
+#endif //_BTREESTORAGE_HPP_
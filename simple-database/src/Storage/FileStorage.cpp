@@ -0,0 +1,291 @@
+#include "FileStorage.hpp"
+#include "DbDriver.hpp"
+#include <string>
+#include <vector>
+
+StoragePath FileStorage::RecordPath(const char* tablePath, ObjId id)
+{
+    return JoinPath(tablePath, DbDriver::IdToFileName(id));
+}
+
+StoragePath FileStorage::FanOutPath(const char* tablePath, ObjId id)
+{
+    auto name = DbDriver::IdToFileName(id);
+    char first[3] = {name[0], name[1], '\0'};
+    char second[3] = {name[2], name[3], '\0'};
+    return JoinPath(JoinPath(JoinPath(tablePath, first), second), name);
+}
+
+StoragePath FileStorage::PathFor(const char* tablePath, ObjId id) const
+{
+    return mFanOut ? FanOutPath(tablePath, id) : RecordPath(tablePath, id);
+}
+
+bool FileStorage::MakeFanOutDirs(const char* tablePath, ObjId id)
+{
+    StoragePath dir = FanOutPath(tablePath, id);
+    *strrchr((char*)dir, '/') = '\0';
+    if (DirectoryWrapper::Exists(dir)) {
+        return true;
+    }
+
+    StoragePath parent = dir;
+    *strrchr((char*)parent, '/') = '\0';
+    DirectoryWrapper::New(parent);
+    DirectoryWrapper::New(dir);
+    return DirectoryWrapper::Exists(dir);
+}
+
+bool FileStorage::IsFanOutDir(const char* name)
+{
+    return strlen(name) == 2 && isxdigit(name[0]) && isxdigit(name[1]); // NOLINT
+}
+
+uint32_t FileStorage::Read(const char* tablePath, ObjId id, void* data)
+{
+    StoragePath recordPath = PathFor(tablePath, id);
+    FileWrapper f(recordPath);
+
+    if (!f.DidOpen()) {
+        return 0;
+    }
+
+    // Read entire file
+    uint32_t crc = 0;
+
+    if (f.Size() < sizeof(crc) + sizeof(ObjId)) {
+        LOG("ERROR: File at path");
+        LOG(recordPath);
+        LOG("has no CRC");
+        LOG("File length:");
+        logging::Print(f.Size());
+        return 0;
+    }
+
+    uint32_t len = f.Size() - sizeof(crc);
+
+    if (!f.Read(data, len)) {
+        return 0;
+    }
+
+    if (!f.Read(&crc, sizeof(crc))) {
+        return 0;
+    }
+
+    bool crcMatches = crc == crc32(data, len - sizeof(ObjId));
+
+    if (!crcMatches) {
+        LOG("CRC MISMATCH!");
+        LOG(recordPath);
+        return 0;
+    }
+
+    return len;
+}
+
+void FileStorage::ReadMany(const char* tablePath, const ObjId* ids, size_t count, uint8_t* data, uint32_t stride, uint32_t* lens)
+{
+    if (!ReadQueue::Concurrent()) {
+        StorageEngine::ReadMany(tablePath, ids, count, data, stride, lens);
+        return;
+    }
+
+    std::vector<std::string> paths(count);
+    std::vector<ReadQueue::Request> requests(count);
+    for (size_t i = 0; i < count; i++) {
+        paths[i] = PathFor(tablePath, ids[i]).data();
+        requests[i] = {paths[i].c_str(), data + i * stride, stride, -1};
+    }
+
+    mReads.Read(requests.data(), count);
+
+    // the crcs are checked back on this thread once every read is in
+    uint32_t crc = 0;
+    for (size_t i = 0; i < count; i++) {
+        lens[i] = 0;
+        int64_t fileLen = requests[i].result;
+        if (fileLen < 0) {
+            continue;
+        }
+
+        if ((size_t)fileLen < sizeof(crc) + sizeof(ObjId)) {
+            LOG("ERROR: File at path");
+            LOG(paths[i].c_str());
+            LOG("has no CRC");
+            continue;
+        }
+
+        uint32_t len = fileLen - sizeof(crc);
+        uint8_t* record = data + i * stride;
+        memcpy(&crc, record + len, sizeof(crc));
+        if (crc != crc32(record, len - sizeof(ObjId))) {
+            LOG("CRC MISMATCH!");
+            LOG(paths[i].c_str());
+            continue;
+        }
+
+        lens[i] = len;
+    }
+}
+
+bool FileStorage::Exists(const char* tablePath, ObjId id)
+{
+    return DirectoryWrapper::Exists(PathFor(tablePath, id));
+}
+
+bool FileStorage::Write(const char* tablePath, ObjId id, const void* data, uint32_t len, uint32_t crc)
+{
+    if (mFanOut && !MakeFanOutDirs(tablePath, id)) {
+        LOG("Error creating db object directories in table:");
+        LOG(tablePath);
+        return false;
+    }
+
+    StoragePath recordPath = PathFor(tablePath, id);
+    FileWrapper f(recordPath, "w");
+
+    if (!f.DidOpen()) {
+        LOG("Error creating db object file at path:");
+        LOG(recordPath);
+        return false;
+    }
+
+    LOG("Opened file at path:");
+    LOG(recordPath);
+
+    if (!f.Write(data, len)) {
+        LOG("Error writing new db object at path:");
+        LOG(recordPath);
+        return false;
+    }
+
+    return f.Write(&crc, sizeof(crc));
+}
+
+bool FileStorage::Remove(const char* tablePath, ObjId id)
+{
+    return DirectoryWrapper::Delete(PathFor(tablePath, id));
+}
+
+bool FileStorage::Open(const char* tablePath, TableCursor& cursor)
+{
+    bool didOpen = cursor.Directory().Open(tablePath);
+    cursor.Reset(tablePath, didOpen);
+    return didOpen;
+}
+
+bool FileStorage::Next(TableCursor& cursor, ObjId& id)
+{
+    StoragePath p;
+    while(true) {
+        bool isDir;
+        size_t depth = cursor.Depth();
+        if (!cursor.Directory(depth).NextPath(p, isDir)) {
+            if (depth == 0) {
+                return false;
+            }
+
+            // done with this subdirectory, carry on with its parent
+            cursor.Directory(depth).Close();
+            cursor.Depth(depth - 1);
+            continue;
+        }
+
+        const char* name = strrchr((const char*)p, '/');
+        name = name ? name + 1 : (const char*)p;
+
+        if (depth < LeafDepth()) {
+            if (isDir && IsFanOutDir(name) && cursor.Directory(depth + 1).Open(p)) {
+                cursor.Depth(depth + 1);
+            }
+            continue;
+        }
+
+        if (isDir) continue;
+
+        if (!DbDriver::FileNameToId(name, id)) {
+            LOG("Skipping non record file:");
+            LOG(p);
+            continue;
+        }
+
+        // directory order has nothing to do with ids, so a range is just a filter here
+        if (!cursor.InRange(id)) {
+            continue;
+        }
+
+        cursor.Advance(id);
+        return true;
+    }
+}
+
+void FileStorage::CollectIds(const char* dirPath, size_t depth, std::vector<ObjId>& ids) const
+{
+    // walks the directories itself, a TableCursor's layout isn't safe to rely on here on FF builds
+    DirectoryWrapper dir(dirPath);
+    StoragePath p;
+    bool isDir;
+    while (dir.NextPath(p, isDir)) {
+        const char* name = strrchr((const char*)p, '/');
+        name = name ? name + 1 : (const char*)p;
+
+        ObjId id;
+        if (depth < LeafDepth()) {
+            if (isDir && IsFanOutDir(name)) {
+                CollectIds(p, depth + 1, ids);
+            }
+        } else if (!isDir && DbDriver::FileNameToId(name, id)) {
+            ids.push_back(id);
+        }
+    }
+}
+
+bool FileStorage::Migrate(const char* tablePath)
+{
+    FileStorage from(!mFanOut);
+    if (!DirectoryWrapper::Exists(tablePath)) {
+        return false;
+    }
+
+    std::vector<ObjId> ids;
+    from.CollectIds(tablePath, 0, ids);
+
+    bool somethingFailed = false;
+    for (ObjId id : ids) {
+        if (mFanOut && !MakeFanOutDirs(tablePath, id)) {
+            somethingFailed = true;
+            continue;
+        }
+
+        if (!DirectoryWrapper::Rename(from.PathFor(tablePath, id), PathFor(tablePath, id))) {
+            LOG("Error moving db object file in table:");
+            LOG(tablePath);
+            somethingFailed = true;
+        }
+    }
+
+    if (mFanOut || somethingFailed) {
+        return !somethingFailed;
+    }
+
+    // back to flat, the fan out directories are all empty now
+    std::vector<std::string> dirs;
+    {
+        DirectoryWrapper dir(tablePath);
+        StoragePath p;
+        bool isDir;
+        while (dir.NextPath(p, isDir)) {
+            const char* name = strrchr((const char*)p, '/');
+            name = name ? name + 1 : (const char*)p;
+            if (isDir && IsFanOutDir(name)) {
+                dirs.push_back((const char*)p);
+            }
+        }
+    }
+
+    for (const std::string& dir : dirs) {
+        DirectoryWrapper::Delete(dir.c_str());
+    }
+
+    return true;
+}
@@ -0,0 +1,60 @@
+#ifndef _FILESTORAGE_HPP_
+#define _FILESTORAGE_HPP_
+
+#include <vector>
+#include "StorageEngine.hpp"
+#include "ReadQueue.hpp"
+
+/**
+ * FileStorage
+ * The original layout, every record is its own file named after the hex encoded id
+ * <table>/<hex id> = body | commit id | crc
+ *
+ * With fan out the files are spread over two levels of subdirectories named after the
+ * first two bytes of the file name, <table>/<hex[0..1]>/<hex[2..3]>/<hex id>. Those are
+ * the low bytes of the id, so consecutive ids land in different directories and no
+ * directory holds more than a few hundred entries until a table is well past a million rows.
+ *
+ * ReadMany has every file of the group open & read at once through a ReadQueue.
+ */
+class FileStorage : public StorageEngine {
+    public:
+        explicit FileStorage(bool fanOut = false) : mFanOut(fanOut) {}
+
+        uint32_t Read(const char* tablePath, ObjId id, void* data) override;
+        void ReadMany(const char* tablePath, const ObjId* ids, size_t count, uint8_t* data, uint32_t stride, uint32_t* lens) override;
+        bool Exists(const char* tablePath, ObjId id) override;
+        bool Write(const char* tablePath, ObjId id, const void* data, uint32_t len, uint32_t crc) override;
+        bool Remove(const char* tablePath, ObjId id) override;
+
+        bool Open(const char* tablePath, TableCursor& cursor) override;
+        bool Next(TableCursor& cursor, ObjId& id) override;
+
+        void Close(const char* pathPrefix) override { (void)pathPrefix; }
+
+        /**
+         * Migrate - Move every record of a table laid out the other way into this layout
+         * Each record is moved with a single rename, so it is safe to run again after a crash
+         * @return false if any record couldn't be moved
+         */
+        bool Migrate(const char* tablePath);
+
+        /**
+         * RecordPath - Where the flat layout keeps a record
+         */
+        static StoragePath RecordPath(const char* tablePath, ObjId id);
+        static StoragePath FanOutPath(const char* tablePath, ObjId id);
+
+    private:
+        // depth of the directories holding the record files
+        size_t LeafDepth() const { return mFanOut ? 2 : 0; }
+        StoragePath PathFor(const char* tablePath, ObjId id) const;
+        static bool MakeFanOutDirs(const char* tablePath, ObjId id);
+        static bool IsFanOutDir(const char* name);
+        void CollectIds(const char* dirPath, size_t depth, std::vector<ObjId>& ids) const;
+
+        const bool mFanOut;
+        ReadQueue mReads;
+};
+
+#endif //_FILESTORAGE_HPP_
@@ -0,0 +1,432 @@
+#include "LogStorage.hpp"
+#include <vector>
+#include "crc.h"
+#include "logging.hpp"
+
+LogStorage::LogTable* LogStorage::OpenLog(const char* tablePath, bool create)
+{
+    auto it = mTables.find(tablePath);
+    if (it != mTables.end()) {
+        return &it->second;
+    }
+
+    StoragePath logPath = JoinPath(tablePath, LogFileName);
+    StoragePath compactPath = JoinPath(tablePath, CompactFileName);
+
+    // A compacted log is only renamed into place once it is complete,
+    // so if the original is still around the compacted copy can't be trusted
+    if (DirectoryWrapper::Exists(compactPath)) {
+        if (DirectoryWrapper::Exists(logPath)) {
+            DirectoryWrapper::Delete(compactPath);
+        } else {
+            DirectoryWrapper::Rename(compactPath, logPath);
+        }
+    }
+
+    bool exists = DirectoryWrapper::Exists(logPath);
+    if (!exists && (!create || !DirectoryWrapper::Exists(tablePath))) {
+        return nullptr;
+    }
+
+    auto file = std::make_unique<FileWrapper>(logPath, exists ? "r+b" : "w+b");
+    if (!file->DidOpen()) {
+        LOG("Error opening table log at path:");
+        LOG(logPath);
+        return nullptr;
+    }
+
+    LogTable& table = mTables[tablePath];
+    table.file = std::move(file);
+
+    if (!Replay(table)) {
+        mTables.erase(tablePath);
+        return nullptr;
+    }
+
+    return &table;
+}
+
+void LogStorage::Forget(LogTable& table, ObjId id)
+{
+    auto it = table.keydir.find(id);
+    if (it == table.keydir.end()) {
+        return;
+    }
+
+    uint32_t entrySize = sizeof(EntryHeader) + it->second.length;
+    table.liveBytes -= entrySize;
+    table.deadBytes += entrySize;
+    table.keydir.erase(it);
+}
+
+bool LogStorage::Replay(LogTable& table)
+{
+    FileWrapper& f = *table.file;
+    uint32_t size = f.Size();
+    uint32_t pos = 0;
+    std::vector<uint8_t> body;
+
+    while (size - pos >= sizeof(EntryHeader)) {
+        EntryHeader header;
+        if (!f.ReadAt(pos, &header, sizeof(header))) {
+            break;
+        }
+
+        if (header.length == TombstoneLength) {
+            Forget(table, header.id);
+            table.deadBytes += sizeof(header);
+            pos += sizeof(header);
+            continue;
+        }
+
+        if (header.length < sizeof(ObjId) || header.length > size - pos - sizeof(header)) {
+            break;
+        }
+
+        body.resize(header.length);
+        if (!f.ReadAt(pos + sizeof(header), body.data(), header.length)) {
+            break;
+        }
+
+        if (header.crc != crc32(body.data(), header.length - sizeof(ObjId))) {
+            break;
+        }
+
+        Forget(table, header.id);
+        table.keydir[header.id] = {pos, header.length, header.crc};
+        table.liveBytes += sizeof(header) + header.length;
+        pos += sizeof(header) + header.length;
+    }
+
+    if (pos < size) {
+        LOG("Discarding torn entries at the end of the table log");
+        if (!f.Truncate(pos)) {
+            return false;
+        }
+    }
+
+    table.tail = pos;
+    return true;
+}
+
+bool LogStorage::Fits(const LogTable& table, uint64_t bytes)
+{
+    if ((uint64_t)table.tail + bytes <= MaxLogBytes) {
+        return true;
+    }
+
+    LOG("Table log is full, refusing to append to it");
+    return false;
+}
+
+bool LogStorage::Append(LogTable& table, const EntryHeader& header, const void* data)
+{
+    FileWrapper& f = *table.file;
+    uint32_t bodyLength = header.length == TombstoneLength ? 0 : header.length;
+    if (!Fits(table, (uint64_t)sizeof(header) + bodyLength)) {
+        return false;
+    }
+
+    bool written = f.Seek(table.tail) &&
+        f.Write(&header, sizeof(header)) &&
+        (bodyLength == 0 || f.Write(data, bodyLength)) &&
+        f.Flush();
+
+    if (!written) {
+        LOG("Error appending to table log");
+        // don't leave half an entry behind for the next append to land after
+        f.Truncate(table.tail);
+        return false;
+    }
+
+    table.tail += sizeof(header) + bodyLength;
+    return true;
+}
+
+uint32_t LogStorage::Read(const char* tablePath, ObjId id, void* data)
+{
+    LogTable* table = OpenLog(tablePath, false);
+    if (table == nullptr) {
+        return 0;
+    }
+
+    auto it = table->keydir.find(id);
+    if (it == table->keydir.end()) {
+        return 0;
+    }
+
+    const Entry& entry = it->second;
+    if (!table->file->ReadAt(entry.offset + sizeof(EntryHeader), data, entry.length)) {
+        return 0;
+    }
+
+    if (entry.crc != crc32(data, entry.length - sizeof(ObjId))) {
+        LOG("CRC MISMATCH!");
+        LOG(tablePath);
+        return 0;
+    }
+
+    return entry.length;
+}
+
+const uint8_t* LogStorage::View(const char* tablePath, ObjId id, uint32_t& len)
+{
+    LogTable* table = OpenLog(tablePath, false);
+    if (table == nullptr) {
+        return nullptr;
+    }
+
+    auto it = table->keydir.find(id);
+    if (it == table->keydir.end()) {
+        return nullptr;
+    }
+
+    const Entry& entry = it->second;
+    uint32_t end = entry.offset + sizeof(EntryHeader) + entry.length;
+    FileWrapper& f = *table->file;
+    const uint8_t* map = f.Map();
+    if (map == nullptr || end > f.MappedLength()) {
+        return nullptr;
+    }
+
+    len = entry.length;
+    return map + entry.offset + sizeof(EntryHeader);
+}
+
+bool LogStorage::Exists(const char* tablePath, ObjId id)
+{
+    LogTable* table = OpenLog(tablePath, false);
+    return table != nullptr && table->keydir.count(id) != 0;
+}
+
+bool LogStorage::Write(const char* tablePath, ObjId id, const void* data, uint32_t len, uint32_t crc)
+{
+    LogTable* table = OpenLog(tablePath, true);
+    if (table == nullptr) {
+        return false;
+    }
+
+    uint32_t offset = table->tail;
+    if (!Append(*table, {id, len, crc}, data)) {
+        return false;
+    }
+
+    Forget(*table, id);
+    table->keydir[id] = {offset, len, crc};
+    table->liveBytes += sizeof(EntryHeader) + len;
+
+    MaybeCompact(tablePath, *table);
+    return true;
+}
+
+bool LogStorage::Remove(const char* tablePath, ObjId id)
+{
+    LogTable* table = OpenLog(tablePath, false);
+    if (table == nullptr || table->keydir.count(id) == 0) {
+        return false;
+    }
+
+    if (!Append(*table, {id, TombstoneLength, 0}, nullptr)) {
+        return false;
+    }
+
+    Forget(*table, id);
+    table->deadBytes += sizeof(EntryHeader);
+
+    MaybeCompact(tablePath, *table);
+    return true;
+}
+
+bool LogStorage::AppendBatch(LogTable& table, const std::vector<uint8_t>& entries)
+{
+    FileWrapper& f = *table.file;
+    if (!Fits(table, entries.size())) {
+        return false;
+    }
+
+    bool written = f.Seek(table.tail) &&
+        f.Write(entries.data(), entries.size()) &&
+        f.Sync();
+
+    if (!written) {
+        LOG("Error appending batch to table log");
+        f.Truncate(table.tail);
+        return false;
+    }
+
+    table.tail += entries.size();
+    return true;
+}
+
+bool LogStorage::WriteBatch(const char* tablePath, const BatchRecord* records, size_t count)
+{
+    LogTable* table = OpenLog(tablePath, true);
+    if (table == nullptr) {
+        return false;
+    }
+
+    std::vector<uint8_t> entries;
+    for (size_t i = 0; i < count; i++) {
+        EntryHeader header = {records[i].id, records[i].len, records[i].crc};
+        const uint8_t* data = (const uint8_t*)records[i].data;
+        entries.insert(entries.end(), (const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+        entries.insert(entries.end(), data, data + records[i].len);
+    }
+
+    uint32_t offset = table->tail;
+    if (!AppendBatch(*table, entries)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        Forget(*table, records[i].id);
+        table->keydir[records[i].id] = {offset, records[i].len, records[i].crc};
+        table->liveBytes += sizeof(EntryHeader) + records[i].len;
+        offset += sizeof(EntryHeader) + records[i].len;
+    }
+
+    MaybeCompact(tablePath, *table);
+    return true;
+}
+
+bool LogStorage::RemoveBatch(const char* tablePath, const ObjId* ids, size_t count)
+{
+    LogTable* table = OpenLog(tablePath, false);
+    if (table == nullptr) {
+        return false;
+    }
+
+    bool removedAll = true;
+    std::vector<uint8_t> entries;
+    for (size_t i = 0; i < count; i++) {
+        if (table->keydir.count(ids[i]) == 0) {
+            removedAll = false;
+            continue;
+        }
+
+        EntryHeader header = {ids[i], TombstoneLength, 0};
+        entries.insert(entries.end(), (const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+    }
+
+    if (entries.empty()) {
+        return removedAll;
+    }
+
+    if (!AppendBatch(*table, entries)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if (table->keydir.count(ids[i]) != 0) {
+            Forget(*table, ids[i]);
+            table->deadBytes += sizeof(EntryHeader);
+        }
+    }
+
+    MaybeCompact(tablePath, *table);
+    return removedAll;
+}
+
+void LogStorage::MaybeCompact(const char* tablePath, LogTable& table)
+{
+    if (table.deadBytes >= MinCompactionBytes && table.deadBytes > table.liveBytes) {
+        Compact(tablePath, table);
+    }
+}
+
+bool LogStorage::Compact(const char* tablePath)
+{
+    LogTable* table = OpenLog(tablePath, false);
+    return table != nullptr && Compact(tablePath, *table);
+}
+
+bool LogStorage::Compact(const char* tablePath, LogTable& table)
+{
+    StoragePath logPath = JoinPath(tablePath, LogFileName);
+    StoragePath compactPath = JoinPath(tablePath, CompactFileName);
+
+    std::map<ObjId, Entry> keydir;
+    uint32_t pos = 0;
+    bool written = true;
+
+    {
+        FileWrapper out(compactPath, "w+b");
+        written = out.DidOpen();
+
+        std::vector<uint8_t> body;
+        for (auto it = table.keydir.begin(); written && it != table.keydir.end(); ++it) {
+            const Entry& entry = it->second;
+            EntryHeader header = {it->first, entry.length, entry.crc};
+            body.resize(entry.length);
+
+            written = table.file->ReadAt(entry.offset + sizeof(header), body.data(), entry.length) &&
+                out.Write(&header, sizeof(header)) &&
+                out.Write(body.data(), entry.length);
+
+            keydir[it->first] = {pos, entry.length, entry.crc};
+            pos += sizeof(header) + entry.length;
+        }
+
+        written = written && out.Flush();
+    }
+
+    if (!written) {
+        LOG("Error compacting table log");
+        DirectoryWrapper::Delete(compactPath);
+        return false;
+    }
+
+    table.file.reset();
+    if (!DirectoryWrapper::Rename(compactPath, logPath)) {
+        // drop the table, it will be recovered from whichever file survived when it is next opened
+        LOG("Error replacing table log with compacted log");
+        mTables.erase(tablePath);
+        return false;
+    }
+
+    table.file = std::make_unique<FileWrapper>(logPath, "r+b");
+    if (!table.file->DidOpen()) {
+        mTables.erase(tablePath);
+        return false;
+    }
+
+    table.keydir = std::move(keydir);
+    table.tail = pos;
+    table.liveBytes = pos;
+    table.deadBytes = 0;
+    return true;
+}
+
+bool LogStorage::Open(const char* tablePath, TableCursor& cursor)
+{
+    cursor.Reset(tablePath, DirectoryWrapper::Exists(tablePath));
+    return cursor.DidOpen();
+}
+
+bool LogStorage::Next(TableCursor& cursor, ObjId& id)
+{
+    LogTable* table = OpenLog(cursor.TablePath(), false);
+    if (table == nullptr) {
+        return false;
+    }
+
+    auto it = cursor.Started() ? table->keydir.upper_bound(cursor.Position()) : table->keydir.lower_bound(cursor.First());
+    if (it == table->keydir.end() || it->first > cursor.Last()) {
+        return false;
+    }
+
+    id = it->first;
+    cursor.Advance(id);
+    return true;
+}
+
+void LogStorage::Close(const char* pathPrefix)
+{
+    for (auto it = mTables.begin(); it != mTables.end();) {
+        if (PathHasPrefix(it->first.c_str(), pathPrefix)) {
+            it = mTables.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
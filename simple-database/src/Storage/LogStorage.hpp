@@ -0,0 +1,89 @@
+#ifndef _LOGSTORAGE_HPP_
+#define _LOGSTORAGE_HPP_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "StorageEngine.hpp"
+#include "FileWrapper.hpp"
+
+/**
+ * LogStorage
+ * Every table is a single append-only file, <table>/records.log
+ * Each save appends a new entry, each delete appends a tombstone
+ * An in-memory keydir maps ids to the latest entry so a read is a single positioned read
+ *
+ * The keydir is rebuilt by replaying the log the first time a table is touched.
+ * A torn entry at the end of the log (e.g. power loss mid append) is cut off during replay.
+ * Once enough of the log is dead it is rewritten in id order with only the live entries.
+ * A batch is appended with a single write and synced once. A log never grows past
+ * MaxLogBytes, appends that would take it further are refused.
+ *
+ * Where files can be memory mapped, View hands out records straight from a mapping of the log.
+ * Those skip the CRC check, every entry was already checked when the log was replayed.
+ */
+class LogStorage : public StorageEngine {
+    public:
+        static constexpr const char* LogFileName = "records.log";
+        static constexpr const char* CompactFileName = "records.log.tmp";
+
+        // don't bother compacting until this many bytes are dead
+        static const uint32_t MinCompactionBytes = 64 * 1024;
+
+        uint32_t Read(const char* tablePath, ObjId id, void* data) override;
+        const uint8_t* View(const char* tablePath, ObjId id, uint32_t& len) override;
+        bool Exists(const char* tablePath, ObjId id) override;
+        bool Write(const char* tablePath, ObjId id, const void* data, uint32_t len, uint32_t crc) override;
+        bool Remove(const char* tablePath, ObjId id) override;
+
+        bool WriteBatch(const char* tablePath, const BatchRecord* records, size_t count) override;
+        bool RemoveBatch(const char* tablePath, const ObjId* ids, size_t count) override;
+
+        bool Open(const char* tablePath, TableCursor& cursor) override;
+        bool Next(TableCursor& cursor, ObjId& id) override;
+
+        void Close(const char* pathPrefix) override;
+
+        bool Compact(const char* tablePath);
+
+    private:
+        struct EntryHeader {
+            ObjId id;
+            uint32_t length;
+            uint32_t crc;
+        };
+
+        struct Entry {
+            uint32_t offset;
+            uint32_t length;
+            uint32_t crc;
+        };
+
+        struct LogTable {
+            std::unique_ptr<FileWrapper> file;
+            std::map<ObjId, Entry> keydir;
+            uint32_t tail = 0;
+            uint32_t liveBytes = 0;
+            uint32_t deadBytes = 0;
+        };
+
+        static const uint32_t TombstoneLength = UINT32_MAX;
+        // positions in the log are 32 bit, and FAT can't hold a bigger file either
+        static const uint32_t MaxLogBytes = UINT32_MAX;
+
+        LogTable* OpenLog(const char* tablePath, bool create);
+        bool Replay(LogTable& table);
+        bool Append(LogTable& table, const EntryHeader& header, const void* data);
+        bool AppendBatch(LogTable& table, const std::vector<uint8_t>& entries);
+        // whether `bytes` more can go on the end without a position wrapping around
+        static bool Fits(const LogTable& table, uint64_t bytes);
+        void MaybeCompact(const char* tablePath, LogTable& table);
+        bool Compact(const char* tablePath, LogTable& table);
+        void Forget(LogTable& table, ObjId id);
+
+        std::unordered_map<std::string, LogTable> mTables;
+};
+
+#endif //_LOGSTORAGE_HPP_
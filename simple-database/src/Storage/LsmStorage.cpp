@@ -0,0 +1,981 @@
+#include "LsmStorage.hpp"
+#include <algorithm>
+#include <inttypes.h>
+#include <stdio.h>
+#include "crc.h"
+#include "logging.hpp"
+
+static uint64_t BloomHash(ObjId id)
+{
+    // splitmix64 finalizer, ids are sequential so they need spreading out
+    uint64_t h = id + 0x9e3779b97f4a7c15ULL;
+    h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+    return h ^ (h >> 31);
+}
+
+/**
+ * RunWriter
+ * Writes a run to <path>.tmp and only renames it into place once it is complete and synced,
+ * so a run on disk is either whole or not there at all, and a finished one survives a crash
+ */
+class LsmStorage::RunWriter {
+    public:
+        explicit RunWriter(const char* path) :
+            mPath(path),
+            mTmpPath(mPath + ".tmp"),
+            mFile(mTmpPath.c_str(), "w+b")
+        {
+            mOk = mFile.DidOpen();
+        }
+
+        ~RunWriter()
+        {
+            if (!mFinished) {
+                mFile.Close();
+                DirectoryWrapper::Delete(mTmpPath.c_str());
+            }
+        }
+
+        bool Empty() const { return mIndex.empty(); }
+
+        bool Add(ObjId id, uint32_t length, uint32_t crc, const void* data)
+        {
+            mIndex.push_back({id, mOffset, length, crc, 0});
+            if (length != TombstoneLength) {
+                Buffer(data, length);
+                mOffset += length;
+            }
+            return mOk;
+        }
+
+        RunPtr Finish(uint32_t level, uint32_t seq)
+        {
+            std::vector<uint8_t> bloom(std::max<size_t>(8, (mIndex.size() * BloomBitsPerKey + 7) / 8), 0);
+            uint32_t bits = bloom.size() * 8;
+            for (const IndexEntry& entry : mIndex) {
+                uint64_t h = BloomHash(entry.id);
+                uint32_t h1 = (uint32_t)h;
+                uint32_t h2 = (uint32_t)(h >> 32) | 1;
+                for (uint32_t i = 0; i < BloomHashes; i++) {
+                    uint32_t bit = (h1 + i * h2) % bits;
+                    bloom[bit / 8] |= 1 << (bit % 8);
+                }
+            }
+
+            uint32_t indexBytes = mIndex.size() * sizeof(IndexEntry);
+            RunFooter footer = {
+                Magic,
+                (uint32_t)mIndex.size(),
+                mOffset,
+                crc32(mIndex.data(), indexBytes),
+                mOffset + indexBytes,
+                (uint32_t)bloom.size(),
+            };
+
+            Buffer(mIndex.data(), indexBytes);
+            Buffer(bloom.data(), bloom.size());
+            Buffer(&footer, sizeof(footer));
+            mOk = mOk && Drain() && mFile.Sync();
+            mFile.Close();
+
+            // the wal is cut back and merged inputs deleted once this returns, so the rename has to stick too
+            std::string dir = mPath.substr(0, mPath.find_last_of('/'));
+            if (!mOk || !DirectoryWrapper::Rename(mTmpPath.c_str(), mPath.c_str())) {
+                LOG("Error writing run at path:");
+                LOG(mPath.c_str());
+                return nullptr;
+            }
+            mFinished = true;
+
+            if (!DirectoryWrapper::Sync(dir.c_str())) {
+                LOG("Error syncing run directory:");
+                LOG(dir.c_str());
+                return nullptr;
+            }
+
+            auto run = std::make_shared<Run>();
+            run->level = level;
+            run->seq = seq;
+            run->size = footer.bloomOffset + footer.bloomBytes + sizeof(footer);
+            run->path = mPath;
+            run->file = std::make_unique<FileWrapper>(mPath.c_str(), "rb");
+            run->index = std::move(mIndex);
+            run->bloom = std::move(bloom);
+            return run->file->DidOpen() ? run : nullptr;
+        }
+
+    private:
+        // FF syncs on every write, so batch small records up
+        static const size_t BufferSize = 4096;
+
+        void Buffer(const void* data, size_t len)
+        {
+            const uint8_t* bytes = (const uint8_t*)data;
+            mBuffer.insert(mBuffer.end(), bytes, bytes + len);
+            if (mBuffer.size() >= BufferSize) {
+                mOk = mOk && Drain();
+            }
+        }
+
+        bool Drain()
+        {
+            bool written = mBuffer.empty() || mFile.Write(mBuffer.data(), mBuffer.size());
+            mBuffer.clear();
+            return written;
+        }
+
+        std::string mPath;
+        std::string mTmpPath;
+        FileWrapper mFile;
+        std::vector<uint8_t> mBuffer;
+        std::vector<IndexEntry> mIndex;
+        uint32_t mOffset = 0;
+        bool mOk = false;
+        bool mFinished = false;
+};
+
+bool LsmStorage::Run::MayContain(ObjId id) const
+{
+    uint32_t bits = bloom.size() * 8;
+    if (bits == 0) {
+        return true;
+    }
+
+    uint64_t h = BloomHash(id);
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+    for (uint32_t i = 0; i < BloomHashes; i++) {
+        uint32_t bit = (h1 + i * h2) % bits;
+        if (!(bloom[bit / 8] & (1 << (bit % 8)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+const LsmStorage::IndexEntry* LsmStorage::Run::LowerBound(ObjId id) const
+{
+    auto it = std::lower_bound(index.begin(), index.end(), id,
+            [](const IndexEntry& entry, ObjId id) { return entry.id < id; });
+    return it == index.end() ? nullptr : &*it;
+}
+
+const LsmStorage::IndexEntry* LsmStorage::Run::Find(ObjId id) const
+{
+    const IndexEntry* entry = LowerBound(id);
+    return entry != nullptr && entry->id == id ? entry : nullptr;
+}
+
+bool LsmStorage::Version::Removed() const
+{
+    if (mem != nullptr) {
+        return mem->removed;
+    }
+    return entry == nullptr || entry->length == TombstoneLength;
+}
+
+LsmStorage::~LsmStorage()
+{
+#if LSM_BACKGROUND_COMPACTION
+    {
+        Lock lock = Acquire();
+        mStopping = true;
+    }
+    mWake.notify_all();
+    if (mWorker.joinable()) {
+        mWorker.join();
+    }
+#endif
+}
+
+StoragePath LsmStorage::RunPath(const char* tablePath, uint32_t level, uint32_t seq)
+{
+    char name[32];
+    snprintf(name, sizeof(name), "L%" PRIu32 "-%08" PRIx32 ".run", level, seq);
+    return JoinPath(tablePath, name);
+}
+
+void LsmStorage::SortRuns(LsmTable& table)
+{
+    std::sort(table.runs.begin(), table.runs.end(), [](const RunPtr& a, const RunPtr& b) {
+        return a->level != b->level ? a->level < b->level : a->seq > b->seq;
+    });
+}
+
+LsmStorage::LsmTable* LsmStorage::OpenTree(const char* tablePath, bool create)
+{
+    auto it = mTables.find(tablePath);
+    if (it != mTables.end()) {
+        return &it->second;
+    }
+
+    // the wal is created with the table and only ever truncated, so it marks an lsm table
+    StoragePath walPath = JoinPath(tablePath, WalFileName);
+    bool exists = DirectoryWrapper::Exists(walPath);
+    if (!exists && (!create || !DirectoryWrapper::Exists(tablePath))) {
+        return nullptr;
+    }
+
+    auto wal = std::make_unique<FileWrapper>(walPath, exists ? "r+b" : "w+b");
+    if (!wal->DidOpen()) {
+        LOG("Error opening table wal at path:");
+        LOG(walPath);
+        return nullptr;
+    }
+
+    LsmTable& table = mTables[tablePath];
+    table.wal = std::move(wal);
+
+    if (!LoadRuns(tablePath, table) || !Replay(table)) {
+        mTables.erase(tablePath);
+        return nullptr;
+    }
+
+    // pick up where we left off if the last session stopped with merges outstanding
+    ScheduleCompaction(tablePath, table);
+    return &table;
+}
+
+bool LsmStorage::LoadRuns(const char* tablePath, LsmTable& table)
+{
+    std::vector<std::string> leftovers;
+    {
+        DirectoryWrapper dir(tablePath);
+        if (!dir.DidOpen()) {
+            return false;
+        }
+
+        StoragePath p;
+        bool isDir;
+        while (dir.NextPath(p, isDir)) {
+            if (isDir) continue;
+
+            const char* name = strrchr((const char*)p, '/');
+            name = name ? name + 1 : (const char*)p;
+
+            uint32_t level, seq;
+            int consumed = 0;
+            size_t len = strlen(name);
+            if (len > 4 && strcmp(name + len - 4, ".tmp") == 0) {
+                leftovers.push_back((const char*)p);
+            } else if (sscanf(name, "L%" SCNu32 "-%" SCNx32 ".run%n", &level, &seq, &consumed) == 2 && name[consumed] == '\0') {
+                RunPtr run = LoadRun(p, level, seq);
+                if (run) {
+                    table.runs.push_back(run);
+                    table.nextSeq = std::max(table.nextSeq, seq + 1);
+                }
+            }
+        }
+    }
+
+    // runs that never got renamed into place
+    for (const std::string& path : leftovers) {
+        DirectoryWrapper::Delete(path.c_str());
+    }
+
+    SortRuns(table);
+    return true;
+}
+
+LsmStorage::RunPtr LsmStorage::LoadRun(const char* path, uint32_t level, uint32_t seq)
+{
+    auto run = std::make_shared<Run>();
+    run->file = std::make_unique<FileWrapper>(path, "rb");
+    if (!run->file->DidOpen()) {
+        return nullptr;
+    }
+
+    FileWrapper& f = *run->file;
+    RunFooter footer = {};
+    uint32_t size = f.Size();
+    bool valid = size >= sizeof(footer) && f.ReadAt(size - sizeof(footer), &footer, sizeof(footer)) &&
+        footer.magic == Magic &&
+        footer.bloomOffset >= footer.indexOffset &&
+        footer.bloomOffset - footer.indexOffset == (uint64_t)footer.count * sizeof(IndexEntry) &&
+        (uint64_t)footer.bloomOffset + footer.bloomBytes + sizeof(footer) == size;
+
+    if (valid) {
+        run->index.resize(footer.count);
+        run->bloom.resize(footer.bloomBytes);
+        valid = f.ReadAt(footer.indexOffset, run->index.data(), footer.count * sizeof(IndexEntry)) &&
+            f.ReadAt(footer.bloomOffset, run->bloom.data(), footer.bloomBytes) &&
+            footer.indexCrc == crc32(run->index.data(), footer.count * sizeof(IndexEntry));
+    }
+
+    if (!valid) {
+        LOG("Skipping damaged run at path:");
+        LOG(path);
+        return nullptr;
+    }
+
+    run->level = level;
+    run->seq = seq;
+    run->size = size;
+    run->path = path;
+    return run;
+}
+
+void LsmStorage::Put(LsmTable& table, ObjId id, MemEntry&& entry)
+{
+    auto it = table.memtable.find(id);
+    if (it != table.memtable.end()) {
+        table.memBytes -= sizeof(EntryHeader) + it->second.data.size();
+    }
+
+    table.memBytes += sizeof(EntryHeader) + entry.data.size();
+    table.memtable[id] = std::move(entry);
+}
+
+bool LsmStorage::Replay(LsmTable& table)
+{
+    FileWrapper& f = *table.wal;
+    uint32_t size = f.Size();
+    uint32_t pos = 0;
+
+    while (size - pos >= sizeof(EntryHeader)) {
+        EntryHeader header;
+        if (!f.ReadAt(pos, &header, sizeof(header))) {
+            break;
+        }
+
+        MemEntry entry;
+        if (header.length == TombstoneLength) {
+            entry.removed = true;
+            Put(table, header.id, std::move(entry));
+            pos += sizeof(header);
+            continue;
+        }
+
+        if (header.length < sizeof(ObjId) || header.length > size - pos - sizeof(header)) {
+            break;
+        }
+
+        entry.data.resize(header.length);
+        entry.crc = header.crc;
+        if (!f.ReadAt(pos + sizeof(header), entry.data.data(), header.length)) {
+            break;
+        }
+
+        if (header.crc != crc32(entry.data.data(), header.length - sizeof(ObjId))) {
+            break;
+        }
+
+        Put(table, header.id, std::move(entry));
+        pos += sizeof(header) + header.length;
+    }
+
+    if (pos < size) {
+        LOG("Discarding torn entries at the end of the table wal");
+        if (!f.Truncate(pos)) {
+            return false;
+        }
+    }
+
+    table.walTail = pos;
+    return true;
+}
+
+bool LsmStorage::Append(LsmTable& table, const EntryHeader& header, const void* data)
+{
+    FileWrapper& f = *table.wal;
+    uint32_t bodyLength = header.length == TombstoneLength ? 0 : header.length;
+
+    bool written = f.Seek(table.walTail) &&
+        f.Write(&header, sizeof(header)) &&
+        (bodyLength == 0 || f.Write(data, bodyLength)) &&
+        f.Sync();
+
+    if (!written) {
+        LOG("Error appending to table wal");
+        f.Truncate(table.walTail);
+        return false;
+    }
+
+    table.walTail += sizeof(header) + bodyLength;
+    return true;
+}
+
+bool LsmStorage::Flush(const char* tablePath, LsmTable& table)
+{
+    if (table.memtable.empty()) {
+        return true;
+    }
+
+    uint32_t seq = table.nextSeq++;
+    RunWriter writer(RunPath(tablePath, 0, seq));
+    for (const auto& [id, entry] : table.memtable) {
+        if (entry.removed) {
+            writer.Add(id, TombstoneLength, 0, nullptr);
+        } else {
+            writer.Add(id, entry.data.size(), entry.crc, entry.data.data());
+        }
+    }
+
+    RunPtr run = writer.Finish(0, seq);
+    if (!run) {
+        // everything is still in the wal, try again on the next write
+        return false;
+    }
+
+    table.runs.push_back(run);
+    SortRuns(table);
+
+    // the run holds everything the wal did, a crash before the truncate just replays it again
+    table.memtable.clear();
+    table.memBytes = 0;
+    if (table.wal->Truncate(0)) {
+        table.walTail = 0;
+    }
+
+    table.stalled = false;
+    ScheduleCompaction(tablePath, table);
+    return true;
+}
+
+LsmStorage::Version LsmStorage::Find(const LsmTable& table, ObjId id) const
+{
+    Version version;
+
+    auto it = table.memtable.find(id);
+    if (it != table.memtable.end()) {
+        version.mem = &it->second;
+        return version;
+    }
+
+    for (const RunPtr& run : table.runs) {
+        if (!run->MayContain(id)) {
+            continue;
+        }
+
+        const IndexEntry* entry = run->Find(id);
+        if (entry != nullptr) {
+            version.run = run.get();
+            version.entry = entry;
+            return version;
+        }
+    }
+
+    return version;
+}
+
+uint32_t LsmStorage::Read(const char* tablePath, ObjId id, void* data)
+{
+    Lock lock = Acquire();
+    LsmTable* table = OpenTree(tablePath, false);
+    if (table == nullptr) {
+        return 0;
+    }
+
+    Version version = Find(*table, id);
+    if (!version.Found() || version.Removed()) {
+        return 0;
+    }
+
+    if (version.mem != nullptr) {
+        memcpy(data, version.mem->data.data(), version.mem->data.size());
+        return version.mem->data.size();
+    }
+
+    const IndexEntry& entry = *version.entry;
+    if (!version.run->file->ReadAt(entry.offset, data, entry.length)) {
+        return 0;
+    }
+
+    if (entry.crc != crc32(data, entry.length - sizeof(ObjId))) {
+        LOG("CRC MISMATCH!");
+        LOG(version.run->path.c_str());
+        return 0;
+    }
+
+    return entry.length;
+}
+
+bool LsmStorage::Exists(const char* tablePath, ObjId id)
+{
+    Lock lock = Acquire();
+    LsmTable* table = OpenTree(tablePath, false);
+    if (table == nullptr) {
+        return false;
+    }
+
+    Version version = Find(*table, id);
+    return version.Found() && !version.Removed();
+}
+
+bool LsmStorage::Write(const char* tablePath, ObjId id, const void* data, uint32_t len, uint32_t crc)
+{
+    Lock lock = Acquire();
+    LsmTable* table = OpenTree(tablePath, true);
+    if (table == nullptr) {
+        return false;
+    }
+
+    if (!Append(*table, {id, len, crc}, data)) {
+        return false;
+    }
+
+    MemEntry entry;
+    entry.data.assign((const uint8_t*)data, (const uint8_t*)data + len);
+    entry.crc = crc;
+    Put(*table, id, std::move(entry));
+
+    if (table->memBytes >= MemtableLimit) {
+        Flush(tablePath, *table);
+    }
+
+    return true;
+}
+
+bool LsmStorage::Remove(const char* tablePath, ObjId id)
+{
+    Lock lock = Acquire();
+    LsmTable* table = OpenTree(tablePath, false);
+    if (table == nullptr) {
+        return false;
+    }
+
+    Version version = Find(*table, id);
+    if (!version.Found() || version.Removed()) {
+        return false;
+    }
+
+    if (!Append(*table, {id, TombstoneLength, 0}, nullptr)) {
+        return false;
+    }
+
+    MemEntry entry;
+    entry.removed = true;
+    Put(*table, id, std::move(entry));
+
+    if (table->memBytes >= MemtableLimit) {
+        Flush(tablePath, *table);
+    }
+
+    return true;
+}
+
+bool LsmStorage::AppendBatch(LsmTable& table, const std::vector<uint8_t>& entries)
+{
+    FileWrapper& f = *table.wal;
+
+    bool written = f.Seek(table.walTail) &&
+        f.Write(entries.data(), entries.size()) &&
+        f.Sync();
+
+    if (!written) {
+        LOG("Error appending batch to table wal");
+        f.Truncate(table.walTail);
+        return false;
+    }
+
+    table.walTail += entries.size();
+    return true;
+}
+
+bool LsmStorage::WriteBatch(const char* tablePath, const BatchRecord* records, size_t count)
+{
+    Lock lock = Acquire();
+    LsmTable* table = OpenTree(tablePath, true);
+    if (table == nullptr) {
+        return false;
+    }
+
+    std::vector<uint8_t> entries;
+    for (size_t i = 0; i < count; i++) {
+        EntryHeader header = {records[i].id, records[i].len, records[i].crc};
+        const uint8_t* data = (const uint8_t*)records[i].data;
+        entries.insert(entries.end(), (const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+        entries.insert(entries.end(), data, data + records[i].len);
+    }
+
+    if (!AppendBatch(*table, entries)) {
+        return false;
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        MemEntry entry;
+        const uint8_t* data = (const uint8_t*)records[i].data;
+        entry.data.assign(data, data + records[i].len);
+        entry.crc = records[i].crc;
+        Put(*table, records[i].id, std::move(entry));
+    }
+
+    if (table->memBytes >= MemtableLimit) {
+        Flush(tablePath, *table);
+    }
+
+    return true;
+}
+
+bool LsmStorage::RemoveBatch(const char* tablePath, const ObjId* ids, size_t count)
+{
+    Lock lock = Acquire();
+    LsmTable* table = OpenTree(tablePath, false);
+    if (table == nullptr) {
+        return false;
+    }
+
+    bool removedAll = true;
+    std::vector<ObjId> removed;
+    std::vector<uint8_t> entries;
+    for (size_t i = 0; i < count; i++) {
+        Version version = Find(*table, ids[i]);
+        if (!version.Found() || version.Removed()) {
+            removedAll = false;
+            continue;
+        }
+
+        EntryHeader header = {ids[i], TombstoneLength, 0};
+        entries.insert(entries.end(), (const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+        removed.push_back(ids[i]);
+    }
+
+    if (entries.empty()) {
+        return removedAll;
+    }
+
+    if (!AppendBatch(*table, entries)) {
+        return false;
+    }
+
+    for (ObjId id : removed) {
+        MemEntry entry;
+        entry.removed = true;
+        Put(*table, id, std::move(entry));
+    }
+
+    if (table->memBytes >= MemtableLimit) {
+        Flush(tablePath, *table);
+    }
+
+    return removedAll;
+}
+
+bool LsmStorage::Flush(const char* tablePath)
+{
+    Lock lock = Acquire();
+    LsmTable* table = OpenTree(tablePath, false);
+    return table != nullptr && Flush(tablePath, *table);
+}
+
+size_t LsmStorage::RunCount(const char* tablePath, uint32_t level)
+{
+    Lock lock = Acquire();
+    LsmTable* table = OpenTree(tablePath, false);
+    if (table == nullptr) {
+        return 0;
+    }
+
+    return std::count_if(table->runs.begin(), table->runs.end(),
+            [level](const RunPtr& run) { return run->level == level; });
+}
+
+bool LsmStorage::Open(const char* tablePath, TableCursor& cursor)
+{
+    cursor.Reset(tablePath, DirectoryWrapper::Exists(tablePath));
+    return cursor.DidOpen();
+}
+
+bool LsmStorage::Next(TableCursor& cursor, ObjId& id)
+{
+    Lock lock = Acquire();
+    LsmTable* table = OpenTree(cursor.TablePath(), false);
+    if (table == nullptr) {
+        return false;
+    }
+
+    ObjId from = cursor.First();
+    if (cursor.Started()) {
+        if (cursor.Position() == UINT64_MAX) {
+            return false;
+        }
+        from = cursor.Position() + 1;
+    }
+
+    while (from <= cursor.Last()) {
+        // smallest id at or after `from` in any of the sources
+        bool found = false;
+        ObjId next = 0;
+
+        auto it = table->memtable.lower_bound(from);
+        if (it != table->memtable.end()) {
+            next = it->first;
+            found = true;
+        }
+
+        for (const RunPtr& run : table->runs) {
+            const IndexEntry* entry = run->LowerBound(from);
+            if (entry != nullptr && (!found || entry->id < next)) {
+                next = entry->id;
+                found = true;
+            }
+        }
+
+        if (!found || next > cursor.Last()) {
+            return false;
+        }
+
+        if (!Find(*table, next).Removed()) {
+            id = next;
+            cursor.Advance(id);
+            return true;
+        }
+
+        if (next == UINT64_MAX) {
+            return false;
+        }
+        from = next + 1;
+    }
+
+    return false;
+}
+
+uint64_t LsmStorage::LevelBudget(uint32_t level)
+{
+    uint64_t budget = Level1Bytes;
+    for (uint32_t i = 1; i < level; i++) {
+        budget *= LevelMultiplier;
+    }
+    return budget;
+}
+
+bool LsmStorage::NeedsCompaction(const LsmTable& table, uint32_t& level) const
+{
+    if (table.compacting || table.stalled) {
+        return false;
+    }
+
+    std::vector<uint64_t> levelBytes;
+    size_t level0Runs = 0;
+    for (const RunPtr& run : table.runs) {
+        if (run->level == 0) {
+            level0Runs++;
+        }
+        if (levelBytes.size() <= run->level) {
+            levelBytes.resize(run->level + 1, 0);
+        }
+        levelBytes[run->level] += run->size;
+    }
+
+    if (level0Runs >= Level0Runs) {
+        level = 0;
+        return true;
+    }
+
+    for (uint32_t l = 1; l < levelBytes.size(); l++) {
+        if (levelBytes[l] > LevelBudget(l)) {
+            level = l;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool LsmStorage::PickCompaction(const char* tablePath, LsmTable& table, Compaction& job)
+{
+    uint32_t level;
+    if (!NeedsCompaction(table, level)) {
+        return false;
+    }
+
+    job.tablePath = tablePath;
+    job.level = level + 1;
+    job.seq = table.nextSeq++;
+    job.inputs.clear();
+    job.dropTombstones = true;
+
+    // runs are sorted by precedence already, so the inputs are too
+    for (const RunPtr& run : table.runs) {
+        if (run->level == level || run->level == job.level) {
+            job.inputs.push_back(run);
+        } else if (run->level > job.level) {
+            job.dropTombstones = false;
+        }
+    }
+
+    table.compacting = true;
+    return true;
+}
+
+bool LsmStorage::Merge(const Compaction& job, RunPtr& output)
+{
+    RunWriter writer(RunPath(job.tablePath.c_str(), job.level, job.seq));
+    std::vector<size_t> pos(job.inputs.size(), 0);
+    std::vector<uint8_t> body;
+
+    while (true) {
+        bool found = false;
+        ObjId next = 0;
+        for (size_t i = 0; i < job.inputs.size(); i++) {
+            const auto& index = job.inputs[i]->index;
+            if (pos[i] < index.size() && (!found || index[pos[i]].id < next)) {
+                next = index[pos[i]].id;
+                found = true;
+            }
+        }
+
+        if (!found) {
+            break;
+        }
+
+        // the first input holding the id has the newest version, the rest are shadowed
+        const Run* from = nullptr;
+        const IndexEntry* entry = nullptr;
+        for (size_t i = 0; i < job.inputs.size(); i++) {
+            const auto& index = job.inputs[i]->index;
+            if (pos[i] < index.size() && index[pos[i]].id == next) {
+                if (entry == nullptr) {
+                    from = job.inputs[i].get();
+                    entry = &index[pos[i]];
+                }
+                pos[i]++;
+            }
+        }
+
+        if (entry->length == TombstoneLength) {
+            if (!job.dropTombstones) {
+                writer.Add(next, TombstoneLength, 0, nullptr);
+            }
+            continue;
+        }
+
+        body.resize(entry->length);
+        if (!from->file->ReadAt(entry->offset, body.data(), entry->length) ||
+                entry->crc != crc32(body.data(), entry->length - sizeof(ObjId))) {
+            LOG("Error reading run while merging:");
+            LOG(from->path.c_str());
+            return false;
+        }
+
+        if (!writer.Add(next, entry->length, entry->crc, body.data())) {
+            return false;
+        }
+    }
+
+    output = writer.Empty() ? nullptr : writer.Finish(job.level, job.seq);
+    return writer.Empty() || output != nullptr;
+}
+
+void LsmStorage::Install(const Compaction& job, RunPtr output, bool merged)
+{
+    // Close waits for merges to finish, so the table is still open
+    LsmTable& table = mTables[job.tablePath];
+    table.compacting = false;
+
+    if (!merged) {
+        LOG("Error merging runs, compaction stalled until the next flush");
+        table.stalled = true;
+        return;
+    }
+
+    // Deepest inputs go first. If we die part way through, whatever is left
+    // shadows the merged run with the same or newer versions, never older ones
+    for (auto in = job.inputs.rbegin(); in != job.inputs.rend(); ++in) {
+        const RunPtr& run = *in;
+        table.runs.erase(std::remove(table.runs.begin(), table.runs.end(), run), table.runs.end());
+        run->file.reset();
+        DirectoryWrapper::Delete(run->path.c_str());
+    }
+
+    if (output) {
+        table.runs.push_back(output);
+    }
+    SortRuns(table);
+}
+
+void LsmStorage::ScheduleCompaction(const char* tablePath, LsmTable& table)
+{
+    uint32_t level;
+    if (!NeedsCompaction(table, level)) {
+        return;
+    }
+
+#if LSM_BACKGROUND_COMPACTION
+    (void)tablePath;
+    if (!mWorker.joinable()) {
+        mWorker = std::thread(&LsmStorage::Worker, this);
+    }
+    mWake.notify_one();
+#else
+    Compaction job;
+    while (PickCompaction(tablePath, table, job)) {
+        RunPtr output;
+        bool merged = Merge(job, output);
+        Install(job, output, merged);
+    }
+#endif
+}
+
+#if LSM_BACKGROUND_COMPACTION
+void LsmStorage::Worker()
+{
+    Lock lock = Acquire();
+    while (!mStopping) {
+        Compaction job;
+        bool picked = false;
+        for (auto& [path, table] : mTables) {
+            if (PickCompaction(path.c_str(), table, job)) {
+                picked = true;
+                break;
+            }
+        }
+
+        if (!picked) {
+            mIdle.notify_all();
+            mWake.wait(lock);
+            continue;
+        }
+
+        // inputs are immutable and the output isn't visible yet, so merge without the lock
+        lock.unlock();
+        RunPtr output;
+        bool merged = Merge(job, output);
+        lock.lock();
+
+        Install(job, output, merged);
+        mIdle.notify_all();
+    }
+}
+#endif
+
+void LsmStorage::WaitForCompaction()
+{
+#if LSM_BACKGROUND_COMPACTION
+    Lock lock = Acquire();
+    mIdle.wait(lock, [this] {
+        for (const auto& [path, table] : mTables) {
+            uint32_t level;
+            if (table.compacting || NeedsCompaction(table, level)) {
+                return mStopping;
+            }
+        }
+        return true;
+    });
+#endif
+}
+
+void LsmStorage::Close(const char* pathPrefix)
+{
+    Lock lock = Acquire();
+
+#if LSM_BACKGROUND_COMPACTION
+    mIdle.wait(lock, [this, pathPrefix] {
+        for (const auto& [path, table] : mTables) {
+            if (table.compacting && PathHasPrefix(path.c_str(), pathPrefix)) {
+                return false;
+            }
+        }
+        return true;
+    });
+#endif
+
+    for (auto it = mTables.begin(); it != mTables.end();) {
+        if (PathHasPrefix(it->first.c_str(), pathPrefix)) {
+            it = mTables.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
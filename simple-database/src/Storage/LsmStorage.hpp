@@ -0,0 +1,213 @@
+#ifndef _LSMSTORAGE_HPP_
+#define _LSMSTORAGE_HPP_
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "StorageEngine.hpp"
+#include "FileWrapper.hpp"
+
+// FatFS is built without reentrancy and FileWrapper::ReadAt isn't atomic on windows,
+// so those builds compact inline on the write path instead
+#ifndef LSM_BACKGROUND_COMPACTION
+#if USE_FF || defined(_WIN32)
+#define LSM_BACKGROUND_COMPACTION 0
+#else
+#define LSM_BACKGROUND_COMPACTION 1
+#endif
+#endif
+
+#if LSM_BACKGROUND_COMPACTION
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#endif
+
+/**
+ * LsmStorage
+ * Log structured merge tree per table, for tables that take bursts of writes
+ *
+ * Saves and deletes land in an in-memory memtable, backed by <table>/lsm.wal so they
+ * survive a restart, a batch goes into the wal as a single write. Once the memtable is big
+ * enough it is written out as an immutable sorted run, <table>/L<level>-<seq>.run, with a
+ * bloom filter on ids so lookups can skip runs that don't hold the record.
+ *
+ * Runs are merged level by level: level 0 once there are enough runs in it, every deeper
+ * level once it outgrows its byte budget. Merging happens on a background thread on native
+ * builds and inline after a flush on FF builds. Deletes are tombstones until they reach the
+ * deepest level.
+ *
+ * A lookup checks the memtable, then level 0 newest first, then the deeper levels in order.
+ * Scans merge all of them in id order.
+ */
+class LsmStorage : public StorageEngine {
+    public:
+        static constexpr const char* WalFileName = "lsm.wal";
+
+        // the memtable is flushed to a level 0 run past this many bytes
+        static const uint32_t MemtableLimit = 64 * 1024;
+        // level 0 is merged into level 1 once it has this many runs
+        static const uint32_t Level0Runs = 4;
+        // level 1 may grow to this many bytes, every level after it 10x the one before
+        static const uint32_t Level1Bytes = 256 * 1024;
+        static const uint32_t LevelMultiplier = 10;
+
+        static const uint32_t BloomBitsPerKey = 10;
+        static const uint32_t BloomHashes = 7;
+
+        LsmStorage() = default;
+        ~LsmStorage() override;
+
+        uint32_t Read(const char* tablePath, ObjId id, void* data) override;
+        bool Exists(const char* tablePath, ObjId id) override;
+        bool Write(const char* tablePath, ObjId id, const void* data, uint32_t len, uint32_t crc) override;
+        bool Remove(const char* tablePath, ObjId id) override;
+
+        bool WriteBatch(const char* tablePath, const BatchRecord* records, size_t count) override;
+        bool RemoveBatch(const char* tablePath, const ObjId* ids, size_t count) override;
+
+        bool Open(const char* tablePath, TableCursor& cursor) override;
+        bool Next(TableCursor& cursor, ObjId& id) override;
+
+        void Close(const char* pathPrefix) override;
+
+        /**
+         * Flush - Write out the memtable of a table as a level 0 run now
+         */
+        bool Flush(const char* tablePath);
+
+        /**
+         * WaitForCompaction - Block until every table is done merging
+         */
+        void WaitForCompaction();
+
+        /**
+         * RunCount - Number of runs a table has at `level`
+         */
+        size_t RunCount(const char* tablePath, uint32_t level);
+
+    private:
+        // wal entries, a tombstone has no body
+        struct EntryHeader {
+            ObjId id;
+            uint32_t length;
+            uint32_t crc;
+        };
+
+        struct IndexEntry {
+            ObjId id;
+            uint32_t offset;
+            uint32_t length;
+            uint32_t crc;
+            uint32_t reserved;
+        };
+
+        // a run is the record bodies in id order, the index, the bloom filter and then this
+        struct RunFooter {
+            uint32_t magic;
+            uint32_t count;
+            uint32_t indexOffset;
+            uint32_t indexCrc;
+            uint32_t bloomOffset;
+            uint32_t bloomBytes;
+        };
+
+        struct Run {
+            uint32_t level = 0;
+            uint32_t seq = 0;
+            uint32_t size = 0;
+            std::string path;
+            std::unique_ptr<FileWrapper> file;
+            std::vector<IndexEntry> index;
+            std::vector<uint8_t> bloom;
+
+            bool MayContain(ObjId id) const;
+            const IndexEntry* Find(ObjId id) const;
+            const IndexEntry* LowerBound(ObjId id) const;
+        };
+        using RunPtr = std::shared_ptr<Run>;
+
+        struct MemEntry {
+            std::vector<uint8_t> data;
+            uint32_t crc = 0;
+            bool removed = false;
+        };
+
+        struct LsmTable {
+            std::map<ObjId, MemEntry> memtable;
+            uint32_t memBytes = 0;
+            std::unique_ptr<FileWrapper> wal;
+            uint32_t walTail = 0;
+            std::vector<RunPtr> runs;  // level 0 newest first, then level 1, 2...
+            uint32_t nextSeq = 1;
+            bool compacting = false;
+            bool stalled = false;      // last merge failed, don't retry until the next flush
+        };
+
+        struct Compaction {
+            std::string tablePath;
+            std::vector<RunPtr> inputs;  // newest first
+            uint32_t level = 0;          // of the output
+            uint32_t seq = 0;
+            bool dropTombstones = false;
+        };
+
+        // where the newest version of a record lives, `mem` or `run` + `entry`
+        struct Version {
+            const MemEntry* mem = nullptr;
+            const Run* run = nullptr;
+            const IndexEntry* entry = nullptr;
+
+            bool Found() const { return mem != nullptr || entry != nullptr; }
+            bool Removed() const;
+        };
+
+        class RunWriter;
+
+        static const uint32_t Magic = 0x4e55524c; // "LRUN"
+        static const uint32_t TombstoneLength = UINT32_MAX;
+
+#if LSM_BACKGROUND_COMPACTION
+        using Lock = std::unique_lock<std::mutex>;
+        Lock Acquire() { return Lock(mMutex); }
+#else
+        struct Lock { ~Lock() {} };
+        Lock Acquire() { return {}; }
+#endif
+
+        LsmTable* OpenTree(const char* tablePath, bool create);
+        bool Replay(LsmTable& table);
+        bool LoadRuns(const char* tablePath, LsmTable& table);
+        RunPtr LoadRun(const char* path, uint32_t level, uint32_t seq);
+        static StoragePath RunPath(const char* tablePath, uint32_t level, uint32_t seq);
+        static void SortRuns(LsmTable& table);
+
+        bool Append(LsmTable& table, const EntryHeader& header, const void* data);
+        bool AppendBatch(LsmTable& table, const std::vector<uint8_t>& entries);
+        void Put(LsmTable& table, ObjId id, MemEntry&& entry);
+        bool Flush(const char* tablePath, LsmTable& table);
+        Version Find(const LsmTable& table, ObjId id) const;
+
+        static uint64_t LevelBudget(uint32_t level);
+        bool NeedsCompaction(const LsmTable& table, uint32_t& level) const;
+        bool PickCompaction(const char* tablePath, LsmTable& table, Compaction& job);
+        bool Merge(const Compaction& job, RunPtr& output);
+        void Install(const Compaction& job, RunPtr output, bool merged);
+        void ScheduleCompaction(const char* tablePath, LsmTable& table);
+
+        std::unordered_map<std::string, LsmTable> mTables;
+
+#if LSM_BACKGROUND_COMPACTION
+        void Worker();
+
+        std::mutex mMutex;
+        std::condition_variable mWake;
+        std::condition_variable mIdle;
+        std::thread mWorker;
+        bool mStopping = false;
+#endif
+};
+
+#endif //_LSMSTORAGE_HPP_
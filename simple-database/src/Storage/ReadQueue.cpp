@@ -0,0 +1,330 @@
+#include "ReadQueue.hpp"
+#include "FileWrapper.hpp"
+#include "logging.hpp"
+
+#if DB_IO_URING
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+ReadQueue::~ReadQueue()
+{
+#if DB_READ_THREADS
+    {
+        std::lock_guard<std::mutex> lock(mPoolLock);
+        mStopping = true;
+    }
+    mWake.notify_all();
+    for (std::thread& worker : mWorkers) {
+        worker.join();
+    }
+#endif
+
+#if DB_IO_URING
+    TearDownRing();
+#endif
+}
+
+void ReadQueue::Read(Request* requests, size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        requests[i].result = -1;
+    }
+    if (count == 0) {
+        return;
+    }
+
+#if DB_IO_URING || DB_READ_THREADS
+    std::lock_guard<std::mutex> group(mGroupLock);
+#endif
+
+#if DB_IO_URING
+    if (ReadWithRing(requests, count)) {
+        return;
+    }
+#endif
+
+#if DB_READ_THREADS
+    if (count > 1) {
+        ReadWithThreads(requests, count);
+        return;
+    }
+#endif
+
+    for (size_t i = 0; i < count; i++) {
+        ReadOne(requests[i]);
+    }
+}
+
+void ReadQueue::ReadOne(Request& request)
+{
+    FileWrapper f(request.path, "rb");
+    if (!f.DidOpen()) {
+        request.result = -1;
+        return;
+    }
+
+    uint32_t len = f.Size() < request.capacity ? f.Size() : request.capacity;
+    request.result = len == 0 || f.Read(request.data, len) ? (int64_t)len : -1;
+}
+
+#if DB_IO_URING
+
+bool ReadQueue::SetUpRing()
+{
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int fd = (int)syscall(__NR_io_uring_setup, RingEntries, &params);
+    if (fd < 0) {
+        LOG("io_uring unavailable, reading with threads");
+        mRingFailed = true;
+        return false;
+    }
+    mRingFd = fd;
+
+    mSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    mCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMap) {
+        mSqRingSize = mSqRingSize > mCqRingSize ? mSqRingSize : mCqRingSize;
+        mCqRingSize = mSqRingSize;
+    }
+
+    void* sqRing = mmap(nullptr, mSqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    mSqRing = sqRing == MAP_FAILED ? nullptr : sqRing;
+    if (mSqRing != nullptr && singleMap) {
+        mCqRing = mSqRing;
+    } else if (mSqRing != nullptr) {
+        void* cqRing = mmap(nullptr, mCqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        mCqRing = cqRing == MAP_FAILED ? nullptr : cqRing;
+    }
+
+    mSqesSize = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, mSqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    mSqes = sqes == MAP_FAILED ? nullptr : sqes;
+
+    if (mSqRing == nullptr || mCqRing == nullptr || mSqes == nullptr) {
+        LOG("Error mapping the io_uring, reading with threads");
+        mRingFailed = true;
+        TearDownRing();
+        return false;
+    }
+
+    uint8_t* sq = (uint8_t*)mSqRing;
+    uint8_t* cq = (uint8_t*)mCqRing;
+    mSqEntries = params.sq_entries < RingEntries ? params.sq_entries : RingEntries;
+    mSqTail = (unsigned*)(sq + params.sq_off.tail);
+    mSqMask = (unsigned*)(sq + params.sq_off.ring_mask);
+    mSqArray = (unsigned*)(sq + params.sq_off.array);
+    mCqHead = (unsigned*)(cq + params.cq_off.head);
+    mCqTail = (unsigned*)(cq + params.cq_off.tail);
+    mCqMask = (unsigned*)(cq + params.cq_off.ring_mask);
+    mCqes = cq + params.cq_off.cqes;
+    return true;
+}
+
+void ReadQueue::TearDownRing()
+{
+    if (mSqes != nullptr) {
+        munmap(mSqes, mSqesSize);
+    }
+    if (mCqRing != nullptr && mCqRing != mSqRing) {
+        munmap(mCqRing, mCqRingSize);
+    }
+    if (mSqRing != nullptr) {
+        munmap(mSqRing, mSqRingSize);
+    }
+    if (mRingFd >= 0) {
+        close(mRingFd);
+    }
+
+    mSqes = nullptr;
+    mCqRing = nullptr;
+    mSqRing = nullptr;
+    mRingFd = -1;
+}
+
+static io_uring_sqe* PrepareEntry(void* sqes, unsigned* sqTail, unsigned* sqMask, unsigned* sqArray, size_t n, uint8_t opcode)
+{
+    // only this thread moves the tail, the kernel only reads it
+    unsigned index = (*sqTail + (unsigned)n) & *sqMask;
+    io_uring_sqe* sqe = (io_uring_sqe*)sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = opcode;
+    sqe->user_data = n;
+    sqArray[index] = index;
+    return sqe;
+}
+
+bool ReadQueue::SubmitAndWait(size_t count, int64_t* results)
+{
+    __atomic_store_n(mSqTail, *mSqTail + (unsigned)count, __ATOMIC_RELEASE);
+
+    size_t submitted = 0;
+    size_t reaped = 0;
+    while (reaped < count) {
+        int ret = (int)syscall(__NR_io_uring_enter, mRingFd, (unsigned)(count - submitted), 1, IORING_ENTER_GETEVENTS, nullptr, 0);
+        if (ret < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        submitted += ret;
+
+        unsigned head = *mCqHead;
+        unsigned tail = __atomic_load_n(mCqTail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            io_uring_cqe* cqe = (io_uring_cqe*)mCqes + (head & *mCqMask);
+            if (cqe->user_data < RingEntries) {
+                results[cqe->user_data] = cqe->res;
+            }
+            head++;
+            reaped++;
+        }
+        __atomic_store_n(mCqHead, head, __ATOMIC_RELEASE);
+    }
+
+    return true;
+}
+
+bool ReadQueue::ReadWithRing(Request* requests, size_t count)
+{
+    if (mRingFd < 0 && (mRingFailed || !SetUpRing())) {
+        return false;
+    }
+
+    int64_t results[RingEntries];
+    int fds[RingEntries];
+    int64_t wanted[RingEntries];
+    int64_t done[RingEntries];
+    for (size_t start = 0; start < count; start += mSqEntries) {
+        size_t n = count - start < mSqEntries ? count - start : mSqEntries;
+        Request* group = requests + start;
+
+        // the opens, then the reads, each as a single submission
+        for (size_t i = 0; i < n; i++) {
+            io_uring_sqe* sqe = PrepareEntry(mSqes, mSqTail, mSqMask, mSqArray, i, IORING_OP_OPENAT);
+            sqe->fd = AT_FDCWD;
+            sqe->addr = (uint64_t)(uintptr_t)group[i].path;
+            sqe->open_flags = O_RDONLY | O_CLOEXEC;
+            results[i] = -1;
+        }
+        bool ringWorks = SubmitAndWait(n, results);
+
+        size_t reads = 0;
+        for (size_t i = 0; i < n; i++) {
+            fds[i] = ringWorks && results[i] >= 0 ? (int)results[i] : -1;
+            // the kernel doesn't know the opcode, nothing else will work either
+            ringWorks = ringWorks && results[i] != -EINVAL;
+        }
+
+        // as much as ReadOne would read, -1 once a file can't be read
+        for (size_t i = 0; i < n; i++) {
+            struct stat st;
+            wanted[i] = fds[i] >= 0 && fstat(fds[i], &st) == 0 ? (st.st_size < group[i].capacity ? st.st_size : group[i].capacity) : -1;
+            done[i] = 0;
+        }
+
+        // a read can come back short, the rest is asked for again until it's all there
+        while (ringWorks) {
+            reads = 0;
+            for (size_t i = 0; i < n; i++) {
+                if (wanted[i] < 0 || done[i] == wanted[i]) {
+                    continue;
+                }
+                io_uring_sqe* sqe = PrepareEntry(mSqes, mSqTail, mSqMask, mSqArray, reads, IORING_OP_READ);
+                sqe->fd = fds[i];
+                sqe->addr = (uint64_t)(uintptr_t)(group[i].data + done[i]);
+                sqe->len = (uint32_t)(wanted[i] - done[i]);
+                sqe->off = (uint64_t)done[i];
+                sqe->user_data = i;
+                results[i] = -1;
+                reads++;
+            }
+            if (reads == 0) {
+                break;
+            }
+
+            ringWorks = SubmitAndWait(reads, results);
+            for (size_t i = 0; ringWorks && i < n; i++) {
+                if (wanted[i] < 0 || done[i] == wanted[i]) {
+                    continue;
+                }
+                // nothing more to read before the end means the file was cut short under us
+                if (results[i] <= 0) {
+                    wanted[i] = -1;
+                } else {
+                    done[i] += results[i];
+                }
+            }
+        }
+
+        for (size_t i = 0; i < n; i++) {
+            if (fds[i] >= 0) {
+                close(fds[i]);
+            }
+            group[i].result = wanted[i] >= 0 && done[i] == wanted[i] ? done[i] : -1;
+        }
+
+        if (!ringWorks) {
+            LOG("Error reading through io_uring, reading with threads");
+            mRingFailed = true;
+            TearDownRing();
+            return false;
+        }
+    }
+
+    return true;
+}
+
+#endif
+
+#if DB_READ_THREADS
+
+void ReadQueue::ReadWithThreads(Request* requests, size_t count)
+{
+    std::unique_lock<std::mutex> lock(mPoolLock);
+    while (mWorkers.size() < DB_READ_THREADS) {
+        mWorkers.emplace_back(&ReadQueue::Work, this);
+    }
+
+    mRequests = requests;
+    mCount = count;
+    mNext = 0;
+    mUnfinished = count;
+    mWake.notify_all();
+
+    mDone.wait(lock, [this]() { return mUnfinished == 0; });
+    mRequests = nullptr;
+    mCount = 0;
+    mNext = 0;
+}
+
+void ReadQueue::Work()
+{
+    std::unique_lock<std::mutex> lock(mPoolLock);
+    while (true) {
+        mWake.wait(lock, [this]() { return mStopping || mNext < mCount; });
+        if (mStopping) {
+            return;
+        }
+
+        Request& request = mRequests[mNext++];
+        lock.unlock();
+        ReadOne(request);
+        lock.lock();
+
+        if (--mUnfinished == 0) {
+            mDone.notify_one();
+        }
+    }
+}
+
+#endif
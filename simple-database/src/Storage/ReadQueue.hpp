@@ -0,0 +1,122 @@
+#ifndef _READQUEUE_HPP_
+#define _READQUEUE_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+
+// io_uring is used where the kernel headers have it, native builds elsewhere fall back to
+// a small pool of threads. FatFS is built without reentrancy, so FF reads one file at a time
+#ifndef DB_IO_URING
+#if !USE_FF && defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define DB_IO_URING 1
+#endif
+#endif
+#endif
+#ifndef DB_IO_URING
+#define DB_IO_URING 0
+#endif
+
+#ifndef DB_READ_THREADS
+#if USE_FF
+#define DB_READ_THREADS 0
+#else
+#define DB_READ_THREADS 4
+#endif
+#endif
+
+#if DB_IO_URING || DB_READ_THREADS
+#include <mutex>
+#endif
+#if DB_READ_THREADS
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#endif
+
+/**
+ * ReadQueue
+ * Reads a group of whole files with every read in flight at once
+ *
+ * On linux the opens and then the reads are each submitted through io_uring as one batch.
+ * If the ring can't be set up (old kernel, seccomp) the group is handed to a pool of
+ * threads instead, and with neither the files are read one after the other.
+ */
+class ReadQueue {
+    public:
+        struct Request {
+            const char* path;
+            uint8_t* data;
+            uint32_t capacity;
+            // bytes read, at most capacity, -1 if the file couldn't be opened or read
+            int64_t result;
+        };
+
+        ReadQueue() = default;
+        ~ReadQueue();
+
+        /**
+         * Read - Read up to `capacity` bytes from the start of every requested file
+         * Only one group is read at a time, other callers wait their turn
+         */
+        void Read(Request* requests, size_t count);
+
+        /**
+         * Concurrent - Whether reads in a group overlap at all in this build
+         */
+        static bool Concurrent() { return DB_IO_URING || DB_READ_THREADS > 0; }
+
+    private:
+        ReadQueue(const ReadQueue&) = delete;
+        ReadQueue& operator=(const ReadQueue&) = delete;
+
+        static void ReadOne(Request& request);
+
+#if DB_IO_URING
+        static const unsigned RingEntries = 64;
+
+        bool SetUpRing();
+        void TearDownRing();
+        bool ReadWithRing(Request* requests, size_t count);
+        // submit `count` prepared entries and wait for all of them, each result lands at its user_data
+        bool SubmitAndWait(size_t count, int64_t* results);
+
+        int mRingFd = -1;
+        bool mRingFailed = false;
+        void* mSqRing = nullptr;
+        size_t mSqRingSize = 0;
+        void* mCqRing = nullptr;
+        size_t mCqRingSize = 0;
+        void* mSqes = nullptr;
+        size_t mSqesSize = 0;
+        unsigned mSqEntries = 0;
+        unsigned* mSqTail = nullptr;
+        unsigned* mSqMask = nullptr;
+        unsigned* mSqArray = nullptr;
+        unsigned* mCqHead = nullptr;
+        unsigned* mCqTail = nullptr;
+        unsigned* mCqMask = nullptr;
+        void* mCqes = nullptr;
+#endif
+
+#if DB_READ_THREADS
+        void ReadWithThreads(Request* requests, size_t count);
+        void Work();
+
+        std::mutex mPoolLock;
+        std::condition_variable mWake;
+        std::condition_variable mDone;
+        std::vector<std::thread> mWorkers;
+        Request* mRequests = nullptr;
+        size_t mCount = 0;
+        size_t mNext = 0;
+        size_t mUnfinished = 0;
+        bool mStopping = false;
+#endif
+
+#if DB_IO_URING || DB_READ_THREADS
+        std::mutex mGroupLock;
+#endif
+};
+
+#endif //_READQUEUE_HPP_
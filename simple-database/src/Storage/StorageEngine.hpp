@@ -0,0 +1,187 @@
+#ifndef _STORAGEENGINE_HPP_
+#define _STORAGEENGINE_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include "DirectoryWrapper.hpp"
+#include "FixedLengthString.hpp"
+
+typedef uint64_t ObjId;
+using StoragePath = FixedLengthString<PATH_MAX>;
+
+enum class StorageType {
+    File,   // one file per record, the original layout
+    FileFanOut, // one file per record, spread over two levels of subdirectories
+    Log,    // one append-only log per table with an in-memory id index
+    BTree,  // one paged B+tree file per table keyed on id
+    Lsm,    // memtable + sorted runs per table, merged in the background
+};
+
+/**
+ * TableCursor
+ * Position of a scan through a single table, optionally limited to an inclusive range of ids
+ * Ordered engines resume from the last id handed out, the file engine walks the table directory
+ */
+class TableCursor {
+    public:
+        bool DidOpen() const { return mDidOpen; }
+        const StoragePath& TablePath() const { return mTablePath; }
+
+        // engines that walk nested directories keep one open per level, 0 is the table itself
+        static const size_t MaxDepth = 3;
+        DirectoryWrapper& Directory(size_t depth = 0) { return mDirectories[depth]; }
+        size_t Depth() const { return mDepth; }
+        void Depth(size_t depth) { mDepth = depth; }
+
+        // the driver's id for the table being scanned, engines leave it alone
+        uint32_t TableId() const { return mTableId; }
+        void TableId(uint32_t tableId) { mTableId = tableId; }
+
+        bool Started() const { return mStarted; }
+        ObjId Position() const { return mPosition; }
+
+        ObjId First() const { return mFirst; }
+        ObjId Last() const { return mLast; }
+        bool InRange(ObjId id) const { return id >= mFirst && id <= mLast; }
+
+        // Limit the scan to ids in [first, last], must be set before the scan starts
+        void Range(ObjId first, ObjId last)
+        {
+            mFirst = first;
+            mLast = last;
+        }
+
+        void Reset(const char* tablePath, bool didOpen)
+        {
+            mTablePath = tablePath;
+            mDidOpen = didOpen;
+            mStarted = false;
+            mPosition = 0;
+            mDepth = 0;
+        }
+
+        void Advance(ObjId id)
+        {
+            mStarted = true;
+            mPosition = id;
+        }
+
+    private:
+        // PATH_MAX isn't guaranteed to agree between translation units on FF builds,
+        // so anything read by the inline accessors sits ahead of the path sized members
+        ObjId mPosition = 0;
+        ObjId mFirst = 0;
+        ObjId mLast = UINT64_MAX;
+        bool mStarted = false;
+        bool mDidOpen = false;
+        size_t mDepth = 0;
+        uint32_t mTableId = 0;
+        StoragePath mTablePath;
+        DirectoryWrapper mDirectories[MaxDepth];
+};
+
+/**
+ * BatchRecord
+ * One record of a WriteBatch, laid out the same as a single Write
+ */
+struct BatchRecord {
+    ObjId id;
+    const void* data;
+    uint32_t len;
+    uint32_t crc;
+};
+
+/**
+ * StorageEngine
+ * Everything that touches record bytes on disk goes through one of these
+ * Tables are identified by their directory path, records are the serialized body
+ * followed by the commit id, and the CRC only covers the body
+ */
+class StorageEngine {
+    public:
+        virtual ~StorageEngine() = default;
+
+        /**
+         * Read - Load a record into `data`
+         * @return length of the body + commit id, 0 if it is missing or fails its CRC
+         */
+        virtual uint32_t Read(const char* tablePath, ObjId id, void* data) = 0;
+
+        /**
+         * View - Point at a record where it already sits in memory instead of copying it out
+         * The record is laid out the same as Read would write it to `data`
+         * @return nullptr if the engine can't, otherwise valid until the table is next written to
+         */
+        virtual const uint8_t* View(const char* /*tablePath*/, ObjId /*id*/, uint32_t& /*len*/) { return nullptr; }
+
+        /**
+         * ReadMany - Read a group of records, engines that can have every read in flight at once
+         * Record i goes to `data + i * stride`, with 4 bytes of room past it for the crc
+         * `lens[i]` is set the same as Read would return for it
+         */
+        virtual void ReadMany(const char* tablePath, const ObjId* ids, size_t count, uint8_t* data, uint32_t stride, uint32_t* lens)
+        {
+            for (size_t i = 0; i < count; i++) {
+                lens[i] = Read(tablePath, ids[i], data + i * stride);
+            }
+        }
+
+        virtual bool Exists(const char* tablePath, ObjId id) = 0;
+        virtual bool Write(const char* tablePath, ObjId id, const void* data, uint32_t len, uint32_t crc) = 0;
+        virtual bool Remove(const char* tablePath, ObjId id) = 0;
+
+        /**
+         * WriteBatch / RemoveBatch - Write or remove a group of records in one go
+         * Engines that can group them make the whole batch durable with a single sync,
+         * the rest just go one record at a time
+         */
+        virtual bool WriteBatch(const char* tablePath, const BatchRecord* records, size_t count)
+        {
+            for (size_t i = 0; i < count; i++) {
+                if (!Write(tablePath, records[i].id, records[i].data, records[i].len, records[i].crc)) {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        virtual bool RemoveBatch(const char* tablePath, const ObjId* ids, size_t count)
+        {
+            bool removed = true;
+            for (size_t i = 0; i < count; i++) {
+                removed = Remove(tablePath, ids[i]) && removed;
+            }
+            return removed;
+        }
+
+        virtual bool Open(const char* tablePath, TableCursor& cursor) = 0;
+        virtual bool Next(TableCursor& cursor, ObjId& id) = 0;
+
+        /**
+         * Close - Release any handles & in-memory state for tables under `pathPrefix`
+         * Must be called before the directories are removed from disk
+         */
+        virtual void Close(const char* pathPrefix) = 0;
+
+    protected:
+        static StoragePath JoinPath(const char* dir, const char* name)
+        {
+            StoragePath fp = dir;
+            size_t len = strlen(fp);
+            strncat(fp, "/", fp.size() - 1 - len);
+            strncat(fp, name, fp.size() - 1 - MIN(fp.size() - 1, len + 1));
+            return fp;
+        }
+
+        static bool PathHasPrefix(const char* path, const char* prefix)
+        {
+            size_t len = strlen(prefix);
+            if (len == 0 || strncmp(path, prefix, len) != 0) {
+                return false;
+            }
+            return path[len] == '\0' || path[len] == '/' || prefix[len - 1] == '/';
+        }
+};
+
+#endif //_STORAGEENGINE_HPP_
@@ -0,0 +1,398 @@
+#include "WalStorage.hpp"
+#include <memory>
+#include "FileWrapper.hpp"
+#include "crc.h"
+#include "logging.hpp"
+
+#if !USE_FF && !defined(_WIN32)
+#include <unistd.h>
+#endif
+
+WalStorage::~WalStorage()
+{
+    Detach();
+}
+
+bool WalStorage::Attach(StorageEngine* engine, const char* dbPath, const WalOptions& options)
+{
+    Detach();
+
+    mEngine = engine;
+    mOptions = options;
+    if (mOptions.groupCommit == 0) {
+        mOptions.groupCommit = 1;
+    }
+    mWalPath = JoinPath(dbPath, WalFileName).data();
+
+    // left as it is for the next attach to try again, nothing goes through an unreplayed wal
+    if (!Replay()) {
+        mEngine = nullptr;
+        return false;
+    }
+    return true;
+}
+
+void WalStorage::Detach()
+{
+    if (mEngine == nullptr) {
+        return;
+    }
+
+    if (!Commit()) {
+        ApplyUnlogged();
+    }
+    Checkpoint();
+    mEngine = nullptr;
+}
+
+const WalStorage::Pending* WalStorage::FindPending(const char* tablePath, ObjId id) const
+{
+    if (mGroup.empty()) {
+        return nullptr;
+    }
+
+    auto it = mGroupIndex.find({tablePath, id});
+    return it == mGroupIndex.end() ? nullptr : &mGroup[it->second];
+}
+
+void WalStorage::Add(const char* tablePath, ObjId id, const void* data, uint32_t len, uint32_t crc, bool removed)
+{
+    Pending entry = {tablePath, id, removed, crc, {}};
+    if (!removed) {
+        entry.data.assign((const uint8_t*)data, (const uint8_t*)data + len);
+    }
+
+    mGroupIndex[{entry.tablePath, id}] = mGroup.size();
+    mGroup.push_back(std::move(entry));
+}
+
+void WalStorage::Withdraw(size_t from)
+{
+    // what is left may have been superseded by what goes, so index it again
+    mGroup.resize(from);
+    mGroupIndex.clear();
+    for (size_t i = 0; i < mGroup.size(); i++) {
+        mGroupIndex[{mGroup[i].tablePath, mGroup[i].id}] = i;
+    }
+}
+
+void WalStorage::ApplyUnlogged()
+{
+    LOG("Applying the group without the wal");
+    for (const Pending& pending : mGroup) {
+        if (pending.removed) {
+            mEngine->Remove(pending.tablePath.c_str(), pending.id);
+        } else {
+            mEngine->Write(pending.tablePath.c_str(), pending.id, pending.data.data(), pending.data.size(), pending.crc);
+        }
+    }
+
+    mGroup.clear();
+    mGroupIndex.clear();
+}
+
+bool WalStorage::MaybeCommit()
+{
+    return mGroup.size() < mOptions.groupCommit || Commit();
+}
+
+bool WalStorage::Commit()
+{
+    if (mEngine == nullptr || mGroup.empty()) {
+        return true;
+    }
+
+    std::vector<uint8_t> entries;
+    for (const Pending& pending : mGroup) {
+        size_t start = entries.size();
+        EntryHeader header = {
+            pending.id,
+            pending.removed ? TombstoneLength : (uint32_t)pending.data.size(),
+            pending.crc,
+            (uint32_t)pending.tablePath.size(),
+            0
+        };
+
+        entries.insert(entries.end(), (const uint8_t*)&header, (const uint8_t*)&header + sizeof(header));
+        entries.insert(entries.end(), pending.tablePath.begin(), pending.tablePath.end());
+        entries.insert(entries.end(), pending.data.begin(), pending.data.end());
+
+        // covers the whole entry, with the crc field itself still zero
+        header.entryCrc = crc32(entries.data() + start, entries.size() - start);
+        memcpy(entries.data() + start + offsetof(EntryHeader, entryCrc), &header.entryCrc, sizeof(header.entryCrc));
+    }
+
+    {
+        FileWrapper wal(mWalPath.c_str(), mWalSize > 0 ? "r+b" : "w+b");
+        bool written = wal.DidOpen() &&
+            wal.Seek(mWalSize) &&
+            wal.Write(entries.data(), entries.size()) &&
+            wal.Sync();
+
+        if (!written) {
+            // nothing has reached the engine. The group has been acknowledged, so it stays and
+            // is tried again with the next commit, over whatever part of it made it into the wal
+            LOG("Error appending to the wal");
+            return false;
+        }
+    }
+    mWalSize += entries.size();
+
+    // the group is durable from here on, if applying it fails replay finishes the job
+    bool applied = true;
+    for (const Pending& pending : mGroup) {
+        if (pending.removed) {
+            mEngine->Remove(pending.tablePath.c_str(), pending.id);
+        } else {
+            applied = mEngine->Write(pending.tablePath.c_str(), pending.id, pending.data.data(), pending.data.size(), pending.crc) && applied;
+        }
+    }
+
+    mGroup.clear();
+    mGroupIndex.clear();
+
+    if (mWalSize >= mOptions.checkpointBytes) {
+        applied = Checkpoint() && applied;
+    }
+
+    return applied;
+}
+
+bool WalStorage::Checkpoint()
+{
+    if (mWalSize == 0) {
+        return true;
+    }
+
+#if USE_FF
+    // FF syncs every write as it is made
+#elif defined(_WIN32)
+    // no cheap way to sync everything at once here, the wal is emptied on trust
+#else
+    sync();
+#endif
+
+    FileWrapper wal(mWalPath.c_str(), "w+b");
+    if (!wal.DidOpen()) {
+        LOG("Error emptying the wal");
+        return false;
+    }
+
+    mWalSize = 0;
+    return true;
+}
+
+bool WalStorage::Apply(const EntryHeader& header, const char* tablePath, const uint8_t* data)
+{
+    if (header.length == TombstoneLength) {
+        // may well have been removed before the crash already
+        mEngine->Remove(tablePath, header.id);
+        return true;
+    }
+
+    if (!DirectoryWrapper::Exists(tablePath)) {
+        // the table has been dropped since
+        return true;
+    }
+
+    return mEngine->Write(tablePath, header.id, data, header.length, header.crc);
+}
+
+bool WalStorage::Replay()
+{
+    mWalSize = 0;
+    std::vector<uint8_t> wal;
+    {
+        if (!DirectoryWrapper::Exists(mWalPath.c_str())) {
+            return true;
+        }
+
+        FileWrapper f(mWalPath.c_str(), "rb");
+        if (!f.DidOpen()) {
+            return false;
+        }
+
+        wal.resize(f.Size());
+        if (!wal.empty() && !f.Read(wal.data(), wal.size())) {
+            return false;
+        }
+    }
+
+    size_t pos = 0;
+    uint32_t replayed = 0;
+    while (pos + sizeof(EntryHeader) <= wal.size()) {
+        EntryHeader header;
+        memcpy(&header, wal.data() + pos, sizeof(header));
+
+        uint32_t dataLength = header.length == TombstoneLength ? 0 : header.length;
+        size_t entryLength = sizeof(header) + (size_t)header.pathLength + dataLength;
+        if (entryLength > wal.size() - pos) {
+            break;
+        }
+
+        uint32_t entryCrc = header.entryCrc;
+        memset(wal.data() + pos + offsetof(EntryHeader, entryCrc), 0, sizeof(header.entryCrc));
+        if (entryCrc != crc32(wal.data() + pos, entryLength)) {
+            break;
+        }
+
+        std::string tablePath((const char*)wal.data() + pos + sizeof(header), header.pathLength);
+        if (!Apply(header, tablePath.c_str(), wal.data() + pos + sizeof(header) + header.pathLength)) {
+            LOG("Error replaying the wal");
+            return false;
+        }
+
+        pos += entryLength;
+        replayed++;
+    }
+
+    if (pos < wal.size()) {
+        LOG("Discarding torn entries at the end of the wal");
+    }
+    if (replayed > 0) {
+        LOG("Replayed wal entries:");
+        logging::Print(replayed);
+    }
+
+    // everything in it has been applied again, start from empty
+    mWalSize = wal.size();
+    return Checkpoint();
+}
+
+uint32_t WalStorage::Read(const char* tablePath, ObjId id, void* data)
+{
+    const Pending* pending = FindPending(tablePath, id);
+    if (pending != nullptr) {
+        if (pending->removed) {
+            return 0;
+        }
+        memcpy(data, pending->data.data(), pending->data.size());
+        return pending->data.size();
+    }
+
+    return mEngine->Read(tablePath, id, data);
+}
+
+const uint8_t* WalStorage::View(const char* tablePath, ObjId id, uint32_t& len)
+{
+    const Pending* pending = FindPending(tablePath, id);
+    if (pending != nullptr) {
+        if (pending->removed) {
+            return nullptr;
+        }
+        len = pending->data.size();
+        return pending->data.data();
+    }
+
+    return mEngine->View(tablePath, id, len);
+}
+
+void WalStorage::ReadMany(const char* tablePath, const ObjId* ids, size_t count, uint8_t* data, uint32_t stride, uint32_t* lens)
+{
+    mEngine->ReadMany(tablePath, ids, count, data, stride, lens);
+
+    // anything still in the group is newer than what the engine has
+    for (size_t i = 0; i < count && !mGroup.empty(); i++) {
+        const Pending* pending = FindPending(tablePath, ids[i]);
+        if (pending == nullptr) {
+            continue;
+        }
+        lens[i] = pending->removed ? 0 : pending->data.size();
+        if (!pending->removed) {
+            memcpy(data + i * stride, pending->data.data(), pending->data.size());
+        }
+    }
+}
+
+bool WalStorage::Exists(const char* tablePath, ObjId id)
+{
+    const Pending* pending = FindPending(tablePath, id);
+    if (pending != nullptr) {
+        return !pending->removed;
+    }
+
+    return mEngine->Exists(tablePath, id);
+}
+
+bool WalStorage::Write(const char* tablePath, ObjId id, const void* data, uint32_t len, uint32_t crc)
+{
+    size_t acknowledged = mGroup.size();
+    Add(tablePath, id, data, len, crc, false);
+    if (!MaybeCommit()) {
+        // only this write is refused, the ones before it are kept for the next commit
+        Withdraw(acknowledged);
+        return false;
+    }
+    return true;
+}
+
+bool WalStorage::Remove(const char* tablePath, ObjId id)
+{
+    if (!Exists(tablePath, id)) {
+        return false;
+    }
+
+    size_t acknowledged = mGroup.size();
+    Add(tablePath, id, nullptr, 0, 0, true);
+    if (!MaybeCommit()) {
+        Withdraw(acknowledged);
+        return false;
+    }
+    return true;
+}
+
+bool WalStorage::WriteBatch(const char* tablePath, const BatchRecord* records, size_t count)
+{
+    size_t acknowledged = mGroup.size();
+    for (size_t i = 0; i < count; i++) {
+        Add(tablePath, records[i].id, records[i].data, records[i].len, records[i].crc, false);
+    }
+
+    // a batch is always committed as a whole
+    if (!Commit()) {
+        Withdraw(acknowledged);
+        return false;
+    }
+    return true;
+}
+
+bool WalStorage::RemoveBatch(const char* tablePath, const ObjId* ids, size_t count)
+{
+    size_t acknowledged = mGroup.size();
+    bool removed = true;
+    for (size_t i = 0; i < count; i++) {
+        if (!Exists(tablePath, ids[i])) {
+            removed = false;
+            continue;
+        }
+        Add(tablePath, ids[i], nullptr, 0, 0, true);
+    }
+
+    if (!Commit()) {
+        Withdraw(acknowledged);
+        return false;
+    }
+    return removed;
+}
+
+bool WalStorage::Open(const char* tablePath, TableCursor& cursor)
+{
+    // the engine scans what it has on disk, so it needs the group first
+    Commit();
+    return mEngine->Open(tablePath, cursor);
+}
+
+bool WalStorage::Next(TableCursor& cursor, ObjId& id)
+{
+    return mEngine->Next(cursor, id);
+}
+
+void WalStorage::Close(const char* pathPrefix)
+{
+    // tables are about to be closed or deleted, nothing in the wal may point at them after
+    if (!Commit()) {
+        ApplyUnlogged();
+    }
+    Checkpoint();
+    mEngine->Close(pathPrefix);
+}
@@ -0,0 +1,120 @@
+#ifndef _WALSTORAGE_HPP_
+#define _WALSTORAGE_HPP_
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+#include "StorageEngine.hpp"
+
+/**
+ * WalOptions
+ * How DbDriver puts a write-ahead log in front of its storage engine
+ */
+struct WalOptions {
+    bool enabled = false;
+    // saves & deletes collected before they are written to the wal with a single sync,
+    // anything still collecting is lost on a crash, but never half written
+    uint32_t groupCommit = 1;
+    // once the wal grows past this the records in it are synced and it is emptied
+    uint32_t checkpointBytes = 256 * 1024;
+};
+
+/**
+ * WalStorage
+ * A write-ahead log in front of another engine, <db>/db.wal
+ *
+ * Saves & deletes are collected into a group, the group is appended to the wal and synced,
+ * and only then handed on to the engine underneath. A crash while the engine is part way
+ * through rewriting a record is fixed by replaying the wal, so a record is either the old
+ * version or the new one. The engine is never asked to sync, a checkpoint syncs everything
+ * once the wal is big enough and starts it again from empty.
+ *
+ * Reads see records still waiting in the group. Scans, and closing a table, commit the group first.
+ */
+class WalStorage : public StorageEngine {
+    public:
+        static constexpr const char* WalFileName = "db.wal";
+
+        WalStorage() = default;
+        ~WalStorage() override;
+
+        /**
+         * Attach - Log in front of `engine`, the wal lives in `dbPath`
+         * Replays anything left in the wal from before a crash
+         * @return false if it couldn't be replayed, it is left detached then
+         */
+        bool Attach(StorageEngine* engine, const char* dbPath, const WalOptions& options);
+
+        /**
+         * Detach - Commit & checkpoint everything, then stop logging
+         */
+        void Detach();
+
+        /**
+         * Commit - Write the group collected so far to the wal, sync it and apply it
+         * If the wal can't be written the group is kept, and goes with the next commit
+         */
+        bool Commit();
+
+        /**
+         * Checkpoint - Sync the engine's files and empty the wal
+         */
+        bool Checkpoint();
+
+        uint32_t Read(const char* tablePath, ObjId id, void* data) override;
+        const uint8_t* View(const char* tablePath, ObjId id, uint32_t& len) override;
+        void ReadMany(const char* tablePath, const ObjId* ids, size_t count, uint8_t* data, uint32_t stride, uint32_t* lens) override;
+        bool Exists(const char* tablePath, ObjId id) override;
+        bool Write(const char* tablePath, ObjId id, const void* data, uint32_t len, uint32_t crc) override;
+        bool Remove(const char* tablePath, ObjId id) override;
+
+        bool WriteBatch(const char* tablePath, const BatchRecord* records, size_t count) override;
+        bool RemoveBatch(const char* tablePath, const ObjId* ids, size_t count) override;
+
+        bool Open(const char* tablePath, TableCursor& cursor) override;
+        bool Next(TableCursor& cursor, ObjId& id) override;
+
+        void Close(const char* pathPrefix) override;
+
+    private:
+        // followed by the table path and the record
+        struct EntryHeader {
+            ObjId id;
+            uint32_t length;      // of the record, TombstoneLength for a delete
+            uint32_t crc;         // of the record body, as handed to the engine
+            uint32_t pathLength;
+            uint32_t entryCrc;    // of the whole entry, this header included with entryCrc as 0
+        };
+
+        struct Pending {
+            std::string tablePath;
+            ObjId id;
+            bool removed;
+            uint32_t crc;
+            std::vector<uint8_t> data;
+        };
+
+        static const uint32_t TombstoneLength = UINT32_MAX;
+
+        const Pending* FindPending(const char* tablePath, ObjId id) const;
+        void Add(const char* tablePath, ObjId id, const void* data, uint32_t len, uint32_t crc, bool removed);
+        bool MaybeCommit();
+        // takes back what was added from `from` on, when it couldn't be committed
+        void Withdraw(size_t from);
+        // the last resort when the wal can't be written and the group can't wait any longer
+        void ApplyUnlogged();
+        bool Apply(const EntryHeader& header, const char* tablePath, const uint8_t* data);
+        bool Replay();
+
+        StorageEngine* mEngine = nullptr;
+        WalOptions mOptions;
+        std::string mWalPath;
+        uint32_t mWalSize = 0;
+
+        std::vector<Pending> mGroup;
+        // newest entry in the group for each record
+        std::map<std::pair<std::string, ObjId>, size_t> mGroupIndex;
+};
+
+#endif //_WALSTORAGE_HPP_
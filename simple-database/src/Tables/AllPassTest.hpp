@@ -4,7 +4,7 @@
 
 class AllPassTest : public RecordTest {
     public:
-        virtual bool operator()(void* recordData) {
+        virtual bool operator()(const void* recordData) {
             (void)recordData;
             return true;
         };
@@ -52,7 +52,7 @@ class ChildTable {
 template <class T, class Table>
 ResultSet<T> ChildTable<T, Table>::Children(ObjId foreignKey)
 {
-    return mTable.CustomSearch(Query::ResultType::Many, [&foreignKey, this](uint8_t* data) {
+    return mTable.CustomSearch(Query::ResultType::Many, [&foreignKey, this](const uint8_t* data) {
         // deserialize the data for use in the custom filter
         T record;
         record.Deserialize(data, false);
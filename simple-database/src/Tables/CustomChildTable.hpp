@@ -17,7 +17,7 @@ class CustomChildTable : public ChildTable<T, Table>
 template <class T, class Table>
 ResultSet<T> CustomChildTable<T, Table>::Children(ObjId foreignKey)
 {
-    return this->mTable.CustomSearch(Query::ResultType::Many, [&foreignKey, this](uint8_t* data) {
+    return this->mTable.CustomSearch(Query::ResultType::Many, [&foreignKey, this](const uint8_t* data) {
         T record;
         record.Deserialize(data, false);
 
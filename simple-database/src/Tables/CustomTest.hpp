@@ -10,13 +10,14 @@ class CustomTest : public RecordTest {
     public:
         CustomTest(Functor test) : test{test} {}
 
-        bool operator()(void* recordData) override {
+        bool operator()(const void* recordData) override {
             if constexpr (std::is_convertible<Functor, std::function<bool(T*)>>::value) {
                 T record;
-                record.Deserialize((uint8_t*)recordData, false);
+                record.Deserialize((const uint8_t*)recordData, false);
                 return test((T*)&record);
             } else {
-                return test((uint8_t*)recordData);
+                // a mapped record is read only, the test gets to look at it and no more
+                return test((const uint8_t*)recordData);
             }
         }
     private:
@@ -14,8 +14,10 @@ class MaskTest : public RecordTest {
             propertyPos = record.NonCompactPropertyPosition(query.propertyName);
         }
 
-        bool operator()(void* recordData) override {
-            return *(M*)((uint8_t*)recordData + propertyPos) & mask;
+        bool operator()(const void* recordData) override {
+            M value;
+            memcpy(&value, (const uint8_t*)recordData + propertyPos, sizeof(value));
+            return value & mask;
         }
     private:
         T& record;
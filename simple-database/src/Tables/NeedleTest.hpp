@@ -29,13 +29,13 @@ class NeedleTest : public RecordTest {
             }
         };
 
-        bool operator()(void* recordData) override {
+        bool operator()(const void* recordData) override {
             if (property == nullptr) {
                 return false;
             }
 
-            uint32_t len = property->Deserialize((uint8_t*)recordData + propertyPos);
-            bool bufferMatch = 0 == memcmp((uint8_t*)recordData + propertyPos + comparisonOffset, query.needle, query.needleLen);
+            uint32_t len = property->Deserialize((const uint8_t*)recordData + propertyPos);
+            bool bufferMatch = 0 == memcmp((const uint8_t*)recordData + propertyPos + comparisonOffset, query.needle, query.needleLen);
             bool lengthMatch = query.needleLen == len - comparisonOffset;
             return bufferMatch && (!query.exactMatch || lengthMatch);
         }
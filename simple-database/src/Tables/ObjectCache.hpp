@@ -0,0 +1,174 @@
+#ifndef _OBJECTCACHE_HPP_
+#define _OBJECTCACHE_HPP_
+
+#include <stddef.h>
+#include <stdint.h>
+#include <functional>
+#include <list>
+#include <memory>
+#include <unordered_map>
+#include "StorageEngine.hpp"
+
+// FatFS builds are single threaded, native ones may find records from several threads
+#ifndef DB_OBJECT_CACHE_LOCKING
+#if USE_FF
+#define DB_OBJECT_CACHE_LOCKING 0
+#else
+#define DB_OBJECT_CACHE_LOCKING 1
+#endif
+#endif
+
+#if DB_OBJECT_CACHE_LOCKING
+#include <mutex>
+#endif
+
+/**
+ * ObjectCache
+ * Records of one type that have already been deserialized, so finding them again is a shared
+ * pointer instead of a parse. There is one per type, shared by every table of it, and it holds nothing
+ * until it is given a capacity.
+ *
+ * Every entry remembers the version of its record when it was read, see DbDriver::RecordVersion.
+ * A save or delete of the record moves that on, and the entry is dropped when next looked up.
+ */
+template <class T>
+class ObjectCache {
+    public:
+        struct Key {
+            ObjId scope;
+            ObjId id;
+            bool pending;
+
+            bool operator==(const Key& other) const {
+                return scope == other.scope && id == other.id && pending == other.pending;
+            }
+        };
+
+        static ObjectCache<T>& Instance() {
+            static ObjectCache<T> cache;
+            return cache;
+        }
+
+        /**
+         * Resize - Hold up to `capacity` records, the least recently found go first. 0 empties it
+         */
+        void Resize(size_t capacity);
+        size_t Capacity() const { return mCapacity; }
+        size_t Size();
+
+        /**
+         * Get - The record read at `version`
+         * @return false if it isn't cached, or was cached from an older version of it
+         */
+        bool Get(const Key& key, uint64_t version, std::shared_ptr<const T>& record);
+        void Put(const Key& key, uint64_t version, std::shared_ptr<const T> record);
+        void Clear();
+
+    private:
+        struct KeyHash {
+            size_t operator()(const Key& key) const {
+                return std::hash<ObjId>()(key.id) ^ (std::hash<ObjId>()(key.scope) * 31) ^ key.pending;
+            }
+        };
+
+        struct Entry {
+            Key key;
+            uint64_t version;
+            std::shared_ptr<const T> record;
+        };
+
+        using Entries = std::list<Entry>;
+
+        void Erase(typename Entries::iterator it);
+
+        size_t mCapacity = 0;
+        // most recently found first
+        Entries mEntries;
+        std::unordered_map<Key, typename Entries::iterator, KeyHash> mIndex;
+#if DB_OBJECT_CACHE_LOCKING
+        std::mutex mLock;
+#endif
+};
+
+#if DB_OBJECT_CACHE_LOCKING
+#define OBJECT_CACHE_LOCK std::lock_guard<std::mutex> guard{mLock}
+#else
+#define OBJECT_CACHE_LOCK
+#endif
+
+template <class T>
+void ObjectCache<T>::Resize(size_t capacity)
+{
+    OBJECT_CACHE_LOCK;
+    mCapacity = capacity;
+    while (mEntries.size() > mCapacity) {
+        Erase(std::prev(mEntries.end()));
+    }
+}
+
+template <class T>
+size_t ObjectCache<T>::Size()
+{
+    OBJECT_CACHE_LOCK;
+    return mEntries.size();
+}
+
+template <class T>
+void ObjectCache<T>::Erase(typename Entries::iterator it)
+{
+    mIndex.erase(it->key);
+    mEntries.erase(it);
+}
+
+template <class T>
+bool ObjectCache<T>::Get(const Key& key, uint64_t version, std::shared_ptr<const T>& record)
+{
+    OBJECT_CACHE_LOCK;
+    auto it = mIndex.find(key);
+    if (it == mIndex.end()) {
+        return false;
+    }
+
+    auto entry = it->second;
+    if (entry->version != version) {
+        Erase(entry);
+        return false;
+    }
+
+    mEntries.splice(mEntries.begin(), mEntries, entry);
+    record = entry->record;
+    return true;
+}
+
+template <class T>
+void ObjectCache<T>::Put(const Key& key, uint64_t version, std::shared_ptr<const T> record)
+{
+    OBJECT_CACHE_LOCK;
+    if (mCapacity == 0) {
+        return;
+    }
+
+    auto it = mIndex.find(key);
+    if (it != mIndex.end()) {
+        Erase(it->second);
+    }
+
+    while (mEntries.size() >= mCapacity) {
+        Erase(std::prev(mEntries.end()));
+    }
+
+    mEntries.push_front(Entry{key, version, std::move(record)});
+    mIndex.emplace(key, mEntries.begin());
+}
+
+template <class T>
+void ObjectCache<T>::Clear()
+{
+    OBJECT_CACHE_LOCK;
+    mIndex.clear();
+    mEntries.clear();
+}
+
+#undef OBJECT_CACHE_LOCK
+
+#endif //_OBJECTCACHE_HPP_
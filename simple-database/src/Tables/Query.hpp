@@ -28,9 +28,18 @@
 #define CountMaskQuery(property, mask) \
     Query(Query::ResultType::Count, Query::SearchType::Mask, property, &(mask), sizeof(mask), true)
 
+#define WhereRangeQuery(property, range) \
+    Query(Query::ResultType::Many, Query::SearchType::Range, property, range, sizeof(range), true)
+
+#define CountRangeQuery(property, range) \
+    Query(Query::ResultType::Count, Query::SearchType::Range, property, range, sizeof(range), true)
+
 #define CountAllQuery() \
     Query(Query::ResultType::Count, Query::SearchType::All, nullptr, nullptr, 0, false)
 
+#define AggregateQuery(property) \
+    Query(Query::ResultType::Aggregate, Query::SearchType::All, property, nullptr, 0, false)
+
 #define CustomQuery(resultType) \
     Query(resultType, Query::SearchType::Custom, nullptr, nullptr, 0, false)
 
@@ -43,6 +52,8 @@ class Query {
             Single,
             Many,
             Count,
+            // sum, min, max & count of a property
+            Aggregate,
         };
         enum class SearchType {
             Needle,
@@ -50,6 +61,8 @@ class Query {
             All,
             Custom,
             RawCustom,
+            // needle is the min & max as two uint64_t
+            Range,
         };
         static const uint32_t MaxNeedleLength = 255;
 
@@ -60,6 +73,9 @@ class Query {
         uint32_t needleLen = 0;
         bool exactMatch = false;
         bool negate = false;
+        // ranges answered from an index come highest first, and stop after `limit`
+        bool descending = false;
+        size_t limit = SIZE_MAX;
         char propertyName[BaseProperty::MaxPropertyNameLength];
         ResultType resultType;
         SearchType searchType;
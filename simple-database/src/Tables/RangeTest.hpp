@@ -0,0 +1,49 @@
+#ifndef _RANGETEST_HPP_
+#define _RANGETEST_HPP_
+
+#include "RecordTest.hpp"
+#include "Query.hpp"
+
+template<class T>
+class RangeTest : public RecordTest {
+    public:
+        RangeTest(T& record, Query& query) : record(record), query(query) {
+            assert(query.searchType == Query::SearchType::Range);
+            memcpy(range, query.needle, sizeof(range));
+            property = record.PropertyByName(query.propertyName);
+
+            assert(property != nullptr);
+
+            if (property == nullptr) {
+                propertyPos = 0;
+                propertyLen = 0;
+                return;
+            }
+
+            assert(BaseProperty::PropertyIsPrimitive(property->Type()));
+            assert(property->Type() != BaseProperty::PropertyType::Enum);
+            propertyPos = record.NonCompactPropertyPosition(query.propertyName);
+            propertyLen = property->TotalLength();
+        }
+
+        bool operator()(const void* recordData) override {
+            // nothing but a number fits in the value
+            if (property == nullptr || propertyLen > sizeof(uint64_t)) {
+                return false;
+            }
+
+            uint64_t value = 0;
+            memcpy(&value, (const uint8_t*)recordData + propertyPos, propertyLen);
+            return range[0] <= value && value <= range[1];
+        }
+    private:
+        T& record;
+        Query& query;
+        BaseProperty* property;
+        uint32_t propertyPos;
+        size_t propertyLen;
+        // min & max, both included
+        uint64_t range[2];
+};
+
+#endif //_RANGETEST_HPP_
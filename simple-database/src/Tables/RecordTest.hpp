@@ -4,6 +4,7 @@
 
 class RecordTest {
     public:
-        virtual bool operator()(void* recordData) = 0;
+        // recordData may point straight into a read only mapping of the table
+        virtual bool operator()(const void* recordData) = 0;
 };
 #endif //_RECORDTEST_HPP_
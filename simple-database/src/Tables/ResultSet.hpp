@@ -2,6 +2,7 @@
 #define _RESULTSET_HPP_
 #include <stdint.h>
 #include <functional>
+#include <vector>
 #include "Query.hpp"
 #include "DbDriver.hpp"
 
@@ -9,7 +10,7 @@ template <class T>
 class ResultSet {
     public:
         ResultSet(ObjId scope, bool pending, const Query& query, const char* tableName) : mScope{scope}, mPending{pending}, mQuery(query), mDbDriver(scope, pending) {
-            mDbDriver.OpenTable(tableName, mDirectory);
+            mDbDriver.OpenTable(tableName, mCursor);
         }
 
         template<typename M>
@@ -23,53 +24,80 @@ class ResultSet {
                 mRawCustomTest = customTest;
             }
 
-            mDbDriver.OpenTable(tableName, mDirectory);
+            mDbDriver.OpenTable(tableName, mCursor);
         }
 
-        static const uint8_t PageSize = 0xFF;
+        // results are found this many at a time unless the query was given a page size
+        static const uint32_t DefaultPageSize = 0xFF;
         uint64_t NextId();
         bool HasNextPage();
         uint32_t GetCount();
+
+        /**
+         * GetSum, GetMin, GetMax, GetAvg - Of the property an Aggregate query went over, 0 if
+         * there were no records. The sum wraps around past UINT64_MAX
+         */
+        uint64_t GetSum();
+        uint64_t GetMin();
+        uint64_t GetMax();
+        double GetAvg();
         bool success = false;
     private:
         void HasNextPage(bool hasNextPage);
-        void AppendId(uint64_t id);
+        void AppendId(uint64_t id, uint32_t len = 0);
+        // room for the record of the next id appended, to keep it from the scan that found it
+        uint8_t* NextRecordSlot(uint32_t stride);
         Query& GetQuery();
         void IncCount();
-        uint8_t CurrentPageLength();
+        void Accumulate(uint64_t value);
+        uint32_t CurrentPageLength();
         DbDriver& Driver();
-        DirectoryWrapper& Directory();
+        TableCursor& Cursor();
         void ResetIdx();
         void ClearIds();
 
         ObjId mScope;
         bool mPending;
-        uint64_t mIds[PageSize] = {0};
-        uint8_t mCurrentPageLength = 0;
+        uint32_t mPageSize = DefaultPageSize;
+        std::vector<uint64_t> mIds;
         bool mHasNextPage = false;
         uint32_t mCount = 0;
+        uint64_t mSum = 0;
+        uint64_t mMin = UINT64_MAX;
+        uint64_t mMax = 0;
         Query mQuery;
         DbDriver mDbDriver;
-        DirectoryWrapper mDirectory;
+        TableCursor mCursor;
         std::function<bool(T*)> mCustomTest = nullptr;
-        std::function<bool(uint8_t*)> mRawCustomTest = nullptr;
+        std::function<bool(const uint8_t*)> mRawCustomTest = nullptr;
+
+        uint32_t mResultIdx = 0;
 
-        uint8_t mResultIdx = 0;
+        // records of the current page, kept by the scan that found them or read together the
+        // first time the page is reached
+        std::vector<uint8_t> mRecords;
+        std::vector<uint32_t> mLens;
+        bool mRecordsLoaded = false;
+
+        // a query answered from an index pages through the ids it found instead of the table
+        bool mIndexed = false;
+        std::vector<ObjId> mIndexIds;
+        size_t mIndexPos = 0;
 
         template<typename, typename> friend class Table;
         template<typename> friend class Validator;
 };
 
 template <class T>
-uint8_t ResultSet<T>::CurrentPageLength()
+uint32_t ResultSet<T>::CurrentPageLength()
 {
-    return mCurrentPageLength;
+    return mIds.size();
 }
 
 template <class T>
 uint64_t ResultSet<T>::NextId()
 {
-    if (mResultIdx < mCurrentPageLength) {
+    if (mResultIdx < mIds.size()) {
         return mIds[mResultIdx++];
     }
 
@@ -79,8 +107,10 @@ uint64_t ResultSet<T>::NextId()
 template <class T>
 void ResultSet<T>::ClearIds()
 {
-    mCurrentPageLength = 0;
-    memset(mIds, 0, sizeof(mIds));
+    // the record buffer is kept for the next page
+    mIds.clear();
+    mLens.clear();
+    mRecordsLoaded = false;
 }
 
 template <class T>
@@ -90,12 +120,22 @@ void ResultSet<T>::ResetIdx()
 }
 
 template <class T>
-void ResultSet<T>::AppendId(uint64_t id)
+void ResultSet<T>::AppendId(uint64_t id, uint32_t len)
 {
-    assert(mCurrentPageLength <= PageSize);
+    assert(mIds.size() < mPageSize);
+
+    mIds.push_back(id);
+    mLens.push_back(len);
+}
 
-    mIds[mCurrentPageLength] = id;
-    mCurrentPageLength++;
+template <class T>
+uint8_t* ResultSet<T>::NextRecordSlot(uint32_t stride)
+{
+    size_t end = (mIds.size() + 1) * stride;
+    if (mRecords.size() < end) {
+        mRecords.resize(end);
+    }
+    return mRecords.data() + end - stride;
 }
 
 template <class T>
@@ -119,11 +159,48 @@ void ResultSet<T>::HasNextPage(bool hasNextPage)
 template <class T>
 uint32_t ResultSet<T>::GetCount()
 {
-    assert(mQuery.resultType == Query::ResultType::Count);
+    assert(mQuery.resultType == Query::ResultType::Count || mQuery.resultType == Query::ResultType::Aggregate);
     return mCount;
 
 }
 
+template <class T>
+uint64_t ResultSet<T>::GetSum()
+{
+    assert(mQuery.resultType == Query::ResultType::Aggregate);
+    return mSum;
+}
+
+template <class T>
+uint64_t ResultSet<T>::GetMin()
+{
+    assert(mQuery.resultType == Query::ResultType::Aggregate);
+    return mCount > 0 ? mMin : 0;
+}
+
+template <class T>
+uint64_t ResultSet<T>::GetMax()
+{
+    assert(mQuery.resultType == Query::ResultType::Aggregate);
+    return mMax;
+}
+
+template <class T>
+double ResultSet<T>::GetAvg()
+{
+    assert(mQuery.resultType == Query::ResultType::Aggregate);
+    return mCount > 0 ? (double)mSum / mCount : 0;
+}
+
+template <class T>
+void ResultSet<T>::Accumulate(uint64_t value)
+{
+    mCount++;
+    mSum += value;
+    mMin = value < mMin ? value : mMin;
+    mMax = value > mMax ? value : mMax;
+}
+
 template <class T>
 void ResultSet<T>::IncCount()
 {
@@ -139,8 +216,8 @@ DbDriver& ResultSet<T>::Driver()
 }
 
 template <class T>
-DirectoryWrapper& ResultSet<T>::Directory()
+TableCursor& ResultSet<T>::Cursor()
 {
-    return mDirectory;
+    return mCursor;
 }
 #endif //_RESULTSET_HPP_
@@ -1,9 +1,12 @@
 #ifndef _TABLE_HPP_
 #define _TABLE_HPP_
 #include <functional>
+#include <memory>
+#include <vector>
 #include "Serializeable.hpp"
 #include "DbDriver.hpp"
 #include "ResultSet.hpp"
+#include "ObjectCache.hpp"
 #include "Query.hpp"
 #include "Validator.hpp"
 #include "RecordTest.hpp"
@@ -11,6 +14,7 @@
 #include "CustomTest.hpp"
 #include "AllPassTest.hpp"
 #include "MaskTest.hpp"
+#include "RangeTest.hpp"
 
 using namespace base_message;
 template <class T, class V=void>
@@ -20,6 +24,13 @@ class Table {
 
         virtual bool Find(ObjId id);
 
+        /**
+         * FindMany - Load a group of records by id, with the reads in flight at once where the engine can
+         * `callback` is called with each record found, in the order of `ids`, missing ids are skipped
+         * @return number of records found
+         */
+        template<typename F> size_t FindMany(const ObjId* ids, size_t count, F callback);
+
         template<typename M> bool FindByMask(const char* propertyName, M mask);
         bool FindBy(const char* propertyName, const void* needle, uint32_t needleLen, bool exactMatch = true);
         bool FindBy(const char* propertyName, const char* needle, bool exactMatch = true);
@@ -37,7 +48,76 @@ class Table {
         ResultSet<T> Count(const char* propertyName, const char* needle, bool exactMatch = true);
         ResultSet<T> CountAll();
 
+        /**
+         * Aggregate - Sum, min, max & average of the property over every record, read straight out
+         * of the stored records without loading them. The property has to be an unsigned number or
+         * a bool, on anything else the query fails. Sum, Min, Max & Avg are the same, for one of them
+         */
+        ResultSet<T> Aggregate(const char* propertyName);
+        uint64_t Sum(const char* propertyName) { return Aggregate(propertyName).GetSum(); }
+        uint64_t Min(const char* propertyName) { return Aggregate(propertyName).GetMin(); }
+        uint64_t Max(const char* propertyName) { return Aggregate(propertyName).GetMax(); }
+        double Avg(const char* propertyName) { return Aggregate(propertyName).GetAvg(); }
+
+        /**
+         * WhereRange - Records with `min <= propertyName <= max`, both included
+         * The property has to be an unsigned number or a bool. With IndexPropertyRanges on it the
+         * records come from the index, in order of the property, highest first if `descending`.
+         * Without they come from a scan, in no particular order
+         */
+        ResultSet<T> WhereRange(const char* propertyName, uint64_t min, uint64_t max, bool descending = false);
+        ResultSet<T> CountRange(const char* propertyName, uint64_t min, uint64_t max);
+
+        /**
+         * After - Up to `limit` records with ids above `id`, lowest id first
+         * For keyset paging, the next page starts after the last id of this one. After(0) goes
+         * through the whole table in id order. Puts an ordered index on Id, in place of a hash
+         * index IndexProperty put there, which the ordered one answers exact matches for as well
+         */
+        ResultSet<T> After(ObjId id, size_t limit = SIZE_MAX);
+
         Table<T,V>& Not();
+
+        /**
+         * NoCache - Keep the records the next query reads out of the record cache
+         * For scans over much of a table, which would otherwise push out the records read all the time
+         */
+        Table<T,V>& NoCache();
+
+        /**
+         * PageSize - Have the next query find its results `records` at a time, instead of
+         * ResultSet::DefaultPageSize. Each page is kept in memory as it's read through, a record each
+         */
+        Table<T,V>& PageSize(uint32_t records);
+
+        /**
+         * FindShared - Find without loading the record into LoadedRecord
+         * With CacheObjects on, this is the cached record itself, shared with everything else that found it
+         * @return nullptr if there is no such record
+         */
+        std::shared_ptr<const T> FindShared(ObjId id);
+
+        /**
+         * CacheObjects - Keep up to `count` records of T found with FindShared around already
+         * deserialized, for every table of T. A save or delete of a record drops it, and the few
+         * that share its version slot (see DbDriver::RecordVersion). 0 turns it off
+         */
+        static void CacheObjects(size_t count) { ObjectCache<T>::Instance().Resize(count); }
+
+        /**
+         * IndexProperty - Answer exact matches on the property from a hash index instead of a scan
+         * For FindBy, Where & Count without Not. Each table of T, in each scope, builds its index the
+         * first time it's queried and keeps it up to date from then on. The property can't be a set
+         * or an external buffer
+         */
+        static void IndexProperty(const char* propertyName);
+        static void UnindexProperty(const char* propertyName) { DbDriver::DeclareIndex(T::SerializeableName, propertyName, nullptr); }
+
+        /**
+         * IndexPropertyRanges - Keep the records in order of the property, for WhereRange & CountRange
+         * Built and kept up to date like IndexProperty's, a property has one or the other
+         */
+        static void IndexPropertyRanges(const char* propertyName);
         virtual DbError BeforeSave(T&) { return ErrorCode::None; }
         virtual DbError BeforeDelete(T&) { return ErrorCode::None; }
         virtual void AfterSave(T&) {};
@@ -56,10 +136,27 @@ class Table {
         DbError Save(T& record, ObjId commitId = 0, bool skipValidation = false);
         DbError Save(void* record, ObjId commitId = 0);
 
+        /**
+         * SaveMany - Save a group of records as one batch
+         * New ids are reserved in one go and the records are written with a single sync.
+         * Every record is validated before anything is written, records within the batch
+         * aren't validated against each other.
+         */
+        DbError SaveMany(T* records, size_t count, ObjId commitId = 0);
+        DbError SaveMany(std::vector<T>& records, ObjId commitId = 0) { return SaveMany(records.data(), records.size(), commitId); }
+
         DbError Delete(T& record, bool shouldCallAfterDelete = false);
         DbError Delete(ObjId id, bool shouldCallAfterDelete = false);
         DbError Delete(ResultSet<T>& resultSet, bool shouldCallAfterDelete = false);
 
+        /**
+         * DeleteMany - Delete a group of records as one batch
+         * Ids that can't be found or are refused by BeforeDelete are skipped
+         * and the last such error is returned
+         */
+        DbError DeleteMany(const ObjId* ids, size_t count, bool shouldCallAfterDelete = false);
+        DbError DeleteMany(const std::vector<ObjId>& ids, bool shouldCallAfterDelete = false) { return DeleteMany(ids.data(), ids.size(), shouldCallAfterDelete); }
+
         DbError CancelCommit(ObjId commitId);
         DbError CommitAll(ObjId commitId);
         DbError Commit(T& record, ObjId commitId);
@@ -72,12 +169,26 @@ class Table {
 #endif
         const char* TableName() const;
         bool LoadNextPage(ResultSet<T>& resultSet);
-        bool LoadRecord();
+        bool LoadRecord(const uint8_t* record);
+        bool LoadPageRecord(ResultSet<T>& resultSet);
+        // room for a record, its commit id & its crc, as GetRecords needs
+        uint32_t ReadStride() { return mRecord.MaxLength() + sizeof(ObjId) + sizeof(uint32_t); }
         void Execute(ResultSet<T>& results, RecordTest& test);
+        // finds the ids of an indexed query, false if there's no index to answer it from
+        bool LookUpIndex(ResultSet<T>& results);
+        bool LookUpRangeIndex(ResultSet<T>& results);
+        bool LookUpRangeIndexExact(ResultSet<T>& results);
+        template<class I> void BuildIndex(I& index);
+        void ExecuteIndexed(ResultSet<T>& results);
+        bool FindRecord(ObjId id, bool cacheReads);
+        // hands the NoCache & PageSize hints to the query the results belong to
+        void TakeHints(ResultSet<T>& results);
 
         T mRecord;
         ObjId mRecordCommitId = 0;
         bool mNegateNextQuery = false;
+        bool mNoCacheNextQuery = false;
+        uint32_t mNextPageSize = ResultSet<T>::DefaultPageSize;
 
     protected:
         const ObjId mScope;
@@ -92,16 +203,113 @@ Table<T,V>& Table<T,V>::Not()
     return *this;
 }
 
+template <class T, class V>
+Table<T,V>& Table<T,V>::NoCache()
+{
+    mNoCacheNextQuery = true;
+    return *this;
+}
+
+template <class T, class V>
+Table<T,V>& Table<T,V>::PageSize(uint32_t records)
+{
+    assert(records > 0);
+    mNextPageSize = records > 0 ? records : 1;
+    return *this;
+}
+
+template <class T, class V>
+void Table<T,V>::TakeHints(ResultSet<T>& results)
+{
+    results.Driver().CacheReads(!mNoCacheNextQuery);
+    mNoCacheNextQuery = false;
+    results.mPageSize = mNextPageSize;
+    mNextPageSize = ResultSet<T>::DefaultPageSize;
+}
+
 template <class T, class V>
 bool Table<T,V>::Find(ObjId id)
+{
+    return FindRecord(id, true);
+}
+
+template <class T, class V>
+bool Table<T,V>::FindRecord(ObjId id, bool cacheReads)
 {
     DbDriver driver{mScope, mPending};
+    driver.CacheReads(cacheReads);
 
-    if (!(driver.GetRecord(DbDriver::WorkBuffer(), id, TableName()) > 0)) {
+    uint32_t len;
+    const uint8_t* record = driver.GetRecordView(id, TableName(), len);
+    if (record == nullptr) {
         return false;
     }
 
-    return LoadRecord();
+    return LoadRecord(record);
+}
+
+template <class T, class V>
+std::shared_ptr<const T> Table<T,V>::FindShared(ObjId id)
+{
+    DbDriver driver{mScope, mPending};
+
+    ObjectCache<T>& objects = ObjectCache<T>::Instance();
+    typename ObjectCache<T>::Key key{mScope, id, mPending};
+    uint64_t version = driver.RecordVersion(TableName(), id);
+    std::shared_ptr<const T> object;
+    if (objects.Get(key, version, object)) {
+        return object;
+    }
+
+    uint32_t len;
+    const uint8_t* record = driver.GetRecordView(id, TableName(), len);
+    if (record == nullptr) {
+        return nullptr;
+    }
+
+    auto loaded = std::make_shared<T>();
+    if (loaded->Deserialize(record, false) == 0) {
+        return nullptr;
+    }
+
+    objects.Put(key, version, loaded);
+    return loaded;
+}
+
+template <class T, class V>
+template<typename F>
+size_t Table<T,V>::FindMany(const ObjId* ids, size_t count, F callback)
+{
+    size_t found = 0;
+    if (!DbDriver::ReadsConcurrently()) {
+        for (size_t i = 0; i < count; i++) {
+            if (Find(ids[i])) {
+                found++;
+                callback(mRecord);
+            }
+        }
+        return found;
+    }
+
+    DbDriver driver{mScope, mPending};
+    uint32_t stride = ReadStride();
+    std::vector<uint8_t> records;
+    std::vector<uint32_t> lens;
+    for (size_t start = 0; start < count; start += ResultSet<T>::DefaultPageSize) {
+        size_t n = MIN(count - start, (size_t)ResultSet<T>::DefaultPageSize);
+        records.resize(n * stride);
+        lens.resize(n);
+        driver.GetRecords(ids + start, n, records.data(), stride, lens.data(), TableName());
+
+        for (size_t i = 0; i < n; i++) {
+            if (lens[i] > 0 && LoadRecord(records.data() + i * stride)) {
+                found++;
+                callback(mRecord);
+            }
+        }
+    }
+
+    return found;
 }
 
 template <class T, class V>
@@ -110,31 +318,73 @@ void Table<T,V>::Execute(ResultSet<T>& results, RecordTest& test)
     assert(results.mScope == mScope);
     assert(results.mPending == mPending);
 
-    if (!results.Directory().DidOpen()) {
+    if (!results.Cursor().DidOpen()) {
         results.success = false;
         return;
     }
 
+    if (results.mIndexed || LookUpIndex(results)) {
+        ExecuteIndexed(results);
+        return;
+    }
+
     uint32_t idPos = mRecord.NonCompactPropertyPosition("Id");
     Query& query = results.GetQuery();
+    // a custom test may write over the work buffer the record is read into, keep it first
+    bool keepFirst = query.searchType == Query::SearchType::Custom || query.searchType == Query::SearchType::RawCustom;
+    uint32_t stride = ReadStride();
+
+    // where an aggregated property is in every record, so it's read without loading them
+    uint32_t valuePos = 0;
+    size_t valueLen = 0;
+    if (query.resultType == Query::ResultType::Aggregate) {
+        BaseProperty* property = mRecord.PropertyByName(query.propertyName);
+        assert(property != nullptr);
+        if (property == nullptr) {
+            results.success = false;
+            return;
+        }
+
+        // only unsigned numbers add up, enums are stored by name and the rest aren't numbers
+        BaseProperty::PropertyType type = property->Type();
+        if (type != BaseProperty::PropertyType::UInt8 && type != BaseProperty::PropertyType::UInt16 &&
+                type != BaseProperty::PropertyType::UInt32 && type != BaseProperty::PropertyType::UInt64 &&
+                type != BaseProperty::PropertyType::Bool) {
+            results.success = false;
+            return;
+        }
+        valuePos = mRecord.NonCompactPropertyPosition(query.propertyName);
+        valueLen = property->TotalLength();
+    }
 
-    while (results.Driver().GetNextRecord(DbDriver::WorkBuffer(), results.Directory())) {
+    uint32_t len;
+    const uint8_t* record;
+    while ((record = results.Driver().GetNextRecordView(results.Cursor(), len)) != nullptr) {
         uint64_t id = 0;
-        memcpy(&id, (DbDriver::WorkBuffer() + idPos), sizeof(id));
-        bool testResult = test(DbDriver::WorkBuffer());
+        memcpy(&id, (record + idPos), sizeof(id));
+
+        uint8_t* kept = nullptr;
+        if (keepFirst && query.resultType != Query::ResultType::Count) {
+            kept = results.NextRecordSlot(stride);
+            memcpy(kept, record, MIN(len, stride));
+        }
+        // tested on the copy where there is one, so it sees what gets loaded
+        bool testResult = test(kept != nullptr ? kept : record);
 
         if ((query.negate && !testResult) || (!query.negate && testResult)) {
             switch(query.resultType) {
                 case Query::ResultType::Single: {
-                    // We must reload the record
-                    // because the work buffer may have been destroyed during a custom search
-                    results.success = Find(id);
+                    results.success = LoadRecord(kept != nullptr ? kept : record);
                     goto loopEnd;
                 }
                 case Query::ResultType::Many: {
+                    // the record comes along, so LoadNextResult doesn't have to read it again
+                    if (kept == nullptr) {
+                        memcpy(results.NextRecordSlot(stride), record, MIN(len, stride));
+                    }
                     results.success = true;
-                    results.AppendId(id);
-                    if (results.CurrentPageLength() == ResultSet<T>::PageSize) {
+                    results.AppendId(id, len);
+                    if (results.CurrentPageLength() == results.mPageSize) {
                         // if we have filled the page break out early
                         results.HasNextPage(true);
                         goto loopEnd;
@@ -142,15 +392,205 @@ void Table<T,V>::Execute(ResultSet<T>& results, RecordTest& test)
                     break;
                 }
                 case Query::ResultType::Count: {
-                    results.success = Find(id);
+                    results.success = true;
                     results.IncCount();
                     break;
                 }
+                case Query::ResultType::Aggregate: {
+                    uint64_t value = 0;
+                    memcpy(&value, record + valuePos, valueLen);
+                    results.success = true;
+                    results.Accumulate(value);
+                    break;
+                }
             }
         }
     }
     loopEnd:
-    return;
+    results.mRecordsLoaded = query.resultType == Query::ResultType::Many;
+}
+
+template <class T, class V>
+void Table<T,V>::IndexProperty(const char* propertyName)
+{
+    auto record = std::make_shared<T>();
+    BaseProperty* property = record->PropertyByName(propertyName);
+    assert(property != nullptr);
+    if (property == nullptr) {
+        return;
+    }
+
+    assert(!BaseProperty::PropertyIsSet(property->Type()));
+    assert(property->Type() != BaseProperty::PropertyType::ExternalBuffer);
+
+    // the same part of the record a NeedleTest compares
+    uint32_t pos = record->NonCompactPropertyPosition(propertyName);
+    uint32_t offset = property->Type() == BaseProperty::PropertyType::InternalBuffer ? 4 : 0;
+    DbDriver::DeclareIndex(T::SerializeableName, propertyName,
+        [record, property, pos, offset](const uint8_t* data, const uint8_t*& value, uint32_t& len) {
+            len = property->Deserialize(data + pos) - offset;
+            value = data + pos + offset;
+            return true;
+        }
+    );
+}
+
+template <class T, class V>
+void Table<T,V>::IndexPropertyRanges(const char* propertyName)
+{
+    T record;
+    BaseProperty* property = record.PropertyByName(propertyName);
+    assert(property != nullptr);
+    if (property == nullptr) {
+        return;
+    }
+
+    // enums are stored by name, they don't order as numbers
+    assert(BaseProperty::PropertyIsPrimitive(property->Type()));
+    assert(property->Type() != BaseProperty::PropertyType::Enum);
+
+    uint32_t pos = record.NonCompactPropertyPosition(propertyName);
+    size_t len = property->TotalLength();
+    DbDriver::DeclareOrderedIndex(T::SerializeableName, propertyName,
+        [pos, len](const uint8_t* data, uint64_t& value) {
+            value = 0;
+            memcpy(&value, data + pos, len);
+            return true;
+        }
+    );
+}
+
+template <class T, class V>
+bool Table<T,V>::LookUpIndex(ResultSet<T>& results)
+{
+    Query& query = results.GetQuery();
+    if (query.negate) {
+        return false;
+    }
+
+    if (query.searchType == Query::SearchType::Range) {
+        return LookUpRangeIndex(results);
+    }
+
+    if (query.searchType != Query::SearchType::Needle || !query.exactMatch) {
+        return false;
+    }
+
+    HashIndex* index = results.Driver().Index(TableName(), query.propertyName);
+    if (index == nullptr) {
+        return LookUpRangeIndexExact(results);
+    }
+
+    if (!index->IsBuilt()) {
+        BuildIndex(*index);
+    }
+
+    index->Find(query.needle, query.needleLen, results.mIndexIds);
+    results.mIndexPos = 0;
+    results.mIndexed = true;
+    return true;
+}
+
+template <class T, class V>
+bool Table<T,V>::LookUpRangeIndex(ResultSet<T>& results)
+{
+    Query& query = results.GetQuery();
+    OrderedIndex* index = results.Driver().Ordered(TableName(), query.propertyName);
+    if (index == nullptr) {
+        return false;
+    }
+
+    if (!index->IsBuilt()) {
+        BuildIndex(*index);
+    }
+
+    uint64_t range[2];
+    memcpy(range, query.needle, sizeof(range));
+    index->Range(range[0], range[1], query.descending, query.limit, results.mIndexIds);
+    results.mIndexPos = 0;
+    results.mIndexed = true;
+    return true;
+}
+
+template <class T, class V>
+bool Table<T,V>::LookUpRangeIndexExact(ResultSet<T>& results)
+{
+    // an ordered index holds the whole number, so it answers exact matches on it as well
+    Query& query = results.GetQuery();
+    BaseProperty* property = mRecord.PropertyByName(query.propertyName);
+    if (property == nullptr || query.needleLen != property->TotalLength() || query.needleLen > sizeof(uint64_t)) {
+        return false;
+    }
+
+    OrderedIndex* index = results.Driver().Ordered(TableName(), query.propertyName);
+    if (index == nullptr) {
+        return false;
+    }
+
+    if (!index->IsBuilt()) {
+        BuildIndex(*index);
+    }
+
+    uint64_t value = 0;
+    memcpy(&value, query.needle, query.needleLen);
+    index->Range(value, value, false, SIZE_MAX, results.mIndexIds);
+    results.mIndexPos = 0;
+    results.mIndexed = true;
+    return true;
+}
+
+template <class T, class V>
+template<class I>
+void Table<T,V>::BuildIndex(I& index)
+{
+    DbDriver driver{mScope, mPending};
+    // one pass over everything shouldn't push out what is read all the time
+    driver.CacheReads(false);
+    TableCursor cursor;
+    if (!driver.OpenTable(TableName(), cursor)) {
+        return;
+    }
+
+    uint32_t idPos = mRecord.NonCompactPropertyPosition("Id");
+    uint32_t len;
+    const uint8_t* record;
+    while ((record = driver.GetNextRecordView(cursor, len)) != nullptr) {
+        uint64_t id = 0;
+        memcpy(&id, (record + idPos), sizeof(id));
+        index.Insert(id, record);
+    }
+    index.MarkBuilt();
+}
+
+template <class T, class V>
+void Table<T,V>::ExecuteIndexed(ResultSet<T>& results)
+{
+    std::vector<ObjId>& ids = results.mIndexIds;
+    switch(results.GetQuery().resultType) {
+        case Query::ResultType::Single: {
+            results.success = !ids.empty() && FindRecord(ids.front(), results.Driver().CachesReads());
+            break;
+        }
+        case Query::ResultType::Many: {
+            results.success = results.mIndexPos < ids.size();
+            while (results.mIndexPos < ids.size() && results.CurrentPageLength() < results.mPageSize) {
+                results.AppendId(ids[results.mIndexPos++]);
+            }
+            results.HasNextPage(results.mIndexPos < ids.size());
+            break;
+        }
+        case Query::ResultType::Count: {
+            results.mCount = ids.size();
+            results.success = !ids.empty();
+            break;
+        }
+        case Query::ResultType::Aggregate: {
+            // always a scan, there's nothing to look up
+            assert(false);
+            results.success = false;
+            break;
+        }
+    }
 }
 
 template <class T, class V>
@@ -160,6 +600,7 @@ bool Table<T,V>::FindBy(const char* propertyName, const void* needle, uint32_t n
     q.negate = mNegateNextQuery;
     mNegateNextQuery = false;
     ResultSet<T> results{mScope, mPending, q, TableName()};
+    TakeHints(results);
     NeedleTest<T> test{mRecord, q};
     Execute(results, test);
     return results.success;
@@ -179,6 +620,7 @@ bool Table<T,V>::FindByMask(const char* propertyName, M mask)
     q.negate = mNegateNextQuery;
     mNegateNextQuery = false;
     ResultSet<T> result{mScope, mPending, q, TableName()};
+    TakeHints(result);
     MaskTest<T, M> test{mRecord, q, mask};
     Execute(result, test);
     return result.success;
@@ -191,6 +633,7 @@ ResultSet<T> Table<T,V>::Count(const char* propertyName, const void* needle, uin
     q.negate = mNegateNextQuery;
     mNegateNextQuery = false;
     ResultSet<T> results{mScope, mPending, q, TableName()};
+    TakeHints(results);
     NeedleTest<T> test{mRecord, q};
     Execute(results, test);
     return results;
@@ -210,6 +653,7 @@ ResultSet<T> Table<T,V>::CountMask(const char* propertyName, M mask)
     q.negate = mNegateNextQuery;
     mNegateNextQuery = false;
     ResultSet<T> results{mScope, mPending, q, TableName()};
+    TakeHints(results);
     MaskTest<T, M> test{mRecord, q, mask};
     Execute(results, test);
     return results;
@@ -221,11 +665,76 @@ ResultSet<T> Table<T,V>::CountAll()
     Query q = CountAllQuery();
 
     ResultSet<T> result{mScope, mPending, q, TableName()};
+    TakeHints(result);
     AllPassTest test;
     Execute(result, test);
     return result;
 }
 
+template <class T, class V>
+ResultSet<T> Table<T,V>::Aggregate(const char* propertyName)
+{
+    Query q = AggregateQuery(propertyName);
+
+    ResultSet<T> result{mScope, mPending, q, TableName()};
+    TakeHints(result);
+    AllPassTest test;
+    Execute(result, test);
+    return result;
+}
+
+template <class T, class V>
+ResultSet<T> Table<T,V>::WhereRange(const char* propertyName, uint64_t min, uint64_t max, bool descending)
+{
+    uint64_t range[2] = {min, max};
+    Query q = WhereRangeQuery(propertyName, range);
+    q.descending = descending;
+    q.negate = mNegateNextQuery;
+    mNegateNextQuery = false;
+    ResultSet<T> results{mScope, mPending, q, TableName()};
+    TakeHints(results);
+    RangeTest<T> test{mRecord, q};
+    Execute(results, test);
+    return results;
+}
+
+template <class T, class V>
+ResultSet<T> Table<T,V>::After(ObjId id, size_t limit)
+{
+    uint64_t range[2] = {id + 1, UINT64_MAX};
+    Query q = WhereRangeQuery("Id", range);
+    q.limit = limit;
+    ResultSet<T> results{mScope, mPending, q, TableName()};
+    TakeHints(results);
+    // nothing comes after the last id, and one past it wraps around to the first
+    if (id == UINT64_MAX) {
+        return results;
+    }
+
+    // the directory order has nothing to do with the ids, only the index knows theirs
+    if (DbDriver{mScope, mPending}.Ordered(TableName(), "Id") == nullptr) {
+        IndexPropertyRanges("Id");
+    }
+
+    RangeTest<T> test{mRecord, q};
+    Execute(results, test);
+    return results;
+}
+
+template <class T, class V>
+ResultSet<T> Table<T,V>::CountRange(const char* propertyName, uint64_t min, uint64_t max)
+{
+    uint64_t range[2] = {min, max};
+    Query q = CountRangeQuery(propertyName, range);
+    q.negate = mNegateNextQuery;
+    mNegateNextQuery = false;
+    ResultSet<T> results{mScope, mPending, q, TableName()};
+    TakeHints(results);
+    RangeTest<T> test{mRecord, q};
+    Execute(results, test);
+    return results;
+}
+
 template <class T, class V>
 ResultSet<T> Table<T,V>::Where(const char* propertyName, const char* needle, bool exactMatch)
 {
@@ -239,6 +748,7 @@ ResultSet<T> Table<T,V>::Where(const char* propertyName, const void* needle, uin
     q.negate = mNegateNextQuery;
     mNegateNextQuery = false;
     ResultSet<T> results{mScope, mPending, q, TableName()};
+    TakeHints(results);
     NeedleTest<T> test{mRecord, q};
     Execute(results, test);
     return results;
@@ -252,6 +762,7 @@ ResultSet<T> Table<T,V>::WhereMask(const char* propertyName, M mask)
     q.negate = mNegateNextQuery;
     mNegateNextQuery = false;
     ResultSet<T> results{mScope, mPending, q, TableName()};
+    TakeHints(results);
     MaskTest<T, M> test{mRecord, q, mask};
     Execute(results, test);
     return results;
@@ -263,6 +774,7 @@ ResultSet<T> Table<T,V>::All()
     Query q = AllQuery();
 
     ResultSet<T> result{mScope, mPending, q, TableName()};
+    TakeHints(result);
     AllPassTest test;
     Execute(result, test);
     return result;
@@ -273,8 +785,9 @@ template<class functor>
 ResultSet<T> Table<T,V>::CustomSearch(Query::ResultType resultType, functor customTest)
 {
     ResultSet<T> results{mScope, mPending, resultType, TableName(), customTest};
+    TakeHints(results);
 
-    if (!results.Directory().DidOpen()) {
+    if (!results.Cursor().DidOpen()) {
         results.success = false;
         return results;
     }
@@ -349,7 +862,13 @@ bool Table<T,V>::LoadNextPage(ResultSet<T>& resultSet)
             }
         case Query::SearchType::RawCustom:
             {
-                CustomTest<T, std::function<bool(uint8_t*)>> test{resultSet.mRawCustomTest};
+                CustomTest<T, std::function<bool(const uint8_t*)>> test{resultSet.mRawCustomTest};
+                Execute(resultSet, test);
+                break;
+            }
+        case Query::SearchType::Range:
+            {
+                RangeTest<T> test{mRecord, query};
                 Execute(resultSet, test);
                 break;
             }
@@ -378,7 +897,36 @@ bool Table<T,V>::LoadNextResult(ResultSet<T>& resultSet)
         id = resultSet.NextId();
     }
 
-    return Find(id);
+    if (id == 0) {
+        return false;
+    }
+
+    if (!resultSet.mRecordsLoaded && !DbDriver::ReadsConcurrently()) {
+        return FindRecord(id, resultSet.Driver().CachesReads());
+    }
+
+    return LoadPageRecord(resultSet);
+}
+
+template <class T, class V>
+bool Table<T,V>::LoadPageRecord(ResultSet<T>& resultSet)
+{
+    uint32_t stride = ReadStride();
+    if (!resultSet.mRecordsLoaded) {
+        uint32_t count = resultSet.CurrentPageLength();
+        resultSet.mRecords.resize(count * stride);
+        DbDriver driver{mScope, mPending};
+        driver.CacheReads(resultSet.Driver().CachesReads());
+        driver.GetRecords(resultSet.mIds.data(), count, resultSet.mRecords.data(), stride, resultSet.mLens.data(), TableName());
+        resultSet.mRecordsLoaded = true;
+    }
+
+    size_t idx = resultSet.mResultIdx - 1;
+    if (resultSet.mLens[idx] == 0) {
+        return false;
+    }
+
+    return LoadRecord(resultSet.mRecords.data() + idx * stride);
 }
 
 template <class T, class V>
@@ -416,10 +964,10 @@ DbError Table<T, V>::ValidateCommit(ObjId commitId)
 }
 
 template <class T, class V>
-bool Table<T,V>::LoadRecord()
+bool Table<T,V>::LoadRecord(const uint8_t* record)
 {
-    mRecordCommitId = *(ObjId*)(DbDriver::WorkBuffer() + mRecord.MaxLength());
-    return mRecord.Deserialize(DbDriver::WorkBuffer(), false) != 0;
+    memcpy(&mRecordCommitId, record + mRecord.MaxLength(), sizeof(mRecordCommitId));
+    return mRecord.Deserialize(record, false) != 0;
 }
 
 template <class T, class V>
@@ -506,6 +1054,77 @@ DbError Table<T,V>::Save(T& record, ObjId commitId, bool skipValidation)
     return ErrorCode::None;
 }
 
+template <class T, class V>
+DbError Table<T,V>::SaveMany(T* records, size_t count, ObjId commitId)
+{
+    if (mPending && !commitId) {
+        return { ErrorCode::General, "Pending data must be saved with a commit id" };
+    }
+    if (count == 0) {
+        return ErrorCode::None;
+    }
+
+    size_t newRecords = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (!records[i].Id()) {
+            newRecords++;
+        }
+    }
+
+    if (newRecords > 0) {
+        ObjId id;
+        DbDriver db{mScope, mPending};
+        if (!db.NextIds(TableName(), newRecords, id)) {
+            return { ErrorCode::FileWrite, "Unable to provision new ids" };
+        }
+
+        for (size_t i = 0; i < count; i++) {
+            if (!records[i].Id()) {
+                records[i].Id(id++);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        if constexpr (!std::is_void<V>::value) {
+            auto validator = V{mScope, mPending};
+            DbError error = validator.RecordIsValid(records[i], commitId);
+            if (error) {
+                return error;
+            }
+        }
+
+        if (!mPending) {
+            DbError preSaveError = BeforeSave(records[i]);
+            if (preSaveError != ErrorCode::None) {
+                return preSaveError;
+            }
+        }
+    }
+
+    uint32_t len = mRecord.MaxLength();
+    uint32_t stride = len + sizeof(ObjId);
+    std::vector<uint8_t> buffer(count * stride);
+    std::vector<ObjId> ids(count);
+    for (size_t i = 0; i < count; i++) {
+        records[i].Serialize(buffer.data() + i * stride, false);
+        ids[i] = records[i].Id();
+    }
+
+    DbDriver db{mScope, mPending};
+    if (!db.SaveRecords(ids.data(), commitId, buffer.data(), len, count, TableName())) {
+        return { ErrorCode::FileWrite, "Unable to write db records to disk" };
+    }
+
+    if (!mPending) {
+        for (size_t i = 0; i < count; i++) {
+            AfterSave(records[i]);
+        }
+    }
+
+    return ErrorCode::None;
+}
+
 template <class T, class V>
 DbError Table<T,V>::Save(void * record, ObjId commitId)
 {
@@ -568,6 +1187,49 @@ DbError Table<T,V>::Delete(ResultSet<T>& resultSet, bool shouldCallAfterDelete)
     return result;
 }
 
+template <class T, class V>
+DbError Table<T,V>::DeleteMany(const ObjId* ids, size_t count, bool shouldCallAfterDelete)
+{
+    DbError result;
+    std::vector<ObjId> found;
+    std::vector<T> deleted;
+
+    for (size_t i = 0; i < count; i++) {
+        if (ids[i] == 0 || !Find(ids[i])) {
+            result = { ErrorCode::ObjectNotFound, "Cannot find record by id" };
+            continue;
+        }
+
+        if (!mPending) {
+            DbError preDeleteError = BeforeDelete(LoadedRecord());
+            if (preDeleteError != ErrorCode::None) {
+                result = preDeleteError;
+                continue;
+            }
+        }
+
+        found.push_back(ids[i]);
+        deleted.push_back(LoadedRecord());
+    }
+
+    if (found.empty()) {
+        return result;
+    }
+
+    DbDriver db{mScope, mPending};
+    if (!db.DeleteRecords(found.data(), found.size(), TableName())) {
+        return { ErrorCode::FileWrite, "Unable to delete records from disk" };
+    }
+
+    if (!mPending || shouldCallAfterDelete) {
+        for (size_t i = 0; i < found.size(); i++) {
+            AfterDelete(found[i], deleted[i]);
+        }
+    }
+
+    return result;
+}
+
 template <class T, class V>
 DbError Table<T, V>::CancelCommit(ObjId commitId)
 {
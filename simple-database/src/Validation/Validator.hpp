@@ -136,7 +136,8 @@ bool Validator<T>::UniqueValidation(const BaseProperty* property, ObjId id, bool
         return true;
     }
 
-    ResultSet<T> results = table.Where(property->Name(), (uint8_t*)serialized + offset, len - offset);
+    // two are enough to know, the scan can stop there
+    ResultSet<T> results = table.PageSize(2).Where(property->Name(), (uint8_t*)serialized + offset, len - offset);
 
     // if there are no results then its cool
     if (results.CurrentPageLength() == 0) {
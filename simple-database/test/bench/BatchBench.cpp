@@ -0,0 +1,113 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "fs.hpp"
+
+/**
+ * BatchBench
+ * Times saving, reading and deleting a few hundred records one at a time against doing
+ * the same with SaveMany / FindMany / DeleteMany, on every storage engine
+ */
+
+using User = TestUser;
+using Clock = std::chrono::steady_clock;
+
+static const size_t BatchSize = 500;
+
+static std::vector<User> MakeUsers()
+{
+    std::vector<User> users(BatchSize);
+    for (size_t i = 0; i < users.size(); i++) {
+        users[i].Name().Set(("user" + std::to_string(i)).c_str());
+        users[i].CNonce(i);
+    }
+    return users;
+}
+
+static double Millis(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void Reset()
+{
+    DbDriver::CloseStorage();
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    DbDriver::InitDb();
+    DbDriver::ClearCache();
+}
+
+static void Bench(const char* name, StorageType type)
+{
+    Table<User> table;
+    std::vector<ObjId> ids(BatchSize);
+    for (size_t i = 0; i < ids.size(); i++) {
+        ids[i] = i + 1;
+    }
+
+    DbDriver::SetStorageType(type);
+    Reset();
+
+    std::vector<User> users = MakeUsers();
+    auto start = Clock::now();
+    for (User& u : users) {
+        table.Save(u);
+    }
+    double saveOne = Millis(start);
+
+    start = Clock::now();
+    for (ObjId id : ids) {
+        table.Delete(id);
+    }
+    double deleteOne = Millis(start);
+
+    Reset();
+
+    users = MakeUsers();
+    start = Clock::now();
+    table.SaveMany(users);
+    double saveMany = Millis(start);
+
+    // reads start from a cold cache each time
+    DbDriver::ClearCache();
+    start = Clock::now();
+    for (ObjId id : ids) {
+        table.Find(id);
+    }
+    double findOne = Millis(start);
+
+    DbDriver::ClearCache();
+    size_t found = 0;
+    start = Clock::now();
+    table.FindMany(ids.data(), ids.size(), [&found](User&) { found++; });
+    double findMany = Millis(start);
+
+    start = Clock::now();
+    table.DeleteMany(ids);
+    double deleteMany = Millis(start);
+
+    printf("%-6s save %8.2fms  SaveMany %8.2fms (%5.1fx)  delete %8.2fms  DeleteMany %8.2fms (%5.1fx)\n",
+        name, saveOne, saveMany, saveOne / saveMany, deleteOne, deleteMany, deleteOne / deleteMany);
+    printf("%-6s find %8.2fms  FindMany %8.2fms (%5.1fx)  %zu found\n",
+        "", findOne, findMany, findOne / findMany, found);
+}
+
+int main()
+{
+    initFS();
+    printf("%zu records per batch\n", BatchSize);
+
+    Bench("File", StorageType::File);
+    Bench("Log", StorageType::Log);
+    Bench("BTree", StorageType::BTree);
+    Bench("Lsm", StorageType::Lsm);
+
+    DbDriver::CloseStorage();
+    DbDriver::SetStorageType(StorageType::File);
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    return 0;
+}
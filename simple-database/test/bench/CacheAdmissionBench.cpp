@@ -0,0 +1,90 @@
+#include <cmath>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "DbCache.hpp"
+#include "SlabAllocator.hpp"
+
+/**
+ * CacheAdmissionBench
+ * Hit ratio of point lookups against a cache that also serves full table scans,
+ * with plain LRU and with TinyLfu admission, each with & without the scans skipping the cache
+ */
+
+static const size_t RecordLen = 200;
+static const size_t Records = 100 * 1000;
+static const size_t CachedRecords = 10 * 1000;
+static const size_t Lookups = 1000 * 1000;
+// a scan of every record in another table after this many lookups
+static const size_t LookupsPerScan = 50 * 1000;
+static const size_t ScanRecords = 50 * 1000;
+
+struct Ratio {
+    size_t hits = 0;
+    size_t reads = 0;
+
+    double Percent() const { return reads > 0 ? 100.0 * hits / reads : 0; }
+};
+
+// lookups follow a zipf distribution, a few records are read far more than the rest
+static std::vector<uint64_t> ZipfIds(size_t count, double skew)
+{
+    std::vector<double> weights(Records);
+    for (size_t i = 0; i < Records; i++) {
+        weights[i] = 1.0 / pow((double)(i + 1), skew);
+    }
+
+    std::mt19937 random{42};
+    std::discrete_distribution<size_t> zipf(weights.begin(), weights.end());
+    std::vector<uint64_t> ids(count);
+    for (uint64_t& id : ids) {
+        id = zipf(random) + 1;
+    }
+    return ids;
+}
+
+static bool Read(DbCache& cache, const RecordKey& key, bool cacheRead)
+{
+    uint8_t record[RecordLen] = {0xde, 0xad, 0xbe, 0xef};
+    size_t len;
+    if (cache.GetItem(key, record, len)) {
+        return true;
+    }
+
+    if (cacheRead) {
+        cache.AddItem(key, record, RecordLen);
+    }
+    return false;
+}
+
+static void Bench(const char* name, CachePolicy policy, bool cacheScans, const std::vector<uint64_t>& ids)
+{
+    DbCache cache{CachedRecords * SlabAllocator::SlotSize(RecordLen), policy};
+    Ratio lookups;
+    Ratio scans;
+    for (size_t i = 0; i < ids.size(); i++) {
+        lookups.hits += Read(cache, {0, ids[i], 1, false}, true);
+        lookups.reads++;
+
+        if ((i + 1) % LookupsPerScan == 0) {
+            for (uint64_t id = 1; id <= ScanRecords; id++) {
+                scans.hits += Read(cache, {0, id, 2, false}, cacheScans);
+                scans.reads++;
+            }
+        }
+    }
+
+    Ratio all = {lookups.hits + scans.hits, lookups.reads + scans.reads};
+    printf("%-24s lookups %5.1f%%  scans %5.1f%%  all %5.1f%%\n", name, lookups.Percent(), scans.Percent(), all.Percent());
+}
+
+int main()
+{
+    printf("%zu records, %zu cached, a %zu record scan every %zu lookups\n", Records, CachedRecords, ScanRecords, LookupsPerScan);
+    std::vector<uint64_t> ids = ZipfIds(Lookups, 0.9);
+    Bench("lru", CachePolicy::Lru, true, ids);
+    Bench("lru, scans uncached", CachePolicy::Lru, false, ids);
+    Bench("tinylfu", CachePolicy::TinyLfu, true, ids);
+    Bench("tinylfu, scans uncached", CachePolicy::TinyLfu, false, ids);
+    return 0;
+}
@@ -0,0 +1,75 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <vector>
+#include "DbCache.hpp"
+#include "SlabAllocator.hpp"
+
+/**
+ * CacheBench
+ * Times hits, evicting adds and removes against a full record cache of 10k, 100k & 1M records
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static const size_t RecordLen = 64;
+
+static std::vector<RecordKey> MakeKeys(size_t first, size_t count)
+{
+    std::vector<RecordKey> keys(count);
+    for (size_t i = 0; i < count; i++) {
+        keys[i] = {0, first + i, 1, false};
+    }
+    return keys;
+}
+
+static double NanosPerOp(Clock::time_point start, size_t ops)
+{
+    return std::chrono::duration<double, std::nano>(Clock::now() - start).count() / ops;
+}
+
+static void Bench(size_t entries)
+{
+    uint8_t record[RecordLen] = {0xde, 0xad, 0xbe, 0xef};
+    DbCache cache{entries * SlabAllocator::SlotSize(RecordLen)};
+    std::vector<RecordKey> keys = MakeKeys(0, entries);
+    for (const RecordKey& key : keys) {
+        cache.AddItem(key, record, RecordLen);
+    }
+
+    std::vector<RecordKey> shuffled = keys;
+    std::shuffle(shuffled.begin(), shuffled.end(), std::mt19937{42});
+
+    size_t len;
+    auto start = Clock::now();
+    for (const RecordKey& key : shuffled) {
+        cache.GetItem(key, record, len);
+    }
+    double hit = NanosPerOp(start, entries);
+
+    // the cache is full, so every add evicts the least recently used record
+    std::vector<RecordKey> newKeys = MakeKeys(entries, entries);
+    start = Clock::now();
+    for (const RecordKey& key : newKeys) {
+        cache.AddItem(key, record, RecordLen);
+    }
+    double evict = NanosPerOp(start, entries);
+
+    std::shuffle(newKeys.begin(), newKeys.end(), std::mt19937{7});
+    start = Clock::now();
+    for (const RecordKey& key : newKeys) {
+        cache.RemoveItem(key);
+    }
+    double remove = NanosPerOp(start, entries);
+
+    printf("%8zu records  hit %7.1fns  add+evict %7.1fns  remove %7.1fns\n", entries, hit, evict, remove);
+}
+
+int main()
+{
+    Bench(10 * 1000);
+    Bench(100 * 1000);
+    Bench(1000 * 1000);
+    return 0;
+}
@@ -0,0 +1,115 @@
+#include <chrono>
+#include <cstdio>
+#include <thread>
+#include <string>
+#include <vector>
+#include "ShardedCache.hpp"
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "fs.hpp"
+
+/**
+ * CacheThreadsBench
+ * Times threads reading records out of a warm cache, with every thread behind one lock
+ * against the cache split into DB_CACHE_SHARDS shards, and then threads finding records
+ * through their own Table, which goes through the driver's tables as well
+ */
+
+using Clock = std::chrono::steady_clock;
+
+static const size_t Entries = 100 * 1000;
+static const size_t ReadsPerThread = 1000 * 1000;
+static const size_t RecordLen = 64;
+static const size_t TableRecords = 10 * 1000;
+static const size_t FindsPerThread = 200 * 1000;
+
+static double Bench(size_t shards, size_t threadCount, const std::vector<RecordKey>& keys)
+{
+    ShardedCache cache{Entries * 1024, shards};
+    uint8_t record[RecordLen] = {0xde, 0xad, 0xbe, 0xef};
+    for (const RecordKey& key : keys) {
+        cache.AddItem(key, record, RecordLen);
+    }
+
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (size_t t = 0; t < threadCount; t++) {
+        threads.emplace_back([&cache, &keys, t]() {
+            uint8_t data[RecordLen];
+            size_t len;
+            size_t k = t * 7919;
+            for (size_t i = 0; i < ReadsPerThread; i++) {
+                k = (k + 104729) % keys.size();
+                cache.GetItem(keys[k], data, len);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return threadCount * ReadsPerThread / seconds / 1e6;
+}
+
+static double BenchFind(size_t threadCount)
+{
+    std::vector<std::thread> threads;
+    auto start = Clock::now();
+    for (size_t t = 0; t < threadCount; t++) {
+        threads.emplace_back([t]() {
+            Table<TestUser> table;
+            size_t k = t * 7919;
+            for (size_t i = 0; i < FindsPerThread; i++) {
+                k = (k + 104729) % TableRecords;
+                table.Find(k + 1);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    double seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    return threadCount * FindsPerThread / seconds / 1e6;
+}
+
+int main()
+{
+    std::vector<RecordKey> keys(Entries);
+    for (size_t i = 0; i < Entries; i++) {
+        keys[i] = {0, i, 1, false};
+    }
+
+    printf("%zu records, %u hardware threads\n", Entries, std::thread::hardware_concurrency());
+    for (size_t threads = 1; threads <= 8; threads *= 2) {
+        double single = Bench(1, threads, keys);
+        double sharded = Bench(DB_CACHE_SHARDS, threads, keys);
+        printf("%zu threads  1 shard %7.2fM reads/s  %d shards %7.2fM reads/s\n",
+            threads, single, DB_CACHE_SHARDS, sharded);
+    }
+
+    initFS();
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    DbDriver::InitDb();
+    Table<TestUser> table;
+    std::vector<TestUser> users(TableRecords);
+    for (size_t i = 0; i < users.size(); i++) {
+        users[i].Name().Set(("user" + std::to_string(i)).c_str());
+    }
+    table.SaveMany(users);
+
+    // every record is in the cache before the clock starts
+    for (ObjId id = 1; id <= TableRecords; id++) {
+        table.Find(id);
+    }
+
+    printf("\n%zu records through Table::Find\n", TableRecords);
+    for (size_t threads = 1; threads <= 8; threads *= 2) {
+        printf("%zu threads  %7.2fM finds/s\n", threads, BenchFind(threads));
+    }
+
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "fs.hpp"
+
+/**
+ * IndexBench
+ * Finds records by name with FindBy, scanning the table against answering from an index on
+ * the property, on every storage engine
+ */
+
+using User = TestUser;
+using Clock = std::chrono::steady_clock;
+
+static const size_t BatchSize = 500;
+
+static std::vector<User> MakeUsers()
+{
+    std::vector<User> users(BatchSize);
+    for (size_t i = 0; i < users.size(); i++) {
+        users[i].Name().Set(("user" + std::to_string(i)).c_str());
+        users[i].CNonce(i);
+    }
+    return users;
+}
+
+static double Millis(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void Reset()
+{
+    DbDriver::CloseStorage();
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    DbDriver::InitDb();
+    DbDriver::ClearCache();
+}
+
+static void Bench(const char* name, StorageType type)
+{
+    Table<User> table;
+    DbDriver::SetStorageType(type);
+    Reset();
+
+    std::vector<User> users = MakeUsers();
+    table.SaveMany(users);
+
+    static const size_t Lookups = 50;
+    auto start = Clock::now();
+    for (size_t i = 0; i < Lookups; i++) {
+        table.FindBy("Name", ("user" + std::to_string(i * 7)).c_str());
+    }
+    double findByScan = Millis(start);
+
+    Table<User>::IndexProperty("Name");
+    // built by the first lookup, timed with the rest
+    start = Clock::now();
+    for (size_t i = 0; i < Lookups; i++) {
+        table.FindBy("Name", ("user" + std::to_string(i * 7)).c_str());
+    }
+    double findByIndexed = Millis(start);
+    Table<User>::UnindexProperty("Name");
+
+    printf("%-6s %zu FindBy scan %8.2fms  indexed %8.2fms (%5.1fx)\n",
+        name, Lookups, findByScan, findByIndexed, findByScan / findByIndexed);
+}
+
+int main()
+{
+    initFS();
+    printf("%zu records\n", BatchSize);
+
+    Bench("File", StorageType::File);
+    Bench("Log", StorageType::Log);
+    Bench("BTree", StorageType::BTree);
+    Bench("Lsm", StorageType::Lsm);
+
+    DbDriver::CloseStorage();
+    DbDriver::SetStorageType(StorageType::File);
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "fs.hpp"
+
+/**
+ * KeysetBench
+ * Reaches the last page of records by walking All up to it against starting it with After
+ * the id before, on every storage engine
+ */
+
+using User = TestUser;
+using Clock = std::chrono::steady_clock;
+
+static const size_t BatchSize = 500;
+
+static std::vector<User> MakeUsers()
+{
+    std::vector<User> users(BatchSize);
+    for (size_t i = 0; i < users.size(); i++) {
+        users[i].Name().Set(("user" + std::to_string(i)).c_str());
+        users[i].CNonce(i);
+    }
+    return users;
+}
+
+static double Millis(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void Reset()
+{
+    DbDriver::CloseStorage();
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    DbDriver::InitDb();
+    DbDriver::ClearCache();
+}
+
+static void Bench(const char* name, StorageType type)
+{
+    Table<User> table;
+    DbDriver::SetStorageType(type);
+    Reset();
+
+    std::vector<User> users = MakeUsers();
+    table.SaveMany(users);
+
+    static const size_t Page = 100;
+    auto start = Clock::now();
+    ResultSet<User> all = table.All();
+    for (size_t i = 0; i < BatchSize && table.LoadNextResult(all); i++) {
+        // skipping to the last page still reads everything before it
+    }
+    double lastPageWalked = Millis(start);
+
+    // the index on Id is built before the timing starts
+    table.After(0, 1);
+    start = Clock::now();
+    ResultSet<User> after = table.After(BatchSize - Page, Page);
+    while (table.LoadNextResult(after)) {
+    }
+    double lastPageAfter = Millis(start);
+    Table<User>::UnindexProperty("Id");
+
+    printf("%-6s last page walked %8.2fms  After %8.2fms (%5.1fx)\n",
+        name, lastPageWalked, lastPageAfter, lastPageWalked / lastPageAfter);
+}
+
+int main()
+{
+    initFS();
+    printf("%zu records\n", BatchSize);
+
+    Bench("File", StorageType::File);
+    Bench("Log", StorageType::Log);
+    Bench("BTree", StorageType::BTree);
+    Bench("Lsm", StorageType::Lsm);
+
+    DbDriver::CloseStorage();
+    DbDriver::SetStorageType(StorageType::File);
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    return 0;
+}
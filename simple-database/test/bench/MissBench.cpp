@@ -0,0 +1,84 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "fs.hpp"
+
+/**
+ * MissBench
+ * Looks up a few hundred ids that don't exist, the first time and again once the misses are
+ * remembered, on every storage engine
+ */
+
+using User = TestUser;
+using Clock = std::chrono::steady_clock;
+
+static const size_t BatchSize = 500;
+
+static std::vector<User> MakeUsers()
+{
+    std::vector<User> users(BatchSize);
+    for (size_t i = 0; i < users.size(); i++) {
+        users[i].Name().Set(("user" + std::to_string(i)).c_str());
+        users[i].CNonce(i);
+    }
+    return users;
+}
+
+static double Millis(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void Reset()
+{
+    DbDriver::CloseStorage();
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    DbDriver::InitDb();
+    DbDriver::ClearCache();
+}
+
+static void Bench(const char* name, StorageType type)
+{
+    Table<User> table;
+    DbDriver::SetStorageType(type);
+    Reset();
+
+    std::vector<User> users = MakeUsers();
+    table.SaveMany(users);
+
+    // past the last saved id
+    auto start = Clock::now();
+    for (ObjId id = BatchSize + 1; id <= 2 * BatchSize; id++) {
+        table.Find(id);
+    }
+    double findMissing = Millis(start);
+
+    start = Clock::now();
+    for (ObjId id = BatchSize + 1; id <= 2 * BatchSize; id++) {
+        table.Find(id);
+    }
+    double findMissingAgain = Millis(start);
+
+    printf("%-6s find missing %8.2fms  again %8.2fms (%5.1fx)\n",
+        name, findMissing, findMissingAgain, findMissing / findMissingAgain);
+}
+
+int main()
+{
+    initFS();
+    printf("%zu records\n", BatchSize);
+
+    Bench("File", StorageType::File);
+    Bench("Log", StorageType::Log);
+    Bench("BTree", StorageType::BTree);
+    Bench("Lsm", StorageType::Lsm);
+
+    DbDriver::CloseStorage();
+    DbDriver::SetStorageType(StorageType::File);
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "fs.hpp"
+
+/**
+ * RangeBench
+ * Counts the records in a range of a property with CountRange, scanning the table against
+ * answering from an ordered index on the property, on every storage engine
+ */
+
+using User = TestUser;
+using Clock = std::chrono::steady_clock;
+
+static const size_t BatchSize = 500;
+
+static std::vector<User> MakeUsers()
+{
+    std::vector<User> users(BatchSize);
+    for (size_t i = 0; i < users.size(); i++) {
+        users[i].Name().Set(("user" + std::to_string(i)).c_str());
+        users[i].CNonce(i);
+    }
+    return users;
+}
+
+static double Millis(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void Reset()
+{
+    DbDriver::CloseStorage();
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    DbDriver::InitDb();
+    DbDriver::ClearCache();
+}
+
+static void Bench(const char* name, StorageType type)
+{
+    Table<User> table;
+    DbDriver::SetStorageType(type);
+    Reset();
+
+    std::vector<User> users = MakeUsers();
+    table.SaveMany(users);
+
+    static const size_t Lookups = 50;
+    size_t counted = 0;
+    auto start = Clock::now();
+    for (size_t i = 0; i < Lookups; i++) {
+        counted += table.CountRange("CNonce", i * 7, i * 7 + 20).GetCount();
+    }
+    double rangeScan = Millis(start);
+
+    Table<User>::IndexPropertyRanges("CNonce");
+    start = Clock::now();
+    for (size_t i = 0; i < Lookups; i++) {
+        counted -= table.CountRange("CNonce", i * 7, i * 7 + 20).GetCount();
+    }
+    double rangeIndexed = Millis(start);
+    Table<User>::UnindexProperty("CNonce");
+
+    printf("%-6s %zu CountRange scan %8.2fms  indexed %8.2fms (%5.1fx)%s\n",
+        name, Lookups, rangeScan, rangeIndexed, rangeScan / rangeIndexed, counted == 0 ? "" : "  counts differ");
+}
+
+int main()
+{
+    initFS();
+    printf("%zu records\n", BatchSize);
+
+    Bench("File", StorageType::File);
+    Bench("Log", StorageType::Log);
+    Bench("BTree", StorageType::BTree);
+    Bench("Lsm", StorageType::Lsm);
+
+    DbDriver::CloseStorage();
+    DbDriver::SetStorageType(StorageType::File);
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    return 0;
+}
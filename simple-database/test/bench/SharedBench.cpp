@@ -0,0 +1,92 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "fs.hpp"
+
+/**
+ * SharedBench
+ * Finds a few hundred cached records with Find against FindShared with their objects kept
+ * deserialized, on every storage engine
+ */
+
+using User = TestUser;
+using Clock = std::chrono::steady_clock;
+
+static const size_t BatchSize = 500;
+
+static std::vector<User> MakeUsers()
+{
+    std::vector<User> users(BatchSize);
+    for (size_t i = 0; i < users.size(); i++) {
+        users[i].Name().Set(("user" + std::to_string(i)).c_str());
+        users[i].CNonce(i);
+    }
+    return users;
+}
+
+static double Millis(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void Reset()
+{
+    DbDriver::CloseStorage();
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    DbDriver::InitDb();
+    DbDriver::ClearCache();
+}
+
+static void Bench(const char* name, StorageType type)
+{
+    Table<User> table;
+    DbDriver::SetStorageType(type);
+    Reset();
+
+    std::vector<User> users = MakeUsers();
+    table.SaveMany(users);
+
+    // everything is in the record cache, only the parse is left to save
+    for (ObjId id = 1; id <= BatchSize; id++) {
+        table.Find(id);
+    }
+    auto start = Clock::now();
+    for (ObjId id = 1; id <= BatchSize; id++) {
+        table.Find(id);
+    }
+    double findCached = Millis(start);
+
+    Table<User>::CacheObjects(BatchSize);
+    for (ObjId id = 1; id <= BatchSize; id++) {
+        table.FindShared(id);
+    }
+    start = Clock::now();
+    for (ObjId id = 1; id <= BatchSize; id++) {
+        table.FindShared(id);
+    }
+    double findShared = Millis(start);
+    Table<User>::CacheObjects(0);
+
+    printf("%-6s find cached %8.2fms  FindShared %8.2fms (%5.1fx)\n",
+        name, findCached, findShared, findCached / findShared);
+}
+
+int main()
+{
+    initFS();
+    printf("%zu records\n", BatchSize);
+
+    Bench("File", StorageType::File);
+    Bench("Log", StorageType::Log);
+    Bench("BTree", StorageType::BTree);
+    Bench("Lsm", StorageType::Lsm);
+
+    DbDriver::CloseStorage();
+    DbDriver::SetStorageType(StorageType::File);
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    return 0;
+}
@@ -0,0 +1,87 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "fs.hpp"
+
+/**
+ * StreamBench
+ * Reads All's records as its scan hands them over against finding each of its ids again,
+ * with the record cache out of the way, on every storage engine
+ */
+
+using User = TestUser;
+using Clock = std::chrono::steady_clock;
+
+static const size_t BatchSize = 500;
+
+static std::vector<User> MakeUsers()
+{
+    std::vector<User> users(BatchSize);
+    for (size_t i = 0; i < users.size(); i++) {
+        users[i].Name().Set(("user" + std::to_string(i)).c_str());
+        users[i].CNonce(i);
+    }
+    return users;
+}
+
+static double Millis(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void Reset()
+{
+    DbDriver::CloseStorage();
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    DbDriver::InitDb();
+    DbDriver::ClearCache();
+}
+
+static void Bench(const char* name, StorageType type)
+{
+    Table<User> table;
+    DbDriver::SetStorageType(type);
+    Reset();
+
+    std::vector<User> users = MakeUsers();
+    table.SaveMany(users);
+
+    DbDriver::ClearCache();
+    auto start = Clock::now();
+    // one page, NextId doesn't go past the first
+    ResultSet<User> streamed = table.NoCache().PageSize(BatchSize + 1).All();
+    while (table.LoadNextResult(streamed)) {
+    }
+    double allStreamed = Millis(start);
+
+    DbDriver::ClearCache();
+    start = Clock::now();
+    ResultSet<User> listed = table.NoCache().PageSize(BatchSize + 1).All();
+    while (ObjId id = listed.NextId()) {
+        table.Find(id);
+    }
+    double allFound = Millis(start);
+
+    printf("%-6s All found again %8.2fms  streamed %8.2fms (%5.1fx)\n",
+        name, allFound, allStreamed, allFound / allStreamed);
+}
+
+int main()
+{
+    initFS();
+    printf("%zu records\n", BatchSize);
+
+    Bench("File", StorageType::File);
+    Bench("Log", StorageType::Log);
+    Bench("BTree", StorageType::BTree);
+    Bench("Lsm", StorageType::Lsm);
+
+    DbDriver::CloseStorage();
+    DbDriver::SetStorageType(StorageType::File);
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    return 0;
+}
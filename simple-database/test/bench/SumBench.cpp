@@ -0,0 +1,83 @@
+#include <chrono>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "fs.hpp"
+
+/**
+ * SumBench
+ * Adds a property up over every record by loading each one against Sum reading it straight
+ * out of them, on every storage engine
+ */
+
+using User = TestUser;
+using Clock = std::chrono::steady_clock;
+
+static const size_t BatchSize = 500;
+
+static std::vector<User> MakeUsers()
+{
+    std::vector<User> users(BatchSize);
+    for (size_t i = 0; i < users.size(); i++) {
+        users[i].Name().Set(("user" + std::to_string(i)).c_str());
+        users[i].CNonce(i);
+    }
+    return users;
+}
+
+static double Millis(Clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static void Reset()
+{
+    DbDriver::CloseStorage();
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    DbDriver::InitDb();
+    DbDriver::ClearCache();
+}
+
+static void Bench(const char* name, StorageType type)
+{
+    Table<User> table;
+    DbDriver::SetStorageType(type);
+    Reset();
+
+    std::vector<User> users = MakeUsers();
+    table.SaveMany(users);
+
+    uint64_t loadedSum = 0;
+    auto start = Clock::now();
+    ResultSet<User> everyone = table.PageSize(BatchSize + 1).All();
+    while (table.LoadNextResult(everyone)) {
+        loadedSum += table.LoadedRecord().CNonce();
+    }
+    double sumLoaded = Millis(start);
+
+    start = Clock::now();
+    uint64_t sum = table.Sum("CNonce");
+    double sumRead = Millis(start);
+
+    printf("%-6s sum loaded %8.2fms  Sum %8.2fms (%5.1fx)%s\n",
+        name, sumLoaded, sumRead, sumLoaded / sumRead, sum == loadedSum ? "" : "  sums differ");
+}
+
+int main()
+{
+    initFS();
+    printf("%zu records\n", BatchSize);
+
+    Bench("File", StorageType::File);
+    Bench("Log", StorageType::Log);
+    Bench("BTree", StorageType::BTree);
+    Bench("Lsm", StorageType::Lsm);
+
+    DbDriver::CloseStorage();
+    DbDriver::SetStorageType(StorageType::File);
+    DirectoryWrapper::Delete(Path("/db").c_str());
+    return 0;
+}
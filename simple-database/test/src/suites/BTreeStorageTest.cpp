@@ -0,0 +1,196 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "BTreeStorage.hpp"
+#include "fs.hpp"
+
+using User = TestUser;
+
+class BTreeStorageTest : public ::testing::Test {
+    protected:
+        void SetUp() override {
+            initFS();
+            DirectoryWrapper::Delete(Path("/db").c_str());
+            DbDriver::InitDb();
+            DbDriver::SetStorageType(StorageType::BTree);
+        }
+
+        void TearDown() override {
+            DbDriver::CloseStorage();
+            DbDriver::SetStorageType(StorageType::File);
+            DirectoryWrapper::Delete(Path("/db").c_str());
+            DbDriver::ClearCache();
+        }
+
+        void Restart() {
+            DbDriver::CloseStorage();
+            DbDriver::ClearCache();
+        }
+
+        // ids 1..count in a scrambled order so splits happen all over the tree
+        static std::vector<ObjId> ScrambledIds(ObjId count) {
+            std::vector<ObjId> ids;
+            for (ObjId i = 0; i < count; i++) {
+                ids.push_back((i * 7919) % count + 1);
+            }
+            return ids;
+        }
+
+        static void Fill(uint8_t* data, size_t len, ObjId id) {
+            for (size_t i = 0; i < len; i++) {
+                data[i] = (uint8_t)(id + i);
+            }
+        }
+
+        std::vector<ObjId> Scan(DbDriver& db, const char* tableName, ObjId first = 0, ObjId last = UINT64_MAX) {
+            std::vector<ObjId> ids;
+            std::vector<uint8_t> data(BTreeStorage::PageSize);
+            TableCursor cursor;
+            EXPECT_TRUE(db.OpenTable(tableName, cursor));
+            cursor.Range(first, last);
+            while (db.GetNextRecord(data.data(), cursor)) {
+                ids.push_back(cursor.Position());
+            }
+            return ids;
+        }
+};
+
+TEST_F(BTreeStorageTest, recordsLiveInASinglePagedFile) {
+    uint8_t data[10] = {0x55};
+    DbDriver db{0, false};
+    ASSERT_TRUE(db.SaveRecord(1, 0, data, sizeof(data), "User"));
+    ASSERT_TRUE(db.SaveRecord(2, 0, data, sizeof(data), "User"));
+
+    EXPECT_FALSE(DirectoryWrapper::Exists(Path("/db/user/0100000000000000").c_str()));
+    FileWrapper f(Path("/db/user/records.btree").c_str());
+    ASSERT_TRUE(f.DidOpen());
+    EXPECT_EQ(f.Size() % BTreeStorage::PageSize, 0);
+
+    uint8_t read[sizeof(data) + sizeof(ObjId)] = {0};
+    ASSERT_EQ(db.GetRecord(read, 2, "User"), sizeof(read));
+    EXPECT_EQ(0, memcmp(read, data, sizeof(data)));
+}
+
+TEST_F(BTreeStorageTest, scansAreInIdOrder) {
+    const ObjId count = 2000;
+    uint8_t data[10] = {0};
+    DbDriver db{0, false};
+    for (ObjId id : ScrambledIds(count)) {
+        ASSERT_TRUE(db.SaveRecord(id, 0, data, sizeof(data), "User"));
+    }
+
+    Restart();
+
+    auto ids = Scan(db, "User");
+    ASSERT_EQ(ids.size(), count);
+    for (ObjId i = 0; i < count; i++) {
+        EXPECT_EQ(ids[i], i + 1);
+    }
+}
+
+TEST_F(BTreeStorageTest, scansCanBeLimitedToARange) {
+    uint8_t data[10] = {0};
+    DbDriver db{0, false};
+    for (ObjId id : ScrambledIds(1000)) {
+        ASSERT_TRUE(db.SaveRecord(id, 0, data, sizeof(data), "User"));
+    }
+
+    auto ids = Scan(db, "User", 100, 199);
+    ASSERT_EQ(ids.size(), 100);
+    EXPECT_EQ(ids.front(), 100);
+    EXPECT_EQ(ids.back(), 199);
+
+    EXPECT_TRUE(Scan(db, "User", 1001).empty());
+}
+
+TEST_F(BTreeStorageTest, largeRecordsReuseOverflowPages) {
+    uint8_t data[3000];
+    DbDriver db{0, false};
+    Fill(data, sizeof(data), 1);
+    ASSERT_TRUE(db.SaveRecord(1, 0, data, sizeof(data), "User"));
+
+    uint32_t size;
+    {
+        FileWrapper f(Path("/db/user/records.btree").c_str());
+        size = f.Size();
+    }
+
+    for (int i = 0; i < 20; i++) {
+        Fill(data, sizeof(data), i);
+        ASSERT_TRUE(db.SaveRecord(1, 0, data, sizeof(data), "User"));
+    }
+
+    {
+        FileWrapper f(Path("/db/user/records.btree").c_str());
+        EXPECT_LE(f.Size(), size + BTreeStorage::PageSize);
+    }
+
+    Restart();
+    uint8_t read[sizeof(data) + sizeof(ObjId)];
+    ASSERT_EQ(db.GetRecord(read, 1, "User"), sizeof(read));
+    EXPECT_EQ(0, memcmp(read, data, sizeof(data)));
+}
+
+TEST_F(BTreeStorageTest, deepTreeSurvivesARestart) {
+    // big enough records that the internal nodes have to split too
+    const ObjId count = 1200;
+    uint8_t data[900];
+    DbDriver db{0, false};
+    for (ObjId id : ScrambledIds(count)) {
+        Fill(data, sizeof(data), id);
+        ASSERT_TRUE(db.SaveRecord(id, 0, data, sizeof(data), "User"));
+    }
+
+    Restart();
+
+    uint8_t read[sizeof(data) + sizeof(ObjId)];
+    for (ObjId id = 1; id <= count; id++) {
+        Fill(data, sizeof(data), id);
+        ASSERT_EQ(db.GetRecord(read, id, "User"), sizeof(read));
+        ASSERT_EQ(0, memcmp(read, data, sizeof(data)));
+    }
+
+    for (ObjId id = 1; id <= count; id += 2) {
+        ASSERT_TRUE(db.DeleteRecord(id, "User"));
+    }
+    EXPECT_FALSE(db.DeleteRecord(1, "User"));
+
+    Restart();
+    auto ids = Scan(db, "User");
+    ASSERT_EQ(ids.size(), count / 2);
+    for (ObjId id : ids) {
+        EXPECT_EQ(id % 2, 0);
+    }
+}
+
+TEST_F(BTreeStorageTest, tableWorksOnTopOfTheTree) {
+    Table<User> uTable;
+    for (int i = 0; i < 300; i++) {
+        User u;
+        u.Name().Set(std::to_string(i).c_str());
+        ASSERT_FALSE(uTable.Save(u));
+    }
+
+    Restart();
+
+    ASSERT_TRUE(uTable.FindBy("Name", "150"));
+    EXPECT_EQ(uTable.LoadedRecord().Id(), 151);
+
+    auto results = uTable.All();
+    ObjId expected = 1;
+    while (uTable.LoadNextResult(results)) {
+        EXPECT_EQ(uTable.LoadedRecord().Id(), expected++);
+    }
+    EXPECT_EQ(expected, 301);
+
+    Table<User> pending{0, true};
+    User u;
+    u.Name("Vegeta");
+    ASSERT_FALSE(pending.Save(u, 7));
+    ASSERT_FALSE(pending.CommitAll(7));
+    EXPECT_TRUE(uTable.Find(u.Id()));
+    EXPECT_FALSE(pending.Find(u.Id()));
+    EXPECT_EQ(uTable.CountAll().GetCount(), 301);
+}
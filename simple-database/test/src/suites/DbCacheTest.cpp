@@ -4,12 +4,25 @@
 
 const size_t ItemSize = 1024;
 
+static RecordKey Key(uint64_t id)
+{
+    return {0, id, 1, false};
+}
+
+const RecordKey one = Key(1);
+const RecordKey two = Key(2);
+const RecordKey key = Key(3);
+const RecordKey key1 = Key(4);
+const RecordKey key2 = Key(5);
+const RecordKey largestBoy = Key(6);
+const RecordKey nope = Key(7);
+
 class DbCacheTest : public ::testing::Test {
     protected:
     void SetUp() override {
         cache.Clear();
-        cache.AddItem("one", data1, sizeof(data1));
-        cache.AddItem("two", data2, sizeof(data2));
+        cache.AddItem(one, data1, sizeof(data1));
+        cache.AddItem(two, data2, sizeof(data2));
     }
 
     void TearDown() override {
@@ -23,84 +36,321 @@ class DbCacheTest : public ::testing::Test {
 
 TEST_F(DbCacheTest, ItemCanBeCached) {
     const uint8_t data[ItemSize] = {0xde, 0xad, 0xbe, 0xef};
-    cache.AddItem("key", data, sizeof(data));
+    cache.AddItem(key, data, sizeof(data));
 
     uint8_t cached[ItemSize];
     size_t len;
-    ASSERT_TRUE(cache.GetItem("one", cached, len));
-    ASSERT_TRUE(cache.GetItem("two", cached, len));
-    ASSERT_TRUE(cache.GetItem("key", cached, len));
+    ASSERT_TRUE(cache.GetItem(one, cached, len));
+    ASSERT_TRUE(cache.GetItem(two, cached, len));
+    ASSERT_TRUE(cache.GetItem(key, cached, len));
     ASSERT_EQ(len, ItemSize);
     ASSERT_EQ(0, memcmp(cached, data, sizeof(data)));
 }
 
+TEST_F(DbCacheTest, EveryPartOfTheKeyCounts) {
+    const uint8_t data[ItemSize] = {0xde, 0xad, 0xbe, 0xef};
+    cache.AddItem({0, 9, 1, false}, data, sizeof(data));
+
+    uint8_t cached[ItemSize];
+    size_t len;
+    ASSERT_TRUE(cache.GetItem({0, 9, 1, false}, cached, len));
+    ASSERT_FALSE(cache.GetItem({1, 9, 1, false}, cached, len));
+    ASSERT_FALSE(cache.GetItem({0, 9, 2, false}, cached, len));
+    ASSERT_FALSE(cache.GetItem({0, 9, 1, true}, cached, len));
+}
+
 TEST_F(DbCacheTest, ItemCanBeRemoved) {
     uint8_t cached[ItemSize];
     size_t len;
-    ASSERT_TRUE(cache.GetItem("one", cached, len));
-    cache.RemoveItem("one");
-    ASSERT_FALSE(cache.GetItem("one", cached, len));
+    ASSERT_TRUE(cache.GetItem(one, cached, len));
+    cache.RemoveItem(one);
+    ASSERT_FALSE(cache.GetItem(one, cached, len));
 }
 
 TEST_F(DbCacheTest, DataNotModifiedIfKeyDoesntExist) {
     uint8_t cached[ItemSize];
     memcpy(cached, data1, sizeof(data1));
     size_t len;
-    ASSERT_FALSE(cache.GetItem("nope", cached, len));
+    ASSERT_FALSE(cache.GetItem(nope, cached, len));
     ASSERT_EQ(0, memcmp(data1, cached, sizeof(data1)));
 }
 
 TEST_F(DbCacheTest, AllItemsCanBeCleared) {
     uint8_t cached[ItemSize];
     size_t len;
-    ASSERT_TRUE(cache.GetItem("one", cached, len));
-    ASSERT_TRUE(cache.GetItem("two", cached, len));
+    ASSERT_TRUE(cache.GetItem(one, cached, len));
+    ASSERT_TRUE(cache.GetItem(two, cached, len));
     cache.Clear();
-    ASSERT_FALSE(cache.GetItem("one", cached, len));
-    ASSERT_FALSE(cache.GetItem("two", cached, len));
+    ASSERT_FALSE(cache.GetItem(one, cached, len));
+    ASSERT_FALSE(cache.GetItem(two, cached, len));
 }
 
 TEST_F(DbCacheTest, CanAddDataAfterReachingTheLimit) {
     const uint8_t data[ItemSize] = {0xde, 0xad, 0xbe, 0xef};
-    cache.AddItem("key1", data, sizeof(data));
-    cache.AddItem("key2", data, sizeof(data));
+    cache.AddItem(key1, data, sizeof(data));
+    cache.AddItem(key2, data, sizeof(data));
 
     uint8_t cached[ItemSize];
     size_t len;
-    ASSERT_TRUE(cache.GetItem("key2", cached, len));
+    ASSERT_TRUE(cache.GetItem(key2, cached, len));
     ASSERT_EQ(len, ItemSize);
     ASSERT_EQ(0, memcmp(cached, data, sizeof(data)));
 }
 
 TEST_F(DbCacheTest, LastInsertedItemIsPushedOutFirst) {
+    const uint8_t data[ItemSize] = {0xde, 0xad, 0xbe, 0xef};
+    cache.AddItem(key1, data, sizeof(data));
+    cache.AddItem(key2, data, sizeof(data));
+
+    uint8_t cached[ItemSize];
+    size_t len;
+    ASSERT_FALSE(cache.GetItem(one, cached, len));
+    ASSERT_TRUE(cache.GetItem(two, cached, len));
+}
+
+TEST_F(DbCacheTest, ReadingAnItemKeepsItCached) {
+    uint8_t cached[ItemSize];
+    size_t len;
+    ASSERT_TRUE(cache.GetItem(one, cached, len));
+
+    const uint8_t data[ItemSize] = {0xde, 0xad, 0xbe, 0xef};
+    cache.AddItem(key1, data, sizeof(data));
+    cache.AddItem(key2, data, sizeof(data));
+
+    ASSERT_TRUE(cache.GetItem(one, cached, len));
+    ASSERT_FALSE(cache.GetItem(two, cached, len));
+    ASSERT_TRUE(cache.GetItem(key2, cached, len));
+}
+
+TEST_F(DbCacheTest, UpdatingAnItemReplacesIt) {
     const uint8_t data[] = {0xde, 0xad, 0xbe, 0xef};
-    cache.AddItem("key1", data, sizeof(data));
-    cache.AddItem("key2", data, sizeof(data));
+    cache.AddItem(one, data, sizeof(data));
 
     uint8_t cached[ItemSize];
     size_t len;
-    ASSERT_FALSE(cache.GetItem("one", cached, len));
-    ASSERT_TRUE(cache.GetItem("two", cached, len));
+    ASSERT_TRUE(cache.GetItem(one, cached, len));
+    ASSERT_EQ(len, sizeof(data));
+    ASSERT_EQ(0, memcmp(cached, data, sizeof(data)));
+    ASSERT_TRUE(cache.GetItem(two, cached, len));
 }
 
+TEST_F(DbCacheTest, SmallItemsCostTheirSlotSize) {
+    const uint8_t data[] = {0xde, 0xad, 0xbe, 0xef};
+    cache.AddItem(key1, data, sizeof(data));
+    cache.AddItem(key2, data, sizeof(data));
+
+    uint8_t cached[ItemSize];
+    size_t len;
+    ASSERT_TRUE(cache.GetItem(one, cached, len));
+    ASSERT_TRUE(cache.GetItem(two, cached, len));
+    ASSERT_TRUE(cache.GetItem(key1, cached, len));
+    ASSERT_TRUE(cache.GetItem(key2, cached, len));
+    ASSERT_EQ(len, sizeof(data));
+    ASSERT_EQ(0, memcmp(cached, data, sizeof(data)));
+}
 
 TEST_F(DbCacheTest, CanEraseMultipleItemsDuringSingleItemAdd) {
     const uint8_t data[] = {0xde, 0xad, 0xbe, 0xef};
-    cache.AddItem("key1", data, sizeof(data));
+    cache.AddItem(key1, data, sizeof(data));
     uint8_t cached[ItemSize];
     size_t len;
-    ASSERT_TRUE(cache.GetItem("one", cached, len));
-    ASSERT_TRUE(cache.GetItem("two", cached, len));
-    ASSERT_TRUE(cache.GetItem("key1", cached, len));
+    ASSERT_TRUE(cache.GetItem(one, cached, len));
+    ASSERT_TRUE(cache.GetItem(two, cached, len));
+    ASSERT_TRUE(cache.GetItem(key1, cached, len));
 
     static const size_t largeDataLength = 3 * 1024;
     uint8_t largeData[largeDataLength] = {0};
 
     size_t size;
 
-    cache.AddItem("largest-boy", largeData, 3 * 1024);
-    ASSERT_FALSE(cache.GetItem("one", cached, len));
-    ASSERT_FALSE(cache.GetItem("two", cached, len));
-    ASSERT_FALSE(cache.GetItem("key1", cached, len));
-    ASSERT_TRUE(cache.GetItem("largest-boy", largeData, len));
+    cache.AddItem(largestBoy, largeData, 3 * 1024);
+    ASSERT_FALSE(cache.GetItem(one, cached, len));
+    ASSERT_FALSE(cache.GetItem(two, cached, len));
+    ASSERT_FALSE(cache.GetItem(key1, cached, len));
+    ASSERT_TRUE(cache.GetItem(largestBoy, largeData, len));
+}
+
+class TinyLfuCacheTest : public ::testing::Test {
+    protected:
+        static const size_t Items = 16;
+        DbCache cache = {Items * ItemSize, CachePolicy::TinyLfu};
+        uint8_t data[ItemSize] = {0xde, 0xad, 0xbe, 0xef};
+        uint8_t cached[ItemSize];
+        size_t len;
+
+        // a record read through the cache, added when it misses
+        void Read(const RecordKey& key) {
+            if (!cache.GetItem(key, cached, len)) {
+                cache.AddItem(key, data, sizeof(data));
+            }
+        }
+};
+
+TEST_F(TinyLfuCacheTest, ItemsGetInWhileThereIsRoom) {
+    for (size_t i = 0; i < Items; i++) {
+        cache.AddItem(Key(100 + i), data, sizeof(data));
+    }
+
+    for (size_t i = 0; i < Items; i++) {
+        ASSERT_TRUE(cache.GetItem(Key(100 + i), cached, len));
+    }
+}
+
+TEST_F(TinyLfuCacheTest, ScanDoesntFlushFrequentlyReadItems) {
+    for (size_t i = 0; i < Items / 2; i++) {
+        for (size_t reads = 0; reads < 3; reads++) {
+            Read(Key(100 + i));
+        }
+    }
+
+    // every record of a table read once, far more than fit
+    for (size_t i = 0; i < 10 * Items; i++) {
+        Read(Key(1000 + i));
+    }
+
+    for (size_t i = 0; i < Items / 2; i++) {
+        ASSERT_TRUE(cache.GetItem(Key(100 + i), cached, len));
+    }
+}
+
+TEST_F(TinyLfuCacheTest, FrequentlyMissedItemIsAdmitted) {
+    for (size_t i = 0; i < Items; i++) {
+        Read(Key(100 + i));
+    }
+
+    ASSERT_FALSE(cache.GetItem(largestBoy, cached, len));
+    ASSERT_FALSE(cache.GetItem(largestBoy, cached, len));
+    ASSERT_FALSE(cache.GetItem(largestBoy, cached, len));
+    cache.AddItem(largestBoy, data, sizeof(data));
+    ASSERT_TRUE(cache.GetItem(largestBoy, cached, len));
+
+    // something had to make room for it
+    size_t stillCached = 0;
+    for (size_t i = 0; i < Items; i++) {
+        stillCached += cache.GetItem(Key(100 + i), cached, len);
+    }
+    ASSERT_EQ(stillCached, Items - 1);
+}
+
+TEST_F(DbCacheTest, CountsHitsMissesAndEvictions) {
+    cache.ResetStats();
+    uint8_t cached[ItemSize];
+    size_t len;
+    ASSERT_TRUE(cache.GetItem(one, cached, len));
+    ASSERT_FALSE(cache.GetItem(nope, cached, len));
+
+    const uint8_t data[ItemSize] = {0xde, 0xad, 0xbe, 0xef};
+    cache.AddItem(key1, data, sizeof(data));
+    cache.AddItem(key2, data, sizeof(data));
+    cache.RemoveItem(key2);
+
+    CacheStats stats = cache.Stats();
+    EXPECT_EQ(stats.hits, 1);
+    EXPECT_EQ(stats.misses, 1);
+    EXPECT_EQ(stats.evictions, 1);
+    EXPECT_EQ(stats.insertedBytes, 2 * ItemSize);
+    EXPECT_EQ(stats.residentItems, 2);
+    EXPECT_EQ(stats.residentBytes, 2 * ItemSize);
+
+    CacheStats table = cache.TableStats(1);
+    EXPECT_EQ(table.hits, 1);
+    EXPECT_EQ(table.residentItems, 2);
+    EXPECT_EQ(cache.TableStats(2).residentItems, 0);
+}
+
+TEST_F(DbCacheTest, TableBudgetOnlyEvictsItsOwnRecords) {
+    const uint8_t data[ItemSize] = {0xde, 0xad, 0xbe, 0xef};
+    const RecordKey other = {0, 1, 2, false};
+    const RecordKey otherNext = {0, 2, 2, false};
+    cache.SetTableBudget(2, ItemSize);
+    cache.AddItem(other, data, sizeof(data));
+    cache.AddItem(otherNext, data, sizeof(data));
+
+    uint8_t cached[ItemSize];
+    size_t len;
+    ASSERT_TRUE(cache.GetItem(one, cached, len));
+    ASSERT_TRUE(cache.GetItem(two, cached, len));
+    ASSERT_FALSE(cache.GetItem(other, cached, len));
+    ASSERT_TRUE(cache.GetItem(otherNext, cached, len));
+
+    // lowering a budget evicts straight away
+    cache.SetTableBudget(1, ItemSize);
+    ASSERT_FALSE(cache.GetItem(one, cached, len));
+    ASSERT_TRUE(cache.GetItem(two, cached, len));
+}
+
+TEST_F(DbCacheTest, ScopeBudgetTakesInRecordsAlreadyCached) {
+    const uint8_t data[ItemSize] = {0xde, 0xad, 0xbe, 0xef};
+    const RecordKey scoped = {5, 1, 1, false};
+    cache.AddItem(scoped, data, sizeof(data));
+    cache.SetScopeBudget(5, ItemSize);
+
+    const RecordKey scopedNext = {5, 2, 1, true};
+    cache.AddItem(scopedNext, data, sizeof(data));
+
+    uint8_t cached[ItemSize];
+    size_t len;
+    ASSERT_FALSE(cache.GetItem(scoped, cached, len));
+    ASSERT_TRUE(cache.GetItem(scopedNext, cached, len));
+    ASSERT_TRUE(cache.GetItem(one, cached, len));
+    ASSERT_TRUE(cache.GetItem(two, cached, len));
+}
+
+TEST_F(DbCacheTest, ScopeOrTableCanBeDroppedAlone) {
+    const uint8_t data[100] = {0xde, 0xad, 0xbe, 0xef};
+    const RecordKey scoped = {5, 1, 1, false};
+    const RecordKey scopedPending = {5, 2, 1, true};
+    const RecordKey scopedOther = {5, 3, 2, false};
+    cache.AddItem(scoped, data, sizeof(data));
+    cache.AddItem(scopedPending, data, sizeof(data));
+    cache.AddItem(scopedOther, data, sizeof(data));
+
+    uint8_t cached[ItemSize];
+    size_t len;
+    cache.RemoveTable(5, 1);
+    ASSERT_FALSE(cache.GetItem(scoped, cached, len));
+    ASSERT_FALSE(cache.GetItem(scopedPending, cached, len));
+    ASSERT_TRUE(cache.GetItem(scopedOther, cached, len));
+    ASSERT_TRUE(cache.GetItem(one, cached, len));
+
+    cache.RemoveScope(5);
+    ASSERT_FALSE(cache.GetItem(scopedOther, cached, len));
+    ASSERT_TRUE(cache.GetItem(one, cached, len));
+    ASSERT_TRUE(cache.GetItem(two, cached, len));
+    ASSERT_EQ(cache.Stats().residentItems, 2);
+    ASSERT_EQ(cache.Stats().evictions, 0);
+
+    // the scope is listed again once it has records again
+    cache.AddItem(scoped, data, sizeof(data));
+    cache.RemoveScope(5);
+    ASSERT_FALSE(cache.GetItem(scoped, cached, len));
+}
+
+TEST_F(DbCacheTest, ShrinkingEvictsTheOldest) {
+    cache.Resize(ItemSize);
+    ASSERT_EQ(cache.MaxSize(), ItemSize);
+
+    uint8_t cached[ItemSize];
+    size_t len;
+    ASSERT_FALSE(cache.GetItem(one, cached, len));
+    ASSERT_TRUE(cache.GetItem(two, cached, len));
+    ASSERT_EQ(cache.Stats().evictions, 1);
+}
+
+TEST_F(DbCacheTest, RecordStaysAbsentUntilAdded) {
+    ASSERT_FALSE(cache.IsAbsent(key));
+    cache.MarkAbsent(key);
+    ASSERT_TRUE(cache.IsAbsent(key));
+    ASSERT_FALSE(cache.IsAbsent(key1));
+    ASSERT_EQ(cache.Stats().absentHits, 1);
+
+    // even a record the cache has no room for takes the mark away
+    cache.SetTableBudget(1, ItemSize / 2);
+    const uint8_t data[ItemSize] = {0xde, 0xad, 0xbe, 0xef};
+    cache.AddItem(key, data, sizeof(data));
+    ASSERT_FALSE(cache.IsAbsent(key));
+
+    cache.MarkAbsent(key1);
+    cache.ClearAbsent();
+    ASSERT_FALSE(cache.IsAbsent(key1));
 }
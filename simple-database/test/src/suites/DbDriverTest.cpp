@@ -1,4 +1,7 @@
 #include <gtest/gtest.h>
+#include <atomic>
+#include <thread>
+#include <vector>
 #include "DbDriver.hpp"
 #include "MessageEnums.hpp"
 #include "fs.hpp"
@@ -54,6 +57,306 @@ TEST_F(DbDriverTest, initScope) {
     dir.Close();
 }
 
+TEST_F(DbDriverTest, tablesAreOnlyCreatedOnce) {
+    DbDriver dbDriver{0, false};
+    DirectoryWrapper dir;
+    ASSERT_TRUE(dbDriver.OpenTable("User", dir));
+    dir.Close();
+
+    // resolved tables aren't checked again, so a table deleted behind the db's back stays gone
+    ASSERT_TRUE(DirectoryWrapper::Delete(Path("/db/user").c_str()));
+    EXPECT_FALSE(dbDriver.OpenTable("User", dir));
+
+    DbDriver::InitDb();
+    EXPECT_TRUE(dbDriver.OpenTable("User", dir));
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/user/pending").c_str()));
+    dir.Close();
+}
+
+TEST_F(DbDriverTest, droppedTablesAreCreatedAgain) {
+    uint8_t data[10] = {0x55};
+    DbDriver dbDriver{1, false};
+    ASSERT_TRUE(dbDriver.SaveRecord(1, 0, data, sizeof(data), "User"));
+
+    ASSERT_TRUE(dbDriver.DeleteTable("User"));
+    ASSERT_TRUE(dbDriver.SaveRecord(1, 0, data, sizeof(data), "User"));
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/0100000000000000/user/counter").c_str()));
+
+    ASSERT_TRUE(dbDriver.DeleteScope());
+    ASSERT_TRUE(dbDriver.SaveRecord(1, 0, data, sizeof(data), "User"));
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/0100000000000000/user/counter").c_str()));
+
+    ASSERT_TRUE(DbDriver::DeleteAll());
+    DbDriver scoped{1, false};
+    ASSERT_TRUE(scoped.SaveRecord(1, 0, data, sizeof(data), "User"));
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/0100000000000000/user/counter").c_str()));
+}
+
+TEST_F(DbDriverTest, cachedRecordsAreKeptApart) {
+    uint8_t data[4][10] = {{0x11}, {0x22}, {0x33}, {0x44}};
+    DbDriver root{0, false};
+    DbDriver rootPending{0, true};
+    DbDriver scoped{1, false};
+    ASSERT_TRUE(root.SaveRecord(1, 0, data[0], sizeof(data[0]), "User"));
+    ASSERT_TRUE(rootPending.SaveRecord(1, 7, data[1], sizeof(data[1]), "User"));
+    ASSERT_TRUE(scoped.SaveRecord(1, 0, data[2], sizeof(data[2]), "User"));
+    ASSERT_TRUE(root.SaveRecord(1, 0, data[3], sizeof(data[3]), "Other"));
+
+    // every read is a cache hit, each must find its own record
+    uint8_t read[10 + sizeof(ObjId)];
+    ASSERT_EQ(root.GetRecord(read, 1, "User"), 10 + sizeof(ObjId));
+    EXPECT_EQ(read[0], 0x11);
+    ASSERT_GT(rootPending.GetRecord(read, 1, "User"), 0);
+    EXPECT_EQ(read[0], 0x22);
+    ASSERT_GT(scoped.GetRecord(read, 1, "User"), 0);
+    EXPECT_EQ(read[0], 0x33);
+    ASSERT_GT(root.GetRecord(read, 1, "Other"), 0);
+    EXPECT_EQ(read[0], 0x44);
+}
+
+TEST_F(DbDriverTest, everySpellingOfATableIsTheSameTable) {
+    uint8_t data[2][10] = {{0xAA}, {0xBB}};
+    DbDriver driver{0, false};
+    DbDriver::ClearCache();
+    ASSERT_TRUE(driver.SaveRecord(1, 0, data[0], sizeof(data[0]), "user"));
+
+    // one file on disk, so one record in the cache
+    uint8_t read[10 + sizeof(ObjId)];
+    ASSERT_GT(driver.GetRecord(read, 1, "user"), 0);
+    ASSERT_TRUE(driver.SaveRecord(1, 0, data[1], sizeof(data[1]), "User"));
+    ASSERT_GT(driver.GetRecord(read, 1, "user"), 0);
+    EXPECT_EQ(read[0], 0xBB);
+    EXPECT_EQ(DbDriver::GetTableCacheStats("USER").residentItems, 1);
+    DbDriver::ClearCache();
+}
+
+TEST_F(DbDriverTest, readsLeaveMissingTablesAlone) {
+    DbDriver driver{0, false};
+    uint8_t read[10 + sizeof(ObjId)];
+    uint32_t len;
+    EXPECT_EQ(driver.GetRecord(read, 1, "Ghost"), 0);
+    EXPECT_EQ(driver.GetRecordView(1, "Ghost", len), nullptr);
+    EXPECT_FALSE(driver.RecordExists(1, "Ghost"));
+    EXPECT_FALSE(DirectoryWrapper::Exists(Path("/db/ghost").c_str()));
+
+    // the first save makes them after all
+    uint8_t data[10] = {0x66};
+    ASSERT_TRUE(driver.SaveRecord(1, 0, data, sizeof(data), "Ghost"));
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/ghost/pending").c_str()));
+    ASSERT_GT(driver.GetRecord(read, 1, "Ghost"), 0);
+    EXPECT_EQ(read[0], 0x66);
+}
+
+#if DB_DRIVER_LOCKING
+TEST_F(DbDriverTest, findsRunOnManyThreads) {
+    const size_t scopes = 4;
+    const size_t perScope = 50;
+    for (ObjId scope = 1; scope <= scopes; scope++) {
+        Table<TestUser> table{scope};
+        std::vector<TestUser> users(perScope);
+        for (size_t i = 0; i < perScope; i++) {
+            users[i].Name().Set(("user" + std::to_string(i)).c_str());
+            users[i].CNonce(scope * 1000 + i);
+        }
+        ASSERT_EQ(ErrorCode::None, table.SaveMany(users));
+    }
+
+    // every thread resolves the tables again and reads from an empty cache
+    DbDriver::CloseTables();
+    DbDriver::ClearCache();
+
+    std::atomic<size_t> found{0};
+    std::atomic<size_t> wrong{0};
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 8; t++) {
+        threads.emplace_back([&found, &wrong, t, scopes, perScope]() {
+            for (size_t i = 0; i < scopes * perScope; i++) {
+                ObjId scope = (t + i) % scopes + 1;
+                ObjId id = i / scopes + 1;
+                Table<TestUser> table{scope};
+                if (!table.Find(id)) {
+                    continue;
+                }
+                found++;
+                wrong += table.LoadedRecord().CNonce() != scope * 1000 + id - 1;
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    EXPECT_EQ(found, 8 * scopes * perScope);
+    EXPECT_EQ(wrong, 0);
+}
+#endif
+
+TEST_F(DbDriverTest, uncachedReadsLeaveTheCacheAlone) {
+    uint8_t data[10] = {0x55};
+    DbDriver driver{0, false};
+    ASSERT_TRUE(driver.SaveRecord(1, 0, data, sizeof(data), "User"));
+    ASSERT_TRUE(driver.SaveRecord(2, 0, data, sizeof(data), "User"));
+    DbDriver::ClearCache();
+
+    uint8_t read[10 + sizeof(ObjId)];
+    driver.CacheReads(false);
+    ASSERT_GT(driver.GetRecord(read, 1, "User"), 0);
+    driver.CacheReads(true);
+    ASSERT_GT(driver.GetRecord(read, 2, "User"), 0);
+
+    // with the files gone only what was cached can still be read
+    ASSERT_TRUE(DirectoryWrapper::Delete(Path("/db/user/0100000000000000").c_str()));
+    ASSERT_TRUE(DirectoryWrapper::Delete(Path("/db/user/0200000000000000").c_str()));
+    EXPECT_EQ(driver.GetRecord(read, 1, "User"), 0);
+    EXPECT_GT(driver.GetRecord(read, 2, "User"), 0);
+    DbDriver::ClearCache();
+}
+
+TEST_F(DbDriverTest, cacheCanBeSizedAndWatched) {
+    size_t size = DbDriver::CacheSize();
+    DbDriver::SetCacheSize(size / 2);
+    EXPECT_EQ(DbDriver::CacheSize(), size / 2);
+    DbDriver::SetCacheSize(size);
+
+    uint8_t data[10] = {0x55};
+    DbDriver driver{0, false};
+    ASSERT_TRUE(driver.SaveRecord(1, 0, data, sizeof(data), "User"));
+    DbDriver::ResetCacheStats();
+
+    uint8_t read[10 + sizeof(ObjId)];
+    ASSERT_GT(driver.GetRecord(read, 1, "User"), 0);
+    ASSERT_EQ(driver.GetRecord(read, 2, "User"), 0);
+
+    CacheStats user = DbDriver::GetTableCacheStats("User");
+    EXPECT_EQ(user.hits, 1);
+    EXPECT_EQ(user.misses, 1);
+    EXPECT_EQ(user.residentItems, 1);
+    EXPECT_EQ(DbDriver::GetTableCacheStats("Other").misses, 0);
+    EXPECT_GE(DbDriver::GetCacheStats().hits, 1);
+    DbDriver::ClearCache();
+}
+
+TEST_F(DbDriverTest, missesAreRemembered) {
+    uint8_t data[10] = {0x55};
+    uint8_t read[10 + sizeof(ObjId)];
+    DbDriver driver{0, false};
+    DbDriver::ResetCacheStats();
+
+    EXPECT_EQ(driver.GetRecord(read, 5, "User"), 0);
+    EXPECT_FALSE(driver.RecordExists(5, "User"));
+    EXPECT_EQ(driver.GetRecord(read, 5, "User"), 0);
+    EXPECT_EQ(DbDriver::GetTableCacheStats("User").absentHits, 2);
+
+    ASSERT_TRUE(driver.SaveRecord(5, 0, data, sizeof(data), "User"));
+    EXPECT_TRUE(driver.RecordExists(5, "User"));
+    EXPECT_GT(driver.GetRecord(read, 5, "User"), 0);
+
+    // a deleted record is known to be gone
+    ASSERT_TRUE(driver.DeleteRecord(5, "User"));
+    EXPECT_FALSE(driver.RecordExists(5, "User"));
+    EXPECT_EQ(DbDriver::GetTableCacheStats("User").absentHits, 3);
+    DbDriver::ClearCache();
+}
+
+TEST_F(DbDriverTest, missesAreForgottenUnderEverySpelling) {
+    uint8_t data[10] = {0x55};
+    uint8_t read[10 + sizeof(ObjId)];
+    DbDriver driver{0, false};
+    DbDriver::ClearCache();
+
+    EXPECT_FALSE(driver.RecordExists(5, "user"));
+    ASSERT_TRUE(driver.SaveRecord(5, 0, data, sizeof(data), "User"));
+    EXPECT_TRUE(driver.RecordExists(5, "user"));
+    EXPECT_GT(driver.GetRecord(read, 5, "user"), 0);
+
+    // a read kept out of the cache leaves no mark either
+    DbDriver::ResetCacheStats();
+    driver.CacheReads(false);
+    EXPECT_FALSE(driver.RecordExists(6, "User"));
+    driver.CacheReads(true);
+    EXPECT_FALSE(driver.RecordExists(6, "User"));
+    EXPECT_EQ(DbDriver::GetTableCacheStats("User").absentHits, 0);
+    DbDriver::ClearCache();
+}
+
+TEST_F(DbDriverTest, droppingAScopeOrTableKeepsTheRestCached) {
+    uint8_t data[10] = {0x55};
+    DbDriver root{0, false};
+    DbDriver scoped{1, false};
+    ASSERT_TRUE(root.SaveRecord(1, 0, data, sizeof(data), "User"));
+    ASSERT_TRUE(root.SaveRecord(1, 0, data, sizeof(data), "Other"));
+    ASSERT_TRUE(scoped.SaveRecord(1, 0, data, sizeof(data), "User"));
+
+    ASSERT_TRUE(scoped.DeleteScope());
+    ASSERT_TRUE(root.DeleteTable("Other"));
+
+    // with its file gone the record can only be read from the cache
+    ASSERT_TRUE(DirectoryWrapper::Delete(Path("/db/user/0100000000000000").c_str()));
+    uint8_t read[10 + sizeof(ObjId)];
+    EXPECT_GT(root.GetRecord(read, 1, "User"), 0);
+    EXPECT_EQ(root.GetRecord(read, 1, "Other"), 0);
+    EXPECT_EQ(scoped.GetRecord(read, 1, "User"), 0);
+    DbDriver::ClearCache();
+}
+
+TEST_F(DbDriverTest, droppingATableUnderAnotherSpellingEmptiesItsCache) {
+    uint8_t data[10] = {0x55};
+    uint8_t read[10 + sizeof(ObjId)];
+    DbDriver driver{0, false};
+    ASSERT_TRUE(driver.SaveRecord(1, 0, data, sizeof(data), "user"));
+    ASSERT_GT(driver.GetRecord(read, 1, "user"), 0);
+
+    ASSERT_TRUE(driver.DeleteTable("User"));
+    EXPECT_EQ(driver.GetRecord(read, 1, "user"), 0);
+    EXPECT_EQ(DbDriver::GetTableCacheStats("user").residentItems, 0);
+    DbDriver::ClearCache();
+}
+
+TEST_F(DbDriverTest, cacheSnapshotWarmsTheNextRun) {
+    uint8_t data[10] = {0x55};
+    uint8_t read[10 + sizeof(ObjId)];
+    DbDriver driver{0, false};
+    DbDriver scoped{1, true};
+    ASSERT_TRUE(driver.SaveRecord(1, 0, data, sizeof(data), "User"));
+    ASSERT_TRUE(driver.SaveRecord(2, 0, data, sizeof(data), "User"));
+    ASSERT_TRUE(driver.SaveRecord(3, 0, data, sizeof(data), "User"));
+    ASSERT_TRUE(scoped.SaveRecord(1, 7, data, sizeof(data), "Other"));
+    DbDriver::ClearCache();
+    ASSERT_GT(driver.GetRecord(read, 1, "User"), 0);
+    ASSERT_GT(driver.GetRecord(read, 2, "User"), 0);
+    ASSERT_GT(scoped.GetRecord(read, 1, "Other"), 0);
+    ASSERT_TRUE(DbDriver::SaveCacheSnapshot(100));
+
+    // record 2 changes while the db is down
+    DbDriver::ClearCache();
+    data[0] = 0x66;
+    ASSERT_TRUE(driver.SaveRecord(2, 0, data, sizeof(data), "User"));
+    DbDriver::ClearCache();
+    DbDriver::CloseTables();
+
+    ASSERT_TRUE(DbDriver::LoadCacheSnapshot());
+    EXPECT_EQ(DbDriver::WarmCache(2), 1);
+    EXPECT_EQ(DbDriver::WarmCache(2), 0);
+
+    // with the files gone only what was warmed can be read
+    ASSERT_TRUE(DirectoryWrapper::Delete(Path("/db/user/0100000000000000").c_str()));
+    ASSERT_TRUE(DirectoryWrapper::Delete(Path("/db/user/0200000000000000").c_str()));
+    ASSERT_TRUE(DirectoryWrapper::Delete(Path("/db/user/0300000000000000").c_str()));
+    EXPECT_GT(driver.GetRecord(read, 1, "User"), 0);
+    EXPECT_EQ(driver.GetRecord(read, 2, "User"), 0);
+    EXPECT_EQ(driver.GetRecord(read, 3, "User"), 0);
+    EXPECT_GT(scoped.GetRecord(read, 1, "Other"), 0);
+
+    // a torn snapshot is thrown away
+    FileWrapper snapshot{Path("/db/cache.snapshot").c_str(), "r+"};
+    ASSERT_TRUE(snapshot.Seek(snapshot.Size() - 1));
+    ASSERT_TRUE(snapshot.Write("x", 1));
+    snapshot.Close();
+    EXPECT_FALSE(DbDriver::LoadCacheSnapshot());
+    EXPECT_EQ(DbDriver::WarmCache(10), 0);
+    DbDriver::ClearCache();
+}
+
 TEST_F(DbDriverTest, canReInitDb) {
     CheckInit();
 };
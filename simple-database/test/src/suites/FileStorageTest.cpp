@@ -0,0 +1,120 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "fs.hpp"
+
+using User = TestUser;
+
+class FileStorageTest : public ::testing::Test {
+    protected:
+        void SetUp() override {
+            initFS();
+            DirectoryWrapper::Delete(Path("/db").c_str());
+            DbDriver::InitDb();
+            DbDriver::ClearCache();
+        }
+
+        void TearDown() override {
+            DbDriver::SetStorageType(StorageType::File);
+            DirectoryWrapper::Delete(Path("/db").c_str());
+            DbDriver::ClearCache();
+        }
+
+        static void SaveUsers(Table<User>& table, int count) {
+            for (int i = 0; i < count; i++) {
+                User u;
+                u.Name().Set(std::to_string(i).c_str());
+                ASSERT_FALSE(table.Save(u));
+            }
+        }
+};
+
+TEST_F(FileStorageTest, fanOutSpreadsRecordsOverSubdirectories) {
+    DbDriver::SetStorageType(StorageType::FileFanOut);
+    Table<User> uTable;
+    SaveUsers(uTable, 300);
+
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/testuser/01/00/0100000000000000").c_str()));
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/testuser/2c/01/2c01000000000000").c_str()));
+    EXPECT_FALSE(DirectoryWrapper::Exists(Path("/db/testuser/0100000000000000").c_str()));
+
+    DbDriver::ClearCache();
+    ASSERT_TRUE(uTable.Find(300));
+    EXPECT_STREQ(uTable.LoadedRecord().Name(), "299");
+    EXPECT_EQ(uTable.CountAll().GetCount(), 300);
+    ASSERT_TRUE(uTable.FindBy("Name", "150"));
+    EXPECT_EQ(uTable.LoadedRecord().Id(), 151);
+
+    ASSERT_FALSE(uTable.Delete(151));
+    EXPECT_FALSE(uTable.Find(151));
+    EXPECT_EQ(uTable.CountAll().GetCount(), 299);
+}
+
+TEST_F(FileStorageTest, fanOutScansSkipOtherDirectories) {
+    DbDriver::SetStorageType(StorageType::FileFanOut);
+    Table<User> uTable;
+    SaveUsers(uTable, 3);
+
+    Table<User> pendingTable{DbDriver::RootScope, true};
+    User pending;
+    ASSERT_FALSE(pendingTable.Save(pending, 7));
+
+    // counter and pending live next to the fan out directories
+    EXPECT_EQ(uTable.CountAll().GetCount(), 3);
+    EXPECT_EQ(pendingTable.CountAll().GetCount(), 1);
+}
+
+TEST_F(FileStorageTest, tablesCanBeMigratedBetweenLayouts) {
+    Table<User> uTable;
+    Table<User> scopedTable{1};
+    Table<User> pendingTable{DbDriver::RootScope, true};
+    SaveUsers(uTable, 50);
+    SaveUsers(scopedTable, 5);
+    User pending;
+    ASSERT_FALSE(pendingTable.Save(pending, 7));
+
+    DbDriver::SetStorageType(StorageType::FileFanOut);
+    EXPECT_EQ(uTable.CountAll().GetCount(), 0);
+    ASSERT_TRUE(DbDriver::MigrateFileLayout());
+
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/testuser/32/00/3200000000000000").c_str()));
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/0100000000000000/testuser/05/00/0500000000000000").c_str()));
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/testuser/pending/33/00/3300000000000000").c_str()));
+    EXPECT_EQ(uTable.CountAll().GetCount(), 50);
+    EXPECT_EQ(scopedTable.CountAll().GetCount(), 5);
+    EXPECT_EQ(pendingTable.CountAll().GetCount(), 1);
+
+    // running it again finds nothing left to move
+    ASSERT_TRUE(DbDriver::MigrateFileLayout());
+    EXPECT_EQ(uTable.CountAll().GetCount(), 50);
+
+    DbDriver::SetStorageType(StorageType::File);
+    ASSERT_TRUE(DbDriver::MigrateFileLayout());
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/testuser/3200000000000000").c_str()));
+    EXPECT_FALSE(DirectoryWrapper::Exists(Path("/db/testuser/32").c_str()));
+    EXPECT_EQ(uTable.CountAll().GetCount(), 50);
+    EXPECT_EQ(scopedTable.CountAll().GetCount(), 5);
+    ASSERT_TRUE(pendingTable.Find(51));
+}
+
+TEST_F(FileStorageTest, tablesNamedLikeScopesAreMigrated) {
+    // a table with a name that is also a scope's
+    const char* tableName = "00000000000000ab";
+    uint8_t record[8] = {1, 2, 3, 4, 5, 6, 7, 8};
+    DbDriver driver{DbDriver::RootScope, false};
+    ASSERT_TRUE(driver.SaveRecord(1, 0, record, sizeof(record), tableName));
+
+    DbDriver::SetStorageType(StorageType::FileFanOut);
+    ASSERT_TRUE(DbDriver::MigrateFileLayout());
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/00000000000000ab/01/00/0100000000000000").c_str()));
+    EXPECT_FALSE(DirectoryWrapper::Exists(Path("/db/00000000000000ab/0100000000000000").c_str()));
+    // its counter is left as it is
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/00000000000000ab/counter").c_str()));
+}
+
+TEST_F(FileStorageTest, onlyFileLayoutsCanBeMigrated) {
+    DbDriver::SetStorageType(StorageType::Log);
+    EXPECT_FALSE(DbDriver::MigrateFileLayout());
+}
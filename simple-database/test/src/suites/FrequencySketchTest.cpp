@@ -0,0 +1,45 @@
+#include <gtest/gtest.h>
+#include "FrequencySketch.hpp"
+
+static const uint64_t Hashes[] = {0x9e3779b97f4a7c15ULL, 0xbf58476d1ce4e5b9ULL, 0x94d049bb133111ebULL};
+
+TEST(FrequencySketchTest, CountsEachKey) {
+    FrequencySketch sketch{1024};
+    for (size_t i = 0; i < 3; i++) {
+        for (size_t n = 0; n <= i; n++) {
+            sketch.Increment(Hashes[i]);
+        }
+    }
+
+    ASSERT_EQ(sketch.Estimate(Hashes[0]), 1);
+    ASSERT_EQ(sketch.Estimate(Hashes[1]), 2);
+    ASSERT_EQ(sketch.Estimate(Hashes[2]), 3);
+    ASSERT_EQ(sketch.Estimate(42), 0);
+
+    sketch.Clear();
+    ASSERT_EQ(sketch.Estimate(Hashes[2]), 0);
+}
+
+TEST(FrequencySketchTest, CountersStopAtTheMaximum) {
+    FrequencySketch sketch{1024};
+    for (size_t i = 0; i < 100; i++) {
+        sketch.Increment(Hashes[0]);
+    }
+    ASSERT_EQ(sketch.Estimate(Hashes[0]), FrequencySketch::MaxCount);
+}
+
+TEST(FrequencySketchTest, OldCountsFade) {
+    FrequencySketch sketch{16};
+    for (size_t i = 0; i < 8; i++) {
+        sketch.Increment(Hashes[0]);
+    }
+    ASSERT_EQ(sketch.Estimate(Hashes[0]), 8);
+
+    // counts only grow until the sketch halves them all, after that none is above 7
+    bool faded = false;
+    for (uint64_t key = 1; key < 1000 && !faded; key++) {
+        sketch.Increment(key * 0x9e3779b97f4a7c15ULL);
+        faded = sketch.Estimate(Hashes[0]) < 8;
+    }
+    ASSERT_TRUE(faded);
+}
@@ -0,0 +1,117 @@
+#include <gtest/gtest.h>
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "IdAllocator.hpp"
+#include "fs.hpp"
+
+using User = TestUser;
+
+class IdAllocatorTest : public ::testing::Test {
+    protected:
+        void SetUp() override {
+            initFS();
+            DirectoryWrapper::Delete(Path("/db").c_str());
+            DbDriver::InitDb();
+            DbDriver::ClearCache();
+        }
+
+        void TearDown() override {
+            DirectoryWrapper::Delete(Path("/db").c_str());
+            DbDriver::ClearCache();
+        }
+
+        // Drop the in-memory counters, as if the process had restarted
+        void Restart() {
+            DbDriver::InitDb();
+            DbDriver::ClearCache();
+        }
+
+        ObjId StoredCounter() {
+            FileWrapper f(Path("/db/testuser/counter/objct").c_str(), "r");
+            ObjId stored = 0;
+            EXPECT_TRUE(f.Read(&stored, sizeof(stored)));
+            return stored;
+        }
+
+        void CreateUser(User& u) {
+            ASSERT_FALSE(uTable.Save(u));
+        }
+
+        Table<User> uTable;
+};
+
+TEST_F(IdAllocatorTest, counterIsOnlyWrittenOncePerBlock) {
+    User u;
+    CreateUser(u);
+    EXPECT_EQ(u.Id(), 1);
+    ObjId reserved = StoredCounter();
+    EXPECT_EQ(reserved, 2 + IdAllocator::BlockSize);
+
+    for (ObjId id = 2; id < reserved; id++) {
+        User next;
+        CreateUser(next);
+        EXPECT_EQ(next.Id(), id);
+    }
+    EXPECT_EQ(StoredCounter(), reserved);
+
+    User past;
+    CreateUser(past);
+    EXPECT_EQ(past.Id(), reserved);
+    EXPECT_GT(StoredCounter(), reserved);
+}
+
+TEST_F(IdAllocatorTest, idsAreNotReusedAfterARestart) {
+    for (int i = 0; i < 3; i++) {
+        User u;
+        CreateUser(u);
+    }
+    EXPECT_EQ(uTable.PeekNextId(), 4);
+
+    Restart();
+
+    ObjId peeked = uTable.PeekNextId();
+    EXPECT_GT(peeked, 3);
+    User u;
+    CreateUser(u);
+    EXPECT_EQ(u.Id(), peeked);
+}
+
+TEST_F(IdAllocatorTest, setIdsAreReservedBeforeTheyAreWritten) {
+    User u;
+    u.Id(500);
+    CreateUser(u);
+    EXPECT_GT(StoredCounter(), 500);
+    EXPECT_EQ(uTable.PeekNextId(), 501);
+
+    Restart();
+    EXPECT_GT(uTable.PeekNextId(), 500);
+}
+
+TEST_F(IdAllocatorTest, droppingTheDbStartsIdsAgain) {
+    User u;
+    CreateUser(u);
+    User u2;
+    CreateUser(u2);
+    EXPECT_EQ(u2.Id(), 2);
+
+    ASSERT_TRUE(DbDriver::DeleteAll());
+    EXPECT_EQ(uTable.PeekNextId(), 1);
+
+    ASSERT_TRUE(uTable.DropTable());
+    User u3;
+    CreateUser(u3);
+    EXPECT_EQ(u3.Id(), 1);
+}
+
+TEST_F(IdAllocatorTest, pendingTablesShareTheCounter) {
+    Table<User> pendingTable{DbDriver::RootScope, true};
+    User pending;
+    ASSERT_FALSE(pendingTable.Save(pending, 1));
+    EXPECT_EQ(pending.Id(), 1);
+
+    ASSERT_TRUE(pendingTable.DropTable());
+    User u;
+    CreateUser(u);
+    EXPECT_EQ(u.Id(), 2);
+}
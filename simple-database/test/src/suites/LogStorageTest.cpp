@@ -0,0 +1,229 @@
+#include <gtest/gtest.h>
+#include <set>
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "fs.hpp"
+
+using User = TestUser;
+
+class LogStorageTest : public ::testing::Test {
+    protected:
+        void SetUp() override {
+            initFS();
+            DirectoryWrapper::Delete(Path("/db").c_str());
+            DbDriver::InitDb();
+            DbDriver::SetStorageType(StorageType::Log);
+        }
+
+        void TearDown() override {
+            DbDriver::CloseStorage();
+            DbDriver::SetStorageType(StorageType::File);
+            DirectoryWrapper::Delete(Path("/db").c_str());
+            DbDriver::ClearCache();
+        }
+
+        // Drop everything held in memory, as if the process had restarted
+        void Restart() {
+            DbDriver::CloseStorage();
+            DbDriver::ClearCache();
+        }
+
+        void CreateUser(User& u, ObjId scope = DbDriver::RootScope) {
+            Table<User> t{scope};
+            DbError error = t.Save(u);
+            ASSERT_FALSE(error);
+        }
+};
+
+TEST_F(LogStorageTest, recordsAreAppendedToASingleFile) {
+    uint8_t data[10] = {0x55};
+    DbDriver dbDriver{0, false};
+    ASSERT_TRUE(dbDriver.SaveRecord(1, 0, data, sizeof(data), "User"));
+    ASSERT_TRUE(dbDriver.SaveRecord(2, 0, data, sizeof(data), "User"));
+
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/user/records.log").c_str()));
+    EXPECT_FALSE(DirectoryWrapper::Exists(Path("/db/user/0100000000000000").c_str()));
+    EXPECT_FALSE(DirectoryWrapper::Exists(Path("/db/user/0200000000000000").c_str()));
+
+    uint8_t read[sizeof(data) + sizeof(ObjId)] = {0};
+    ASSERT_EQ(dbDriver.GetRecord(read, 2, "User"), sizeof(read));
+    EXPECT_EQ(0, memcmp(read, data, sizeof(data)));
+}
+
+TEST_F(LogStorageTest, latestVersionOfARecordIsRead) {
+    uint8_t data[10] = {0x55};
+    uint8_t updated[10] = {0x66};
+    DbDriver dbDriver{0, false};
+    ASSERT_TRUE(dbDriver.SaveRecord(1, 0, data, sizeof(data), "User"));
+    ASSERT_TRUE(dbDriver.SaveRecord(1, 0, updated, sizeof(updated), "User"));
+
+    uint8_t read[sizeof(data) + sizeof(ObjId)] = {0};
+    DbDriver::ClearCache();
+    ASSERT_GT(dbDriver.GetRecord(read, 1, "User"), 0);
+    EXPECT_EQ(0, memcmp(read, updated, sizeof(updated)));
+
+    Restart();
+    ASSERT_GT(dbDriver.GetRecord(read, 1, "User"), 0);
+    EXPECT_EQ(0, memcmp(read, updated, sizeof(updated)));
+}
+
+TEST_F(LogStorageTest, deletesSurviveARestart) {
+    uint8_t data[10] = {0x55};
+    DbDriver dbDriver{0, false};
+    ASSERT_TRUE(dbDriver.SaveRecord(1, 0, data, sizeof(data), "User"));
+    ASSERT_TRUE(dbDriver.SaveRecord(2, 0, data, sizeof(data), "User"));
+    ASSERT_TRUE(dbDriver.DeleteRecord(1, "User"));
+    EXPECT_FALSE(dbDriver.DeleteRecord(1, "User"));
+
+    Restart();
+    EXPECT_FALSE(dbDriver.RecordExists(1, "User"));
+    EXPECT_TRUE(dbDriver.RecordExists(2, "User"));
+}
+
+TEST_F(LogStorageTest, tornAppendIsDiscarded) {
+    uint8_t data[10] = {0x55};
+    DbDriver dbDriver{0, false};
+    ASSERT_TRUE(dbDriver.SaveRecord(1, 0, data, sizeof(data), "User"));
+    Restart();
+
+    {
+        // half a header, as if we lost power mid append
+        FileWrapper f(Path("/db/user/records.log").c_str(), "r+b");
+        ASSERT_TRUE(f.Seek(f.Size()));
+        ObjId id = 2;
+        ASSERT_TRUE(f.Write(&id, sizeof(id)));
+    }
+
+    uint8_t read[sizeof(data) + sizeof(ObjId)] = {0};
+    ASSERT_GT(dbDriver.GetRecord(read, 1, "User"), 0);
+    EXPECT_FALSE(dbDriver.RecordExists(2, "User"));
+
+    ASSERT_TRUE(dbDriver.SaveRecord(2, 0, data, sizeof(data), "User"));
+    Restart();
+    EXPECT_TRUE(dbDriver.RecordExists(1, "User"));
+    EXPECT_TRUE(dbDriver.RecordExists(2, "User"));
+}
+
+TEST_F(LogStorageTest, deadEntriesAreCompactedAway) {
+    uint8_t data[1024] = {0x55};
+    DbDriver dbDriver{0, false};
+    for (int i = 0; i < 200; i++) {
+        ASSERT_TRUE(dbDriver.SaveRecord(1, 0, data, sizeof(data), "User"));
+    }
+
+    FileWrapper f(Path("/db/user/records.log").c_str());
+    EXPECT_LT(f.Size(), 100 * sizeof(data));
+    f.Close();
+
+    Restart();
+    uint8_t read[sizeof(data) + sizeof(ObjId)] = {0};
+    ASSERT_EQ(dbDriver.GetRecord(read, 1, "User"), sizeof(read));
+}
+
+TEST_F(LogStorageTest, tableWorksOnTopOfTheLog) {
+    Table<User> uTable;
+    for (int i = 0; i < 300; i++) {
+        User u;
+        u.Name().Set(std::to_string(i).c_str());
+        CreateUser(u);
+    }
+
+    Restart();
+
+    ASSERT_TRUE(uTable.FindBy("Name", "150"));
+    EXPECT_EQ(uTable.LoadedRecord().Id(), 151);
+
+    // the log engine scans in id order
+    auto results = uTable.All();
+    ObjId lastId = 0;
+    int count = 0;
+    while (uTable.LoadNextResult(results)) {
+        EXPECT_GT(uTable.LoadedRecord().Id(), lastId);
+        lastId = uTable.LoadedRecord().Id();
+        count++;
+    }
+    EXPECT_EQ(count, 300);
+
+    auto toDelete = uTable.CustomSearch(Query::ResultType::Many, [](User* u) { return u->Id() % 2 == 0; });
+    ASSERT_FALSE(uTable.Delete(toDelete));
+    EXPECT_EQ(uTable.CountAll().GetCount(), 150);
+}
+
+TEST_F(LogStorageTest, pendingRecordsCanBeCommitted) {
+    Table<User> pending{1, true};
+    User u;
+    u.Name("Vegeta");
+    ASSERT_FALSE(pending.Save(u, 7));
+    ASSERT_FALSE(pending.CommitAll(7));
+
+    Table<User> main{1};
+    EXPECT_TRUE(main.Find(u.Id()));
+    EXPECT_FALSE(pending.Find(u.Id()));
+}
+
+TEST_F(LogStorageTest, droppingATableForgetsItsRecords) {
+    uint8_t data[10] = {0x55};
+    DbDriver dbDriver{0, false};
+    ASSERT_TRUE(dbDriver.SaveRecord(1, 0, data, sizeof(data), "User"));
+    ASSERT_TRUE(dbDriver.SaveRecord(1, 0, data, sizeof(data), "Users"));
+    ASSERT_TRUE(dbDriver.DeleteTable("User"));
+
+    EXPECT_FALSE(dbDriver.RecordExists(1, "User"));
+    EXPECT_TRUE(dbDriver.RecordExists(1, "Users"));
+}
+
+TEST_F(LogStorageTest, recordsCanBeViewedInPlace) {
+    uint8_t data[10] = {0x55};
+    uint8_t updated[10] = {0x66};
+    DbDriver dbDriver{0, false};
+    ASSERT_TRUE(dbDriver.SaveRecord(1, 0, data, sizeof(data), "User"));
+
+    uint32_t len = 0;
+    const uint8_t* view = dbDriver.GetRecordView(1, "User", len);
+    ASSERT_NE(view, nullptr);
+    EXPECT_EQ(len, sizeof(data) + sizeof(ObjId));
+    EXPECT_EQ(0, memcmp(view, data, sizeof(data)));
+#if !USE_FF && !defined(_WIN32)
+    // straight out of the mapped log, not copied into the work buffer
+    EXPECT_NE(view, DbDriver::WorkBuffer());
+#endif
+
+    // appends land past the end of the mapping
+    ASSERT_TRUE(dbDriver.SaveRecord(2, 0, data, sizeof(data), "User"));
+    ASSERT_TRUE(dbDriver.SaveRecord(1, 0, updated, sizeof(updated), "User"));
+    view = dbDriver.GetRecordView(1, "User", len);
+    ASSERT_NE(view, nullptr);
+    EXPECT_EQ(0, memcmp(view, updated, sizeof(updated)));
+    EXPECT_EQ(dbDriver.GetRecordView(3, "User", len), nullptr);
+
+    TableCursor cursor;
+    ASSERT_TRUE(dbDriver.OpenTable("User", cursor));
+    int count = 0;
+    while ((view = dbDriver.GetNextRecordView(cursor, len)) != nullptr) {
+        EXPECT_EQ(len, sizeof(data) + sizeof(ObjId));
+        count++;
+    }
+    EXPECT_EQ(count, 2);
+}
+
+TEST_F(LogStorageTest, batchesAreAppendedTogether) {
+    Table<User> uTable;
+    std::vector<User> users(50);
+    for (size_t i = 0; i < users.size(); i++) {
+        users[i].Name().Set(std::to_string(i).c_str());
+    }
+    ASSERT_FALSE(uTable.SaveMany(users));
+
+    users[10].Name().Set("updated");
+    ASSERT_FALSE(uTable.SaveMany(&users[10], 1));
+    std::vector<ObjId> ids = {1, 2, 3};
+    ASSERT_FALSE(uTable.DeleteMany(ids));
+
+    Restart();
+    EXPECT_EQ(uTable.CountAll().GetCount(), 47);
+    EXPECT_FALSE(uTable.Find(3));
+    ASSERT_TRUE(uTable.Find(11));
+    EXPECT_STREQ(uTable.LoadedRecord().Name(), "updated");
+    EXPECT_EQ(uTable.PeekNextId(), 51);
+}
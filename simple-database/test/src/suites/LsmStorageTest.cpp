@@ -0,0 +1,226 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "LsmStorage.hpp"
+#include "crc.h"
+#include "fs.hpp"
+
+using User = TestUser;
+
+class LsmStorageTest : public ::testing::Test {
+    protected:
+        void SetUp() override {
+            initFS();
+            DirectoryWrapper::Delete(Path("/db").c_str());
+            DbDriver::InitDb();
+            DbDriver::SetStorageType(StorageType::Lsm);
+
+            tablePath = Path("/db/lsm");
+            DirectoryWrapper::New(tablePath.c_str());
+        }
+
+        void TearDown() override {
+            DbDriver::CloseStorage();
+            DbDriver::SetStorageType(StorageType::File);
+            DirectoryWrapper::Delete(Path("/db").c_str());
+            DbDriver::ClearCache();
+        }
+
+        void Restart() {
+            DbDriver::CloseStorage();
+            DbDriver::ClearCache();
+        }
+
+        // a record as DbDriver would hand it over, body followed by the commit id
+        static std::vector<uint8_t> Record(ObjId id, uint8_t version, size_t len = 100) {
+            std::vector<uint8_t> record(len + sizeof(ObjId), 0);
+            for (size_t i = 0; i < len; i++) {
+                record[i] = (uint8_t)(id + i + version);
+            }
+            return record;
+        }
+
+        static bool Write(LsmStorage& lsm, const std::string& path, ObjId id, uint8_t version, size_t len = 100) {
+            auto record = Record(id, version, len);
+            return lsm.Write(path.c_str(), id, record.data(), record.size(), crc32(record.data(), len));
+        }
+
+        static bool ReadsBack(LsmStorage& lsm, const std::string& path, ObjId id, uint8_t version, size_t len = 100) {
+            auto record = Record(id, version, len);
+            std::vector<uint8_t> read(record.size());
+            return lsm.Read(path.c_str(), id, read.data()) == record.size() && read == record;
+        }
+
+        static std::vector<ObjId> Scan(LsmStorage& lsm, const std::string& path) {
+            std::vector<ObjId> ids;
+            TableCursor cursor;
+            EXPECT_TRUE(lsm.Open(path.c_str(), cursor));
+            ObjId id;
+            while (lsm.Next(cursor, id)) {
+                ids.push_back(id);
+            }
+            return ids;
+        }
+
+        std::string tablePath;
+};
+
+TEST_F(LsmStorageTest, unflushedWritesAreReplayedFromTheWal) {
+    {
+        LsmStorage lsm;
+        ASSERT_TRUE(Write(lsm, tablePath, 1, 0));
+        ASSERT_TRUE(Write(lsm, tablePath, 2, 0));
+        ASSERT_TRUE(lsm.Remove(tablePath.c_str(), 2));
+        EXPECT_EQ(lsm.RunCount(tablePath.c_str(), 0), 0);
+    }
+
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/lsm/lsm.wal").c_str()));
+
+    LsmStorage lsm;
+    EXPECT_TRUE(ReadsBack(lsm, tablePath, 1, 0));
+    EXPECT_FALSE(lsm.Exists(tablePath.c_str(), 2));
+}
+
+TEST_F(LsmStorageTest, fullMemtableIsFlushedToARun) {
+    LsmStorage lsm;
+    // 1000 byte bodies + commit id + wal header make each entry exactly 1KB
+    const ObjId count = LsmStorage::MemtableLimit / 1024;
+    for (ObjId id = 1; id <= count; id++) {
+        ASSERT_TRUE(Write(lsm, tablePath, id, 0, 1000));
+    }
+
+    EXPECT_EQ(lsm.RunCount(tablePath.c_str(), 0), 1);
+    FileWrapper wal(Path("/db/lsm/lsm.wal").c_str());
+    EXPECT_EQ(wal.Size(), 0);
+
+    for (ObjId id = 1; id <= count; id++) {
+        EXPECT_TRUE(ReadsBack(lsm, tablePath, id, 0, 1000));
+    }
+    EXPECT_FALSE(lsm.Exists(tablePath.c_str(), count + 1));
+}
+
+TEST_F(LsmStorageTest, newestVersionWinsAcrossRuns) {
+    LsmStorage lsm;
+    for (ObjId id = 1; id <= 10; id++) {
+        ASSERT_TRUE(Write(lsm, tablePath, id, 0));
+    }
+    ASSERT_TRUE(lsm.Flush(tablePath.c_str()));
+
+    ASSERT_TRUE(Write(lsm, tablePath, 3, 1));
+    ASSERT_TRUE(lsm.Remove(tablePath.c_str(), 5));
+    ASSERT_TRUE(lsm.Flush(tablePath.c_str()));
+
+    ASSERT_TRUE(Write(lsm, tablePath, 4, 2));
+    ASSERT_TRUE(lsm.Remove(tablePath.c_str(), 6));
+    EXPECT_FALSE(lsm.Remove(tablePath.c_str(), 5));
+
+    EXPECT_EQ(lsm.RunCount(tablePath.c_str(), 0), 2);
+    EXPECT_TRUE(ReadsBack(lsm, tablePath, 1, 0));
+    EXPECT_TRUE(ReadsBack(lsm, tablePath, 3, 1));
+    EXPECT_TRUE(ReadsBack(lsm, tablePath, 4, 2));
+    EXPECT_FALSE(lsm.Exists(tablePath.c_str(), 5));
+    EXPECT_FALSE(lsm.Exists(tablePath.c_str(), 6));
+
+    std::vector<ObjId> expected = {1, 2, 3, 4, 7, 8, 9, 10};
+    EXPECT_EQ(Scan(lsm, tablePath), expected);
+}
+
+TEST_F(LsmStorageTest, level0IsMergedIntoLevel1) {
+    {
+        LsmStorage lsm;
+        for (uint32_t run = 0; run < LsmStorage::Level0Runs; run++) {
+            for (ObjId id = 1; id <= 50; id++) {
+                ASSERT_TRUE(Write(lsm, tablePath, id * 4 + run, run));
+            }
+            // overwrite and delete some of what the earlier runs wrote
+            ASSERT_TRUE(Write(lsm, tablePath, 4, run));
+            if (run > 0) {
+                ASSERT_TRUE(lsm.Remove(tablePath.c_str(), 4 * (run + 1) + run - 1));
+            }
+            ASSERT_TRUE(lsm.Flush(tablePath.c_str()));
+        }
+
+        lsm.WaitForCompaction();
+        EXPECT_EQ(lsm.RunCount(tablePath.c_str(), 0), 0);
+        EXPECT_EQ(lsm.RunCount(tablePath.c_str(), 1), 1);
+    }
+
+    LsmStorage lsm;
+    EXPECT_EQ(lsm.RunCount(tablePath.c_str(), 1), 1);
+    EXPECT_TRUE(ReadsBack(lsm, tablePath, 4, LsmStorage::Level0Runs - 1));
+    EXPECT_TRUE(ReadsBack(lsm, tablePath, 9, 1));
+    EXPECT_FALSE(lsm.Exists(tablePath.c_str(), 8));
+    EXPECT_FALSE(lsm.Exists(tablePath.c_str(), 13));
+    EXPECT_FALSE(lsm.Exists(tablePath.c_str(), 18));
+    EXPECT_EQ(Scan(lsm, tablePath).size(), 50 * LsmStorage::Level0Runs - 3);
+}
+
+TEST_F(LsmStorageTest, unfinishedRunsAreDiscarded) {
+    {
+        LsmStorage lsm;
+        ASSERT_TRUE(Write(lsm, tablePath, 1, 0));
+        ASSERT_TRUE(lsm.Flush(tablePath.c_str()));
+    }
+
+    {
+        FileWrapper f(Path("/db/lsm/L0-00000063.run.tmp").c_str(), "w");
+        uint8_t junk[16] = {0};
+        ASSERT_TRUE(f.Write(junk, sizeof(junk)));
+    }
+
+    LsmStorage lsm;
+    EXPECT_TRUE(ReadsBack(lsm, tablePath, 1, 0));
+    EXPECT_FALSE(DirectoryWrapper::Exists(Path("/db/lsm/L0-00000063.run.tmp").c_str()));
+}
+
+TEST_F(LsmStorageTest, tableWorksOnTopOfTheTree) {
+    Table<User> uTable;
+    for (int i = 0; i < 1000; i++) {
+        User u;
+        u.Name().Set(std::to_string(i).c_str());
+        ASSERT_FALSE(uTable.Save(u));
+    }
+
+    Restart();
+
+    ASSERT_TRUE(uTable.FindBy("Name", "150"));
+    EXPECT_EQ(uTable.LoadedRecord().Id(), 151);
+
+    auto results = uTable.All();
+    ObjId expected = 1;
+    while (uTable.LoadNextResult(results)) {
+        EXPECT_EQ(uTable.LoadedRecord().Id(), expected++);
+    }
+    EXPECT_EQ(expected, 1001);
+
+    auto toDelete = uTable.CustomSearch(Query::ResultType::Many, [](User* u) { return u->Id() % 2 == 0; });
+    ASSERT_FALSE(uTable.Delete(toDelete));
+
+    Restart();
+    EXPECT_EQ(uTable.CountAll().GetCount(), 500);
+    EXPECT_FALSE(uTable.Find(2));
+    EXPECT_TRUE(uTable.Find(3));
+}
+
+TEST_F(LsmStorageTest, batchesSurviveARestart) {
+    Table<User> uTable;
+    std::vector<User> users(300);
+    for (size_t i = 0; i < users.size(); i++) {
+        users[i].Name().Set(std::to_string(i).c_str());
+    }
+    ASSERT_FALSE(uTable.SaveMany(users));
+
+    std::vector<ObjId> ids;
+    for (ObjId id = 2; id <= 300; id += 3) {
+        ids.push_back(id);
+    }
+    ASSERT_FALSE(uTable.DeleteMany(ids));
+
+    Restart();
+    EXPECT_EQ(uTable.CountAll().GetCount(), 200);
+    EXPECT_FALSE(uTable.Find(2));
+    ASSERT_TRUE(uTable.Find(300));
+    EXPECT_STREQ(uTable.LoadedRecord().Name(), "299");
+}
@@ -0,0 +1,103 @@
+#include <gtest/gtest.h>
+#include <string>
+#include <vector>
+#include "DirectoryWrapper.hpp"
+#include "FileWrapper.hpp"
+#include "ReadQueue.hpp"
+#include "fs.hpp"
+
+class ReadQueueTest : public ::testing::Test {
+    protected:
+        void SetUp() override {
+            initFS();
+            DirectoryWrapper::Delete(Path("/rq").c_str());
+            DirectoryWrapper::New(Path("/rq").c_str());
+        }
+
+        void TearDown() override {
+            DirectoryWrapper::Delete(Path("/rq").c_str());
+        }
+
+        static std::string FilePathFor(size_t i) {
+            return Path(("/rq/" + std::to_string(i)).c_str());
+        }
+
+        static void WriteFile(size_t i, const std::string& contents) {
+            FileWrapper f(FilePathFor(i).c_str(), "w");
+            ASSERT_TRUE(f.Write(contents.data(), contents.size()));
+        }
+};
+
+TEST_F(ReadQueueTest, readsEveryFileInTheGroup) {
+    // more than fit in the ring at once
+    const size_t count = 150;
+    std::vector<std::string> paths(count);
+    std::vector<std::vector<uint8_t>> buffers(count, std::vector<uint8_t>(16));
+    std::vector<ReadQueue::Request> requests(count);
+    for (size_t i = 0; i < count; i++) {
+        if (i % 10 != 3) {
+            WriteFile(i, "file " + std::to_string(i));
+        }
+        paths[i] = FilePathFor(i);
+        requests[i] = {paths[i].c_str(), buffers[i].data(), (uint32_t)buffers[i].size(), 0};
+    }
+
+    ReadQueue reads;
+    reads.Read(requests.data(), count);
+
+    for (size_t i = 0; i < count; i++) {
+        if (i % 10 == 3) {
+            EXPECT_EQ(requests[i].result, -1);
+            continue;
+        }
+        std::string expected = "file " + std::to_string(i);
+        ASSERT_EQ(requests[i].result, (int64_t)expected.size());
+        EXPECT_EQ(std::string((const char*)buffers[i].data(), expected.size()), expected);
+    }
+}
+
+TEST_F(ReadQueueTest, readsStopAtTheCapacity) {
+    WriteFile(0, "0123456789");
+    WriteFile(1, "");
+    std::string first = FilePathFor(0);
+    std::string second = FilePathFor(1);
+    uint8_t buffer[2][4] = {};
+    ReadQueue::Request requests[2] = {
+        {first.c_str(), buffer[0], sizeof(buffer[0]), 0},
+        {second.c_str(), buffer[1], sizeof(buffer[1]), 0},
+    };
+
+    ReadQueue reads;
+    reads.Read(requests, 2);
+    EXPECT_EQ(requests[0].result, 4);
+    EXPECT_EQ(memcmp(buffer[0], "0123", 4), 0);
+    EXPECT_EQ(requests[1].result, 0);
+}
+
+TEST_F(ReadQueueTest, largeFilesAreReadWhole) {
+    // big enough that a single read may come back short
+    const size_t count = 4;
+    const size_t size = 1024 * 1024;
+    std::vector<std::string> paths(count);
+    std::vector<std::vector<uint8_t>> buffers(count, std::vector<uint8_t>(size + 16));
+    std::vector<ReadQueue::Request> requests(count);
+    for (size_t i = 0; i < count; i++) {
+        std::string contents(size, '\0');
+        for (size_t pos = 0; pos < size; pos++) {
+            contents[pos] = (char)(pos * 7 + i);
+        }
+        WriteFile(i, contents);
+        paths[i] = FilePathFor(i);
+        requests[i] = {paths[i].c_str(), buffers[i].data(), (uint32_t)buffers[i].size(), 0};
+    }
+
+    ReadQueue reads;
+    reads.Read(requests.data(), count);
+
+    for (size_t i = 0; i < count; i++) {
+        ASSERT_EQ(requests[i].result, (int64_t)size);
+        for (size_t pos = 0; pos < size; pos += 4099) {
+            ASSERT_EQ(buffers[i][pos], (uint8_t)(pos * 7 + i));
+        }
+    }
+}
@@ -0,0 +1,168 @@
+#include <gtest/gtest.h>
+#include <algorithm>
+#include <thread>
+#include <vector>
+#include "ShardedCache.hpp"
+
+const size_t ShardItemSize = 1024;
+
+class ShardedCacheTest : public ::testing::Test {
+    protected:
+        static RecordKey Key(size_t i) {
+            return {0, i, 1, false};
+        }
+};
+
+TEST_F(ShardedCacheTest, ItemsAreFoundInTheirShard) {
+    ShardedCache cache{64 * ShardItemSize, 4};
+    ASSERT_EQ(cache.ShardCount(), 4);
+
+    uint8_t data[ShardItemSize] = {0};
+    for (size_t i = 0; i < 16; i++) {
+        data[0] = i;
+        cache.AddItem(Key(i), data, sizeof(data));
+    }
+
+    uint8_t cached[ShardItemSize];
+    size_t len;
+    for (size_t i = 0; i < 16; i++) {
+        ASSERT_TRUE(cache.GetItem(Key(i), cached, len));
+        EXPECT_EQ(cached[0], i);
+    }
+
+    cache.RemoveItem(Key(3));
+    EXPECT_FALSE(cache.GetItem(Key(3), cached, len));
+    cache.Clear();
+    EXPECT_FALSE(cache.GetItem(Key(4), cached, len));
+}
+
+TEST_F(ShardedCacheTest, ShardsEvictOnTheirOwn) {
+    // room for one item per shard
+    ShardedCache cache{2 * ShardItemSize, 2};
+    uint8_t data[ShardItemSize] = {0};
+    for (size_t i = 0; i < 32; i++) {
+        cache.AddItem(Key(i), data, sizeof(data));
+    }
+
+    uint8_t cached[ShardItemSize];
+    size_t len;
+    size_t found = 0;
+    for (size_t i = 0; i < 32; i++) {
+        found += cache.GetItem(Key(i), cached, len);
+    }
+    EXPECT_LE(found, 2);
+    EXPECT_TRUE(cache.GetItem(Key(31), cached, len));
+}
+
+#if DB_CACHE_LOCKING
+TEST_F(ShardedCacheTest, ThreadsCanShareTheCache) {
+    ShardedCache cache{1024 * ShardItemSize};
+    const size_t perThread = 200;
+
+    std::vector<std::thread> threads;
+    for (size_t t = 0; t < 4; t++) {
+        threads.emplace_back([&cache, t, perThread]() {
+            uint8_t data[ShardItemSize];
+            uint8_t cached[ShardItemSize];
+            size_t len;
+            for (size_t i = 0; i < perThread; i++) {
+                size_t id = t * perThread + i;
+                memset(data, (uint8_t)id, sizeof(data));
+                cache.AddItem(Key(id), data, sizeof(data));
+
+                // everyone reads what the others are writing too
+                cache.GetItem(Key((id + perThread) % (4 * perThread)), cached, len);
+                ASSERT_TRUE(cache.GetItem(Key(id), cached, len));
+                ASSERT_EQ(cached[ShardItemSize - 1], (uint8_t)id);
+            }
+        });
+    }
+    for (std::thread& thread : threads) {
+        thread.join();
+    }
+
+    uint8_t cached[ShardItemSize];
+    size_t len;
+    for (size_t id = 0; id < 4 * perThread; id++) {
+        ASSERT_TRUE(cache.GetItem(Key(id), cached, len));
+        EXPECT_EQ(cached[0], (uint8_t)id);
+    }
+}
+#endif
+
+TEST_F(ShardedCacheTest, StatsAndBudgetsCoverEveryShard) {
+    ShardedCache cache{64 * ShardItemSize, 4};
+    cache.SetTableBudget(2, 8 * ShardItemSize);
+
+    uint8_t data[ShardItemSize] = {0};
+    for (size_t i = 0; i < 16; i++) {
+        cache.AddItem(Key(i), data, sizeof(data));
+        cache.AddItem({0, i, 2, false}, data, sizeof(data));
+    }
+
+    // each shard holds its quarter of the budget
+    EXPECT_EQ(cache.TableStats(1).residentItems, 16);
+    EXPECT_LE(cache.TableStats(2).residentItems, 8);
+    EXPECT_EQ(cache.Stats().insertedBytes, 32 * ShardItemSize);
+
+    cache.Resize(32 * ShardItemSize);
+    EXPECT_EQ(cache.MaxSize(), 32 * ShardItemSize);
+    EXPECT_LE(cache.Stats().residentBytes, 32 * ShardItemSize);
+}
+
+TEST_F(ShardedCacheTest, RecordsBiggerThanAShardsPartOfTheBudgetAreKept) {
+    // a quarter of the budget per shard, less than a record
+    ShardedCache cache{64 * ShardItemSize, 4};
+    cache.SetTableBudget(1, 2 * ShardItemSize);
+
+    uint8_t data[ShardItemSize] = {0};
+    uint8_t cached[ShardItemSize];
+    size_t len;
+    cache.AddItem(Key(0), data, sizeof(data));
+    EXPECT_TRUE(cache.GetItem(Key(0), cached, len));
+
+    // a shard keeps one such record, the newest
+    for (size_t i = 1; i < 64; i++) {
+        cache.AddItem(Key(i), data, sizeof(data));
+    }
+    EXPECT_GE(cache.TableStats(1).residentItems, 1);
+    EXPECT_LE(cache.TableStats(1).residentItems, cache.ShardCount());
+    EXPECT_TRUE(cache.GetItem(Key(63), cached, len));
+
+    // what doesn't fit the whole budget still stays out
+    uint8_t big[3 * ShardItemSize] = {0};
+    cache.AddItem(Key(64), big, sizeof(big));
+    EXPECT_FALSE(cache.GetItem(Key(64), big, len));
+}
+
+TEST_F(ShardedCacheTest, HottestRanksEveryShardTogether) {
+    ShardedCache cache{64 * ShardItemSize, 4, CachePolicy::TinyLfu};
+
+    // the records read most all land in the same shard
+    std::vector<size_t> hot;
+    size_t shard = (RecordKeyHash()(Key(0)) >> 32) % cache.ShardCount();
+    for (size_t i = 0; hot.size() < 4; i++) {
+        if ((RecordKeyHash()(Key(i)) >> 32) % cache.ShardCount() == shard) {
+            hot.push_back(i);
+        }
+    }
+
+    uint8_t data[ShardItemSize] = {0};
+    for (size_t i = 0; i < 48; i++) {
+        cache.AddItem(Key(i), data, sizeof(data));
+    }
+    uint8_t cached[ShardItemSize];
+    size_t len;
+    for (int read = 0; read < 3; read++) {
+        for (size_t i : hot) {
+            ASSERT_TRUE(cache.GetItem(Key(i), cached, len));
+        }
+    }
+
+    std::vector<size_t> visited;
+    cache.Hottest(hot.size(), [&](const RecordKey& key, const uint8_t*, size_t) {
+        visited.push_back(key.id);
+    });
+    std::sort(visited.begin(), visited.end());
+    EXPECT_EQ(visited, hot);
+}
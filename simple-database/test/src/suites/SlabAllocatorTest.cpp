@@ -0,0 +1,118 @@
+#include <gtest/gtest.h>
+#include <set>
+#include <vector>
+#include "SlabAllocator.hpp"
+
+TEST(SlabAllocatorTest, SizesRoundUpToTheirClass) {
+    ASSERT_EQ(SlabAllocator::SlotSize(0), 64);
+    ASSERT_EQ(SlabAllocator::SlotSize(1), 64);
+    ASSERT_EQ(SlabAllocator::SlotSize(64), 64);
+    ASSERT_EQ(SlabAllocator::SlotSize(65), 80);
+    ASSERT_EQ(SlabAllocator::SlotSize(100), 112);
+    ASSERT_EQ(SlabAllocator::SlotSize(128), 128);
+    ASSERT_EQ(SlabAllocator::SlotSize(1000), 1024);
+    ASSERT_EQ(SlabAllocator::SlotSize(1025), 1280);
+    ASSERT_EQ(SlabAllocator::SlotSize(3072), 3072);
+    ASSERT_EQ(SlabAllocator::SlotSize(SlabAllocator::MaxSlot), SlabAllocator::MaxSlot);
+    ASSERT_EQ(SlabAllocator::SlotSize(SlabAllocator::MaxSlot + 1), SlabAllocator::MaxSlot + 1);
+
+    // never more than a quarter over what was asked for
+    for (size_t len = SlabAllocator::MinSlot; len <= SlabAllocator::MaxSlot; len++) {
+        size_t slot = SlabAllocator::SlotSize(len);
+        ASSERT_GE(slot, len);
+        ASSERT_LE(slot, len + len / 4);
+    }
+}
+
+TEST(SlabAllocatorTest, SlotsDontOverlap) {
+    SlabAllocator slabs;
+    std::set<uint8_t*> slots;
+    for (size_t i = 0; i < 2000; i++) {
+        uint8_t* slot = slabs.Allocate(100);
+        ASSERT_NE(slot, nullptr);
+        memset(slot, (int)i, 100);
+        slots.insert(slot);
+    }
+    ASSERT_EQ(slots.size(), 2000);
+
+    uint8_t* previous = nullptr;
+    for (uint8_t* slot : slots) {
+        if (previous != nullptr) {
+            ASSERT_GE(slot - previous, SlabAllocator::SlotSize(100));
+        }
+        previous = slot;
+    }
+}
+
+TEST(SlabAllocatorTest, FreedSlotsAreReused) {
+    SlabAllocator slabs;
+    uint8_t* first = slabs.Allocate(500);
+    uint8_t* second = slabs.Allocate(500);
+    size_t arenaBytes = slabs.ArenaBytes();
+
+    slabs.Free(first, 500);
+    // same class, different length
+    ASSERT_EQ(slabs.Allocate(480), first);
+    slabs.Free(second, 500);
+    ASSERT_NE(slabs.Allocate(100), second);
+    ASSERT_EQ(slabs.Allocate(500), second);
+    ASSERT_EQ(slabs.ArenaBytes(), arenaBytes + SlabAllocator::ArenaSize);
+}
+
+TEST(SlabAllocatorTest, BigAllocationsSkipTheArenas) {
+    SlabAllocator slabs;
+    size_t len = SlabAllocator::MaxSlot * 2;
+    uint8_t* big = slabs.Allocate(len);
+    ASSERT_NE(big, nullptr);
+    memset(big, 0xee, len);
+    ASSERT_EQ(slabs.ArenaBytes(), 0);
+    slabs.Free(big, len);
+}
+
+TEST(SlabAllocatorTest, ResetDropsEveryArena) {
+    SlabAllocator slabs;
+    for (size_t i = 0; i < 1000; i++) {
+        slabs.Allocate(1024);
+    }
+    ASSERT_GE(slabs.ArenaBytes(), 1000 * 1024);
+
+    slabs.Reset();
+    ASSERT_EQ(slabs.ArenaBytes(), 0);
+    ASSERT_NE(slabs.Allocate(1024), nullptr);
+}
+
+TEST(SlabAllocatorTest, EmptyArenasMoveToTheSizesInUse) {
+    SlabAllocator slabs;
+    const size_t count = 2000;
+    std::vector<uint8_t*> small(count);
+    for (uint8_t*& slot : small) {
+        slot = slabs.Allocate(100);
+        memset(slot, 0x11, 100);
+    }
+    size_t arenaBytes = slabs.ArenaBytes();
+
+    // the records get bigger, the arenas of the small ones are taken over as they empty
+    std::vector<uint8_t*> big;
+    for (size_t i = 0; i < count; i++) {
+        slabs.Free(small[i], 100);
+        if (i % 8 == 7) {
+            big.push_back(slabs.Allocate(800));
+            memset(big.back(), 0x22, 800);
+        }
+    }
+    // only the first of them needed an arena of their own, before any had emptied
+    EXPECT_LE(slabs.ArenaBytes(), arenaBytes + SlabAllocator::ArenaSize);
+
+    // and what is left empty beyond the pool goes back to the heap
+    for (uint8_t* slot : big) {
+        slabs.Free(slot, 800);
+    }
+    EXPECT_EQ(slabs.ArenaBytes(), SlabAllocator::EmptyArenas * SlabAllocator::ArenaSize);
+
+    std::set<uint8_t*> slots;
+    for (size_t i = 0; i < count; i++) {
+        uint8_t* slot = slabs.Allocate(3000);
+        ASSERT_NE(slot, nullptr);
+        ASSERT_TRUE(slots.insert(slot).second);
+    }
+}
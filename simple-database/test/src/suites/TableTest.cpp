@@ -1,4 +1,6 @@
 #include <gtest/gtest.h>
+#include <algorithm>
+#include <set>
 #include <vector>
 #include "DbDriver.hpp"
 #include "Table.hpp"
@@ -27,6 +29,9 @@ class EmptyTableTest : public ::testing::Test {
             DirectoryWrapper::Delete(Path("/db").c_str());
             DbDriver::SetOnCreateCallback(nullptr);
             DbDriver::ClearCache();
+            Table<User>::CacheObjects(0);
+            Table<User>::UnindexProperty("Name");
+            Table<User>::UnindexProperty("CNonce");
         }
 
         void CreateUser(User& u, ObjId scope = DbDriver::RootScope) {
@@ -122,6 +127,7 @@ class FullTableTest : public EmptyTableTest {
             users.clear();
             DirectoryWrapper::Delete(Path("/db").c_str());
             DbDriver::ClearCache();
+            Table<User>::UnindexProperty("Id");
         }
 
         const int totalRecords = 350;
@@ -328,6 +334,59 @@ TEST_F(TableTest, deleteRecord) {
     EXPECT_FALSE(uTable.Find(2));
 }
 
+TEST_F(EmptyTableTest, saveManyProvisionsIdsInOrder) {
+    std::vector<User> users(20);
+    for (size_t i = 0; i < users.size(); i++) {
+        users[i].Name().Set(("Saiyan" + std::to_string(i)).c_str());
+    }
+    ASSERT_EQ(ErrorCode::None, uTable.SaveMany(users));
+    EXPECT_EQ(21, uTable.PeekNextId());
+
+    DbDriver::ClearCache();
+    for (size_t i = 0; i < users.size(); i++) {
+        EXPECT_EQ(i + 1, users[i].Id());
+        ASSERT_TRUE(uTable.Find(i + 1));
+        EXPECT_STREQ(uTable.LoadedRecord().Name(), ("Saiyan" + std::to_string(i)).c_str());
+    }
+}
+
+TEST_F(EmptyTableTest, saveManyKeepsSetIds) {
+    std::vector<User> users(3);
+    users[0].Id(40);
+    users[2].Id(7);
+    ASSERT_EQ(ErrorCode::None, uTable.SaveMany(users));
+    EXPECT_EQ(1, users[1].Id());
+    EXPECT_EQ(41, uTable.PeekNextId());
+    EXPECT_TRUE(uTable.Find(40));
+    EXPECT_TRUE(uTable.Find(7));
+    EXPECT_TRUE(uTable.Find(1));
+}
+
+TEST_F(EmptyTableTest, saveManyWritesNothingIfARecordIsInvalid) {
+    Table<User, UserValidator> validated;
+    std::vector<User> users(3);
+    for (size_t i = 0; i < users.size(); i++) {
+        users[i].Name().Set(("Namek" + std::to_string(i)).c_str());
+        users[i].PublicKey().Set(pk, sizeof(pk));
+        users[i].Roles(USER_ROLE_CRYPTO_OFFICER);
+    }
+    users[1].Name().Set("");
+
+    ASSERT_NE(ErrorCode::None, validated.SaveMany(users));
+    EXPECT_FALSE(validated.CountAll().success);
+}
+
+TEST_F(TableTest, deleteManyRecords) {
+    std::vector<ObjId> ids = {1, 3, 99};
+    EXPECT_EQ(ErrorCode::ObjectNotFound, uTable.DeleteMany(ids));
+    EXPECT_FALSE(uTable.Find(1));
+    EXPECT_TRUE(uTable.Find(2));
+    EXPECT_FALSE(uTable.Find(3));
+
+    DbDriver::ClearCache();
+    EXPECT_EQ(1, uTable.CountAll().GetCount());
+}
+
 TEST_F(TableTest, deleteResults) {
     auto results = uTable.CustomSearch(Query::ResultType::Many, [](User* u) { return u->Id() > 1; });
     ASSERT_FALSE(uTable.Delete(results));
@@ -347,6 +406,202 @@ TEST_F(TableTest, dropTable) {
     EXPECT_NE(u.Id(), 0);
 }
 
+TEST_F(TableTest, noCacheQueryLeavesTheCacheAlone) {
+    DbDriver::ClearCache();
+    ResultSet<User> uncached = uTable.NoCache().All();
+    ASSERT_TRUE(uncached.success);
+    while (uTable.LoadNextResult(uncached)) {}
+
+    // with its file gone a record can only be found if it was cached
+    ASSERT_TRUE(DirectoryWrapper::Delete(Path("/db/testuser/0100000000000000").c_str()));
+    EXPECT_FALSE(uTable.Find(1));
+
+    // the hint only holds for one query
+    ResultSet<User> cached = uTable.All();
+    ASSERT_TRUE(cached.success);
+    while (uTable.LoadNextResult(cached)) {}
+
+    ASSERT_TRUE(DirectoryWrapper::Delete(Path("/db/testuser/0200000000000000").c_str()));
+    EXPECT_TRUE(uTable.Find(2));
+}
+
+TEST_F(TableTest, cachedObjectsLastUntilTheTableChanges) {
+    Table<User>::CacheObjects(16);
+    std::shared_ptr<const User> shared = uTable.FindShared(1);
+    ASSERT_NE(shared, nullptr);
+    EXPECT_FALSE(uTable.LoadedRecord().Id());
+
+    // the same object again, without going to the record cache at all
+    DbDriver::ResetCacheStats();
+    Table<User> other;
+    EXPECT_EQ(other.FindShared(1), shared);
+    EXPECT_EQ(DbDriver::GetCacheStats().hits, 0);
+
+    ASSERT_TRUE(other.Find(1));
+    other.LoadedRecord().Name().Set("Vegeta");
+    ASSERT_FALSE(other.Save(other.LoadedRecord()));
+    std::shared_ptr<const User> saved = uTable.FindShared(1);
+    ASSERT_NE(saved, nullptr);
+    EXPECT_NE(saved, shared);
+    EXPECT_STREQ(saved->Name(), "Vegeta");
+
+    ASSERT_FALSE(other.Delete(1));
+    EXPECT_EQ(uTable.FindShared(1), nullptr);
+    // still good for whoever holds it
+    EXPECT_STREQ(saved->Name(), "Vegeta");
+}
+
+TEST_F(TableTest, savingARecordKeepsTheOthersCached) {
+    Table<User>::CacheObjects(16);
+    std::shared_ptr<const User> first = uTable.FindShared(1);
+    std::shared_ptr<const User> second = uTable.FindShared(2);
+    ASSERT_NE(first, nullptr);
+    ASSERT_NE(second, nullptr);
+
+    ASSERT_TRUE(uTable.Find(1));
+    uTable.LoadedRecord().Name().Set("Vegeta");
+    ASSERT_FALSE(uTable.Save(uTable.LoadedRecord()));
+    EXPECT_STREQ(uTable.FindShared(1)->Name(), "Vegeta");
+    EXPECT_EQ(uTable.FindShared(2), second);
+
+    // the pending side has versions of its own
+    Table<User> pendingTable{scope, true};
+    User pending;
+    ASSERT_FALSE(pendingTable.Save(pending, 7));
+    EXPECT_EQ(uTable.FindShared(2), second);
+
+    // a cleared cache could have missed any change
+    DbDriver::ClearCache();
+    EXPECT_NE(uTable.FindShared(2), second);
+}
+
+TEST_F(TableTest, indexedLookupsFollowSavesAndDeletes) {
+    Table<User>::IndexProperty("Name");
+    Table<User> pendingTable{scope, true};
+
+    ASSERT_TRUE(uTable.FindBy("Name", "Krillin"));
+    ObjId krillin = uTable.LoadedRecord().Id();
+    EXPECT_FALSE(uTable.FindBy("Name", "Krill"));
+    EXPECT_TRUE(uTable.FindBy("Name", "Krill", false));
+    HashIndex* index = DbDriver{scope, false}.Index(User::SerializeableName, "Name");
+    ASSERT_NE(index, nullptr);
+    EXPECT_TRUE(index->IsBuilt());
+    EXPECT_EQ(index->Size(), 3);
+
+    // the index is built now, what follows has to be kept up to date
+    User u;
+    u.Name().Set("Krillin");
+    ASSERT_FALSE(uTable.Save(u));
+    ResultSet<User> results = uTable.Count("Name", "Krillin");
+    EXPECT_EQ(results.GetCount(), 2);
+
+    ASSERT_TRUE(uTable.Find(krillin));
+    uTable.LoadedRecord().Name().Set("Yamcha");
+    ASSERT_FALSE(uTable.Save(uTable.LoadedRecord()));
+    results = uTable.Where("Name", "Krillin");
+    std::vector<ObjId> found;
+    while (uTable.LoadNextResult(results)) {
+        found.push_back(uTable.LoadedRecord().Id());
+    }
+    EXPECT_EQ(found, std::vector<ObjId>{u.Id()});
+    EXPECT_TRUE(uTable.FindBy("Name", "Yamcha"));
+
+    ASSERT_FALSE(uTable.Delete(u.Id()));
+    EXPECT_FALSE(uTable.FindBy("Name", "Krillin"));
+    EXPECT_EQ(uTable.Count("Name", "Krillin").GetCount(), 0);
+
+    // the pending side has its own
+    User pending;
+    pending.Name().Set("Vegeta");
+    ASSERT_FALSE(pendingTable.Save(pending, 7));
+    EXPECT_TRUE(pendingTable.FindBy("Name", "Vegeta"));
+    EXPECT_FALSE(uTable.FindBy("Name", "Vegeta"));
+    ASSERT_FALSE(pendingTable.CommitAll(7));
+    EXPECT_FALSE(pendingTable.FindBy("Name", "Vegeta"));
+    EXPECT_TRUE(uTable.FindBy("Name", "Vegeta"));
+
+    Table<User>::UnindexProperty("Name");
+    EXPECT_TRUE(uTable.FindBy("Name", "Vegeta"));
+}
+
+TEST_F(TableTest, rangesWithAndWithoutAnIndex) {
+    auto names = [this](ResultSet<User> results) {
+        std::vector<std::string> found;
+        while (uTable.LoadNextResult(results)) {
+            found.push_back((const char*)uTable.LoadedRecord().Name());
+        }
+        return found;
+    };
+
+    // scanned, in no particular order
+    std::vector<std::string> scanned = names(uTable.WhereRange("CNonce", 1, 10));
+    std::sort(scanned.begin(), scanned.end());
+    EXPECT_EQ(scanned, (std::vector<std::string>{"Goku", "Krillin"}));
+    EXPECT_EQ(uTable.CountRange("CNonce", 4, UINT64_MAX).GetCount(), 1);
+
+    Table<User>::IndexPropertyRanges("CNonce");
+    EXPECT_EQ(names(uTable.WhereRange("CNonce", 0, 10)), (std::vector<std::string>{"Piccolo", "Goku", "Krillin"}));
+    EXPECT_EQ(names(uTable.WhereRange("CNonce", 0, 10, true)), (std::vector<std::string>{"Krillin", "Goku", "Piccolo"}));
+    EXPECT_FALSE(uTable.WhereRange("CNonce", 5, 10).success);
+    EXPECT_FALSE(uTable.WhereRange("CNonce", 10, 5).success);
+
+    User u;
+    u.Name().Set("Gohan");
+    u.CNonce(UINT64_MAX);
+    ASSERT_FALSE(uTable.Save(u));
+    ASSERT_TRUE(uTable.FindBy("Name", "Piccolo"));
+    uTable.LoadedRecord().CNonce(5);
+    ASSERT_FALSE(uTable.Save(uTable.LoadedRecord()));
+    EXPECT_EQ(names(uTable.WhereRange("CNonce", 4, UINT64_MAX)), (std::vector<std::string>{"Krillin", "Piccolo", "Gohan"}));
+    EXPECT_EQ(uTable.CountRange("CNonce", 4, 5).GetCount(), 2);
+
+    ASSERT_FALSE(uTable.Delete(u.Id()));
+    EXPECT_EQ(uTable.CountRange("CNonce", 4, UINT64_MAX).GetCount(), 2);
+    // Not still scans
+    EXPECT_EQ(names(uTable.Not().WhereRange("CNonce", 4, UINT64_MAX)), std::vector<std::string>{"Goku"});
+    Table<User>::UnindexProperty("CNonce");
+}
+
+TEST_F(TableTest, countsReadEachRecordOnce) {
+    DbDriver::ResetCacheStats();
+    ResultSet<User> results = uTable.Count("Name", "Goku");
+    EXPECT_TRUE(results.success);
+    EXPECT_EQ(results.GetCount(), 1);
+    CacheStats stats = DbDriver::GetCacheStats();
+    EXPECT_EQ(stats.hits + stats.misses, 3);
+}
+
+TEST_F(TableTest, aggregatesOverAProperty) {
+    ResultSet<User> results = uTable.Aggregate("CNonce");
+    ASSERT_TRUE(results.success);
+    EXPECT_EQ(results.GetCount(), 3);
+    EXPECT_EQ(results.GetSum(), 7);
+    EXPECT_EQ(results.GetMin(), 0);
+    EXPECT_EQ(results.GetMax(), 4);
+    EXPECT_DOUBLE_EQ(results.GetAvg(), 7.0 / 3);
+
+    // a property narrower than 8 bytes
+    uint64_t krillinRoles = USER_ROLE_MAINTENANCE | USER_ROLE_ORGANIZATION_MANAGER | USER_ROLE_ACCOUNT_MANAGER;
+    EXPECT_EQ(uTable.Max("Roles"), std::max<uint64_t>(gokuRoles, krillinRoles));
+    EXPECT_EQ(uTable.Sum("Roles"), gokuRoles + krillinRoles);
+
+    Table<User> empty{scope + 1};
+    results = empty.Aggregate("CNonce");
+    EXPECT_FALSE(results.success);
+    EXPECT_EQ(results.GetMin(), 0);
+    EXPECT_EQ(empty.Avg("CNonce"), 0);
+}
+
+TEST_F(TableTest, aggregatesOnlyAddUpNumbers) {
+    ResultSet<User> results = uTable.Aggregate("Name");
+    EXPECT_FALSE(results.success);
+    EXPECT_EQ(results.GetSum(), 0);
+
+    results = uTable.Aggregate("Metadata");
+    EXPECT_FALSE(results.success);
+    EXPECT_EQ(uTable.Max("PublicKey"), 0);
+}
+
 TEST_F(TableTest, customQuery) {
     User& u = uTable.LoadedRecord();
     auto results = uTable.CustomSearch(Query::ResultType::Single, [](User* u) {
@@ -364,6 +619,22 @@ TEST_F(TableTest, customCountQuery) {
     EXPECT_EQ(results.GetCount(), 1);
 }
 
+TEST_F(TableTest, RawCustomSearchSeesEveryRecord) {
+    size_t seen = 0;
+    auto results = uTable.CustomSearch(Query::ResultType::Many, [&seen](const uint8_t* data) {
+        seen += data != nullptr;
+        return true;
+    });
+    ASSERT_TRUE(results.success);
+
+    size_t loaded = 0;
+    while (uTable.LoadNextResult(results)) {
+        loaded++;
+    }
+    EXPECT_GT(seen, 0);
+    EXPECT_EQ(loaded, seen);
+}
+
 TEST_F(TableTest, CustomSearchForManyCanDestructivelyAlterWorkBuffer) {
     auto results1 = uTable.CustomSearch(Query::ResultType::Many, [](auto ...) {
         return true;
@@ -446,6 +717,93 @@ TEST_F(FullTableTest, wherePropertyKindaMatches)
     EXPECT_FALSE(uTable.LoadNextResult(results));
 }
 
+TEST_F(FullTableTest, keysetPagesComeInIdOrder)
+{
+    std::vector<ObjId> expected;
+    for (int i = 1; i <= totalRecords; i++) {
+        expected.push_back(i);
+    }
+
+    // past a result page, in id order whatever order the directory is in
+    std::vector<ObjId> found;
+    ResultSet<User> results = uTable.After(0);
+    while (uTable.LoadNextResult(results)) {
+        found.push_back(uTable.LoadedRecord().Id());
+    }
+    EXPECT_EQ(found, expected);
+
+    ASSERT_FALSE(uTable.Delete(101));
+    expected.erase(expected.begin() + 100);
+
+    found.clear();
+    size_t pages = 0;
+    ObjId last = 0;
+    do {
+        results = uTable.After(last, 100);
+        pages++;
+        while (uTable.LoadNextResult(results)) {
+            last = uTable.LoadedRecord().Id();
+            found.push_back(last);
+        }
+    } while (results.success);
+    EXPECT_EQ(found, expected);
+    EXPECT_EQ(pages, 5);
+
+    EXPECT_FALSE(uTable.After(totalRecords).success);
+    EXPECT_FALSE(uTable.After(UINT64_MAX).success);
+}
+
+TEST_F(FullTableTest, keysetPagesTakeOverAHashIndexOnId)
+{
+    Table<User>::IndexProperty("Id");
+    ObjId id = 7;
+    ASSERT_TRUE(uTable.FindBy("Id", &id, sizeof(id)));
+
+    ResultSet<User> results = uTable.After(0, 3);
+    std::vector<ObjId> found;
+    while (uTable.LoadNextResult(results)) {
+        found.push_back(uTable.LoadedRecord().Id());
+    }
+    EXPECT_EQ(found, (std::vector<ObjId>{1, 2, 3}));
+
+    // the ordered index answers what the hash index did
+    DbDriver driver{DbDriver::RootScope, false};
+    EXPECT_EQ(driver.Index(User::SerializeableName, "Id"), nullptr);
+    OrderedIndex* index = driver.Ordered(User::SerializeableName, "Id");
+    ASSERT_NE(index, nullptr);
+    ASSERT_TRUE(uTable.FindBy("Id", &id, sizeof(id)));
+    EXPECT_STREQ(uTable.LoadedRecord().Name(), "6");
+    EXPECT_EQ(uTable.Count("Id", &id, sizeof(id)).GetCount(), 1);
+    ASSERT_FALSE(uTable.Delete(id));
+    EXPECT_FALSE(uTable.FindBy("Id", &id, sizeof(id)));
+    EXPECT_EQ(index->Size(), totalRecords - 1);
+}
+
+TEST_F(FullTableTest, pagesOfAnySizeReadEachRecordOnce)
+{
+    DbDriver::ResetCacheStats();
+    ResultSet<User> results = uTable.PageSize(50).Where("PublicKey", pk, sizeof(pk));
+    ASSERT_TRUE(results.success);
+    EXPECT_TRUE(results.HasNextPage());
+
+    std::set<ObjId> found;
+    while (uTable.LoadNextResult(results)) {
+        found.insert(uTable.LoadedRecord().Id());
+        EXPECT_STREQ(uTable.LoadedRecord().Name(), std::to_string(uTable.LoadedRecord().Id() - 1).c_str());
+    }
+    EXPECT_EQ(found.size(), totalRecords);
+
+    // the scan that found them handed them over, nothing was read twice
+    CacheStats stats = DbDriver::GetCacheStats();
+    EXPECT_EQ(stats.hits + stats.misses, totalRecords);
+
+    // bigger than the default, for one query only
+    results = uTable.PageSize(totalRecords + 1).Where("PublicKey", pk, sizeof(pk));
+    EXPECT_FALSE(results.HasNextPage());
+    results = uTable.Where("PublicKey", pk, sizeof(pk));
+    EXPECT_TRUE(results.HasNextPage());
+}
+
 TEST_F(FullTableTest, multiplePageResult)
 {
     ResultSet<User> results = uTable.Where("PublicKey", pk, sizeof(pk));
@@ -473,6 +831,26 @@ TEST_F(FullTableTest, multiplePageResult)
     ASSERT_FALSE(uTable.LoadNextResult(results));
 }
 
+TEST_F(FullTableTest, findManyLoadsRecordsInOrder)
+{
+    std::vector<ObjId> ids = {300, 2, 9999, 1};
+    for (int i = 1; i <= totalRecords; i++) {
+        ids.push_back(i);
+    }
+
+    DbDriver::ClearCache();
+    std::vector<std::string> names;
+    size_t found = uTable.FindMany(ids.data(), ids.size(), [&names](User& u) {
+        names.emplace_back((const char*)u.Name());
+    });
+
+    ASSERT_EQ(found, totalRecords + 3);
+    EXPECT_EQ(names[0], "299");
+    EXPECT_EQ(names[1], "1");
+    EXPECT_EQ(names[2], "0");
+    EXPECT_EQ(names.back(), std::to_string(totalRecords - 1));
+}
+
 TEST_F(FullTableTest, whereMask)
 {
     ResultSet<User> results = uTable.WhereMask("Roles", USER_ROLE_ACCOUNT_AUDITOR);
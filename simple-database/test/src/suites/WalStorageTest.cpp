@@ -0,0 +1,238 @@
+#include <gtest/gtest.h>
+#include <vector>
+#include "DbDriver.hpp"
+#include "Table.hpp"
+#include "TestUser.hpp"
+#include "fs.hpp"
+
+using User = TestUser;
+
+class WalStorageTest : public ::testing::Test {
+    protected:
+        void SetUp() override {
+            initFS();
+            DirectoryWrapper::Delete(Path("/db").c_str());
+            DbDriver::InitDb();
+            DbDriver::ClearCache();
+        }
+
+        void TearDown() override {
+            DbDriver::SetWalOptions(WalOptions{});
+            DirectoryWrapper::Delete(Path("/db").c_str());
+            DbDriver::ClearCache();
+        }
+
+        void EnableWal(uint32_t groupCommit = 1, uint32_t checkpointBytes = 1024 * 1024) {
+            WalOptions options;
+            options.enabled = true;
+            options.groupCommit = groupCommit;
+            options.checkpointBytes = checkpointBytes;
+            ASSERT_TRUE(DbDriver::SetWalOptions(options));
+        }
+
+        static std::vector<uint8_t> ReadFile(const std::string& path) {
+            FileWrapper f(path.c_str(), "rb");
+            std::vector<uint8_t> bytes(f.Size());
+            EXPECT_TRUE(bytes.empty() || f.Read(bytes.data(), bytes.size()));
+            return bytes;
+        }
+
+        static void WriteFile(const std::string& path, const std::vector<uint8_t>& bytes) {
+            FileWrapper f(path.c_str(), "w");
+            ASSERT_TRUE(bytes.empty() || f.Write(bytes.data(), bytes.size()));
+        }
+
+        // Lose everything held in memory and come back up with the files as they are now,
+        // `wal` as it was before the crash
+        void Crash(const std::vector<uint8_t>& wal) {
+            DbDriver::CloseStorage();
+            WriteFile(walPath, wal);
+            DbDriver::ClearCache();
+            ASSERT_TRUE(DbDriver::InitDb());
+        }
+
+        Table<User> uTable;
+        std::string walPath = Path("/db/db.wal");
+        std::string recordPath = Path("/db/testuser/0100000000000000");
+};
+
+TEST_F(WalStorageTest, tornRecordIsRestoredFromTheWal) {
+    EnableWal();
+    User u;
+    u.Name().Set("Goku");
+    ASSERT_FALSE(uTable.Save(u));
+    u.Name().Set("Vegeta");
+    ASSERT_FALSE(uTable.Save(u));
+    std::vector<uint8_t> wal = ReadFile(walPath);
+    EXPECT_FALSE(wal.empty());
+
+    // cut off part way through rewriting the record
+    std::vector<uint8_t> record = ReadFile(recordPath);
+    record.resize(5);
+    WriteFile(recordPath, record);
+    Crash(wal);
+
+    ASSERT_TRUE(uTable.Find(1));
+    EXPECT_STREQ(uTable.LoadedRecord().Name(), "Vegeta");
+    EXPECT_TRUE(ReadFile(walPath).empty());
+}
+
+TEST_F(WalStorageTest, deletesAreReplayed) {
+    EnableWal();
+    User u;
+    u.Name().Set("Goku");
+    ASSERT_FALSE(uTable.Save(u));
+    std::vector<uint8_t> record = ReadFile(recordPath);
+
+    ASSERT_FALSE(uTable.Delete(1));
+    std::vector<uint8_t> wal = ReadFile(walPath);
+
+    // the delete made it into the wal, but never reached the record
+    WriteFile(recordPath, record);
+    Crash(wal);
+
+    EXPECT_FALSE(uTable.Find(1));
+    EXPECT_FALSE(DirectoryWrapper::Exists(recordPath.c_str()));
+}
+
+TEST_F(WalStorageTest, tornWalEntriesAreDiscarded) {
+    EnableWal();
+    User u;
+    u.Name().Set("Goku");
+    ASSERT_FALSE(uTable.Save(u));
+    std::vector<uint8_t> wal = ReadFile(walPath);
+    size_t firstEntry = wal.size();
+
+    User u2;
+    u2.Name().Set("Krillin");
+    ASSERT_FALSE(uTable.Save(u2));
+    wal = ReadFile(walPath);
+    wal.resize(firstEntry + (wal.size() - firstEntry) / 2);
+
+    // neither record made it to disk before the crash
+    DirectoryWrapper::Delete(recordPath.c_str());
+    DirectoryWrapper::Delete(Path("/db/testuser/0200000000000000").c_str());
+    Crash(wal);
+
+    ASSERT_TRUE(uTable.Find(1));
+    EXPECT_STREQ(uTable.LoadedRecord().Name(), "Goku");
+    // only half of this one made it to the wal, so it never happened
+    EXPECT_FALSE(uTable.Find(2));
+}
+
+TEST_F(WalStorageTest, groupsAreCommittedTogether) {
+    EnableWal(10);
+    for (int i = 0; i < 5; i++) {
+        User u;
+        u.Name().Set(std::to_string(i).c_str());
+        ASSERT_FALSE(uTable.Save(u));
+    }
+
+    // still collecting, but readable
+    EXPECT_FALSE(DirectoryWrapper::Exists(recordPath.c_str()));
+    EXPECT_TRUE(ReadFile(walPath).empty());
+    DbDriver::ClearCache();
+    ASSERT_TRUE(uTable.Find(3));
+    EXPECT_STREQ(uTable.LoadedRecord().Name(), "2");
+
+    ASSERT_TRUE(DbDriver::CommitWal());
+    EXPECT_TRUE(DirectoryWrapper::Exists(recordPath.c_str()));
+    EXPECT_FALSE(ReadFile(walPath).empty());
+
+    // a scan commits the group before it starts
+    User u;
+    u.Name().Set("5");
+    ASSERT_FALSE(uTable.Save(u));
+    EXPECT_EQ(uTable.CountAll().GetCount(), 6);
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/testuser/0600000000000000").c_str()));
+}
+
+TEST_F(WalStorageTest, checkpointEmptiesTheWal) {
+    EnableWal(1, 1);
+    User u;
+    u.Name().Set("Goku");
+    ASSERT_FALSE(uTable.Save(u));
+    EXPECT_TRUE(ReadFile(walPath).empty());
+    EXPECT_TRUE(uTable.Find(1));
+}
+
+TEST_F(WalStorageTest, worksInFrontOfOtherEngines) {
+    DbDriver::SetStorageType(StorageType::Log);
+    EnableWal(4);
+    std::vector<User> users(10);
+    ASSERT_FALSE(uTable.SaveMany(users));
+    ASSERT_FALSE(uTable.Delete(3));
+
+    DbDriver::CloseStorage();
+    DbDriver::ClearCache();
+    EXPECT_EQ(uTable.CountAll().GetCount(), 9);
+    EXPECT_FALSE(uTable.Find(3));
+
+    DbDriver::SetWalOptions(WalOptions{});
+    DbDriver::CloseStorage();
+    DbDriver::SetStorageType(StorageType::File);
+}
+
+TEST_F(WalStorageTest, failedAppendKeepsTheGroup) {
+    EnableWal(3);
+    std::vector<User> users(4);
+    for (int i = 0; i < 2; i++) {
+        ASSERT_FALSE(uTable.Save(users[i]));
+    }
+
+    // the wal can't be appended to while a directory is in its place
+    DirectoryWrapper::Delete(walPath.c_str());
+    ASSERT_TRUE(DirectoryWrapper::New(walPath.c_str()));
+    EXPECT_TRUE(uTable.Save(users[2]));
+    EXPECT_TRUE(uTable.Find(1));
+    EXPECT_TRUE(uTable.Find(2));
+    EXPECT_FALSE(uTable.Find(3));
+
+    // what was acknowledged goes with the next commit, the refused write doesn't
+    DirectoryWrapper::Delete(walPath.c_str());
+    ASSERT_FALSE(uTable.Save(users[3]));
+    ASSERT_TRUE(DbDriver::CommitWal());
+    EXPECT_TRUE(DirectoryWrapper::Exists(recordPath.c_str()));
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/testuser/0200000000000000").c_str()));
+    EXPECT_FALSE(DirectoryWrapper::Exists(Path("/db/testuser/0300000000000000").c_str()));
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/testuser/0400000000000000").c_str()));
+}
+
+TEST_F(WalStorageTest, walThatCantBeReplayedIsSkipped) {
+    EnableWal();
+    User u;
+    u.Name().Set("Goku");
+    ASSERT_FALSE(uTable.Save(u));
+    std::vector<uint8_t> wal = ReadFile(walPath);
+    ASSERT_TRUE(DbDriver::SetWalOptions(WalOptions{}));
+
+    // the record can't be written again while a directory is in its place, in either layout
+    ASSERT_TRUE(DirectoryWrapper::Delete(recordPath.c_str()));
+    ASSERT_TRUE(DirectoryWrapper::New(recordPath.c_str()));
+    ASSERT_TRUE(DirectoryWrapper::New(Path("/db/testuser/01").c_str()));
+    ASSERT_TRUE(DirectoryWrapper::New(Path("/db/testuser/01/00").c_str()));
+    ASSERT_TRUE(DirectoryWrapper::New(Path("/db/testuser/01/00/0100000000000000").c_str()));
+    WriteFile(walPath, wal);
+
+    WalOptions options;
+    options.enabled = true;
+    EXPECT_FALSE(DbDriver::SetWalOptions(options));
+
+    // saves go straight to the engine, the wal is kept for the next attach
+    u.Id(0);
+    u.Name().Set("Vegeta");
+    ASSERT_FALSE(uTable.Save(u));
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/testuser/0200000000000000").c_str()));
+    EXPECT_TRUE(uTable.Find(2));
+    EXPECT_EQ(ReadFile(walPath), wal);
+
+    EXPECT_FALSE(DbDriver::SetStorageType(StorageType::FileFanOut));
+    u.Id(0);
+    u.Name().Set("Gohan");
+    ASSERT_FALSE(uTable.Save(u));
+    EXPECT_TRUE(DirectoryWrapper::Exists(Path("/db/testuser/03/00/0300000000000000").c_str()));
+    EXPECT_TRUE(uTable.Find(3));
+    EXPECT_EQ(ReadFile(walPath), wal);
+
+    EXPECT_FALSE(DbDriver::SetStorageType(StorageType::File));
+}